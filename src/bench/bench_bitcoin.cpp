@@ -4,6 +4,7 @@
 
 #include "bench.h"
 
+#include "crypto/skein512.h"
 #include "key.h"
 #include "main.h"
 #include "util.h"
@@ -12,6 +13,7 @@ int
 main(int argc, char** argv)
 {
     ECC_Start();
+    Skein512AutoDetect();
     SetupEnvironment();
     fPrintToDebugLog = false; // don't want to write to debug.log file
 
@@ -0,0 +1,76 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "checkqueue.h"
+#include "coins.h"
+#include "main.h"
+#include "primitives/transaction.h"
+#include "script/interpreter.h"
+#include "script/script.h"
+
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+// Checks per simulated block, added in batches of one transaction's inputs
+static const int CHECKS_PER_BLOCK = 2000;
+static const int INPUTS_PER_TX = 2;
+
+/** Validate a block's worth of cheap synthetic script checks on nThreads threads
+ *  (including the master), so that queue overhead dominates. */
+static void CheckQueueThroughput(benchmark::State& state, int nThreads)
+{
+    CMutableTransaction txFrom;
+    txFrom.vout.resize(1);
+    txFrom.vout[0].scriptPubKey = CScript() << OP_SHA256 << OP_SHA256 << OP_DROP << OP_TRUE;
+    txFrom.vout[0].nValue = 1;
+
+    CMutableTransaction mtx;
+    mtx.vin.resize(CHECKS_PER_BLOCK);
+    for (int i = 0; i < CHECKS_PER_BLOCK; i++) {
+        mtx.vin[i].prevout = COutPoint(txFrom.GetHash(), 0);
+        mtx.vin[i].scriptSig = CScript() << std::vector<unsigned char>(32, (unsigned char)i);
+    }
+    CTransaction tx(mtx);
+    PrecomputedTransactionData txdata(tx);
+
+    CCheckQueue<CScriptCheck> queue(128);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < nThreads - 1; i++)
+        threadGroup.create_thread(boost::bind(&CCheckQueue<CScriptCheck>::Thread, &queue));
+
+    std::vector<CScriptCheck> vChecks;
+    while (state.KeepRunning()) {
+        CCheckQueueControl<CScriptCheck> control(&queue);
+        for (int i = 0; i < CHECKS_PER_BLOCK; i += INPUTS_PER_TX) {
+            for (int j = i; j < i + INPUTS_PER_TX; j++)
+                vChecks.push_back(CScriptCheck(txFrom.vout[0].scriptPubKey, txFrom.vout[0].nValue, tx, j, SCRIPT_VERIFY_NONE, false, &txdata));
+            control.Add(vChecks);
+            vChecks.clear();
+        }
+        assert(control.Wait());
+    }
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+static void CheckQueue_1Thread(benchmark::State& state) { CheckQueueThroughput(state, 1); }
+static void CheckQueue_2Threads(benchmark::State& state) { CheckQueueThroughput(state, 2); }
+static void CheckQueue_4Threads(benchmark::State& state) { CheckQueueThroughput(state, 4); }
+static void CheckQueue_8Threads(benchmark::State& state) { CheckQueueThroughput(state, 8); }
+static void CheckQueue_16Threads(benchmark::State& state) { CheckQueueThroughput(state, 16); }
+static void CheckQueue_32Threads(benchmark::State& state) { CheckQueueThroughput(state, 32); }
+static void CheckQueue_64Threads(benchmark::State& state) { CheckQueueThroughput(state, 64); }
+
+BENCHMARK(CheckQueue_1Thread);
+BENCHMARK(CheckQueue_2Threads);
+BENCHMARK(CheckQueue_4Threads);
+BENCHMARK(CheckQueue_8Threads);
+BENCHMARK(CheckQueue_16Threads);
+BENCHMARK(CheckQueue_32Threads);
+BENCHMARK(CheckQueue_64Threads);
@@ -7,6 +7,7 @@
 #include "bench.h"
 #include "bloom.h"
 #include "hash.h"
+#include "primitives/block.h"
 #include "uint256.h"
 #include "utiltime.h"
 #include "crypto/ripemd160.h"
@@ -59,6 +60,28 @@ static void SHA512(benchmark::State& state)
         CSHA512().Write(begin_ptr(in), in.size()).Finalize(hash);
 }
 
+static void SkeinHeader(benchmark::State& state)
+{
+    std::vector<CBlockHeader> headers(1000);
+    while (state.KeepRunning()) {
+        for (size_t i = 0; i < headers.size(); i++) {
+            headers[i].nNonce = headers[i].GetHash().GetCheapHash();
+        }
+    }
+}
+
+static void SkeinHeader_Batch(benchmark::State& state)
+{
+    std::vector<CBlockHeader> headers(1000);
+    std::vector<uint256> hashes(headers.size());
+    while (state.KeepRunning()) {
+        HashSkeinBatch(begin_ptr(headers), headers.size(), begin_ptr(hashes));
+        for (size_t i = 0; i < headers.size(); i++) {
+            headers[i].nNonce = hashes[i].GetCheapHash();
+        }
+    }
+}
+
 static void SipHash_32b(benchmark::State& state)
 {
     uint256 x;
@@ -75,4 +98,6 @@ BENCHMARK(SHA256);
 BENCHMARK(SHA512);
 
 BENCHMARK(SHA256_32b);
+BENCHMARK(SkeinHeader);
+BENCHMARK(SkeinHeader_Batch);
 BENCHMARK(SipHash_32b);
@@ -0,0 +1,119 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "main.h"
+#include "primitives/transaction.h"
+#include "script/script.h"
+#include "txmempool.h"
+
+#include <list>
+#include <vector>
+
+static void AddTx(const CTransaction& tx, CTxMemPool& pool)
+{
+    LockPoints lp;
+    pool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, 1000, 0, 0.0, 1, false, 0, false, 4, lp));
+}
+
+static CMutableTransaction MakeTx(const std::vector<COutPoint>& vPrevouts, int nOutputs)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(vPrevouts.size());
+    for (size_t i = 0; i < vPrevouts.size(); i++) {
+        tx.vin[i].prevout = vPrevouts[i];
+        tx.vin[i].scriptSig = CScript() << OP_1;
+    }
+    tx.vout.resize(nOutputs);
+    for (int i = 0; i < nOutputs; i++) {
+        tx.vout[i].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+        tx.vout[i].nValue = 1000;
+    }
+    return tx;
+}
+
+/** A chain of nLength transactions each spending the only output of the one before */
+static std::vector<CTransaction> MakeChain(int nLength)
+{
+    std::vector<CTransaction> vtx;
+    COutPoint prevout(uint256S("0x01"), 0);
+    for (int i = 0; i < nLength; i++) {
+        vtx.push_back(MakeTx(std::vector<COutPoint>(1, prevout), 1));
+        prevout = COutPoint(vtx.back().GetHash(), 0);
+    }
+    return vtx;
+}
+
+// Add a chain of the default ancestor limit in length and remove it again,
+// which walks the ancestors of every entry on the way in and on the way out.
+static void MempoolChain25(benchmark::State& state)
+{
+    std::vector<CTransaction> vtx = MakeChain(DEFAULT_ANCESTOR_LIMIT);
+    CTxMemPool pool(CFeeRate(1000));
+    std::list<CTransaction> removed;
+    while (state.KeepRunning()) {
+        for (size_t i = 0; i < vtx.size(); i++)
+            AddTx(vtx[i], pool);
+        pool.removeRecursive(vtx.front(), removed);
+        removed.clear();
+    }
+}
+
+// A batch payout spent by many children, which all spend a common
+// second parent as well, and a sweep of all of their outputs.
+static void MempoolFanOut(benchmark::State& state)
+{
+    const int nWidth = 500;
+    std::vector<CTransaction> vtx;
+    vtx.push_back(MakeTx(std::vector<COutPoint>(1, COutPoint(uint256S("0x01"), 0)), nWidth));
+    vtx.push_back(MakeTx(std::vector<COutPoint>(1, COutPoint(uint256S("0x02"), 0)), nWidth));
+    std::vector<COutPoint> vSweep;
+    for (int i = 0; i < nWidth; i++) {
+        std::vector<COutPoint> vPrevouts;
+        vPrevouts.push_back(COutPoint(vtx[0].GetHash(), i));
+        vPrevouts.push_back(COutPoint(vtx[1].GetHash(), i));
+        vtx.push_back(MakeTx(vPrevouts, 1));
+        vSweep.push_back(COutPoint(vtx.back().GetHash(), 0));
+    }
+    vtx.push_back(MakeTx(vSweep, 1));
+
+    CTxMemPool pool(CFeeRate(1000));
+    std::list<CTransaction> removed;
+    while (state.KeepRunning()) {
+        for (size_t i = 0; i < vtx.size(); i++)
+            AddTx(vtx[i], pool);
+        pool.removeRecursive(vtx[0], removed);
+        pool.removeRecursive(vtx[1], removed);
+        removed.clear();
+    }
+}
+
+// A reorg returning the first half of a chain to a mempool holding the rest
+// of it, which makes UpdateTransactionsFromBlock() walk the descendants of
+// every returned transaction.
+static void MempoolReorgChain(benchmark::State& state)
+{
+    const int nLength = 200;
+    std::vector<CTransaction> vtx = MakeChain(nLength);
+    std::vector<uint256> vHashesFromBlock;
+    for (int i = 0; i < nLength / 2; i++)
+        vHashesFromBlock.push_back(vtx[i].GetHash());
+
+    CTxMemPool pool(CFeeRate(1000));
+    std::list<CTransaction> removed;
+    while (state.KeepRunning()) {
+        for (int i = nLength / 2; i < nLength; i++)
+            AddTx(vtx[i], pool);
+        for (int i = 0; i < nLength / 2; i++)
+            AddTx(vtx[i], pool);
+        pool.UpdateTransactionsFromBlock(vHashesFromBlock);
+        pool.removeRecursive(vtx.front(), removed);
+        removed.clear();
+    }
+}
+
+BENCHMARK(MempoolChain25);
+BENCHMARK(MempoolFanOut);
+BENCHMARK(MempoolReorgChain);
@@ -0,0 +1,180 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "netbase.h"
+#include "socketevents.h"
+#include "util.h"
+
+#include <iostream>
+#include <vector>
+
+// Synthetic peers are TCP connections over loopback to a local listening
+// socket, like inbound peers of a public node.
+
+// select() can only watch descriptors below FD_SETSIZE, and every peer takes two
+static const int SELECT_PEERS = 400;
+static const int MANY_PEERS = 1000;
+
+namespace {
+
+struct Peer {
+    SOCKET hClient;
+    SOCKET hServer;
+};
+
+class CLoopbackPeers
+{
+public:
+    SOCKET hListen;
+    struct sockaddr_in addr;
+    std::vector<Peer> vPeers;
+
+    CLoopbackPeers() : hListen(INVALID_SOCKET)
+    {
+        hListen = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        if (hListen == INVALID_SOCKET ||
+            bind(hListen, (struct sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR ||
+            getsockname(hListen, (struct sockaddr*)&addr, &len) == SOCKET_ERROR ||
+            listen(hListen, SOMAXCONN) == SOCKET_ERROR) {
+            CloseSocket(hListen);
+        }
+    }
+
+    ~CLoopbackPeers()
+    {
+        for (size_t i = 0; i < vPeers.size(); i++) {
+            CloseSocket(vPeers[i].hClient);
+            CloseSocket(vPeers[i].hServer);
+        }
+        CloseSocket(hListen);
+    }
+
+    /** Open a connection; the accepted end is the peer's socket on our side. */
+    bool Connect(Peer& peer)
+    {
+        peer.hClient = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (peer.hClient == INVALID_SOCKET)
+            return false;
+        int set = 1;
+        setsockopt(peer.hClient, IPPROTO_TCP, TCP_NODELAY, (const char*)&set, sizeof(int));
+        if (connect(peer.hClient, (struct sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR) {
+            CloseSocket(peer.hClient);
+            return false;
+        }
+        peer.hServer = accept(hListen, NULL, NULL);
+        if (peer.hServer == INVALID_SOCKET) {
+            CloseSocket(peer.hClient);
+            return false;
+        }
+        return true;
+    }
+
+    bool Open(int nPeers)
+    {
+        if (hListen == INVALID_SOCKET || RaiseFileDescriptorLimit(2 * nPeers + 64) < 2 * nPeers + 64)
+            return false;
+        vPeers.resize(nPeers);
+        for (int i = 0; i < nPeers; i++) {
+            if (!Connect(vPeers[i])) {
+                vPeers.resize(i);
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+bool StartEvents(CSocketEvents& events, CLoopbackPeers& peers, int nPeers, CSocketEvents::Backend backend)
+{
+    if (!events.Start(backend) || !peers.Open(nPeers)) {
+        std::cerr << "Can't set up " << nPeers << " loopback peers for " << CSocketEvents::GetBackendName(backend) << ", skipping" << std::endl;
+        return false;
+    }
+    for (int i = 0; i < nPeers; i++) {
+        events.Add(peers.vPeers[i].hServer, &peers.vPeers[i]);
+        events.SetInterest(peers.vPeers[i].hServer, CSocketEvents::EVENT_RECV);
+    }
+    // Swallow the initial writability events
+    std::vector<CSocketEvents::Event> vEvents;
+    events.Wait(0, vEvents);
+    return true;
+}
+
+/** One peer at a time sends a byte; time until it is received on our side. */
+void ReceiveLatency(benchmark::State& state, CSocketEvents::Backend backend, int nPeers)
+{
+    CSocketEvents events;
+    CLoopbackPeers peers;
+    if (!StartEvents(events, peers, nPeers, backend))
+        return;
+
+    std::vector<CSocketEvents::Event> vEvents;
+    int nNext = 0;
+    char ch = 0;
+    while (state.KeepRunning()) {
+        Peer& peer = peers.vPeers[nNext];
+        nNext = (nNext + 1) % nPeers;
+        send(peer.hClient, &ch, 1, MSG_NOSIGNAL);
+        bool fReceived = false;
+        while (!fReceived) {
+            vEvents.clear();
+            events.Wait(1000, vEvents);
+            for (size_t i = 0; i < vEvents.size(); i++) {
+                if (vEvents[i].pdata == &peer && (vEvents[i].nEvents & CSocketEvents::EVENT_RECV))
+                    fReceived = recv(peer.hServer, &ch, 1, MSG_DONTWAIT) == 1;
+            }
+        }
+    }
+}
+
+/** With nPeers connected, replace the oldest peer by a new one. */
+void ConnectChurn(benchmark::State& state, CSocketEvents::Backend backend, int nPeers)
+{
+    CSocketEvents events;
+    CLoopbackPeers peers;
+    if (!StartEvents(events, peers, nPeers, backend))
+        return;
+
+    std::vector<CSocketEvents::Event> vEvents;
+    int nNext = 0;
+    while (state.KeepRunning()) {
+        Peer& peer = peers.vPeers[nNext];
+        nNext = (nNext + 1) % nPeers;
+        events.Remove(peer.hServer);
+        CloseSocket(peer.hServer);
+        CloseSocket(peer.hClient);
+        if (!peers.Connect(peer))
+            break;
+        events.Add(peer.hServer, &peer);
+        events.SetInterest(peer.hServer, CSocketEvents::EVENT_RECV);
+        vEvents.clear();
+        events.Wait(0, vEvents);
+    }
+}
+
+} // anon namespace
+
+static void SocketEvents_ReceiveLatency_Select400(benchmark::State& state) { ReceiveLatency(state, CSocketEvents::BACKEND_SELECT, SELECT_PEERS); }
+static void SocketEvents_ConnectChurn_Select400(benchmark::State& state) { ConnectChurn(state, CSocketEvents::BACKEND_SELECT, SELECT_PEERS); }
+
+BENCHMARK(SocketEvents_ReceiveLatency_Select400);
+BENCHMARK(SocketEvents_ConnectChurn_Select400);
+
+#ifdef USE_EPOLL
+static void SocketEvents_ReceiveLatency_Epoll400(benchmark::State& state) { ReceiveLatency(state, CSocketEvents::BACKEND_EPOLL, SELECT_PEERS); }
+static void SocketEvents_ReceiveLatency_Epoll1000(benchmark::State& state) { ReceiveLatency(state, CSocketEvents::BACKEND_EPOLL, MANY_PEERS); }
+static void SocketEvents_ConnectChurn_Epoll400(benchmark::State& state) { ConnectChurn(state, CSocketEvents::BACKEND_EPOLL, SELECT_PEERS); }
+static void SocketEvents_ConnectChurn_Epoll1000(benchmark::State& state) { ConnectChurn(state, CSocketEvents::BACKEND_EPOLL, MANY_PEERS); }
+
+BENCHMARK(SocketEvents_ReceiveLatency_Epoll400);
+BENCHMARK(SocketEvents_ReceiveLatency_Epoll1000);
+BENCHMARK(SocketEvents_ConnectChurn_Epoll400);
+BENCHMARK(SocketEvents_ConnectChurn_Epoll1000);
+#endif
@@ -0,0 +1,112 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockcache.h"
+
+CBlockCache::CBlockCache(size_t nMaxBytes)
+{
+    stats.nMaxBytes = nMaxBytes;
+}
+
+size_t CBlockCache::EntryBytes(const CEntry& entry) const
+{
+    return entry.pvchBlock->size() + (entry.pstrHex ? entry.pstrHex->size() : 0);
+}
+
+void CBlockCache::Evict()
+{
+    AssertLockHeld(cs);
+    while (stats.nBytes > stats.nMaxBytes && !listLRU.empty()) {
+        std::map<uint256, CEntry>::iterator it = mapEntries.find(listLRU.back());
+        stats.nBytes -= EntryBytes(it->second);
+        mapEntries.erase(it);
+        listLRU.pop_back();
+    }
+    stats.nBlocks = mapEntries.size();
+}
+
+void CBlockCache::SetMaxBytes(size_t nMaxBytes)
+{
+    LOCK(cs);
+    stats.nMaxBytes = nMaxBytes;
+    Evict();
+}
+
+std::shared_ptr<const std::vector<unsigned char> > CBlockCache::Get(const uint256& hash)
+{
+    LOCK(cs);
+    std::map<uint256, CEntry>::iterator it = mapEntries.find(hash);
+    if (it == mapEntries.end()) {
+        stats.nMisses++;
+        return NULL;
+    }
+    stats.nHits++;
+    listLRU.splice(listLRU.begin(), listLRU, it->second.itLRU);
+    return it->second.pvchBlock;
+}
+
+void CBlockCache::Put(const uint256& hash, const std::shared_ptr<const std::vector<unsigned char> >& pvchBlock)
+{
+    LOCK(cs);
+    // Blocks that would not fit are not worth evicting everything else for
+    if (pvchBlock->size() > stats.nMaxBytes || mapEntries.count(hash))
+        return;
+    CEntry& entry = mapEntries[hash];
+    entry.pvchBlock = pvchBlock;
+    listLRU.push_front(hash);
+    entry.itLRU = listLRU.begin();
+    stats.nBytes += EntryBytes(entry);
+    Evict();
+}
+
+std::shared_ptr<const std::string> CBlockCache::GetHex(const uint256& hash)
+{
+    LOCK(cs);
+    std::map<uint256, CEntry>::iterator it = mapEntries.find(hash);
+    if (it == mapEntries.end() || !it->second.pstrHex) {
+        stats.nHexMisses++;
+        return NULL;
+    }
+    stats.nHexHits++;
+    listLRU.splice(listLRU.begin(), listLRU, it->second.itLRU);
+    return it->second.pstrHex;
+}
+
+void CBlockCache::PutHex(const uint256& hash, const std::shared_ptr<const std::string>& pstrHex)
+{
+    LOCK(cs);
+    std::map<uint256, CEntry>::iterator it = mapEntries.find(hash);
+    if (it == mapEntries.end() || it->second.pstrHex)
+        return;
+    it->second.pstrHex = pstrHex;
+    stats.nBytes += pstrHex->size();
+    Evict();
+}
+
+void CBlockCache::Erase(const uint256& hash)
+{
+    LOCK(cs);
+    std::map<uint256, CEntry>::iterator it = mapEntries.find(hash);
+    if (it == mapEntries.end())
+        return;
+    stats.nBytes -= EntryBytes(it->second);
+    listLRU.erase(it->second.itLRU);
+    mapEntries.erase(it);
+    stats.nBlocks = mapEntries.size();
+}
+
+void CBlockCache::Clear()
+{
+    LOCK(cs);
+    mapEntries.clear();
+    listLRU.clear();
+    stats.nBlocks = 0;
+    stats.nBytes = 0;
+}
+
+CBlockCacheStats CBlockCache::GetStats() const
+{
+    LOCK(cs);
+    return stats;
+}
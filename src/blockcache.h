@@ -0,0 +1,84 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKCACHE_H
+#define BITCOIN_BLOCKCACHE_H
+
+#include "sync.h"
+#include "uint256.h"
+
+#include <list>
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/** Default for -blockservecache, in megabytes */
+static const unsigned int DEFAULT_BLOCK_SERVE_CACHE = 32;
+
+/** What a CBlockCache did so far */
+struct CBlockCacheStats
+{
+    size_t nBlocks;     //!< Blocks in the cache
+    size_t nBytes;      //!< Memory used by their serializations and hex forms
+    size_t nMaxBytes;   //!< Limit of nBytes
+    uint64_t nHits;     //!< Serializations found in the cache
+    uint64_t nMisses;   //!< ... and not found
+    uint64_t nHexHits;  //!< Hex forms found in the cache
+    uint64_t nHexMisses;
+
+    CBlockCacheStats() : nBlocks(0), nBytes(0), nMaxBytes(0), nHits(0), nMisses(0), nHexHits(0), nHexMisses(0) {}
+};
+
+/**
+ * Least recently used cache of serialized blocks, and their hex forms, for
+ * the blocks that are served to peers and clients over and over, so that
+ * they do not have to be read from disk and encoded for every request.
+ *
+ * Serializations include witness data, like the blocks on disk. They are
+ * shared with the callers, who may keep them after they are evicted.
+ */
+class CBlockCache
+{
+private:
+    struct CEntry
+    {
+        std::shared_ptr<const std::vector<unsigned char> > pvchBlock;
+        std::shared_ptr<const std::string> pstrHex;
+        std::list<uint256>::iterator itLRU;
+    };
+
+    mutable CCriticalSection cs;
+    std::map<uint256, CEntry> mapEntries;
+    //! Block hashes, most recently used first
+    std::list<uint256> listLRU;
+    CBlockCacheStats stats;
+
+    size_t EntryBytes(const CEntry& entry) const;
+    void Evict();
+
+public:
+    CBlockCache(size_t nMaxBytes);
+
+    /** Change the memory limit, 0 disables the cache */
+    void SetMaxBytes(size_t nMaxBytes);
+
+    /** Return the serialization of a block, or NULL if it is not cached */
+    std::shared_ptr<const std::vector<unsigned char> > Get(const uint256& hash);
+    void Put(const uint256& hash, const std::shared_ptr<const std::vector<unsigned char> >& pvchBlock);
+
+    /** Return the hex form of a cached block's serialization, or NULL if it has none yet */
+    std::shared_ptr<const std::string> GetHex(const uint256& hash);
+    /** Add the hex form of a block; does nothing unless the block is cached */
+    void PutHex(const uint256& hash, const std::shared_ptr<const std::string>& pstrHex);
+
+    /** Drop a block, e.g. when it is disconnected from the chain */
+    void Erase(const uint256& hash);
+    void Clear();
+
+    CBlockCacheStats GetStats() const;
+};
+
+#endif // BITCOIN_BLOCKCACHE_H
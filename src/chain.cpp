@@ -112,6 +112,13 @@ void CBlockIndex::BuildSkip()
         pskip = pprev->GetAncestor(GetSkipHeight(nHeight));
 }
 
+void CChain::BuildSkip(CBlockIndex *pindex) const
+{
+    assert(Contains(pindex));
+    if (pindex->pprev)
+        pindex->pskip = vChain[GetSkipHeight(pindex->nHeight)];
+}
+
 arith_uint256 GetBlockProof(const CBlockIndex& block)
 {
     arith_uint256 bnTarget;
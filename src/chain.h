@@ -459,6 +459,11 @@ public:
 
     /** Find the last common block between this chain and a block index entry. */
     const CBlockIndex *FindFork(const CBlockIndex *pindex) const;
+
+    /** Set the skip pointer of pindex, which must be part of this chain. Equivalent to
+     *  pindex->BuildSkip(), but only reads the chain, so it can run concurrently for
+     *  different entries. */
+    void BuildSkip(CBlockIndex *pindex) const;
 };
 
 #endif // BITCOIN_CHAIN_H
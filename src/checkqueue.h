@@ -6,17 +6,116 @@
 #define BITCOIN_CHECKQUEUE_H
 
 #include <algorithm>
+#include <atomic>
+#include <deque>
 #include <vector>
 
-#include <boost/foreach.hpp>
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 
 template <typename T>
 class CCheckQueueControl;
 
-/** 
+/**
+ * Lock-free ring of pointers to queued verifications. Only one thread (the
+ * queue's master) pushes; any number of threads take entries from the other
+ * end, claiming a range of them with a single compare-and-swap. Indices only
+ * grow, so a claim based on a stale view of the ring can never succeed.
+ */
+template <typename T>
+class CCheckQueueRing
+{
+private:
+    struct Buffer
+    {
+        const int64_t nMask;
+        std::atomic<T*>* const slots;
+
+        Buffer(int64_t nSize) : nMask(nSize - 1), slots(new std::atomic<T*>[nSize]) {}
+        ~Buffer() { delete[] slots; }
+
+        T* Get(int64_t i) const { return slots[i & nMask].load(std::memory_order_relaxed); }
+        void Put(int64_t i, T* p) { slots[i & nMask].store(p, std::memory_order_relaxed); }
+    };
+
+    //! Index of the next entry to be taken
+    std::atomic<int64_t> nTop;
+
+    //! Keep the consumers' and the producer's index on separate cache lines
+    char padding[64];
+
+    //! Index one past the last pushed entry; only written by the producer
+    std::atomic<int64_t> nBottom;
+
+    std::atomic<Buffer*> buffer;
+
+    //! Buffers replaced by a larger one. Consumers may still be reading them,
+    //! so they are only freed with the ring.
+    std::vector<Buffer*> vRetired;
+
+    CCheckQueueRing(const CCheckQueueRing&);
+    CCheckQueueRing& operator=(const CCheckQueueRing&);
+
+public:
+    CCheckQueueRing() : nTop(0), nBottom(0), buffer(new Buffer(256)) {}
+
+    ~CCheckQueueRing()
+    {
+        delete buffer.load();
+        for (size_t i = 0; i < vRetired.size(); i++)
+            delete vRetired[i];
+    }
+
+    //! Number of entries not taken yet
+    int64_t Size() const
+    {
+        return std::max<int64_t>(0, nBottom.load() - nTop.load());
+    }
+
+    //! Append pointers to the n consecutive elements at pcheck. Only called by the producer.
+    void Push(T* pcheck, size_t n)
+    {
+        const int64_t b = nBottom.load(std::memory_order_relaxed);
+        const int64_t t = nTop.load(std::memory_order_acquire);
+        Buffer* buf = buffer.load(std::memory_order_relaxed);
+        if (b - t + (int64_t)n > buf->nMask + 1) {
+            int64_t nSize = 2 * (buf->nMask + 1);
+            while (nSize < b - t + (int64_t)n)
+                nSize *= 2;
+            Buffer* bufNew = new Buffer(nSize);
+            for (int64_t i = t; i < b; i++)
+                bufNew->Put(i, buf->Get(i));
+            vRetired.push_back(buf);
+            buffer.store(bufNew, std::memory_order_release);
+            buf = bufNew;
+        }
+        for (size_t i = 0; i < n; i++)
+            buf->Put(b + i, pcheck + i);
+        nBottom.store(b + n);
+    }
+
+    //! Take up to nMax entries, leaving a fair share of what is left for nShare
+    //! other consumers. Returns the number of entries taken.
+    size_t Take(T** ppcheck, size_t nMax, size_t nShare)
+    {
+        while (true) {
+            int64_t t = nTop.load();
+            const int64_t b = nBottom.load();
+            if (t >= b)
+                return 0;
+            const size_t n = std::max<size_t>(1, std::min<size_t>(nMax, (b - t) / (nShare + 1)));
+            const Buffer* buf = buffer.load(std::memory_order_acquire);
+            for (size_t i = 0; i < n; i++)
+                ppcheck[i] = buf->Get(t + i);
+            if (nTop.compare_exchange_weak(t, t + n))
+                return n;
+        }
+    }
+};
+
+/**
  * Queue for verifications that have to be performed.
   * The verifications are represented by a type T, which must provide an
   * operator(), returning a bool.
@@ -25,110 +124,145 @@ class CCheckQueueControl;
   * onto the queue, where they are processed by N-1 worker threads. When
   * the master is done adding work, it temporarily joins the worker pool
   * as an N'th worker, until all jobs are done.
+  *
+  * Every thread owns a lock-free ring that the master spreads new batches
+  * over. Threads work through their own ring first and steal from the
+  * others when it runs dry, so handing out work takes no locks; the mutex
+  * is only used to sleep when there is nothing left to do.
   */
 template <typename T>
 class CCheckQueue
 {
 private:
-    //! Mutex to protect the inner state
+    //! Threads beyond this many (including the master) only steal
+    static const int MAX_RINGS = 128;
+
+    //! Number of attempts to find more work before going to sleep
+    static const int SPIN_COUNT = 16;
+
+    //! Mutex to sleep on when out of work
     boost::mutex mutex;
 
     //! Worker threads block on this when out of work
     boost::condition_variable condWorker;
 
-    //! Master thread blocks on this when out of work
+    //! Master thread blocks on this when waiting for workers to finish
     boost::condition_variable condMaster;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
+    //! One ring per thread; ring 0 belongs to the master
+    std::atomic<CCheckQueueRing<T>*> rings[MAX_RINGS];
 
-    //! The number of workers (including the master) that are idle.
-    int nIdle;
+    //! The number of threads that registered, including the master
+    std::atomic<int> nRings;
 
-    //! The total number of workers (including the master).
-    int nTotal;
+    //! The number of workers sleeping on condWorker.
+    std::atomic<int> nIdle;
 
     //! The temporary evaluation result.
-    bool fAllOk;
+    std::atomic<bool> fAllOk;
 
     /**
      * Number of verifications that haven't completed yet.
-     * This includes elements that are no longer queued, but still in the
-     * worker's own batches.
+     * This includes elements that are no longer queued, but still in a
+     * thread's own batch.
      */
-    unsigned int nTodo;
-
-    //! Whether we're shutting down.
-    bool fQuit;
+    std::atomic<unsigned int> nTodo;
 
     //! The maximum number of elements to be processed in one batch
     unsigned int nBatchSize;
 
+    //! Storage for the verifications added since the last Wait(); only touched by the master.
+    //! A deque, so that adding a batch doesn't move the ones queued before.
+    std::deque<std::vector<T> > dequeChunks;
+
+    //! Ring the master starts spreading the next batch from
+    int nNextRing;
+
+    CCheckQueue(const CCheckQueue&);
+    CCheckQueue& operator=(const CCheckQueue&);
+
+    int NumRings() const
+    {
+        return std::min(nRings.load(), (int)MAX_RINGS);
+    }
+
+    bool HasQueued() const
+    {
+        for (int i = 0; i < NumRings(); i++) {
+            const CCheckQueueRing<T>* pring = rings[i].load();
+            if (pring && pring->Size() > 0)
+                return true;
+        }
+        return false;
+    }
+
+    //! Take a batch from ring nId, or steal one from any other ring.
+    size_t Take(int nId, T** ppcheck)
+    {
+        const int nTotal = NumRings();
+        for (int i = 0; i < nTotal; i++) {
+            CCheckQueueRing<T>* pring = rings[(nId + i) % nTotal].load();
+            if (!pring)
+                continue;
+            size_t n = pring->Take(ppcheck, nBatchSize, nTotal);
+            if (n)
+                return n;
+        }
+        return 0;
+    }
+
+    //! Run a batch of taken verifications. Once one has failed, the rest are skipped.
+    void Run(T* const* ppcheck, size_t n)
+    {
+        for (size_t i = 0; i < n; i++) {
+            // Move the verification out, so its resources are released as soon as it ran
+            T check;
+            check.swap(*ppcheck[i]);
+            if (fAllOk.load(std::memory_order_relaxed) && !check())
+                fAllOk.store(false, std::memory_order_relaxed);
+        }
+        if (nTodo.fetch_sub(n) == n) {
+            // We processed the last element; inform the master it can exit and return the result
+            boost::unique_lock<boost::mutex> lock(mutex);
+            condMaster.notify_one();
+        }
+    }
+
     /** Internal function that does bulk of the verification work. */
-    bool Loop(bool fMaster = false)
+    void Loop()
     {
-        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
-        std::vector<T> vChecks;
-        vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
+        int nId = nRings.fetch_add(1);
+        if (nId < MAX_RINGS)
+            rings[nId].store(new CCheckQueueRing<T>());
+        std::vector<T*> vBatch(nBatchSize);
+        int nSpin = 0;
         do {
-            {
+            size_t n = Take(nId, &vBatch[0]);
+            if (n) {
+                Run(&vBatch[0], n);
+                nSpin = 0;
+            } else if (nSpin < SPIN_COUNT) {
+                nSpin++;
+                boost::this_thread::yield();
+            } else {
                 boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master it can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
-                }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if ((fMaster || fQuit) && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
-                    }
-                    nIdle++;
-                    cond.wait(lock); // wait
-                    nIdle--;
-                }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
-                }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
+                nIdle++;
+                while (!HasQueued())
+                    condWorker.wait(lock);
+                nIdle--;
+                nSpin = 0;
             }
-            // execute work
-            BOOST_FOREACH (T& check, vChecks)
-                if (fOk)
-                    fOk = check();
-            vChecks.clear();
         } while (true);
     }
 
 public:
     //! Create a new check queue
-    CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+    CCheckQueue(unsigned int nBatchSizeIn) : nRings(1), nIdle(0), fAllOk(true), nTodo(0), nBatchSize(std::max(1U, nBatchSizeIn)), nNextRing(0)
+    {
+        rings[0].store(new CCheckQueueRing<T>());
+        for (int i = 1; i < MAX_RINGS; i++)
+            rings[i].store(NULL);
+    }
 
     //! Worker thread
     void Thread()
@@ -139,37 +273,68 @@ public:
     //! Wait until execution finishes, and return whether all evaluations were successful.
     bool Wait()
     {
-        return Loop(true);
+        std::vector<T*> vBatch(nBatchSize);
+        size_t n;
+        while ((n = Take(0, &vBatch[0])) > 0)
+            Run(&vBatch[0], n);
+        if (nTodo.load() != 0) {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (nTodo.load() != 0)
+                condMaster.wait(lock);
+        }
+        bool fRet = fAllOk.load();
+        // reset the status for new work later
+        fAllOk.store(true);
+        dequeChunks.clear();
+        return fRet;
     }
 
-    //! Add a batch of checks to the queue
+    //! Add a batch of checks to the queue. Takes ownership of the contents of vChecks.
     void Add(std::vector<T>& vChecks)
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        BOOST_FOREACH (T& check, vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
+        if (vChecks.empty())
+            return;
+        dequeChunks.push_back(std::vector<T>());
+        std::vector<T>& chunk = dequeChunks.back();
+        chunk.swap(vChecks);
+
+        const size_t nChecks = chunk.size();
+        nTodo.fetch_add(nChecks);
+
+        // Spread the batch over the rings, starting where the previous one stopped
+        const int nTotal = NumRings();
+        const size_t nPerRing = (nChecks + nTotal - 1) / nTotal;
+        for (size_t nPos = 0; nPos < nChecks; nPos += nPerRing) {
+            CCheckQueueRing<T>* pring = rings[nNextRing % nTotal].load();
+            nNextRing = (nNextRing + 1) % nTotal;
+            if (!pring)
+                pring = rings[0].load();
+            pring->Push(&chunk[nPos], std::min(nPerRing, nChecks - nPos));
+        }
+
+        if (nIdle.load() > 0) {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (nChecks == 1)
+                condWorker.notify_one();
+            else
+                condWorker.notify_all();
         }
-        nTodo += vChecks.size();
-        if (vChecks.size() == 1)
-            condWorker.notify_one();
-        else if (vChecks.size() > 1)
-            condWorker.notify_all();
     }
 
     ~CCheckQueue()
     {
+        for (int i = 0; i < MAX_RINGS; i++)
+            delete rings[i].load();
     }
 
     bool IsIdle()
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        return (nTotal == nIdle && nTodo == 0 && fAllOk == true);
+        return nTodo.load() == 0 && fAllOk.load();
     }
 
 };
 
-/** 
+/**
  * RAII-style controller object for a CCheckQueue that guarantees the passed
  * queue is finished before continuing.
  */
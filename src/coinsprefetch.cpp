@@ -0,0 +1,95 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coinsprefetch.h"
+
+#include "primitives/block.h"
+#include "utiltime.h"
+
+#include <algorithm>
+
+#include <boost/foreach.hpp>
+
+bool CCoinsPrefetchJob::operator()()
+{
+    int64_t nTimeStart = GetTimeMicros();
+    for (size_t i = nBegin; i < nEnd; i++) {
+        Coin& coin = (*pvCoins)[i];
+        (*pvFound)[i] = view->GetCoin((*pvOutPoints)[i], coin) && !coin.IsSpent();
+    }
+    *pnReadMicros += GetTimeMicros() - nTimeStart;
+    return true;
+}
+
+void CCoinsPrefetchJob::swap(CCoinsPrefetchJob& job)
+{
+    std::swap(view, job.view);
+    std::swap(pvOutPoints, job.pvOutPoints);
+    std::swap(pvCoins, job.pvCoins);
+    std::swap(pvFound, job.pvFound);
+    std::swap(nBegin, job.nBegin);
+    std::swap(nEnd, job.nEnd);
+    std::swap(pnReadMicros, job.pnReadMicros);
+}
+
+void PrefetchBlockInputs(CCoinsViewCache& cache, const std::vector<const CBlock*>& vBlocks, CCoinsPrefetchQueue* pqueue, CCoinsPrefetchStats& stats)
+{
+    int64_t nTimeStart = GetTimeMicros();
+    stats = CCoinsPrefetchStats();
+
+    std::vector<uint256> vCreated;
+    BOOST_FOREACH(const CBlock* pblock, vBlocks) {
+        BOOST_FOREACH(const CTransaction& tx, pblock->vtx)
+            vCreated.push_back(tx.GetHash());
+    }
+    std::sort(vCreated.begin(), vCreated.end());
+
+    std::vector<COutPoint> vOutPoints;
+    BOOST_FOREACH(const CBlock* pblock, vBlocks) {
+        BOOST_FOREACH(const CTransaction& tx, pblock->vtx) {
+            if (tx.IsCoinBase())
+                continue;
+            BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+                stats.nInputs++;
+                if (std::binary_search(vCreated.begin(), vCreated.end(), txin.prevout.hash))
+                    stats.nInternal++;
+                else if (cache.HaveCoinInCache(txin.prevout))
+                    stats.nCached++;
+                else
+                    vOutPoints.push_back(txin.prevout);
+            }
+        }
+    }
+    // Outputs are keyed by outpoint in the database, so looking them up in
+    // order keeps each worker's reads close together.
+    std::sort(vOutPoints.begin(), vOutPoints.end());
+    vOutPoints.erase(std::unique(vOutPoints.begin(), vOutPoints.end()), vOutPoints.end());
+    stats.nRead = vOutPoints.size();
+
+    std::vector<Coin> vCoins(vOutPoints.size());
+    std::vector<char> vFound(vOutPoints.size(), 0);
+    std::atomic<int64_t> nReadMicros(0);
+    std::vector<CCoinsPrefetchJob> vJobs;
+    for (size_t nBegin = 0; nBegin < vOutPoints.size(); nBegin += COINS_PREFETCH_BATCH) {
+        size_t nEnd = std::min(nBegin + COINS_PREFETCH_BATCH, vOutPoints.size());
+        vJobs.push_back(CCoinsPrefetchJob(cache.GetBackend(), &vOutPoints, &vCoins, &vFound, nBegin, nEnd, &nReadMicros));
+    }
+    if (pqueue) {
+        CCheckQueueControl<CCoinsPrefetchJob> control(pqueue);
+        control.Add(vJobs);
+        control.Wait();
+    } else {
+        for (size_t i = 0; i < vJobs.size(); i++)
+            vJobs[i]();
+    }
+
+    for (size_t i = 0; i < vOutPoints.size(); i++) {
+        if (vFound[i]) {
+            cache.CacheFetchedCoin(vOutPoints[i], vCoins[i]);
+            stats.nFound++;
+        }
+    }
+    stats.nReadMicros = nReadMicros;
+    stats.nWallMicros = GetTimeMicros() - nTimeStart;
+}
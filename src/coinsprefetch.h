@@ -0,0 +1,73 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COINSPREFETCH_H
+#define BITCOIN_COINSPREFETCH_H
+
+#include "checkqueue.h"
+#include "coins.h"
+
+#include <atomic>
+#include <stdint.h>
+#include <vector>
+
+class CBlock;
+
+/** Number of outputs a prefetch worker looks up at a time */
+static const size_t COINS_PREFETCH_BATCH = 64;
+
+/** Looks up a slice of the outputs being prefetched, run on a CCoinsPrefetchQueue worker. */
+class CCoinsPrefetchJob
+{
+private:
+    const CCoinsView* view;
+    const std::vector<COutPoint>* pvOutPoints;
+    std::vector<Coin>* pvCoins;
+    std::vector<char>* pvFound;
+    size_t nBegin;
+    size_t nEnd;
+    std::atomic<int64_t>* pnReadMicros;
+
+public:
+    CCoinsPrefetchJob() : view(NULL), pvOutPoints(NULL), pvCoins(NULL), pvFound(NULL), nBegin(0), nEnd(0), pnReadMicros(NULL) {}
+    CCoinsPrefetchJob(const CCoinsView* viewIn, const std::vector<COutPoint>* pvOutPointsIn, std::vector<Coin>* pvCoinsIn, std::vector<char>* pvFoundIn, size_t nBeginIn, size_t nEndIn, std::atomic<int64_t>* pnReadMicrosIn) :
+        view(viewIn), pvOutPoints(pvOutPointsIn), pvCoins(pvCoinsIn), pvFound(pvFoundIn), nBegin(nBeginIn), nEnd(nEndIn), pnReadMicros(pnReadMicrosIn) {}
+
+    bool operator()();
+
+    void swap(CCoinsPrefetchJob& job);
+};
+
+typedef CCheckQueue<CCoinsPrefetchJob> CCoinsPrefetchQueue;
+
+/** What a call to PrefetchBlockInputs() did */
+struct CCoinsPrefetchStats
+{
+    size_t nInputs;      //!< Inputs spent by the blocks
+    size_t nInternal;    //!< ... of outputs created by the blocks themselves
+    size_t nCached;      //!< ... already in the cache
+    size_t nRead;        //!< Distinct outputs looked up in the backing view
+    size_t nFound;       //!< ... and found there
+    int64_t nReadMicros; //!< Time spent in lookups, summed over all threads
+    int64_t nWallMicros; //!< Time the call took
+
+    CCoinsPrefetchStats() : nInputs(0), nInternal(0), nCached(0), nRead(0), nFound(0), nReadMicros(0), nWallMicros(0) {}
+};
+
+/**
+ * Warm a coins cache with the outputs spent by a series of blocks, so that
+ * connecting them finds their inputs in memory instead of reading them from
+ * the database one at a time.
+ *
+ * Outputs that are neither created by the blocks nor in the cache yet are
+ * looked up in the cache's backing view, on the workers of pqueue and the
+ * calling thread (or only the latter if pqueue is NULL), which therefore must
+ * allow concurrent reads. Found coins are added to the cache unmodified, so
+ * its contents are the same as if the blocks had fetched them.
+ *
+ * Nothing may modify the cache or its backing view during the call.
+ */
+void PrefetchBlockInputs(CCoinsViewCache& cache, const std::vector<const CBlock*>& vBlocks, CCoinsPrefetchQueue* pqueue, CCoinsPrefetchStats& stats);
+
+#endif // BITCOIN_COINSPREFETCH_H
@@ -79,6 +79,14 @@ typedef u_int SOCKET;
 #define MSG_NOSIGNAL 0
 #endif
 
+// select() can't handle descriptors at or above FD_SETSIZE. Where available,
+// single sockets are waited for with poll(), and many with epoll (see
+// socketevents.h).
+#if defined(__linux__)
+#define USE_POLL
+#define USE_EPOLL
+#endif
+
 #if HAVE_DECL_STRNLEN == 0
 size_t strnlen( const char *start, size_t max_len);
 #endif // HAVE_DECL_STRNLEN
@@ -0,0 +1,103 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_SHA256_LANES_H
+#define BITCOIN_CRYPTO_SHA256_LANES_H
+
+// Internal header: single SHA-256 of 64-byte messages over an abstract vector of
+// independent 32-bit lanes, used by the batch header hashing kernels to finish
+// the Skein-512 digests of several headers at once.
+//
+// Ops must provide:
+//   typedef ... V;
+//   static V Set1(uint32_t);
+//   static V Add(V, V);
+//   static V Xor(V, V);
+//   static V And(V, V);
+//   static V Or(V, V);
+//   template<int N> static V Shr(V);
+//   template<int N> static V Rotr(V);
+
+#include <stdint.h>
+
+namespace sha256_lanes
+{
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint32_t IV[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+template<typename Ops>
+struct SHA256
+{
+    typedef typename Ops::V V;
+
+    static inline V Ch(V x, V y, V z) { return Ops::Xor(z, Ops::And(x, Ops::Xor(y, z))); }
+    static inline V Maj(V x, V y, V z) { return Ops::Or(Ops::And(x, y), Ops::And(z, Ops::Or(x, y))); }
+    static inline V Sigma0(V x) { return Ops::Xor(Ops::Xor(Ops::template Rotr<2>(x), Ops::template Rotr<13>(x)), Ops::template Rotr<22>(x)); }
+    static inline V Sigma1(V x) { return Ops::Xor(Ops::Xor(Ops::template Rotr<6>(x), Ops::template Rotr<11>(x)), Ops::template Rotr<25>(x)); }
+    static inline V sigma0(V x) { return Ops::Xor(Ops::Xor(Ops::template Rotr<7>(x), Ops::template Rotr<18>(x)), Ops::template Shr<3>(x)); }
+    static inline V sigma1(V x) { return Ops::Xor(Ops::Xor(Ops::template Rotr<17>(x), Ops::template Rotr<19>(x)), Ops::template Shr<10>(x)); }
+
+    /** Compress one 64-byte block (sixteen big-endian words per lane) into s. */
+    static inline void Transform(V s[8], const V block[16])
+    {
+        V w[64];
+        for (int i = 0; i < 16; i++)
+            w[i] = block[i];
+        for (int i = 16; i < 64; i++)
+            w[i] = Ops::Add(Ops::Add(sigma1(w[i - 2]), w[i - 7]), Ops::Add(sigma0(w[i - 15]), w[i - 16]));
+
+        V a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+        for (int i = 0; i < 64; i++) {
+            V t1 = Ops::Add(Ops::Add(h, Sigma1(e)), Ops::Add(Ch(e, f, g), Ops::Add(Ops::Set1(K[i]), w[i])));
+            V t2 = Ops::Add(Sigma0(a), Maj(a, b, c));
+            h = g;
+            g = f;
+            f = e;
+            e = Ops::Add(d, t1);
+            d = c;
+            c = b;
+            b = a;
+            a = Ops::Add(t1, t2);
+        }
+        s[0] = Ops::Add(s[0], a);
+        s[1] = Ops::Add(s[1], b);
+        s[2] = Ops::Add(s[2], c);
+        s[3] = Ops::Add(s[3], d);
+        s[4] = Ops::Add(s[4], e);
+        s[5] = Ops::Add(s[5], f);
+        s[6] = Ops::Add(s[6], g);
+        s[7] = Ops::Add(s[7], h);
+    }
+
+    /** SHA-256 of one 64-byte message per lane. m holds its sixteen big-endian words,
+     *  out receives the eight big-endian digest words. */
+    static void Hash64(V out[8], const V m[16])
+    {
+        V pad[16];
+        for (int i = 0; i < 8; i++)
+            out[i] = Ops::Set1(IV[i]);
+        Transform(out, m);
+
+        pad[0] = Ops::Set1(0x80000000);
+        for (int i = 1; i < 15; i++)
+            pad[i] = Ops::Set1(0);
+        pad[15] = Ops::Set1(512);
+        Transform(out, pad);
+    }
+};
+} // namespace sha256_lanes
+
+#endif // BITCOIN_CRYPTO_SHA256_LANES_H
@@ -0,0 +1,176 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/skein512.h"
+
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+#include "crypto/skein512_lanes.h"
+
+#if defined(__x86_64__) || defined(__amd64__) || defined(__i386__)
+#include <cpuid.h>
+#define HAVE_X86_CPUID 1
+
+#if defined(ENABLE_AVX2) && !defined(BUILD_BITCOIN_INTERNAL)
+namespace skein512_avx2 {
+void Transform_8way(unsigned char* out, const unsigned char* in);
+void Transform_8way_Midstate(unsigned char* out, const uint64_t mid[8], const unsigned char* tails);
+}
+#endif
+
+#if defined(ENABLE_AVX512F) && !defined(BUILD_BITCOIN_INTERNAL)
+namespace skein512_avx512 {
+void Transform_8way(unsigned char* out, const unsigned char* in);
+void Transform_8way_Midstate(unsigned char* out, const uint64_t mid[8], const unsigned char* tails);
+}
+#endif
+#endif
+
+// Internal implementation code.
+namespace
+{
+/// Portable single-lane Skein-512 implementation.
+namespace skein512_generic
+{
+struct Ops
+{
+    typedef uint64_t V;
+    static inline V Set1(uint64_t x) { return x; }
+    static inline V Add(V x, V y) { return x + y; }
+    static inline V Xor(V x, V y) { return x ^ y; }
+    template<int R>
+    static inline V Rotl(V x) { return (x << R) | (x >> (64 - R)); }
+};
+
+void Transform_1way(unsigned char* out, const unsigned char* in)
+{
+    uint64_t m[10], h[8];
+    unsigned char digest[SKEIN512_OUTPUT_SIZE];
+    for (int i = 0; i < 10; i++)
+        m[i] = ReadLE64(in + 8 * i);
+    skein512_lanes::Skein512<Ops>::Hash80(h, m);
+    for (int i = 0; i < 8; i++)
+        WriteLE64(digest + 8 * i, h[i]);
+    CSHA256().Write(digest, sizeof(digest)).Finalize(out);
+}
+
+void Transform_1way_Midstate(unsigned char* out, const uint64_t mid[8], const unsigned char* tail)
+{
+    uint64_t h[8];
+    unsigned char digest[SKEIN512_OUTPUT_SIZE];
+    for (int i = 0; i < 8; i++)
+        h[i] = mid[i];
+    skein512_lanes::Skein512<Ops>::Finish(h, ReadLE64(tail), ReadLE64(tail + 8));
+    for (int i = 0; i < 8; i++)
+        WriteLE64(digest + 8 * i, h[i]);
+    CSHA256().Write(digest, sizeof(digest)).Finalize(out);
+}
+} // namespace skein512_generic
+
+typedef void (*TransformNWay)(unsigned char* out, const unsigned char* in);
+typedef void (*TransformNWayMidstate)(unsigned char* out, const uint64_t mid[8], const unsigned char* tails);
+
+TransformNWay Transform8Way = NULL;
+TransformNWayMidstate Transform8WayMidstate = NULL;
+
+#if defined(HAVE_X86_CPUID)
+void inline cpuid(uint32_t leaf, uint32_t subleaf, uint32_t& a, uint32_t& b, uint32_t& c, uint32_t& d)
+{
+    __cpuid_count(leaf, subleaf, a, b, c, d);
+}
+
+/** Read the XCR0 register, which tells which register sets the OS saves on context switch. */
+uint64_t inline GetXCR0()
+{
+    uint32_t a, d;
+    __asm__("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+    return ((uint64_t)d << 32) | a;
+}
+#endif
+} // namespace
+
+std::string Skein512AutoDetect(skein512_implementation::UseImplementation use_implementation)
+{
+    std::string ret = "generic";
+    Transform8Way = NULL;
+    Transform8WayMidstate = NULL;
+#if defined(HAVE_X86_CPUID)
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0, 0, eax, ebx, ecx, edx);
+    const uint32_t max_leaf = eax;
+    cpuid(1, 0, eax, ebx, ecx, edx);
+    const bool have_osxsave = (ecx >> 27) & 1;
+    const bool have_avx = (ecx >> 28) & 1;
+    if (max_leaf < 7 || !have_osxsave || !have_avx) {
+        return ret;
+    }
+    const uint64_t xcr0 = GetXCR0();
+    cpuid(7, 0, eax, ebx, ecx, edx);
+    const bool have_avx2 = ((ebx >> 5) & 1) && (xcr0 & 0x06) == 0x06;
+    const bool have_avx512f = ((ebx >> 16) & 1) && (xcr0 & 0xe6) == 0xe6;
+#if defined(ENABLE_AVX2) && !defined(BUILD_BITCOIN_INTERNAL)
+    if (have_avx2 && (use_implementation & skein512_implementation::USE_AVX2)) {
+        Transform8Way = skein512_avx2::Transform_8way;
+        Transform8WayMidstate = skein512_avx2::Transform_8way_Midstate;
+        ret = "avx2(8way)";
+    }
+#endif
+#if defined(ENABLE_AVX512F) && !defined(BUILD_BITCOIN_INTERNAL)
+    if (have_avx512f && (use_implementation & skein512_implementation::USE_AVX512)) {
+        Transform8Way = skein512_avx512::Transform_8way;
+        Transform8WayMidstate = skein512_avx512::Transform_8way_Midstate;
+        ret = "avx512(8way)";
+    }
+#endif
+    (void)have_avx2;
+    (void)have_avx512f;
+#endif
+    (void)use_implementation;
+    return ret;
+}
+
+void SkeinSHA256_80(unsigned char* out, const unsigned char* in, size_t count)
+{
+    if (Transform8Way) {
+        while (count >= 8) {
+            Transform8Way(out, in);
+            out += 8 * CSHA256::OUTPUT_SIZE;
+            in += 8 * SKEIN512_80_INPUT_SIZE;
+            count -= 8;
+        }
+    }
+    while (count) {
+        skein512_generic::Transform_1way(out, in);
+        out += CSHA256::OUTPUT_SIZE;
+        in += SKEIN512_80_INPUT_SIZE;
+        --count;
+    }
+}
+
+void Skein512Midstate80(Skein512Midstate& mid, const unsigned char* in)
+{
+    uint64_t m[8];
+    for (int i = 0; i < 8; i++)
+        m[i] = ReadLE64(in + 8 * i);
+    skein512_lanes::Skein512<skein512_generic::Ops>::Midstate(mid.h, m);
+}
+
+void SkeinSHA256_80_Midstate(unsigned char* out, const Skein512Midstate& mid, const unsigned char* tails, size_t count)
+{
+    static const size_t TAIL_SIZE = SKEIN512_80_INPUT_SIZE - 64;
+    if (Transform8WayMidstate) {
+        while (count >= 8) {
+            Transform8WayMidstate(out, mid.h, tails);
+            out += 8 * CSHA256::OUTPUT_SIZE;
+            tails += 8 * TAIL_SIZE;
+            count -= 8;
+        }
+    }
+    while (count) {
+        skein512_generic::Transform_1way_Midstate(out, mid.h, tails);
+        out += CSHA256::OUTPUT_SIZE;
+        tails += TAIL_SIZE;
+        --count;
+    }
+}
@@ -0,0 +1,54 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_SKEIN512_H
+#define BITCOIN_CRYPTO_SKEIN512_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+
+/** Size in bytes of the messages handled here (a serialized block header). */
+static const size_t SKEIN512_80_INPUT_SIZE = 80;
+/** Size in bytes of a Skein-512-512 digest. */
+static const size_t SKEIN512_OUTPUT_SIZE = 64;
+
+namespace skein512_implementation {
+/** Multi-lane kernels Skein512AutoDetect may pick from. */
+enum UseImplementation : uint8_t {
+    USE_GENERIC = 0,
+    USE_AVX2 = 1 << 0,
+    USE_AVX512 = 1 << 1,
+    USE_ALL = USE_AVX2 | USE_AVX512,
+};
+}
+
+/** Autodetect the best available batch header hashing implementation among
+ *  those allowed by use_implementation (tests use it to exercise each kernel).
+ *  Returns the name of the implementation. Not thread safe; call once at startup. */
+std::string Skein512AutoDetect(skein512_implementation::UseImplementation use_implementation = skein512_implementation::USE_ALL);
+
+/** Compute SHA-256(Skein-512-512(m)), the block header hash, for `count`
+ *  independent 80-byte messages. Reads count * 80 bytes from `in` and writes
+ *  count * 32 bytes to `out`. Uses the multi-lane AVX2/AVX-512 kernels when
+ *  Skein512AutoDetect selected them, and a portable implementation otherwise. */
+void SkeinSHA256_80(unsigned char* out, const unsigned char* in, size_t count);
+
+/** Skein-512 chaining value after the first 64 bytes of an 80-byte message.
+ *  Block headers that differ only in their last 16 bytes (end of the merkle
+ *  root, nTime, nBits, nNonce) share it, which saves one of the three Threefish
+ *  calls per header when scanning nonces. */
+struct Skein512Midstate
+{
+    uint64_t h[8];
+};
+
+/** Compute the midstate of the 64-byte prefix `in`. */
+void Skein512Midstate80(Skein512Midstate& mid, const unsigned char* in);
+
+/** Like SkeinSHA256_80, for `count` messages whose first 64 bytes produced `mid`.
+ *  Reads their last 16 bytes each (count * 16 bytes) from `tails`. */
+void SkeinSHA256_80_Midstate(unsigned char* out, const Skein512Midstate& mid, const unsigned char* tails, size_t count);
+
+#endif // BITCOIN_CRYPTO_SKEIN512_H
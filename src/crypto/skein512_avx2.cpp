@@ -0,0 +1,128 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// This is a translation unit compiled with AVX2 enabled; only call into it after
+// runtime detection (see Skein512AutoDetect in crypto/skein512.cpp).
+
+#include "crypto/common.h"
+#include "crypto/sha256_lanes.h"
+#include "crypto/skein512_lanes.h"
+
+#ifdef ENABLE_AVX2
+
+#include <immintrin.h>
+
+namespace skein512_avx2 {
+namespace {
+
+/** Four 64-bit lanes, for Skein-512. */
+struct Ops64
+{
+    typedef __m256i V;
+    static inline V Set1(uint64_t x) { return _mm256_set1_epi64x((long long)x); }
+    static inline V Add(V x, V y) { return _mm256_add_epi64(x, y); }
+    static inline V Xor(V x, V y) { return _mm256_xor_si256(x, y); }
+    template<int R>
+    static inline V Rotl(V x) { return _mm256_or_si256(_mm256_slli_epi64(x, R), _mm256_srli_epi64(x, 64 - R)); }
+};
+
+/** Eight 32-bit lanes, for SHA-256. */
+struct Ops32
+{
+    typedef __m256i V;
+    static inline V Set1(uint32_t x) { return _mm256_set1_epi32((int)x); }
+    static inline V Add(V x, V y) { return _mm256_add_epi32(x, y); }
+    static inline V Xor(V x, V y) { return _mm256_xor_si256(x, y); }
+    static inline V And(V x, V y) { return _mm256_and_si256(x, y); }
+    static inline V Or(V x, V y) { return _mm256_or_si256(x, y); }
+    template<int N>
+    static inline V Shr(V x) { return _mm256_srli_epi32(x, N); }
+    template<int N>
+    static inline V Rotr(V x) { return _mm256_or_si256(_mm256_srli_epi32(x, N), _mm256_slli_epi32(x, 32 - N)); }
+};
+
+void Store4(unsigned char* out, const __m256i h[8])
+{
+    uint64_t lanes[4];
+    for (int i = 0; i < 8; i++) {
+        _mm256_storeu_si256((__m256i*)lanes, h[i]);
+        for (int j = 0; j < 4; j++)
+            WriteLE64(out + 64 * j + 8 * i, lanes[j]);
+    }
+}
+
+/** Skein-512-512 of four 80-byte messages (in: 4 * 80 bytes, out: 4 * 64 bytes). */
+void Skein512_4way(unsigned char* out, const unsigned char* in)
+{
+    __m256i m[10], h[8];
+    for (int i = 0; i < 10; i++) {
+        const int o = 8 * i;
+        m[i] = _mm256_set_epi64x((long long)ReadLE64(in + 240 + o), (long long)ReadLE64(in + 160 + o),
+                                 (long long)ReadLE64(in + 80 + o), (long long)ReadLE64(in + o));
+    }
+    skein512_lanes::Skein512<Ops64>::Hash80(h, m);
+    Store4(out, h);
+}
+
+/** Skein-512-512 of four 80-byte messages sharing the midstate `mid`
+ *  (tails: their last 4 * 16 bytes, out: 4 * 64 bytes). */
+void Skein512_4way_Midstate(unsigned char* out, const uint64_t mid[8], const unsigned char* tails)
+{
+    __m256i h[8];
+    for (int i = 0; i < 8; i++)
+        h[i] = Ops64::Set1(mid[i]);
+    __m256i m8 = _mm256_set_epi64x((long long)ReadLE64(tails + 48), (long long)ReadLE64(tails + 32),
+                                   (long long)ReadLE64(tails + 16), (long long)ReadLE64(tails));
+    __m256i m9 = _mm256_set_epi64x((long long)ReadLE64(tails + 56), (long long)ReadLE64(tails + 40),
+                                   (long long)ReadLE64(tails + 24), (long long)ReadLE64(tails + 8));
+    skein512_lanes::Skein512<Ops64>::Finish(h, m8, m9);
+    Store4(out, h);
+}
+
+/** SHA-256 of eight 64-byte messages (in: 8 * 64 bytes, out: 8 * 32 bytes). */
+void SHA256_8way(unsigned char* out, const unsigned char* in)
+{
+    __m256i m[16], s[8];
+    for (int i = 0; i < 16; i++) {
+        const int o = 4 * i;
+        m[i] = _mm256_set_epi32((int)ReadBE32(in + 448 + o), (int)ReadBE32(in + 384 + o),
+                                (int)ReadBE32(in + 320 + o), (int)ReadBE32(in + 256 + o),
+                                (int)ReadBE32(in + 192 + o), (int)ReadBE32(in + 128 + o),
+                                (int)ReadBE32(in + 64 + o), (int)ReadBE32(in + o));
+    }
+
+    sha256_lanes::SHA256<Ops32>::Hash64(s, m);
+
+    uint32_t lanes[8];
+    for (int i = 0; i < 8; i++) {
+        _mm256_storeu_si256((__m256i*)lanes, s[i]);
+        for (int j = 0; j < 8; j++)
+            WriteBE32(out + 32 * j + 4 * i, lanes[j]);
+    }
+}
+
+} // namespace
+
+/** SHA-256(Skein-512-512(header)) of eight 80-byte headers (in: 8 * 80 bytes, out: 8 * 32 bytes). */
+void Transform_8way(unsigned char* out, const unsigned char* in)
+{
+    unsigned char digests[8 * 64];
+    Skein512_4way(digests, in);
+    Skein512_4way(digests + 4 * 64, in + 4 * 80);
+    SHA256_8way(out, digests);
+}
+
+/** Same as Transform_8way, for eight headers whose first 64 bytes produced `mid`
+ *  (tails: their last 8 * 16 bytes). */
+void Transform_8way_Midstate(unsigned char* out, const uint64_t mid[8], const unsigned char* tails)
+{
+    unsigned char digests[8 * 64];
+    Skein512_4way_Midstate(digests, mid, tails);
+    Skein512_4way_Midstate(digests + 4 * 64, mid, tails + 4 * 16);
+    SHA256_8way(out, digests);
+}
+
+} // namespace skein512_avx2
+
+#endif // ENABLE_AVX2
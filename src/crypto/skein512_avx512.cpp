@@ -0,0 +1,129 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// This is a translation unit compiled with AVX-512F enabled; only call into it
+// after runtime detection (see Skein512AutoDetect in crypto/skein512.cpp).
+
+#include "crypto/common.h"
+#include "crypto/sha256_lanes.h"
+#include "crypto/skein512_lanes.h"
+
+#ifdef ENABLE_AVX512F
+
+#include <immintrin.h>
+
+namespace skein512_avx512 {
+namespace {
+
+/** Eight 64-bit lanes, for Skein-512. */
+struct Ops64
+{
+    typedef __m512i V;
+    static inline V Set1(uint64_t x) { return _mm512_set1_epi64((long long)x); }
+    static inline V Add(V x, V y) { return _mm512_add_epi64(x, y); }
+    static inline V Xor(V x, V y) { return _mm512_xor_si512(x, y); }
+    template<int R>
+    static inline V Rotl(V x) { return _mm512_rol_epi64(x, R); }
+};
+
+/** Eight 32-bit lanes, for SHA-256 (AVX-512VL is not required). */
+struct Ops32
+{
+    typedef __m256i V;
+    static inline V Set1(uint32_t x) { return _mm256_set1_epi32((int)x); }
+    static inline V Add(V x, V y) { return _mm256_add_epi32(x, y); }
+    static inline V Xor(V x, V y) { return _mm256_xor_si256(x, y); }
+    static inline V And(V x, V y) { return _mm256_and_si256(x, y); }
+    static inline V Or(V x, V y) { return _mm256_or_si256(x, y); }
+    template<int N>
+    static inline V Shr(V x) { return _mm256_srli_epi32(x, N); }
+    template<int N>
+    static inline V Rotr(V x) { return _mm256_or_si256(_mm256_srli_epi32(x, N), _mm256_slli_epi32(x, 32 - N)); }
+};
+
+void Store8(unsigned char* out, const __m512i h[8])
+{
+    uint64_t lanes[8];
+    for (int i = 0; i < 8; i++) {
+        _mm512_storeu_si512((void*)lanes, h[i]);
+        for (int j = 0; j < 8; j++)
+            WriteLE64(out + 64 * j + 8 * i, lanes[j]);
+    }
+}
+
+/** Load word `word` of eight messages laid out `stride` bytes apart. */
+__m512i Load8(const unsigned char* in, int stride, int word)
+{
+    const unsigned char* p = in + 8 * word;
+    return _mm512_set_epi64((long long)ReadLE64(p + 7 * stride), (long long)ReadLE64(p + 6 * stride),
+                            (long long)ReadLE64(p + 5 * stride), (long long)ReadLE64(p + 4 * stride),
+                            (long long)ReadLE64(p + 3 * stride), (long long)ReadLE64(p + 2 * stride),
+                            (long long)ReadLE64(p + stride), (long long)ReadLE64(p));
+}
+
+/** Skein-512-512 of eight 80-byte messages (in: 8 * 80 bytes, out: 8 * 64 bytes). */
+void Skein512_8way(unsigned char* out, const unsigned char* in)
+{
+    __m512i m[10], h[8];
+    for (int i = 0; i < 10; i++)
+        m[i] = Load8(in, 80, i);
+    skein512_lanes::Skein512<Ops64>::Hash80(h, m);
+    Store8(out, h);
+}
+
+/** Skein-512-512 of eight 80-byte messages sharing the midstate `mid`
+ *  (tails: their last 8 * 16 bytes, out: 8 * 64 bytes). */
+void Skein512_8way_Midstate(unsigned char* out, const uint64_t mid[8], const unsigned char* tails)
+{
+    __m512i h[8];
+    for (int i = 0; i < 8; i++)
+        h[i] = Ops64::Set1(mid[i]);
+    skein512_lanes::Skein512<Ops64>::Finish(h, Load8(tails, 16, 0), Load8(tails, 16, 1));
+    Store8(out, h);
+}
+
+/** SHA-256 of eight 64-byte messages (in: 8 * 64 bytes, out: 8 * 32 bytes). */
+void SHA256_8way(unsigned char* out, const unsigned char* in)
+{
+    __m256i m[16], s[8];
+    for (int i = 0; i < 16; i++) {
+        const int o = 4 * i;
+        m[i] = _mm256_set_epi32((int)ReadBE32(in + 448 + o), (int)ReadBE32(in + 384 + o),
+                                (int)ReadBE32(in + 320 + o), (int)ReadBE32(in + 256 + o),
+                                (int)ReadBE32(in + 192 + o), (int)ReadBE32(in + 128 + o),
+                                (int)ReadBE32(in + 64 + o), (int)ReadBE32(in + o));
+    }
+
+    sha256_lanes::SHA256<Ops32>::Hash64(s, m);
+
+    uint32_t lanes[8];
+    for (int i = 0; i < 8; i++) {
+        _mm256_storeu_si256((__m256i*)lanes, s[i]);
+        for (int j = 0; j < 8; j++)
+            WriteBE32(out + 32 * j + 4 * i, lanes[j]);
+    }
+}
+
+} // namespace
+
+/** SHA-256(Skein-512-512(header)) of eight 80-byte headers (in: 8 * 80 bytes, out: 8 * 32 bytes). */
+void Transform_8way(unsigned char* out, const unsigned char* in)
+{
+    unsigned char digests[8 * 64];
+    Skein512_8way(digests, in);
+    SHA256_8way(out, digests);
+}
+
+/** Same as Transform_8way, for eight headers whose first 64 bytes produced `mid`
+ *  (tails: their last 8 * 16 bytes). */
+void Transform_8way_Midstate(unsigned char* out, const uint64_t mid[8], const unsigned char* tails)
+{
+    unsigned char digests[8 * 64];
+    Skein512_8way_Midstate(digests, mid, tails);
+    SHA256_8way(out, digests);
+}
+
+} // namespace skein512_avx512
+
+#endif // ENABLE_AVX512F
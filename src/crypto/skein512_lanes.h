@@ -0,0 +1,146 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_SKEIN512_LANES_H
+#define BITCOIN_CRYPTO_SKEIN512_LANES_H
+
+// Internal header: Skein-512-512 of 80-byte messages, written once against an
+// abstract vector of independent 64-bit lanes. Each kernel instantiates it with
+// its own Ops type (plain uint64_t, AVX2, AVX-512) in a translation unit
+// compiled with the matching instruction set flags.
+//
+// Ops must provide:
+//   typedef ... V;
+//   static V Set1(uint64_t);
+//   static V Add(V, V);
+//   static V Xor(V, V);
+//   template<int R> static V Rotl(V);
+
+#include <stdint.h>
+
+namespace skein512_lanes
+{
+/** Skein-512-512 initial chaining value (output of the configuration UBI). */
+static const uint64_t IV512[8] = {
+    0x4903ADFF749C51CEULL, 0x0D95DE399746DF03ULL,
+    0x8FD1934127C79BCEULL, 0x9A255629FF352CB1ULL,
+    0x5DB62599DF6CA7B0ULL, 0xEABE394CA9D5C3F4ULL,
+    0x991112C71A75B523ULL, 0xAE18A40B660FCC33ULL
+};
+
+/** UBI tweak word 1 for the three blocks of an 80-byte message. */
+static const uint64_t T1_MSG_FIRST = 0x7000000000000000ULL;
+static const uint64_t T1_MSG_FINAL = 0xB000000000000000ULL;
+static const uint64_t T1_OUT_FINAL = 0xFF00000000000000ULL;
+
+template<typename Ops>
+struct Skein512
+{
+    typedef typename Ops::V V;
+
+    template<int R>
+    static inline void Mix(V& a, V& b)
+    {
+        a = Ops::Add(a, b);
+        b = Ops::Xor(Ops::template Rotl<R>(b), a);
+    }
+
+    /** Add subkey s. ks and ts are pre-extended so that no modular indexing is needed. */
+    static inline void InjectKey(V x[8], const V ks[26], const uint64_t ts[21], int s)
+    {
+        x[0] = Ops::Add(x[0], ks[s + 0]);
+        x[1] = Ops::Add(x[1], ks[s + 1]);
+        x[2] = Ops::Add(x[2], ks[s + 2]);
+        x[3] = Ops::Add(x[3], ks[s + 3]);
+        x[4] = Ops::Add(x[4], ks[s + 4]);
+        x[5] = Ops::Add(x[5], Ops::Add(ks[s + 5], Ops::Set1(ts[s])));
+        x[6] = Ops::Add(x[6], Ops::Add(ks[s + 6], Ops::Set1(ts[s + 1])));
+        x[7] = Ops::Add(x[7], Ops::Add(ks[s + 7], Ops::Set1((uint64_t)s)));
+    }
+
+    static inline void RoundsEven(V x[8])
+    {
+        Mix<46>(x[0], x[1]); Mix<36>(x[2], x[3]); Mix<19>(x[4], x[5]); Mix<37>(x[6], x[7]);
+        Mix<33>(x[2], x[1]); Mix<27>(x[4], x[7]); Mix<14>(x[6], x[5]); Mix<42>(x[0], x[3]);
+        Mix<17>(x[4], x[1]); Mix<49>(x[6], x[3]); Mix<36>(x[0], x[5]); Mix<39>(x[2], x[7]);
+        Mix<44>(x[6], x[1]); Mix< 9>(x[0], x[7]); Mix<54>(x[2], x[5]); Mix<56>(x[4], x[3]);
+    }
+
+    static inline void RoundsOdd(V x[8])
+    {
+        Mix<39>(x[0], x[1]); Mix<30>(x[2], x[3]); Mix<34>(x[4], x[5]); Mix<24>(x[6], x[7]);
+        Mix<13>(x[2], x[1]); Mix<50>(x[4], x[7]); Mix<10>(x[6], x[5]); Mix<17>(x[0], x[3]);
+        Mix<25>(x[4], x[1]); Mix<29>(x[6], x[3]); Mix<39>(x[0], x[5]); Mix<43>(x[2], x[7]);
+        Mix< 8>(x[6], x[1]); Mix<35>(x[0], x[7]); Mix<56>(x[2], x[5]); Mix<22>(x[4], x[3]);
+    }
+
+    /** One UBI step: h = Threefish-512(key h, tweak (t0, t1), m) ^ m. */
+    static inline void UBI(V h[8], const V m[8], uint64_t t0, uint64_t t1)
+    {
+        V ks[26];
+        uint64_t ts[21];
+        ks[8] = Ops::Set1(0x1BD11BDAA9FC1A22ULL);
+        for (int i = 0; i < 8; i++) {
+            ks[i] = h[i];
+            ks[8] = Ops::Xor(ks[8], h[i]);
+        }
+        for (int i = 9; i < 26; i++)
+            ks[i] = ks[i - 9];
+        ts[0] = t0;
+        ts[1] = t1;
+        ts[2] = t0 ^ t1;
+        for (int i = 3; i < 21; i++)
+            ts[i] = ts[i - 3];
+
+        V x[8];
+        for (int i = 0; i < 8; i++)
+            x[i] = m[i];
+        for (int s = 0; s < 18; s += 2) {
+            InjectKey(x, ks, ts, s);
+            RoundsEven(x);
+            InjectKey(x, ks, ts, s + 1);
+            RoundsOdd(x);
+        }
+        InjectKey(x, ks, ts, 18);
+        for (int i = 0; i < 8; i++)
+            h[i] = Ops::Xor(x[i], m[i]);
+    }
+
+    /** Absorb the first 64 bytes of an 80-byte message (words m[0..7]) into h.
+     *  The result only depends on those bytes, so messages that differ only in
+     *  their last 16 bytes can share it. */
+    static inline void Midstate(V h[8], const V m[8])
+    {
+        for (int i = 0; i < 8; i++)
+            h[i] = Ops::Set1(IV512[i]);
+        UBI(h, m, 64, T1_MSG_FIRST);
+    }
+
+    /** Complete an 80-byte message from its midstate and final two words. */
+    static inline void Finish(V h[8], V m8, V m9)
+    {
+        const V zero = Ops::Set1(0);
+        V block[8];
+        block[0] = m8;
+        block[1] = m9;
+        for (int i = 2; i < 8; i++)
+            block[i] = zero;
+        UBI(h, block, 80, T1_MSG_FINAL);
+
+        for (int i = 0; i < 8; i++)
+            block[i] = zero;
+        UBI(h, block, 8, T1_OUT_FINAL);
+    }
+
+    /** Skein-512-512 of one 80-byte message per lane.
+     *  m holds the ten little-endian message words, out receives the eight output words. */
+    static void Hash80(V out[8], const V m[10])
+    {
+        Midstate(out, m);
+        Finish(out, m[8], m[9]);
+    }
+};
+} // namespace skein512_lanes
+
+#endif // BITCOIN_CRYPTO_SKEIN512_LANES_H
@@ -0,0 +1,228 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CUCKOOCACHE_H
+#define BITCOIN_CUCKOOCACHE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <stdint.h>
+#include <vector>
+
+#include <boost/scoped_array.hpp>
+
+/**
+ * A fixed-size array of bit flags that can be set and cleared concurrently
+ * without locks. Flags start out set.
+ */
+class CBitPackedAtomicFlags
+{
+private:
+    boost::scoped_array<std::atomic<uint8_t> > mem;
+
+    CBitPackedAtomicFlags(const CBitPackedAtomicFlags&);
+    CBitPackedAtomicFlags& operator=(const CBitPackedAtomicFlags&);
+
+public:
+    explicit CBitPackedAtomicFlags(uint32_t nSize = 0)
+    {
+        Setup(nSize);
+    }
+
+    /** Reallocate for nSize flags, all set. Not thread safe. */
+    void Setup(uint32_t nSize)
+    {
+        nSize = (nSize + 7) / 8;
+        mem.reset(new std::atomic<uint8_t>[nSize]);
+        for (uint32_t i = 0; i < nSize; i++)
+            mem[i].store(0xFF);
+    }
+
+    void Set(uint32_t n) { mem[n >> 3].fetch_or(1 << (n & 7), std::memory_order_relaxed); }
+    void Unset(uint32_t n) { mem[n >> 3].fetch_and(~(1 << (n & 7)), std::memory_order_relaxed); }
+    bool IsSet(uint32_t n) const { return (1 << (n & 7)) & mem[n >> 3].load(std::memory_order_relaxed); }
+};
+
+/**
+ * A fixed-memory set of cache entries, stored in a single pre-allocated table
+ * with cuckoo hashing: every element has eight candidate slots, chosen by the
+ * eight hash functions Hash::operator()<0..7>.
+ *
+ * Instead of removing entries, slots are flagged as collectable (with one
+ * atomic bit per slot), and inserts reuse flagged slots first. This lets
+ * readers mark an entry for deletion while only holding shared access to the
+ * cache. When the table is full, inserts displace existing entries along a
+ * chain of at most log2(size) slots, dropping whatever is left at the end.
+ *
+ * Entries are also aged in generations: once more than 45% of the table was
+ * inserted in the current generation and not yet erased, every entry of the
+ * previous generation becomes collectable, so stale entries are evicted
+ * before recently added ones.
+ *
+ * Contains() may run concurrently with other calls to Contains(); Setup() and
+ * Insert() need exclusive access.
+ */
+template <typename Element, typename Hash>
+class CCuckooCache
+{
+private:
+    std::vector<Element> table;
+
+    //! Number of slots in table
+    uint32_t nSize;
+
+    //! Set for slots that may be overwritten
+    mutable CBitPackedAtomicFlags collectionFlags;
+
+    //! Set for slots written in the current generation
+    std::vector<bool> epochFlags;
+
+    //! Inserts left before the next check for a generation change
+    uint32_t nEpochCheckCountdown;
+
+    //! Live entries of the current generation that start a new one
+    uint32_t nEpochSize;
+
+    //! Maximum length of a displacement chain in Insert
+    uint8_t nDepthLimit;
+
+    const Hash hashFunction;
+
+    CCuckooCache(const CCuckooCache&);
+    CCuckooCache& operator=(const CCuckooCache&);
+
+    /** Map a 32-bit hash onto [0, nSize) without a division. */
+    uint32_t Reduce(uint32_t h) const
+    {
+        return (uint32_t)(((uint64_t)h * (uint64_t)nSize) >> 32);
+    }
+
+    void ComputeSlots(const Element& e, uint32_t slots[8]) const
+    {
+        slots[0] = Reduce(hashFunction.template operator()<0>(e));
+        slots[1] = Reduce(hashFunction.template operator()<1>(e));
+        slots[2] = Reduce(hashFunction.template operator()<2>(e));
+        slots[3] = Reduce(hashFunction.template operator()<3>(e));
+        slots[4] = Reduce(hashFunction.template operator()<4>(e));
+        slots[5] = Reduce(hashFunction.template operator()<5>(e));
+        slots[6] = Reduce(hashFunction.template operator()<6>(e));
+        slots[7] = Reduce(hashFunction.template operator()<7>(e));
+    }
+
+    /** Start a new generation if the current one has grown large enough. */
+    void EpochCheck()
+    {
+        if (nEpochCheckCountdown != 0) {
+            --nEpochCheckCountdown;
+            return;
+        }
+        uint32_t nLive = 0;
+        for (uint32_t i = 0; i < nSize; i++)
+            nLive += epochFlags[i] && !collectionFlags.IsSet(i);
+        if (nLive >= nEpochSize) {
+            // Entries of the previous generation become collectable, the
+            // current generation becomes the previous one.
+            for (uint32_t i = 0; i < nSize; i++) {
+                if (epochFlags[i])
+                    epochFlags[i] = false;
+                else
+                    collectionFlags.Set(i);
+            }
+            nEpochCheckCountdown = nEpochSize;
+        } else {
+            // Check again once a run of inserts without any erases could have
+            // filled the generation, but not too often.
+            nEpochCheckCountdown = std::max(1U, std::max(nEpochSize / 16, nEpochSize - nLive));
+        }
+    }
+
+public:
+    CCuckooCache() : nSize(0), nEpochCheckCountdown(0), nEpochSize(0), nDepthLimit(0), hashFunction()
+    {
+        Setup(2);
+    }
+
+    /** Resize the table to nNewSize (at least 2) empty slots. Returns the new size. */
+    uint32_t Setup(uint32_t nNewSize)
+    {
+        nSize = std::max<uint32_t>(2, nNewSize);
+        nDepthLimit = static_cast<uint8_t>(std::log2(static_cast<float>(nSize)));
+        table.assign(nSize, Element());
+        collectionFlags.Setup(nSize);
+        epochFlags.assign(nSize, false);
+        nEpochSize = std::max<uint32_t>(1, (45 * (uint64_t)nSize) / 100);
+        nEpochCheckCountdown = nEpochSize;
+        return nSize;
+    }
+
+    /** Resize the table to use at most nBytes of memory for its entries and their
+     *  two flag bits each. Returns the number of slots. */
+    uint32_t SetupBytes(size_t nBytes)
+    {
+        const uint64_t nSlots = (uint64_t)nBytes * 8 / (8 * sizeof(Element) + 2);
+        return Setup(std::min<uint64_t>(nSlots, std::numeric_limits<uint32_t>::max()));
+    }
+
+    /** Add e, possibly evicting another entry. */
+    void Insert(Element e)
+    {
+        EpochCheck();
+        uint32_t slots[8];
+        ComputeSlots(e, slots);
+
+        // Already present: just keep it
+        for (int i = 0; i < 8; i++) {
+            if (table[slots[i]] == e) {
+                collectionFlags.Unset(slots[i]);
+                epochFlags[slots[i]] = true;
+                return;
+            }
+        }
+
+        int nLast = 7;
+        bool fEpoch = true;
+        for (uint8_t nDepth = 0; nDepth < nDepthLimit; nDepth++) {
+            // Use a collectable slot, if there is one
+            for (int i = 0; i < 8; i++) {
+                if (collectionFlags.IsSet(slots[i])) {
+                    table[slots[i]] = e;
+                    collectionFlags.Unset(slots[i]);
+                    epochFlags[slots[i]] = fEpoch;
+                    return;
+                }
+            }
+            // Otherwise displace the entry in the slot after the one we came
+            // from, and find a new home for that one instead.
+            const uint32_t nSlot = slots[(nLast + 1) & 7];
+            std::swap(table[nSlot], e);
+            const bool fEpochDisplaced = epochFlags[nSlot];
+            epochFlags[nSlot] = fEpoch;
+            fEpoch = fEpochDisplaced;
+
+            ComputeSlots(e, slots);
+            nLast = std::find(slots, slots + 8, nSlot) - slots;
+        }
+        // The last displaced entry is dropped.
+    }
+
+    /** Whether e is in the cache. If fErase, its slot is flagged to be reused
+     *  (the entry stays visible until it is actually overwritten). */
+    bool Contains(const Element& e, bool fErase) const
+    {
+        uint32_t slots[8];
+        ComputeSlots(e, slots);
+        for (int i = 0; i < 8; i++) {
+            if (table[slots[i]] == e) {
+                if (fErase)
+                    collectionFlags.Set(slots[i]);
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+#endif // BITCOIN_CUCKOOCACHE_H
@@ -15,14 +15,16 @@
 #include <memenv.h>
 #include <stdint.h>
 
-static leveldb::Options GetOptions(size_t nCacheSize)
+static leveldb::Options GetOptions(size_t nCacheSize, const CDBOptions& dboptions)
 {
     leveldb::Options options;
     options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
-    options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
-    options.compression = leveldb::kNoCompression;
-    options.max_open_files = 64;
+    // up to two write buffers may be held in memory simultaneously
+    options.write_buffer_size = dboptions.nWriteBufferSize ? dboptions.nWriteBufferSize : nCacheSize / 4;
+    options.filter_policy = dboptions.nBloomBits > 0 ? leveldb::NewBloomFilterPolicy(dboptions.nBloomBits) : NULL;
+    options.compression = dboptions.fCompression ? leveldb::kSnappyCompression : leveldb::kNoCompression;
+    options.max_open_files = dboptions.nMaxOpenFiles;
+    options.block_size = dboptions.nBlockSize;
     if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
         // LevelDB versions before 1.16 consider short writes to be corruption. Only trigger error
         // on corruption in later versions.
@@ -31,14 +33,15 @@ static leveldb::Options GetOptions(size_t nCacheSize)
     return options;
 }
 
-CDBWrapper::CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe, bool obfuscate)
+CDBWrapper::CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe, bool obfuscate, const CDBOptions& dboptionsIn)
+    : dboptions(dboptionsIn)
 {
     penv = NULL;
     readoptions.verify_checksums = true;
     iteroptions.verify_checksums = true;
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
+    options = GetOptions(nCacheSize, dboptions);
     options.create_if_missing = true;
     if (fMemory) {
         penv = leveldb::NewMemEnv(leveldb::Env::Default());
@@ -51,6 +54,8 @@ CDBWrapper::CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, b
         }
         TryCreateDirectory(path);
         LogPrintf("Opening LevelDB in %s\n", path.string());
+        LogPrintf("LevelDB options: compression=%d maxopenfiles=%d bloombits=%d blocksize=%u writebuffer=%u\n",
+            dboptions.fCompression, dboptions.nMaxOpenFiles, dboptions.nBloomBits, dboptions.nBlockSize, options.write_buffer_size);
     }
     leveldb::Status status = leveldb::DB::Open(options, path.string(), &pdb);
     dbwrapper_private::HandleError(status);
@@ -122,11 +127,73 @@ bool CDBWrapper::IsEmpty()
     return !(it->Valid());
 }
 
+std::string CDBWrapper::GetProperty(const std::string& strName) const
+{
+    std::string strValue;
+    if (!pdb->GetProperty(strName, &strValue))
+        return "";
+    return strValue;
+}
+
+CDBSnapshot::CDBSnapshot(const CDBWrapper &parentIn) : parent(parentIn), psnapshot(parent.pdb->GetSnapshot()) {}
+CDBSnapshot::~CDBSnapshot() { parent.pdb->ReleaseSnapshot(psnapshot); }
+
 CDBIterator::~CDBIterator() { delete piter; }
 bool CDBIterator::Valid() { return piter->Valid(); }
 void CDBIterator::SeekToFirst() { piter->SeekToFirst(); }
 void CDBIterator::Next() { piter->Next(); }
 
+bool ParseDBOptions(const std::vector<std::string>& vSettings, std::map<std::string, CDBOptions>& mapOptions, std::string& strError)
+{
+    for (std::vector<std::string>::const_iterator it = vSettings.begin(); it != vSettings.end(); ++it) {
+        const std::string& strSetting = *it;
+        size_t nDot = strSetting.find('.');
+        size_t nEquals = strSetting.find('=');
+        if (nDot == std::string::npos || nEquals == std::string::npos || nEquals < nDot) {
+            strError = strprintf("Invalid database option '%s', expected <db>.<option>=<value>", strSetting);
+            return false;
+        }
+        std::string strDB = strSetting.substr(0, nDot);
+        std::string strOption = strSetting.substr(nDot + 1, nEquals - nDot - 1);
+        int64_t nValue;
+        if (!ParseInt64(strSetting.substr(nEquals + 1), &nValue)) {
+            strError = strprintf("Invalid value in database option '%s'", strSetting);
+            return false;
+        }
+        std::map<std::string, CDBOptions>::iterator itDB = mapOptions.find(strDB);
+        if (itDB == mapOptions.end()) {
+            strError = strprintf("Unknown database '%s' in database option '%s'", strDB, strSetting);
+            return false;
+        }
+        CDBOptions& dboptions = itDB->second;
+        bool fInRange;
+        if (strOption == "compression") {
+            fInRange = nValue == 0 || nValue == 1;
+            dboptions.fCompression = nValue;
+        } else if (strOption == "maxopenfiles") {
+            fInRange = nValue > 0 && nValue <= 50000;
+            dboptions.nMaxOpenFiles = nValue;
+        } else if (strOption == "bloombits") {
+            fInRange = nValue >= 0 && nValue <= 64;
+            dboptions.nBloomBits = nValue;
+        } else if (strOption == "blocksize") {
+            fInRange = nValue >= 1024 && nValue <= (4 << 20);
+            dboptions.nBlockSize = nValue;
+        } else if (strOption == "writebuffer") {
+            fInRange = nValue == 0 || (nValue >= (64 << 10) && nValue <= (1 << 30));
+            dboptions.nWriteBufferSize = nValue;
+        } else {
+            strError = strprintf("Unknown option '%s' in database option '%s'", strOption, strSetting);
+            return false;
+        }
+        if (!fInRange) {
+            strError = strprintf("Value out of range in database option '%s'", strSetting);
+            return false;
+        }
+    }
+    return true;
+}
+
 namespace dbwrapper_private {
 
 void HandleError(const leveldb::Status& status)
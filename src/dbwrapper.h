@@ -12,6 +12,10 @@
 #include "utilstrencodings.h"
 #include "version.h"
 
+#include <map>
+#include <string>
+#include <vector>
+
 #include <boost/filesystem/path.hpp>
 
 #include <leveldb/db.h>
@@ -25,6 +29,30 @@ public:
 
 class CDBWrapper;
 
+/** Tunable LevelDB settings of a database */
+struct CDBOptions
+{
+    //! Compress table blocks with Snappy (only effective if LevelDB was built with it)
+    bool fCompression;
+    //! Number of table files LevelDB may keep open
+    int nMaxOpenFiles;
+    //! Bloom filter bits per key, 0 for no filter
+    int nBloomBits;
+    //! Approximate size of a table block before compression, in bytes
+    size_t nBlockSize;
+    //! Size of a memtable in bytes, 0 for a quarter of the cache size
+    size_t nWriteBufferSize;
+
+    CDBOptions() : fCompression(false), nMaxOpenFiles(64), nBloomBits(10), nBlockSize(4096), nWriteBufferSize(0) {}
+};
+
+/**
+ * Apply settings of the form <db>.<option>=<value> (as given to -dboption) to
+ * the databases named in mapOptions. Returns false and sets strError if one
+ * is malformed, or names an unknown database or option.
+ */
+bool ParseDBOptions(const std::vector<std::string>& vSettings, std::map<std::string, CDBOptions>& mapOptions, std::string& strError);
+
 /** These should be considered an implementation detail of the specific database.
  */
 namespace dbwrapper_private {
@@ -50,11 +78,19 @@ private:
     const CDBWrapper &parent;
     leveldb::WriteBatch batch;
 
+    size_t size_estimate;
+
 public:
     /**
      * @param[in] parent    CDBWrapper that this batch is to be submitted to
      */
-    CDBBatch(const CDBWrapper &parent) : parent(parent) { };
+    CDBBatch(const CDBWrapper &parent) : parent(parent), size_estimate(0) { };
+
+    void Clear()
+    {
+        batch.Clear();
+        size_estimate = 0;
+    }
 
     template <typename K, typename V>
     void Write(const K& key, const V& value)
@@ -71,6 +107,14 @@ public:
         leveldb::Slice slValue(&ssValue[0], ssValue.size());
 
         batch.Put(slKey, slValue);
+        // LevelDB serializes writes as:
+        // - byte: header
+        // - varint: key length (1 byte up to 127B, 2 bytes up to 16383B, ...)
+        // - byte[]: key
+        // - varint: value length
+        // - byte[]: value
+        // The formula below assumes the key and value are both less than 16k.
+        size_estimate += 3 + (slKey.size() > 127) + slKey.size() + (slValue.size() > 127) + slValue.size();
     }
 
     template <typename K>
@@ -82,7 +126,15 @@ public:
         leveldb::Slice slKey(&ssKey[0], ssKey.size());
 
         batch.Delete(slKey);
+        // LevelDB serializes erases as:
+        // - byte: header
+        // - varint: key length
+        // - byte[]: key
+        // The formula below assumes the key is less than 16kB.
+        size_estimate += 2 + (slKey.size() > 127) + slKey.size();
     }
+
+    size_t SizeEstimate() const { return size_estimate; }
 };
 
 class CDBIterator
@@ -148,9 +200,31 @@ public:
 
 };
 
+/**
+ * Consistent view of a CDBWrapper as it was when the snapshot was taken, for
+ * reads and iterators that must not see later writes. It must not outlive the
+ * database, nor be outlived by iterators using it.
+ */
+class CDBSnapshot
+{
+    friend class CDBWrapper;
+
+private:
+    const CDBWrapper &parent;
+    const leveldb::Snapshot *psnapshot;
+
+    CDBSnapshot(const CDBSnapshot&);
+    CDBSnapshot& operator=(const CDBSnapshot&);
+
+public:
+    CDBSnapshot(const CDBWrapper &parent);
+    ~CDBSnapshot();
+};
+
 class CDBWrapper
 {
     friend const std::vector<unsigned char>& dbwrapper_private::GetObfuscateKey(const CDBWrapper &w);
+    friend class CDBSnapshot;
 private:
     //! custom environment this database is using (may be NULL in case of default environment)
     leveldb::Env* penv;
@@ -158,6 +232,9 @@ private:
     //! database options used
     leveldb::Options options;
 
+    //! the tunable part of options, as requested
+    CDBOptions dboptions;
+
     //! options used when reading from the database
     leveldb::ReadOptions readoptions;
 
@@ -184,20 +261,8 @@ private:
 
     std::vector<unsigned char> CreateObfuscateKey() const;
 
-public:
-    /**
-     * @param[in] path        Location in the filesystem where leveldb data will be stored.
-     * @param[in] nCacheSize  Configures various leveldb cache settings.
-     * @param[in] fMemory     If true, use leveldb's memory environment.
-     * @param[in] fWipe       If true, remove all existing data.
-     * @param[in] obfuscate   If true, store data obfuscated via simple XOR. If false, XOR
-     *                        with a zero'd byte array.
-     */
-    CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, bool obfuscate = false);
-    ~CDBWrapper();
-
     template <typename K, typename V>
-    bool Read(const K& key, V& value) const
+    bool ReadWithOptions(const leveldb::ReadOptions& options, const K& key, V& value) const
     {
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(ssKey.GetSerializeSize(key));
@@ -205,7 +270,7 @@ public:
         leveldb::Slice slKey(&ssKey[0], ssKey.size());
 
         std::string strValue;
-        leveldb::Status status = pdb->Get(readoptions, slKey, &strValue);
+        leveldb::Status status = pdb->Get(options, slKey, &strValue);
         if (!status.ok()) {
             if (status.IsNotFound())
                 return false;
@@ -222,6 +287,34 @@ public:
         return true;
     }
 
+public:
+    /**
+     * @param[in] path        Location in the filesystem where leveldb data will be stored.
+     * @param[in] nCacheSize  Configures various leveldb cache settings.
+     * @param[in] fMemory     If true, use leveldb's memory environment.
+     * @param[in] fWipe       If true, remove all existing data.
+     * @param[in] obfuscate   If true, store data obfuscated via simple XOR. If false, XOR
+     *                        with a zero'd byte array.
+     * @param[in] dboptionsIn LevelDB tuning.
+     */
+    CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, bool obfuscate = false, const CDBOptions& dboptionsIn = CDBOptions());
+    ~CDBWrapper();
+
+    template <typename K, typename V>
+    bool Read(const K& key, V& value) const
+    {
+        return ReadWithOptions(readoptions, key, value);
+    }
+
+    //! Read key as it was when snapshot was taken
+    template <typename K, typename V>
+    bool Read(const K& key, V& value, const CDBSnapshot& snapshot) const
+    {
+        leveldb::ReadOptions options = readoptions;
+        options.snapshot = snapshot.psnapshot;
+        return ReadWithOptions(options, key, value);
+    }
+
     template <typename K, typename V>
     bool Write(const K& key, const V& value, bool fSync = false)
     {
@@ -276,10 +369,63 @@ public:
         return new CDBIterator(*this, pdb->NewIterator(iteroptions));
     }
 
+    //! Iterator over the database as it was when snapshot was taken
+    CDBIterator *NewIterator(const CDBSnapshot& snapshot) const
+    {
+        leveldb::ReadOptions options = iteroptions;
+        options.snapshot = snapshot.psnapshot;
+        return new CDBIterator(*this, pdb->NewIterator(options));
+    }
+
     /**
      * Return true if the database managed by this class contains no entries.
      */
     bool IsEmpty();
+
+    /**
+     * Compact the range of keys from key_begin to key_end, inclusive.
+     */
+    template<typename K>
+    void CompactRange(const K& key_begin, const K& key_end) const
+    {
+        CDataStream ssKey1(SER_DISK, CLIENT_VERSION), ssKey2(SER_DISK, CLIENT_VERSION);
+        ssKey1.reserve(ssKey1.GetSerializeSize(key_begin));
+        ssKey2.reserve(ssKey2.GetSerializeSize(key_end));
+        ssKey1 << key_begin;
+        ssKey2 << key_end;
+        leveldb::Slice slKey1(&ssKey1[0], ssKey1.size());
+        leveldb::Slice slKey2(&ssKey2[0], ssKey2.size());
+        pdb->CompactRange(&slKey1, &slKey2);
+    }
+
+    /**
+     * Return LevelDB's estimate of the disk space used by the keys from
+     * key_begin up to (excluding) key_end. Recent writes may not be counted.
+     */
+    template<typename K1, typename K2>
+    uint64_t EstimateSize(const K1& key_begin, const K2& key_end) const
+    {
+        CDataStream ssKey1(SER_DISK, CLIENT_VERSION), ssKey2(SER_DISK, CLIENT_VERSION);
+        ssKey1.reserve(ssKey1.GetSerializeSize(key_begin));
+        ssKey2.reserve(ssKey2.GetSerializeSize(key_end));
+        ssKey1 << key_begin;
+        ssKey2 << key_end;
+        leveldb::Range range(leveldb::Slice(&ssKey1[0], ssKey1.size()), leveldb::Slice(&ssKey2[0], ssKey2.size()));
+        uint64_t nSize = 0;
+        pdb->GetApproximateSizes(&range, 1, &nSize);
+        return nSize;
+    }
+
+    /**
+     * Return the value of a LevelDB property, like "leveldb.stats", or an
+     * empty string if there is no such property.
+     */
+    std::string GetProperty(const std::string& strName) const;
+
+    const CDBOptions& GetDBOptions() const { return dboptions; }
+
+    //! Effective memtable size, in bytes
+    size_t GetWriteBufferSize() const { return options.write_buffer_size; }
 };
 
 #endif // BITCOIN_DBWRAPPER_H
@@ -7,6 +7,7 @@
 #include "base58.h"
 #include "chainparams.h"
 #include "httpserver.h"
+#include "rpc/jsonwriter.h"
 #include "rpc/protocol.h"
 #include "rpc/server.h"
 #include "random.h"
@@ -19,10 +20,13 @@
 #include "utilstrencodings.h"
 
 #include <boost/algorithm/string.hpp> // boost::trim
+#include <boost/bind.hpp>
 #include <boost/foreach.hpp> //BOOST_FOREACH
 
 /** WWW-Authenticate to present with 401 Unauthorized response */
 static const char* WWW_AUTH_HEADER_DATA = "Basic realm=\"jsonrpc\"";
+/** How much of a request body is searched for the method, to pick its lane */
+static const size_t JSONRPC_PEEK_SIZE = 1024;
 
 /** Simple one-shot callback timer to be used by the RPC mechanism to e.g.
  * re-lock the wellet.
@@ -83,6 +87,44 @@ static void JSONErrorReply(HTTPRequest* req, const UniValue& objError, const Uni
     req->WriteReply(nStatus, strReply);
 }
 
+/** Sink for a CJSONWriter that sends its output as a chunked JSON reply */
+static void JSONReplyChunk(HTTPRequest* req, const std::string& strChunk)
+{
+    if (!req->ReplyStarted())
+        req->WriteHeader("Content-Type", "application/json");
+    req->WriteReplyChunk(HTTP_OK, strChunk);
+}
+
+/** Reply to a single request for a method with a streaming form, which
+ * writes the result into the reply as it goes instead of building it in
+ * memory first. Returns false if the method has no such form. */
+static bool JSONRPCStreamReply(HTTPRequest* req, const JSONRequest& jreq)
+{
+    CJSONWriter writer(boost::bind(JSONReplyChunk, req, _1));
+    writer.BeginObject();
+    writer.Key("result");
+    try {
+        if (!tableRPC.executeStream(jreq.strMethod, jreq.params, writer))
+            return false;
+    } catch (...) {
+        if (!req->ReplyStarted())
+            throw;
+        // Too late for an error reply, drop the connection
+        LogPrintf("%s: %s failed after part of its reply was sent\n", __func__, jreq.strMethod);
+        req->AbortReply();
+        return true;
+    }
+    writer.Pair("error", NullUniValue);
+    writer.Pair("id", jreq.id);
+    writer.EndObject();
+    writer.Raw("\n");
+
+    if (!req->ReplyStarted())
+        req->WriteHeader("Content-Type", "application/json");
+    req->EndReply(HTTP_OK, writer.GetBuffer());
+    return true;
+}
+
 //This function checks username and password against -rpcauth
 //entries from config file.
 static bool multiUserAuthorized(std::string strUserPass)
@@ -184,6 +226,9 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
         if (valRequest.isObject()) {
             jreq.parse(valRequest);
 
+            if (JSONRPCStreamReply(req, jreq))
+                return true;
+
             UniValue result = tableRPC.execute(jreq.strMethod, jreq.params);
 
             // Send reply
@@ -191,7 +236,7 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
 
         // array of requests
         } else if (valRequest.isArray())
-            strReply = JSONRPCExecBatch(valRequest.get_array());
+            strReply = JSONRPCExecBatch(valRequest.get_array(), HTTPRunOnIdleWorker);
         else
             throw JSONRPCError(RPC_PARSE_ERROR, "Top-level object parse error");
 
@@ -207,6 +252,26 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
     return true;
 }
 
+/** Send calls in the mining category to their own lane, so that pool servers
+ * get block templates and submit blocks while other calls pile up. Only the
+ * start of the request is looked at; batches stay in the RPC lane. Long-poll
+ * getblocktemplate calls stay there too: they wait for the next block or
+ * mempool change, and would hold a mining worker all that time.
+ */
+static HTTPLane JSONRPCSelectLane(HTTPRequest* req)
+{
+    std::string strBody = req->PeekBody(JSONRPC_PEEK_SIZE);
+    std::string strMethod = JSONRPCPeekMethod(strBody);
+    if (strMethod.empty())
+        return HTTP_LANE_RPC;
+    const CRPCCommand* pcmd = tableRPC[strMethod];
+    if (!pcmd || pcmd->category != "mining")
+        return HTTP_LANE_RPC;
+    if (strMethod == "getblocktemplate" && strBody.find("\"longpollid\"") != std::string::npos)
+        return HTTP_LANE_RPC;
+    return HTTP_LANE_MINING;
+}
+
 static bool InitRPCAuthentication()
 {
     if (mapArgs["-rpcpassword"] == "")
@@ -231,7 +296,7 @@ bool StartHTTPRPC()
     if (!InitRPCAuthentication())
         return false;
 
-    RegisterHTTPHandler("/", true, HTTPReq_JSONRPC);
+    RegisterHTTPHandler("/", true, HTTPReq_JSONRPC, HTTP_LANE_RPC, JSONRPCSelectLane);
 
     assert(EventBase());
     httpRPCTimerInterface = new HTTPRPCTimerInterface(EventBase());
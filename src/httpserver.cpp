@@ -70,10 +70,18 @@ private:
     /** Mutex protects entire object */
     CWaitableCriticalSection cs;
     CConditionVariable cond;
-    std::deque<std::unique_ptr<WorkItem>> queue;
+    /** Work items and the time they were queued */
+    std::deque<std::pair<std::unique_ptr<WorkItem>, int64_t> > queue;
     bool running;
     size_t maxDepth;
     int numThreads;
+    /** Number of worker threads waiting for work */
+    size_t numIdle;
+    /** Statistics, see HTTPLaneStats */
+    uint64_t numTaken;
+    uint64_t numRejected;
+    int64_t waitTime;
+    int64_t maxWaitTime;
 
     /** RAII object to keep track of number of running worker threads */
     class ThreadCounter
@@ -96,7 +104,12 @@ private:
 public:
     WorkQueue(size_t maxDepth) : running(true),
                                  maxDepth(maxDepth),
-                                 numThreads(0)
+                                 numThreads(0),
+                                 numIdle(0),
+                                 numTaken(0),
+                                 numRejected(0),
+                                 waitTime(0),
+                                 maxWaitTime(0)
     {
     }
     /** Precondition: worker threads have all stopped
@@ -110,9 +123,21 @@ public:
     {
         boost::unique_lock<boost::mutex> lock(cs);
         if (queue.size() >= maxDepth) {
+            numRejected++;
             return false;
         }
-        queue.emplace_back(std::unique_ptr<WorkItem>(item));
+        queue.emplace_back(std::unique_ptr<WorkItem>(item), GetTimeMicros());
+        cond.notify_one();
+        return true;
+    }
+    /** Enqueue a work item only if an idle worker thread can pick it up right away */
+    bool EnqueueIfIdle(WorkItem* item)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (queue.size() >= numIdle || queue.size() >= maxDepth) {
+            return false;
+        }
+        queue.emplace_back(std::unique_ptr<WorkItem>(item), GetTimeMicros());
         cond.notify_one();
         return true;
     }
@@ -124,12 +149,18 @@ public:
             std::unique_ptr<WorkItem> i;
             {
                 boost::unique_lock<boost::mutex> lock(cs);
+                numIdle++;
                 while (running && queue.empty())
                     cond.wait(lock);
+                numIdle--;
                 if (!running)
                     break;
-                i = std::move(queue.front());
+                i = std::move(queue.front().first);
+                int64_t waited = GetTimeMicros() - queue.front().second;
                 queue.pop_front();
+                numTaken++;
+                waitTime += waited;
+                maxWaitTime = std::max(maxWaitTime, waited);
             }
             (*i)();
         }
@@ -155,18 +186,61 @@ public:
         boost::unique_lock<boost::mutex> lock(cs);
         return queue.size();
     }
+
+    void GetStats(HTTPLaneStats& stats)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        stats.nThreads = numThreads;
+        stats.nBusy = numThreads - (int)numIdle;
+        stats.nDepth = queue.size();
+        stats.nMaxDepth = maxDepth;
+        stats.nRequests = numTaken;
+        stats.nRejected = numRejected;
+        stats.nWaitTime = waitTime;
+        stats.nMaxWaitTime = maxWaitTime;
+    }
+};
+
+/** Work item that runs a function on a worker thread */
+class HTTPFunctionItem : public HTTPClosure
+{
+public:
+    HTTPFunctionItem(const boost::function<void ()>& func): func(func)
+    {
+    }
+    void operator()()
+    {
+        func();
+    }
+
+private:
+    boost::function<void ()> func;
 };
 
 struct HTTPPathHandler
 {
     HTTPPathHandler() {}
-    HTTPPathHandler(std::string prefix, bool exactMatch, HTTPRequestHandler handler):
-        prefix(prefix), exactMatch(exactMatch), handler(handler)
+    HTTPPathHandler(std::string prefix, bool exactMatch, HTTPRequestHandler handler, HTTPLane lane, HTTPLaneSelector selectLane):
+        prefix(prefix), exactMatch(exactMatch), handler(handler), lane(lane), selectLane(selectLane)
     {
     }
     std::string prefix;
     bool exactMatch;
     HTTPRequestHandler handler;
+    HTTPLane lane;
+    HTTPLaneSelector selectLane;
+};
+
+/** Names and settings of the lanes, in HTTPLane order */
+static const struct {
+    const char* name;
+    const char* threadsArg;
+    int defaultThreads;
+    const char* depthArg;
+} httpLanes[HTTP_LANE_COUNT] = {
+    {"rpc", "-rpcthreads", DEFAULT_HTTP_THREADS, "-rpcworkqueue"},
+    {"mining", "-rpcminingthreads", DEFAULT_HTTP_MINING_THREADS, "-rpcminingworkqueue"},
+    {"rest", "-restthreads", DEFAULT_HTTP_REST_THREADS, "-restworkqueue"},
 };
 
 /** HTTP module state */
@@ -177,8 +251,11 @@ static struct event_base* eventBase = 0;
 struct evhttp* eventHTTP = 0;
 //! List of subnets to allow RPC connections from
 static std::vector<CSubNet> rpc_allow_subnets;
-//! Work queue for handling longer requests off the event loop thread
-static WorkQueue<HTTPClosure>* workQueue = 0;
+//! Work queues for handling longer requests off the event loop thread, one
+//! per lane, NULL for the lanes without threads
+static WorkQueue<HTTPClosure>* workQueues[HTTP_LANE_COUNT] = {0};
+//! Number of worker threads to start for each lane
+static int workThreads[HTTP_LANE_COUNT] = {0};
 //! Handlers for (sub)paths
 std::vector<HTTPPathHandler> pathHandlers;
 //! Bound listening sockets
@@ -279,14 +356,18 @@ static void http_request_cb(struct evhttp_request* req, void* arg)
         }
     }
 
-    // Dispatch to worker thread
+    // Dispatch to worker thread of the lane
     if (i != iend) {
+        HTTPLane lane = i->selectLane ? i->selectLane(hreq.get()) : i->lane;
+        if (!workQueues[lane])
+            lane = HTTP_LANE_RPC;
         std::unique_ptr<HTTPWorkItem> item(new HTTPWorkItem(std::move(hreq), path, i->handler));
-        assert(workQueue);
-        if (workQueue->Enqueue(item.get()))
+        assert(workQueues[lane]);
+        if (workQueues[lane]->Enqueue(item.get()))
             item.release(); /* if true, queue took ownership */
         else {
-            LogPrintf("WARNING: request rejected because http work queue depth exceeded, it can be increased with the -rpcworkqueue= setting\n");
+            LogPrintf("WARNING: request rejected because http %s work queue depth exceeded, it can be increased with the %s= setting\n",
+                      httpLanes[lane].name, httpLanes[lane].depthArg);
             item->req->WriteReply(HTTP_INTERNAL, "Work queue depth exceeded");
         }
     } else {
@@ -428,10 +509,16 @@ bool InitHTTPServer()
     }
 
     LogPrint("http", "Initialized HTTP server\n");
-    int workQueueDepth = std::max((long)GetArg("-rpcworkqueue", DEFAULT_HTTP_WORKQUEUE), 1L);
-    LogPrintf("HTTP: creating work queue of depth %d\n", workQueueDepth);
-
-    workQueue = new WorkQueue<HTTPClosure>(workQueueDepth);
+    for (int lane = 0; lane < HTTP_LANE_COUNT; lane++) {
+        // The other lanes can be switched off, which leaves their requests to the RPC lane
+        long minThreads = lane == HTTP_LANE_RPC ? 1 : 0;
+        workThreads[lane] = std::max((long)GetArg(httpLanes[lane].threadsArg, httpLanes[lane].defaultThreads), minThreads);
+        if (workThreads[lane] == 0)
+            continue;
+        int workQueueDepth = std::max((long)GetArg(httpLanes[lane].depthArg, DEFAULT_HTTP_WORKQUEUE), 1L);
+        LogPrintf("HTTP: creating %s work queue of depth %d\n", httpLanes[lane].name, workQueueDepth);
+        workQueues[lane] = new WorkQueue<HTTPClosure>(workQueueDepth);
+    }
     eventBase = base;
     eventHTTP = http;
     return true;
@@ -442,12 +529,15 @@ boost::thread threadHTTP;
 bool StartHTTPServer()
 {
     LogPrint("http", "Starting HTTP server\n");
-    int rpcThreads = std::max((long)GetArg("-rpcthreads", DEFAULT_HTTP_THREADS), 1L);
-    LogPrintf("HTTP: starting %d worker threads\n", rpcThreads);
     threadHTTP = boost::thread(boost::bind(&ThreadHTTP, eventBase, eventHTTP));
 
-    for (int i = 0; i < rpcThreads; i++)
-        boost::thread(boost::bind(&HTTPWorkQueueRun, workQueue));
+    for (int lane = 0; lane < HTTP_LANE_COUNT; lane++) {
+        if (!workQueues[lane])
+            continue;
+        LogPrintf("HTTP: starting %d %s worker threads\n", workThreads[lane], httpLanes[lane].name);
+        for (int i = 0; i < workThreads[lane]; i++)
+            boost::thread(boost::bind(&HTTPWorkQueueRun, workQueues[lane]));
+    }
     return true;
 }
 
@@ -459,20 +549,25 @@ void InterruptHTTPServer()
         BOOST_FOREACH (evhttp_bound_socket *socket, boundSockets) {
             evhttp_del_accept_socket(eventHTTP, socket);
         }
+        boundSockets.clear();
         // Reject requests on current connections
         evhttp_set_gencb(eventHTTP, http_reject_request_cb, NULL);
     }
-    if (workQueue)
-        workQueue->Interrupt();
+    for (int lane = 0; lane < HTTP_LANE_COUNT; lane++)
+        if (workQueues[lane])
+            workQueues[lane]->Interrupt();
 }
 
 void StopHTTPServer()
 {
     LogPrint("http", "Stopping HTTP server\n");
-    if (workQueue) {
-        LogPrint("http", "Waiting for HTTP worker threads to exit\n");
-        workQueue->WaitExit();
-        delete workQueue;
+    LogPrint("http", "Waiting for HTTP worker threads to exit\n");
+    for (int lane = 0; lane < HTTP_LANE_COUNT; lane++) {
+        if (workQueues[lane]) {
+            workQueues[lane]->WaitExit();
+            delete workQueues[lane];
+            workQueues[lane] = 0;
+        }
     }
     if (eventBase) {
         LogPrint("http", "Waiting for HTTP event thread to exit\n");
@@ -535,12 +630,17 @@ void HTTPEvent::trigger(struct timeval* tv)
         evtimer_add(ev, tv); // trigger after timeval passed
 }
 HTTPRequest::HTTPRequest(struct evhttp_request* req) : req(req),
-                                                       replySent(false)
+                                                       replySent(false),
+                                                       replyStarted(false)
 {
 }
 HTTPRequest::~HTTPRequest()
 {
-    if (!replySent) {
+    if (replyStarted && !replySent) {
+        // A chunked reply cannot be replaced by an error any more
+        LogPrintf("%s: Unfinished reply\n", __func__);
+        AbortReply();
+    } else if (!replySent) {
         // Keep track of whether reply was sent to avoid request leaks
         LogPrintf("%s: Unhandled request\n", __func__);
         WriteReply(HTTP_INTERNAL, "Unhandled request");
@@ -559,6 +659,19 @@ std::pair<bool, std::string> HTTPRequest::GetHeader(const std::string& hdr)
         return std::make_pair(false, "");
 }
 
+std::string HTTPRequest::PeekBody(size_t nMaxSize)
+{
+    struct evbuffer* buf = evhttp_request_get_input_buffer(req);
+    if (!buf)
+        return "";
+    size_t size = std::min(evbuffer_get_length(buf), nMaxSize);
+    // Only the part asked for is made contiguous
+    const char* data = (const char*)evbuffer_pullup(buf, size);
+    if (!data)
+        return "";
+    return std::string(data, size);
+}
+
 std::string HTTPRequest::ReadBody()
 {
     struct evbuffer* buf = evhttp_request_get_input_buffer(req);
@@ -605,6 +718,70 @@ void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
     req = 0; // transferred back to main thread
 }
 
+/** Send a chunk of a reply and release its buffer, in the main http thread */
+static void http_send_reply_chunk(struct evhttp_request* req, struct evbuffer* evb)
+{
+    evhttp_send_reply_chunk(req, evb);
+    evbuffer_free(evb);
+}
+
+void HTTPRequest::WriteReplyChunk(int nStatus, const std::string& strChunk)
+{
+    assert(!replySent && req);
+    if (!replyStarted) {
+        HTTPEvent* ev = new HTTPEvent(eventBase, true,
+            boost::bind(evhttp_send_reply_start, req, nStatus, (const char*)NULL));
+        ev->trigger(0);
+        replyStarted = true;
+    }
+    if (strChunk.empty())
+        return;
+    // Events are handled in the order they were triggered, so the chunks
+    // arrive in order, behind the start of the reply.
+    struct evbuffer* evb = evbuffer_new();
+    assert(evb);
+    evbuffer_add(evb, strChunk.data(), strChunk.size());
+    HTTPEvent* ev = new HTTPEvent(eventBase, true,
+        boost::bind(http_send_reply_chunk, req, evb));
+    ev->trigger(0);
+}
+
+void HTTPRequest::EndReply(int nStatus, const std::string& strLast)
+{
+    if (!replyStarted) {
+        WriteReply(nStatus, strLast);
+        return;
+    }
+    WriteReplyChunk(nStatus, strLast);
+    HTTPEvent* ev = new HTTPEvent(eventBase, true,
+        boost::bind(evhttp_send_reply_end, req));
+    ev->trigger(0);
+    replySent = true;
+    req = 0; // transferred back to main thread
+}
+
+/** Drop the connection of a request, in the main http thread. Whatever
+ * part of the reply is still buffered is discarded with it. */
+static void http_abort_reply(struct evhttp_request* req)
+{
+    struct evhttp_connection* evcon = evhttp_request_get_connection(req);
+    if (evcon)
+        evhttp_connection_free(evcon); // also frees req
+    else
+        evhttp_request_free(req);
+}
+
+void HTTPRequest::AbortReply()
+{
+    assert(replyStarted && !replySent && req);
+    // Triggered after the chunks sent so far, like the end of a reply would be
+    HTTPEvent* ev = new HTTPEvent(eventBase, true,
+        boost::bind(http_abort_reply, req));
+    ev->trigger(0);
+    replySent = true;
+    req = 0; // transferred back to main thread
+}
+
 CService HTTPRequest::GetPeer()
 {
     evhttp_connection* con = evhttp_request_get_connection(req);
@@ -645,10 +822,34 @@ HTTPRequest::RequestMethod HTTPRequest::GetRequestMethod()
     }
 }
 
-void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPRequestHandler &handler)
+void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPRequestHandler &handler,
+                         HTTPLane lane, const HTTPLaneSelector& selectLane)
 {
-    LogPrint("http", "Registering HTTP handler for %s (exactmatch %d)\n", prefix, exactMatch);
-    pathHandlers.push_back(HTTPPathHandler(prefix, exactMatch, handler));
+    LogPrint("http", "Registering HTTP handler for %s (exactmatch %d, lane %s)\n", prefix, exactMatch, httpLanes[lane].name);
+    pathHandlers.push_back(HTTPPathHandler(prefix, exactMatch, handler, lane, selectLane));
+}
+
+bool HTTPRunOnIdleWorker(const boost::function<void ()>& func)
+{
+    WorkQueue<HTTPClosure>* workQueue = workQueues[HTTP_LANE_RPC];
+    if (!workQueue)
+        return false;
+    std::unique_ptr<HTTPFunctionItem> item(new HTTPFunctionItem(func));
+    if (!workQueue->EnqueueIfIdle(item.get()))
+        return false;
+    item.release(); /* if true, queue took ownership */
+    return true;
+}
+
+std::vector<HTTPLaneStats> GetHTTPLaneStats()
+{
+    std::vector<HTTPLaneStats> vStats(HTTP_LANE_COUNT);
+    for (int lane = 0; lane < HTTP_LANE_COUNT; lane++) {
+        vStats[lane].name = httpLanes[lane].name;
+        if (workQueues[lane])
+            workQueues[lane]->GetStats(vStats[lane]);
+    }
+    return vStats;
 }
 
 void UnregisterHTTPHandler(const std::string &prefix, bool exactMatch)
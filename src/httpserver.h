@@ -7,12 +7,15 @@
 
 #include <string>
 #include <stdint.h>
+#include <vector>
 #include <boost/thread.hpp>
 #include <boost/scoped_ptr.hpp>
 #include <boost/function.hpp>
 
 static const int DEFAULT_HTTP_THREADS=4;
 static const int DEFAULT_HTTP_WORKQUEUE=16;
+static const int DEFAULT_HTTP_MINING_THREADS=2;
+static const int DEFAULT_HTTP_REST_THREADS=2;
 static const int DEFAULT_HTTP_SERVER_TIMEOUT=30;
 
 struct evhttp_request;
@@ -34,16 +37,59 @@ void InterruptHTTPServer();
 /** Stop HTTP server */
 void StopHTTPServer();
 
+/** Work queues that requests are handled from, each with its own depth
+ * and worker threads, so that a flood of one kind of request cannot starve
+ * the others. A lane without threads hands its requests to HTTP_LANE_RPC.
+ */
+enum HTTPLane {
+    HTTP_LANE_RPC,      //!< JSON-RPC calls that do not go to another lane
+    HTTP_LANE_MINING,   //!< JSON-RPC calls in the mining category
+    HTTP_LANE_REST,     //!< REST requests
+    HTTP_LANE_COUNT
+};
+
+/** Picks the lane for a request. Called on the event loop thread before
+ * the request is queued, so it must be quick, and must not consume the body.
+ */
+typedef boost::function<HTTPLane(HTTPRequest* req)> HTTPLaneSelector;
+
 /** Handler for requests to a certain HTTP path */
 typedef boost::function<bool(HTTPRequest* req, const std::string &)> HTTPRequestHandler;
 /** Register handler for prefix.
  * If multiple handlers match a prefix, the first-registered one will
- * be invoked.
+ * be invoked. Its requests are handled in lane, or in the lane picked by
+ * selectLane if that is set.
  */
-void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPRequestHandler &handler);
+void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPRequestHandler &handler,
+                         HTTPLane lane = HTTP_LANE_RPC, const HTTPLaneSelector& selectLane = HTTPLaneSelector());
 /** Unregister handler for prefix */
 void UnregisterHTTPHandler(const std::string &prefix, bool exactMatch);
 
+/** Run func on a HTTP_LANE_RPC worker thread that is idle right now, to
+ * spread work that a request handler can split up. Returns false, without
+ * running func, if no worker is idle.
+ */
+bool HTTPRunOnIdleWorker(const boost::function<void ()>& func);
+
+/** What a lane did so far, see GetHTTPLaneStats() */
+struct HTTPLaneStats
+{
+    std::string name;
+    int nThreads;           //!< Worker threads, 0 if the lane is handled by HTTP_LANE_RPC
+    int nBusy;              //!< ... of which are handling a request
+    size_t nDepth;          //!< Requests waiting for a worker
+    size_t nMaxDepth;       //!< Limit of nDepth, beyond which requests are rejected
+    uint64_t nRequests;     //!< Requests taken by a worker
+    uint64_t nRejected;     //!< Requests rejected because the queue was full
+    int64_t nWaitTime;      //!< Total time the requests waited for a worker, in microseconds
+    int64_t nMaxWaitTime;   //!< Longest time a request waited, in microseconds
+
+    HTTPLaneStats() : nThreads(0), nBusy(0), nDepth(0), nMaxDepth(0), nRequests(0), nRejected(0), nWaitTime(0), nMaxWaitTime(0) {}
+};
+
+/** Return the statistics of every lane, in HTTPLane order */
+std::vector<HTTPLaneStats> GetHTTPLaneStats();
+
 /** Return evhttp event base. This can be used by submodules to
  * queue timers or custom events.
  */
@@ -57,6 +103,7 @@ class HTTPRequest
 private:
     struct evhttp_request* req;
     bool replySent;
+    bool replyStarted;
 
 public:
     HTTPRequest(struct evhttp_request* req);
@@ -96,6 +143,12 @@ public:
      */
     std::string ReadBody();
 
+    /**
+     * Return up to nMaxSize bytes from the start of the request body,
+     * without consuming it.
+     */
+    std::string PeekBody(size_t nMaxSize);
+
     /**
      * Write output header.
      *
@@ -112,6 +165,31 @@ public:
      * main thread, do not call any other HTTPRequest methods after calling this.
      */
     void WriteReply(int nStatus, const std::string& strReply = "");
+
+    /**
+     * Write part of a HTTP reply, using chunked transfer encoding. The status
+     * line and headers are sent before the first chunk, so nStatus only
+     * matters on the first call.
+     *
+     * @note Finish the reply with EndReply().
+     */
+    void WriteReplyChunk(int nStatus, const std::string& strChunk);
+
+    /**
+     * Finish a reply. If WriteReplyChunk() was called, strLast is sent as the
+     * last chunk, otherwise this is the same as WriteReply().
+     */
+    void EndReply(int nStatus, const std::string& strLast = "");
+
+    /**
+     * Give up on a reply that WriteReplyChunk() started, by closing the
+     * connection without the terminating chunk. The client sees the
+     * transfer fail instead of a complete reply with a truncated body.
+     */
+    void AbortReply();
+
+    /** Whether part of the reply has been sent already */
+    bool ReplyStarted() const { return replyStarted; }
 };
 
 /** Event handler closure.
@@ -7,13 +7,16 @@
 
 #include "addrman.h"
 #include "arith_uint256.h"
+#include "blockcache.h"
 #include "blockencodings.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
+#include "coinsprefetch.h"
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/validation.h"
+#include "cuckoocache.h"
 #include "hash.h"
 #include "init.h"
 #include "merkleblock.h"
@@ -67,6 +70,7 @@ int64_t nTimeBestReceived = 0;
 CWaitableCriticalSection csBestBlock;
 CConditionVariable cvBlockChange;
 int nScriptCheckThreads = 0;
+int nPrefetchBlocks = DEFAULT_PREFETCH_BLOCKS;
 bool fImporting = false;
 bool fReindex = false;
 bool fTxIndex = false;
@@ -86,6 +90,7 @@ CFeeRate minRelayTxFee = CFeeRate(DEFAULT_MIN_RELAY_TX_FEE);
 CAmount maxTxFee = DEFAULT_TRANSACTION_MAXFEE;
 
 CTxMemPool mempool(::minRelayTxFee);
+CBlockCache blockcache(DEFAULT_BLOCK_SERVE_CACHE << 20);
 FeeFilterRounder filterRounder(::minRelayTxFee);
 
 struct IteratorComparator
@@ -111,6 +116,8 @@ void EraseOrphansFor(NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
  * in the last Consensus::Params::nMajorityWindow blocks, starting at pstart and going backwards.
  */
 static bool IsSuperMajority(int minVersion, const CBlockIndex* pstart, unsigned nRequired, const Consensus::Params& consensusParams);
+/** Script verification flags for a block with version nVersion and time nTime on top of pindexPrev. */
+static unsigned int GetBlockScriptFlags(const CBlockIndex* pindexPrev, int32_t nVersion, int64_t nTime, const Consensus::Params& consensusParams);
 static void CheckBlockIndex(const Consensus::Params& consensusParams);
 
 static void CheckBlockIndex();
@@ -698,6 +705,8 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 CCoinsViewCache *pcoinsTip = NULL;
+CCoinsViewDB *pcoinsdbview = NULL;
+CCoinsViewWriteBehind *pcoinsWriteBehind = NULL;
 CBlockTreeDB *pblocktree = NULL;
 
 //////////////////////////////////////////////////////////////////////////////
@@ -981,15 +990,15 @@ bool CheckSequenceLocks(const CTransaction &tx, int flags, LockPoints* lp, bool
         prevheights.resize(tx.vin.size());
         for (size_t txinIndex = 0; txinIndex < tx.vin.size(); txinIndex++) {
             const CTxIn& txin = tx.vin[txinIndex];
-            CCoins coins;
-            if (!viewMemPool.GetCoins(txin.prevout.hash, coins)) {
+            Coin coin;
+            if (!viewMemPool.GetCoin(txin.prevout, coin)) {
                 return error("%s: Missing input", __func__);
             }
-            if (coins.nHeight == MEMPOOL_HEIGHT) {
+            if (coin.nHeight == MEMPOOL_HEIGHT) {
                 // Assume all mempool transaction confirm in the next block
                 prevheights[txinIndex] = tip->nHeight + 1;
             } else {
-                prevheights[txinIndex] = coins.nHeight;
+                prevheights[txinIndex] = coin.nHeight;
             }
         }
         lockPair = CalculateSequenceLocks(tx, flags, &prevheights, index);
@@ -1128,9 +1137,9 @@ void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age) {
     if (expired != 0)
         LogPrint("mempool", "Expired %i transactions from the memory pool\n", expired);
 
-    std::vector<uint256> vNoSpendsRemaining;
+    std::vector<COutPoint> vNoSpendsRemaining;
     pool.TrimToSize(limit, &vNoSpendsRemaining);
-    BOOST_FOREACH(const uint256& removed, vNoSpendsRemaining)
+    BOOST_FOREACH(const COutPoint& removed, vNoSpendsRemaining)
         pcoinsTip->Uncache(removed);
 }
 
@@ -1144,8 +1153,8 @@ std::string FormatStateMessage(const CValidationState &state)
 }
 
 bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree,
-                              bool* pfMissingInputs, bool fOverrideMempoolLimit, const CAmount& nAbsurdFee,
-                              std::vector<uint256>& vHashTxnToUncache)
+                              bool* pfMissingInputs, int64_t nAcceptTime, bool fOverrideMempoolLimit, const CAmount& nAbsurdFee,
+                              std::vector<COutPoint>& vCoinsToUncache)
 {
     const uint256 hash = tx.GetHash();
     AssertLockHeld(cs_main);
@@ -1244,21 +1253,18 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         CCoinsViewMemPool viewMemPool(pcoinsTip, pool);
         view.SetBackend(viewMemPool);
 
-        // do we already have it?
-        bool fHadTxInCache = pcoinsTip->HaveCoinsInCache(hash);
-        if (view.HaveCoins(hash)) {
-            if (!fHadTxInCache)
-                vHashTxnToUncache.push_back(hash);
-            return state.Invalid(false, REJECT_ALREADY_KNOWN, "txn-already-known");
-        }
-
         // do all inputs exist?
-        // Note that this does not check for the presence of actual outputs (see the next check for that),
-        // and only helps with filling in pfMissingInputs (to determine missing vs spent).
         BOOST_FOREACH(const CTxIn txin, tx.vin) {
-            if (!pcoinsTip->HaveCoinsInCache(txin.prevout.hash))
-                vHashTxnToUncache.push_back(txin.prevout.hash);
-            if (!view.HaveCoins(txin.prevout.hash)) {
+            if (!pcoinsTip->HaveCoinInCache(txin.prevout))
+                vCoinsToUncache.push_back(txin.prevout);
+            if (!view.HaveCoin(txin.prevout)) {
+                // Are inputs missing because we already have the tx? Only
+                // check the cache for its outputs, which is cheap.
+                for (size_t out = 0; out < tx.vout.size(); out++) {
+                    if (pcoinsTip->HaveCoinInCache(COutPoint(hash, out)))
+                        return state.Invalid(false, REJECT_ALREADY_KNOWN, "txn-already-known");
+                }
+                // Otherwise this might be an orphan whose parents we haven't seen yet
                 if (pfMissingInputs)
                     *pfMissingInputs = true;
                 return false; // fMissingInputs and !state.IsInvalid() is used to detect this condition, don't set state.Invalid()
@@ -1310,14 +1316,14 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         // during reorgs to ensure COINBASE_MATURITY is still met.
         bool fSpendsCoinbase = false;
         BOOST_FOREACH(const CTxIn &txin, tx.vin) {
-            const CCoins *coins = view.AccessCoins(txin.prevout.hash);
-            if (coins->IsCoinBase()) {
+            const Coin &coin = view.AccessCoin(txin.prevout);
+            if (coin.IsCoinBase()) {
                 fSpendsCoinbase = true;
                 break;
             }
         }
 
-        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height(), pool.HasNoInputsOf(tx), inChainInputValue, fSpendsCoinbase, nSigOpsCost, lp);
+        CTxMemPoolEntry entry(tx, nFees, nAcceptTime, dPriority, chainActive.Height(), pool.HasNoInputsOf(tx), inChainInputValue, fSpendsCoinbase, nSigOpsCost, lp);
         unsigned int nSize = entry.GetTxSize();
 
         // Check that the transaction doesn't have an excessive number of
@@ -1527,28 +1533,35 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
         PrecomputedTransactionData txdata(tx);
-        if (!CheckInputs(tx, state, view, true, scriptVerifyFlags, true, txdata)) {
+        if (!CheckInputs(tx, state, view, true, scriptVerifyFlags, true, false, txdata)) {
             // SCRIPT_VERIFY_CLEANSTACK requires SCRIPT_VERIFY_WITNESS, so we
             // need to turn both off, and compare against just turning off CLEANSTACK
             // to see if the failure is specifically due to witness validation.
-            if (tx.wit.IsNull() && CheckInputs(tx, state, view, true, scriptVerifyFlags & ~(SCRIPT_VERIFY_WITNESS | SCRIPT_VERIFY_CLEANSTACK), true, txdata) &&
-                !CheckInputs(tx, state, view, true, scriptVerifyFlags & ~SCRIPT_VERIFY_CLEANSTACK, true, txdata)) {
+            if (tx.wit.IsNull() && CheckInputs(tx, state, view, true, scriptVerifyFlags & ~(SCRIPT_VERIFY_WITNESS | SCRIPT_VERIFY_CLEANSTACK), true, false, txdata) &&
+                !CheckInputs(tx, state, view, true, scriptVerifyFlags & ~SCRIPT_VERIFY_CLEANSTACK, true, false, txdata)) {
                 // Only the witness is missing, so the transaction itself may be fine.
                 state.SetCorruptionPossible();
             }
             return false;
         }
 
-        // Check again against just the consensus-critical mandatory script
-        // verification flags, in case of bugs in the standard flags that cause
-        // transactions to pass as valid when they're actually invalid. For
-        // instance the STRICTENC flag was incorrectly allowing certain
+        // Check again against the consensus-critical flags the next block
+        // will be validated with (which include the mandatory script
+        // verification flags), in case of bugs in the standard flags that
+        // cause transactions to pass as valid when they're actually invalid.
+        // For instance the STRICTENC flag was incorrectly allowing certain
         // CHECKSIG NOT scripts to pass, even though they were invalid.
         //
         // There is a similar check in CreateNewBlock() to prevent creating
         // invalid blocks, however allowing such transactions into the mempool
         // can be exploited as a DoS attack.
-        if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, txdata))
+        //
+        // With the signature cache warm this is cheap, and its result is
+        // stored in the script execution cache, so that ConnectBlock can skip
+        // the transaction's scripts entirely.
+        unsigned int currentBlockScriptVerifyFlags = GetBlockScriptFlags(chainActive.Tip(), ComputeBlockVersion(chainActive.Tip(), chainparams.GetConsensus()),
+                                                                         GetAdjustedTime(), chainparams.GetConsensus());
+        if (!CheckInputs(tx, state, view, true, currentBlockScriptVerifyFlags | MANDATORY_SCRIPT_VERIFY_FLAGS, true, true, txdata))
         {
             return error("%s: BUG! PLEASE REPORT THIS! ConnectInputs failed against MANDATORY but not STANDARD flags %s, %s",
                 __func__, hash.ToString(), FormatStateMessage(state));
@@ -1581,18 +1594,24 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
     return true;
 }
 
-bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
-                        bool* pfMissingInputs, bool fOverrideMempoolLimit, const CAmount nAbsurdFee)
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                                bool* pfMissingInputs, int64_t nAcceptTime, bool fOverrideMempoolLimit, const CAmount nAbsurdFee)
 {
-    std::vector<uint256> vHashTxToUncache;
-    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, fOverrideMempoolLimit, nAbsurdFee, vHashTxToUncache);
+    std::vector<COutPoint> vCoinsToUncache;
+    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, nAcceptTime, fOverrideMempoolLimit, nAbsurdFee, vCoinsToUncache);
     if (!res) {
-        BOOST_FOREACH(const uint256& hashTx, vHashTxToUncache)
-            pcoinsTip->Uncache(hashTx);
+        BOOST_FOREACH(const COutPoint& outpoint, vCoinsToUncache)
+            pcoinsTip->Uncache(outpoint);
     }
     return res;
 }
 
+bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                        bool* pfMissingInputs, bool fOverrideMempoolLimit, const CAmount nAbsurdFee)
+{
+    return AcceptToMemoryPoolWithTime(pool, state, tx, fLimitFree, pfMissingInputs, GetTime(), fOverrideMempoolLimit, nAbsurdFee);
+}
+
 /** Return transaction in txOut, and if it was found inside a block, its hash is placed in hashBlock */
 bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::Params& consensusParams, uint256 &hashBlock, bool fAllowSlow)
 {
@@ -1631,10 +1650,9 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::P
     if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
         int nHeight = -1;
         {
-            const CCoinsViewCache& view = *pcoinsTip;
-            const CCoins* coins = view.AccessCoins(hash);
-            if (coins)
-                nHeight = coins->nHeight;
+            const Coin& coin = AccessByTxid(*pcoinsTip, hash);
+            if (!coin.IsSpent())
+                nHeight = coin.nHeight;
         }
         if (nHeight > 0)
             pindexSlow = chainActive[nHeight];
@@ -1721,6 +1739,112 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
     return true;
 }
 
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vchBlock, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
+{
+    // The index header written by WriteBlockToDisk precedes the block
+    CDiskBlockPos posHeader = pos;
+    if (posHeader.nPos < 8)
+        return error("ReadRawBlockFromDisk: no index header at %s", pos.ToString());
+    posHeader.nPos -= 8;
+
+    // Open history file to read
+    CAutoFile filein(OpenBlockFile(posHeader, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("ReadRawBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+
+    try {
+        CMessageHeader::MessageStartChars blockStart;
+        unsigned int nSize;
+        filein >> FLATDATA(blockStart) >> nSize;
+        if (memcmp(blockStart, messageStart, MESSAGE_START_SIZE) != 0)
+            return error("ReadRawBlockFromDisk: Block magic mismatch at %s", pos.ToString());
+        if (nSize > MAX_BLOCK_SERIALIZED_SIZE)
+            return error("ReadRawBlockFromDisk: Block size %u too large at %s", nSize, pos.ToString());
+        vchBlock.resize(nSize);
+        filein.read((char*)vchBlock.data(), nSize);
+    }
+    catch (const std::exception& e) {
+        return error("%s: I/O error - %s at %s", __func__, e.what(), pos.ToString());
+    }
+
+    return true;
+}
+
+/** Read a block to serve, checking that the bytes belong to hash */
+static bool ReadServedBlockFromDisk(std::shared_ptr<const std::vector<unsigned char> >& pvchBlock, const CDiskBlockPos& pos, const uint256& hash, const CMessageHeader::MessageStartChars& messageStart)
+{
+    std::shared_ptr<std::vector<unsigned char> > pvchRead = std::make_shared<std::vector<unsigned char> >();
+    if (!ReadRawBlockFromDisk(*pvchRead, pos, messageStart))
+        return false;
+    // The serialization starts with the header
+    CBlockHeader header;
+    try {
+        CDataStream ssHeader(*pvchRead, SER_NETWORK, PROTOCOL_VERSION);
+        ssHeader >> header;
+    }
+    catch (const std::exception& e) {
+        return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+    }
+    if (header.GetHash() != hash)
+        return error("%s: GetHash() doesn't match index for %s at %s", __func__, hash.ToString(), pos.ToString());
+    pvchBlock = pvchRead;
+    return true;
+}
+
+bool ReadServedBlock(std::shared_ptr<const std::vector<unsigned char> >& pvchBlock, const CDiskBlockPos& pos, const uint256& hash, const CMessageHeader::MessageStartChars& messageStart, bool fAddToCache)
+{
+    pvchBlock = blockcache.Get(hash);
+    if (pvchBlock)
+        return true;
+
+    if (!ReadServedBlockFromDisk(pvchBlock, pos, hash, messageStart))
+        return false;
+    if (fAddToCache)
+        blockcache.Put(hash, pvchBlock);
+    return true;
+}
+
+bool ReadServedBlock(CBlock& block, const CDiskBlockPos& pos, const uint256& hash, const CChainParams& chainparams, bool fAddToCache)
+{
+    // Not cached until the whole block is known to decode
+    std::shared_ptr<const std::vector<unsigned char> > pvchBlock = blockcache.Get(hash);
+    bool fCached = pvchBlock != NULL;
+    if (!fCached && !ReadServedBlockFromDisk(pvchBlock, pos, hash, chainparams.MessageStart()))
+        return false;
+
+    try {
+        CDataStream ssBlock(*pvchBlock, SER_NETWORK, PROTOCOL_VERSION);
+        ssBlock >> block;
+    }
+    catch (const std::exception& e) {
+        if (fCached)
+            blockcache.Erase(hash);
+        return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+    }
+    if (block.GetHash() != hash) {
+        if (fCached)
+            blockcache.Erase(hash);
+        return error("%s: GetHash() doesn't match index for %s at %s", __func__, hash.ToString(), pos.ToString());
+    }
+    if (!fCached && fAddToCache)
+        blockcache.Put(hash, pvchBlock);
+    return true;
+}
+
+bool ReadServedBlockHex(std::shared_ptr<const std::string>& pstrHex, const CDiskBlockPos& pos, const uint256& hash, const CMessageHeader::MessageStartChars& messageStart, bool fAddToCache)
+{
+    pstrHex = blockcache.GetHex(hash);
+    if (pstrHex)
+        return true;
+
+    std::shared_ptr<const std::vector<unsigned char> > pvchBlock;
+    if (!ReadServedBlock(pvchBlock, pos, hash, messageStart, fAddToCache))
+        return false;
+    pstrHex = std::make_shared<const std::string>(HexStr(pvchBlock->begin(), pvchBlock->end()));
+    blockcache.PutHex(hash, pstrHex);
+    return true;
+}
+
 static const int64_t nReleaseBlocks = 100;
 static const int64_t nStartSubsidy = 32 * COIN;
 static const int64_t nMinSubsidy = COIN / 2;
@@ -1955,24 +2079,14 @@ void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, CTxUndo &txund
     if (!tx.IsCoinBase()) {
         txundo.vprevout.reserve(tx.vin.size());
         BOOST_FOREACH(const CTxIn &txin, tx.vin) {
-            CCoinsModifier coins = inputs.ModifyCoins(txin.prevout.hash);
-            unsigned nPos = txin.prevout.n;
-
-            if (nPos >= coins->vout.size() || coins->vout[nPos].IsNull())
-                assert(false);
             // mark an outpoint spent, and construct undo information
-            txundo.vprevout.push_back(CTxInUndo(coins->vout[nPos]));
-            coins->Spend(nPos);
-            if (coins->vout.size() == 0) {
-                CTxInUndo& undo = txundo.vprevout.back();
-                undo.nHeight = coins->nHeight;
-                undo.fCoinBase = coins->fCoinBase;
-                undo.nVersion = coins->nVersion;
-            }
+            txundo.vprevout.push_back(Coin());
+            bool fSpent = inputs.SpendCoin(txin.prevout, &txundo.vprevout.back());
+            assert(fSpent);
         }
     }
     // add outputs
-    inputs.ModifyNewCoins(tx.GetHash(), tx.IsCoinBase())->FromTx(tx, nHeight);
+    AddCoins(inputs, tx, nHeight);
 }
 
 void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight)
@@ -2010,20 +2124,20 @@ bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoins
         for (unsigned int i = 0; i < tx.vin.size(); i++)
         {
             const COutPoint &prevout = tx.vin[i].prevout;
-            const CCoins *coins = inputs.AccessCoins(prevout.hash);
-            assert(coins);
+            const Coin& coin = inputs.AccessCoin(prevout);
+            assert(!coin.IsSpent());
 
             // If prev is coinbase, check that it's matured
-            if (coins->IsCoinBase()) {
-                if (nSpendHeight - coins->nHeight < (::Params().MineBlocksOnDemand() ? COINBASE_MATURITY_REGTEST : COINBASE_MATURITY))
+            if (coin.IsCoinBase()) {
+                if (nSpendHeight - coin.nHeight < (::Params().MineBlocksOnDemand() ? COINBASE_MATURITY_REGTEST : COINBASE_MATURITY))
                     return state.Invalid(false,
                         REJECT_INVALID, "bad-txns-premature-spend-of-coinbase",
-                        strprintf("tried to spend coinbase at depth %d", nSpendHeight - coins->nHeight));
+                        strprintf("tried to spend coinbase at depth %d", nSpendHeight - coin.nHeight));
             }
 
             // Check for negative or overflow input values
-            nValueIn += coins->vout[prevout.n].nValue;
-            if (!MoneyRange(coins->vout[prevout.n].nValue) || !MoneyRange(nValueIn))
+            nValueIn += coin.out.nValue;
+            if (!MoneyRange(coin.out.nValue) || !MoneyRange(nValueIn))
                 return state.DoS(100, false, REJECT_INVALID, "bad-txns-inputvalues-outofrange");
 
         }
@@ -2043,7 +2157,37 @@ bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoins
 }
 }// namespace Consensus
 
-bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks)
+namespace {
+/**
+ * Transactions whose scripts all passed with a given set of flags, to skip
+ * them when they are validated again in a block. Entries are
+ * SHA256(nonce || witness txid || flags); the witness txid commits to the
+ * spent outputs through the prevouts. Protected by cs_main.
+ */
+CCuckooCache<uint256, CSignatureCacheHasher> scriptExecutionCache;
+uint256 scriptExecutionCacheNonce(GetRandHash());
+uint64_t nScriptExecutionCacheHits = 0;
+uint64_t nScriptExecutionCacheMisses = 0;
+}
+
+void InitScriptExecutionCache()
+{
+    LOCK(cs_main);
+    // -maxscriptcachesize=0 leaves the smallest possible cache (2 entries)
+    size_t nMaxCacheSize = std::min(std::max((int64_t)0, GetArg("-maxscriptcachesize", DEFAULT_MAX_SCRIPT_CACHE_SIZE)), MAX_MAX_SCRIPT_CACHE_SIZE) * ((size_t) 1 << 20);
+    size_t nElems = scriptExecutionCache.SetupBytes(nMaxCacheSize);
+    LogPrintf("Using %u MiB out of %u requested for script execution cache, able to store %u elements\n",
+              (nElems * sizeof(uint256)) >> 20, nMaxCacheSize >> 20, nElems);
+}
+
+void GetScriptExecutionCacheStats(uint64_t& nHits, uint64_t& nMisses)
+{
+    LOCK(cs_main);
+    nHits = nScriptExecutionCacheHits;
+    nMisses = nScriptExecutionCacheMisses;
+}
+
+bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks)
 {
     if (!tx.IsCoinBase())
     {
@@ -2064,13 +2208,23 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
         // the checkpoint is for a chain that's invalid due to false scriptSigs
         // this optimization would allow an invalid chain to be accepted.
         if (fScriptChecks) {
+            // Skip the scripts if they all passed with the same flags before
+            AssertLockHeld(cs_main);
+            uint256 hashCacheEntry;
+            CSHA256().Write(scriptExecutionCacheNonce.begin(), 32).Write(tx.GetWitnessHash().begin(), 32).Write((const unsigned char*)&flags, sizeof(flags)).Finalize(hashCacheEntry.begin());
+            if (scriptExecutionCache.Contains(hashCacheEntry, !cacheFullScriptStore)) {
+                nScriptExecutionCacheHits++;
+                return true;
+            }
+            nScriptExecutionCacheMisses++;
+
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint &prevout = tx.vin[i].prevout;
-                const CCoins* coins = inputs.AccessCoins(prevout.hash);
-                assert(coins);
+                const Coin& coin = inputs.AccessCoin(prevout);
+                assert(!coin.IsSpent());
 
                 // Verify signature
-                CScriptCheck check(*coins, tx, i, flags, cacheStore, &txdata);
+                CScriptCheck check(coin.out.scriptPubKey, coin.out.nValue, tx, i, flags, cacheSigStore, &txdata);
                 if (pvChecks) {
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
@@ -2082,8 +2236,8 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                         // arguments; if so, don't trigger DoS protection to
                         // avoid splitting the network between upgraded and
                         // non-upgraded nodes.
-                        CScriptCheck check2(*coins, tx, i,
-                                flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore, &txdata);
+                        CScriptCheck check2(coin.out.scriptPubKey, coin.out.nValue, tx, i,
+                                flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheSigStore, &txdata);
                         if (check2())
                             return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
                     }
@@ -2097,6 +2251,11 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                     return state.DoS(100,false, REJECT_INVALID, strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(check.GetScriptError())));
                 }
             }
+
+            if (cacheFullScriptStore && !pvChecks) {
+                // All scripts ran and passed; remember that
+                scriptExecutionCache.Insert(hashCacheEntry);
+            }
         }
     }
 
@@ -2180,36 +2339,30 @@ bool AbortNode(CValidationState& state, const std::string& strMessage, const std
 } // anon namespace
 
 /**
- * Apply the undo operation of a CTxInUndo to the given chain state.
- * @param undo The undo object.
+ * Restore a spent output from its undo record.
+ * @param undo The spent coin, as recorded in the undo data.
  * @param view The coins view to which to apply the changes.
  * @param out The out point that corresponds to the tx input.
- * @return True on success.
+ * @param fClean Cleared if the output was still there.
+ * @return False if the output could not be restored.
  */
-static bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const COutPoint& out)
+static bool ApplyTxInUndo(Coin undo, CCoinsViewCache& view, const COutPoint& out, bool& fClean)
 {
-    bool fClean = true;
-
-    CCoinsModifier coins = view.ModifyCoins(out.hash);
-    if (undo.nHeight != 0) {
-        // undo data contains height: this is the last output of the prevout tx being spent
-        if (!coins->IsPruned())
-            fClean = fClean && error("%s: undo data overwriting existing transaction", __func__);
-        coins->Clear();
-        coins->fCoinBase = undo.fCoinBase;
-        coins->nHeight = undo.nHeight;
-        coins->nVersion = undo.nVersion;
-    } else {
-        if (coins->IsPruned())
-            fClean = fClean && error("%s: undo data adding output to missing transaction", __func__);
-    }
-    if (coins->IsAvailable(out.n))
+    if (view.HaveCoin(out))
         fClean = fClean && error("%s: undo data overwriting existing output", __func__);
-    if (coins->vout.size() < out.n+1)
-        coins->vout.resize(out.n+1);
-    coins->vout[out.n] = undo.txout;
 
-    return fClean;
+    if (undo.nHeight == 0) {
+        // Missing undo metadata (height and coinbase). Older versions only
+        // stored it with the last spend of a transaction's outputs, so some
+        // other output of the same transaction must still have it.
+        const Coin& alternate = AccessByTxid(view, out.hash);
+        if (alternate.IsSpent())
+            return error("%s: undo data adding output to missing transaction", __func__);
+        undo.nHeight = alternate.nHeight;
+        undo.fCoinBase = alternate.fCoinBase;
+    }
+    view.AddCoin(out, undo, !fClean);
+    return true;
 }
 
 bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean)
@@ -2237,22 +2390,14 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
         uint256 hash = tx.GetHash();
 
         // Check that all outputs are available and match the outputs in the block itself
-        // exactly.
-        {
-        CCoinsModifier outs = view.ModifyCoins(hash);
-        outs->ClearUnspendable();
-
-        CCoins outsBlock(tx, pindex->nHeight);
-        // The CCoins serialization does not serialize negative numbers.
-        // No network rules currently depend on the version here, so an inconsistency is harmless
-        // but it must be corrected before txout nversion ever influences a network rule.
-        if (outsBlock.nVersion < 0)
-            outs->nVersion = outsBlock.nVersion;
-        if (*outs != outsBlock)
-            fClean = fClean && error("DisconnectBlock(): added transaction mismatch? database corrupted");
-
-        // remove outputs
-        outs->Clear();
+        // exactly, and remove them.
+        for (size_t o = 0; o < tx.vout.size(); o++) {
+            if (tx.vout[o].scriptPubKey.IsUnspendable())
+                continue;
+            Coin coin;
+            bool fSpent = view.SpendCoin(COutPoint(hash, o), &coin);
+            if (!fSpent || tx.vout[o] != coin.out || pindex->nHeight != (int)coin.nHeight || tx.IsCoinBase() != coin.IsCoinBase())
+                fClean = fClean && error("DisconnectBlock(): added transaction mismatch? database corrupted");
         }
 
         // restore inputs
@@ -2262,9 +2407,8 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
                 return error("DisconnectBlock(): transaction and undo data inconsistent");
             for (unsigned int j = tx.vin.size(); j-- > 0;) {
                 const COutPoint &out = tx.vin[j].prevout;
-                const CTxInUndo &undo = txundo.vprevout[j];
-                if (!ApplyTxInUndo(undo, view, out))
-                    fClean = false;
+                if (!ApplyTxInUndo(txundo.vprevout[j], view, out, fClean))
+                    return error("DisconnectBlock(): failed to restore spent output %s", out.ToString());
             }
         }
     }
@@ -2312,6 +2456,92 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+static CCoinsPrefetchQueue prefetchqueue(1);
+
+void ThreadCoinsPrefetch() {
+    RenameThread("skeincoin-prefetch");
+    prefetchqueue.Thread();
+}
+
+namespace {
+/** Hashes a slice of received headers and checks them against their targets, run on a header checking thread. */
+class CHeaderCheck
+{
+private:
+    const std::vector<CBlockHeader>* pvHeaders;
+    std::vector<uint256>* pvHashes;
+    std::vector<char>* pvPowOk;
+    size_t nBegin;
+    size_t nEnd;
+    const Consensus::Params* pparams;
+
+public:
+    CHeaderCheck() : pvHeaders(NULL), pvHashes(NULL), pvPowOk(NULL), nBegin(0), nEnd(0), pparams(NULL) {}
+    CHeaderCheck(const std::vector<CBlockHeader>* pvHeadersIn, std::vector<uint256>* pvHashesIn, std::vector<char>* pvPowOkIn, size_t nBeginIn, size_t nEndIn, const Consensus::Params* pparamsIn) :
+        pvHeaders(pvHeadersIn), pvHashes(pvHashesIn), pvPowOk(pvPowOkIn), nBegin(nBeginIn), nEnd(nEndIn), pparams(pparamsIn) {}
+
+    bool operator()()
+    {
+        HashSkeinBatch(&(*pvHeaders)[nBegin], nEnd - nBegin, &(*pvHashes)[nBegin]);
+        for (size_t i = nBegin; i < nEnd; i++)
+            (*pvPowOk)[i] = CheckProofOfWork((*pvHashes)[i], (*pvHeaders)[i].nBits, *pparams);
+        return true;
+    }
+
+    void swap(CHeaderCheck& check)
+    {
+        std::swap(pvHeaders, check.pvHeaders);
+        std::swap(pvHashes, check.pvHashes);
+        std::swap(pvPowOk, check.pvPowOk);
+        std::swap(nBegin, check.nBegin);
+        std::swap(nEnd, check.nEnd);
+        std::swap(pparams, check.pparams);
+    }
+};
+} // anon namespace
+
+static CCheckQueue<CHeaderCheck> headercheckqueue(1);
+/** Held by the message handler currently using headercheckqueue */
+static CCriticalSection cs_headercheckqueue;
+
+void ThreadHeaderCheck() {
+    RenameThread("skeincoin-hdrcheck");
+    headercheckqueue.Thread();
+}
+
+void HashAndCheckHeaders(const std::vector<CBlockHeader>& headers, std::vector<uint256>& vHashes, std::vector<char>& vPowOk, const Consensus::Params& consensusParams)
+{
+    vHashes.resize(headers.size());
+    vPowOk.resize(headers.size());
+    std::vector<CHeaderCheck> vChecks;
+    for (size_t nBegin = 0; nBegin < headers.size(); nBegin += HEADER_CHECK_BATCH) {
+        size_t nEnd = std::min(nBegin + HEADER_CHECK_BATCH, headers.size());
+        vChecks.push_back(CHeaderCheck(&headers, &vHashes, &vPowOk, nBegin, nEnd, &consensusParams));
+    }
+
+    // A queue takes one controller at a time; message handlers that find it
+    // busy with another peer's headers hash theirs themselves.
+    if (vChecks.size() > 1 && nScriptCheckThreads > 1) {
+        TRY_LOCK(cs_headercheckqueue, lockQueue);
+        if (lockQueue) {
+            CCheckQueueControl<CHeaderCheck> control(&headercheckqueue);
+            control.Add(vChecks);
+            control.Wait();
+            return;
+        }
+    }
+    for (size_t i = 0; i < vChecks.size(); i++)
+        vChecks[i]();
+}
+
+/**
+ * Blocks read from disk ahead of being connected. Their inputs, and those of
+ * all blocks to connect up to pindexPrefetched, are in pcoinsTip unless it
+ * was flushed since (which resets pindexPrefetched). Protected by cs_main.
+ */
+static std::map<CBlockIndex*, CBlock> mapBlocksAhead;
+static CBlockIndex* pindexPrefetched = NULL;
+
 // Protected by cs_main
 VersionBitsCache versionbitscache;
 
@@ -2330,6 +2560,42 @@ int32_t ComputeBlockVersion(const CBlockIndex* pindexPrev, const Consensus::Para
     return nVersion;
 }
 
+static unsigned int GetBlockScriptFlags(const CBlockIndex* pindexPrev, int32_t nVersion, int64_t nTime, const Consensus::Params& consensusParams)
+{
+    AssertLockHeld(cs_main);
+
+    // BIP16 didn't become active until Apr 1 2012
+    int64_t nBIP16SwitchTime = 1333238400;
+    bool fStrictPayToScriptHash = (nTime >= nBIP16SwitchTime);
+
+    unsigned int flags = fStrictPayToScriptHash ? SCRIPT_VERIFY_P2SH : SCRIPT_VERIFY_NONE;
+
+    // Start enforcing the DERSIG (BIP66) rules, for block.nVersion=3 blocks,
+    // when 75% of the network has upgraded:
+    if (nVersion >= 3 && IsSuperMajority(3, pindexPrev, consensusParams.nMajorityEnforceBlockUpgrade, consensusParams)) {
+        flags |= SCRIPT_VERIFY_DERSIG;
+    }
+
+    // Start enforcing CHECKLOCKTIMEVERIFY, (BIP65) for block.nVersion=4
+    // blocks, when 75% of the network has upgraded:
+    if (nVersion >= 4 && IsSuperMajority(4, pindexPrev, consensusParams.nMajorityEnforceBlockUpgrade, consensusParams)) {
+        flags |= SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
+    }
+
+    // Start enforcing BIP112 (CHECKSEQUENCEVERIFY) using versionbits logic.
+    if (VersionBitsState(pindexPrev, consensusParams, Consensus::DEPLOYMENT_CSV, versionbitscache) == THRESHOLD_ACTIVE) {
+        flags |= SCRIPT_VERIFY_CHECKSEQUENCEVERIFY;
+    }
+
+    // Start enforcing WITNESS rules using versionbits logic.
+    if (IsWitnessEnabled(pindexPrev, consensusParams)) {
+        flags |= SCRIPT_VERIFY_WITNESS;
+        flags |= SCRIPT_VERIFY_NULLDUMMY;
+    }
+
+    return flags;
+}
+
 /**
  * Threshold condition checker that triggers when unknown versionbits are seen on the network.
  */
@@ -2428,43 +2694,20 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     if (fEnforceBIP30) {
         BOOST_FOREACH(const CTransaction& tx, block.vtx) {
-            const CCoins* coins = view.AccessCoins(tx.GetHash());
-            if (coins && !coins->IsPruned())
-                return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
-                                 REJECT_INVALID, "bad-txns-BIP30");
+            for (size_t o = 0; o < tx.vout.size(); o++) {
+                if (view.HaveCoin(COutPoint(tx.GetHash(), o)))
+                    return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
+                                     REJECT_INVALID, "bad-txns-BIP30");
+            }
         }
     }
 
-    // BIP16 didn't become active until Apr 1 2012
-    int64_t nBIP16SwitchTime = 1333238400;
-    bool fStrictPayToScriptHash = (pindex->GetBlockTime() >= nBIP16SwitchTime);
+    unsigned int flags = GetBlockScriptFlags(pindex->pprev, block.nVersion, pindex->GetBlockTime(), chainparams.GetConsensus());
 
-    unsigned int flags = fStrictPayToScriptHash ? SCRIPT_VERIFY_P2SH : SCRIPT_VERIFY_NONE;
-
-    // Start enforcing the DERSIG (BIP66) rules, for block.nVersion=3 blocks,
-    // when 75% of the network has upgraded:
-    if (block.nVersion >= 3 && IsSuperMajority(3, pindex->pprev, chainparams.GetConsensus().nMajorityEnforceBlockUpgrade, chainparams.GetConsensus())) {
-        flags |= SCRIPT_VERIFY_DERSIG;
-    }
-
-    // Start enforcing CHECKLOCKTIMEVERIFY, (BIP65) for block.nVersion=4
-    // blocks, when 75% of the network has upgraded:
-    if (block.nVersion >= 4 && IsSuperMajority(4, pindex->pprev, chainparams.GetConsensus().nMajorityEnforceBlockUpgrade, chainparams.GetConsensus())) {
-        flags |= SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
-    }
-
-    // Start enforcing BIP68 (sequence locks) and BIP112 (CHECKSEQUENCEVERIFY) using versionbits logic.
+    // Start enforcing BIP68 (sequence locks) along with BIP112 (CHECKSEQUENCEVERIFY).
     int nLockTimeFlags = 0;
-    if (VersionBitsState(pindex->pprev, chainparams.GetConsensus(), Consensus::DEPLOYMENT_CSV, versionbitscache) == THRESHOLD_ACTIVE) {
-        flags |= SCRIPT_VERIFY_CHECKSEQUENCEVERIFY;
+    if (flags & SCRIPT_VERIFY_CHECKSEQUENCEVERIFY)
         nLockTimeFlags |= LOCKTIME_VERIFY_SEQUENCE;
-    }
-
-    // Start enforcing WITNESS rules using versionbits logic.
-    if (IsWitnessEnabled(pindex->pprev, chainparams.GetConsensus())) {
-        flags |= SCRIPT_VERIFY_WITNESS;
-        flags |= SCRIPT_VERIFY_NULLDUMMY;
-    }
 
     int64_t nTime2 = GetTimeMicros(); nTimeForks += nTime2 - nTime1;
     LogPrint("bench", "    - Fork checks: %.2fms [%.2fs]\n", 0.001 * (nTime2 - nTime1), nTimeForks * 0.000001);
@@ -2501,7 +2744,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             // be in ConnectBlock because they require the UTXO set
             prevheights.resize(tx.vin.size());
             for (size_t j = 0; j < tx.vin.size(); j++) {
-                prevheights[j] = view.AccessCoins(tx.vin[j].prevout.hash)->nHeight;
+                prevheights[j] = view.AccessCoin(tx.vin[j].prevout).nHeight;
             }
 
             // Which orphan pool entries must we evict?
@@ -2537,7 +2780,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
             std::vector<CScriptCheck> vChecks;
             bool fCacheResults = fJustCheck; /* Don't cache results if we're actually connecting blocks (still consult the cache, though) */
-            if (!CheckInputs(tx, state, view, fScriptChecks, flags, fCacheResults, txdata[i], nScriptCheckThreads ? &vChecks : NULL))
+            if (!CheckInputs(tx, state, view, fScriptChecks, flags, fCacheResults, fCacheResults, txdata[i], nScriptCheckThreads ? &vChecks : NULL))
                 return error("ConnectBlock(): CheckInputs on %s failed with %s",
                     tx.GetHash().ToString(), FormatStateMessage(state));
             control.Add(vChecks);
@@ -2652,6 +2895,9 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
             }
         }
     }
+    // A failed background write leaves the chainstate on disk incomplete
+    if (pcoinsWriteBehind && pcoinsWriteBehind->HasFailed())
+        return AbortNode(state, "Failed to write to coin database");
     int64_t nNow = GetTimeMicros();
     // Avoid writing/flushing immediately after startup.
     if (nLastWrite == 0) {
@@ -2664,10 +2910,19 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
         nLastSetChain = nNow;
     }
     size_t cacheSize = pcoinsTip->DynamicMemoryUsage();
+    // Outputs still being written in the background count against -dbcache too.
+    size_t pendingSize = pcoinsWriteBehind ? pcoinsWriteBehind->DynamicMemoryUsage() : 0;
+    if (mode == FLUSH_STATE_IF_NEEDED && pendingSize > 0 && cacheSize + pendingSize > nCoinCacheUsage) {
+        // Flushing now would only queue the cache behind that write, so wait for it to free its memory first.
+        if (!pcoinsWriteBehind->Sync())
+            return AbortNode(state, "Failed to write to coin database");
+        pendingSize = 0;
+    }
     // The cache is large and close to the limit, but we have time now (not in the middle of a block processing).
-    bool fCacheLarge = mode == FLUSH_STATE_PERIODIC && cacheSize * (10.0/9) > nCoinCacheUsage;
+    // Not while a background write is still in flight, as the flush would have to wait for it.
+    bool fCacheLarge = mode == FLUSH_STATE_PERIODIC && pendingSize == 0 && cacheSize * (10.0/9) > nCoinCacheUsage;
     // The cache is over the limit, we have to write now.
-    bool fCacheCritical = mode == FLUSH_STATE_IF_NEEDED && cacheSize > nCoinCacheUsage;
+    bool fCacheCritical = mode == FLUSH_STATE_IF_NEEDED && cacheSize + pendingSize > nCoinCacheUsage;
     // It's been a while since we wrote the block index to disk. Do this frequently, so we don't need to redownload after a crash.
     bool fPeriodicWrite = mode == FLUSH_STATE_PERIODIC && nNow > nLastWrite + (int64_t)DATABASE_WRITE_INTERVAL * 1000000;
     // It's been very long since we flushed the cache. Do this infrequently, to optimize cache usage.
@@ -2699,25 +2954,36 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
                 return AbortNode(state, "Files to write to block index database");
             }
         }
-        // Finally remove any pruned files
-        if (fFlushForPrune)
-            UnlinkPrunedFiles(setFilesToPrune);
         nLastWrite = nNow;
     }
     // Flush best chain related state. This can only be done if the blocks / block index write was also done.
     if (fDoFullFlush) {
-        // Typical CCoins structures on disk are around 128 bytes in size.
+        // Typical Coin structures on disk are around 48 bytes in size.
         // Pushing a new one to the database can cause it to be written
         // twice (once in the log, and once in the tables). This is already
         // an overestimation, as most will delete an existing entry or
         // overwrite one. Still, use a conservative safety factor of 2.
-        if (!CheckDiskSpace(128 * 2 * 2 * pcoinsTip->GetCacheSize()))
+        unsigned int nCoins = pcoinsTip->GetCacheSize();
+        if (!CheckDiskSpace(48 * 2 * 2 * nCoins))
             return state.Error("out of disk space");
         // Flush the chainstate (which may refer to block index entries).
+        // With a background writer, this only waits for its previous write.
+        int64_t nFlushStart = GetTimeMicros();
         if (!pcoinsTip->Flush())
             return AbortNode(state, "Failed to write to coin database");
+        pindexPrefetched = NULL;
+        // Everything is written before shutting down, and before deleting
+        // blocks that replaying an interrupted write could need.
+        if (pcoinsWriteBehind && (mode == FLUSH_STATE_ALWAYS || fFlushForPrune) && !pcoinsWriteBehind->Sync())
+            return AbortNode(state, "Failed to write to coin database");
+        LogPrintf("%s: flushed %u cached outputs%s, validation stalled for %.2fms\n", __func__, nCoins,
+            pcoinsWriteBehind && mode != FLUSH_STATE_ALWAYS && !fFlushForPrune ? " to the background writer" : "",
+            0.001 * (GetTimeMicros() - nFlushStart));
         nLastFlush = nNow;
     }
+    // Finally remove any pruned files
+    if (fFlushForPrune)
+        UnlinkPrunedFiles(setFilesToPrune);
     if (fDoFullFlush || ((mode == FLUSH_STATE_ALWAYS || mode == FLUSH_STATE_PERIODIC) && nNow > nLastSetChain + (int64_t)DATABASE_WRITE_INTERVAL * 1000000)) {
         // Update best block in wallet (so we can detect restored wallets).
         GetMainSignals().SetBestChain(chainActive.GetLocator());
@@ -2807,6 +3073,7 @@ bool static DisconnectTip(CValidationState& state, const CChainParams& chainpara
 {
     CBlockIndex *pindexDelete = chainActive.Tip();
     assert(pindexDelete);
+    blockcache.Erase(pindexDelete->GetBlockHash());
     // Read block from disk.
     CBlock block;
     if (!ReadBlockFromDisk(block, pindexDelete, chainparams.GetConsensus()))
@@ -2860,6 +3127,67 @@ static int64_t nTimeConnectTotal = 0;
 static int64_t nTimeFlush = 0;
 static int64_t nTimeChainState = 0;
 static int64_t nTimePostConnect = 0;
+static int64_t nTimePrefetch = 0;
+static int64_t nTimePrefetchSaved = 0;
+static uint64_t nPrefetchInputs = 0;
+static uint64_t nPrefetchHits = 0;
+
+/**
+ * Get the block vpindexToConnect[nNext] (the list goes from the last block to
+ * connect to the first) ready to be connected: unless that was done already,
+ * read it and the next -prefetchblocks blocks after it, and prefetch their
+ * inputs into pcoinsTip in parallel. Returns the block, or NULL if it has to
+ * be read from disk.
+ */
+static const CBlock* PrefetchBlocksAhead(const CChainParams& chainparams, const std::vector<CBlockIndex*>& vpindexToConnect, int nNext, CBlockIndex* pindexMostWork, const CBlock* pblock)
+{
+    AssertLockHeld(cs_main);
+    CBlockIndex* pindexNext = vpindexToConnect[nNext];
+    if (nPrefetchBlocks > 0 && (!pindexPrefetched || pindexPrefetched->GetAncestor(pindexNext->nHeight) != pindexNext)) {
+        int64_t nTime1 = GetTimeMicros();
+        // Keep the blocks read already, and drop any that are no longer ahead
+        std::map<CBlockIndex*, CBlock> mapRead;
+        std::vector<const CBlock*> vBlocks;
+        for (int i = nNext; i >= 0 && i > nNext - nPrefetchBlocks; i--) {
+            CBlockIndex* pindex = vpindexToConnect[i];
+            if (pindex == pindexMostWork && pblock) {
+                vBlocks.push_back(pblock);
+            } else {
+                CBlock& block = mapRead[pindex];
+                std::map<CBlockIndex*, CBlock>::iterator it = mapBlocksAhead.find(pindex);
+                if (it != mapBlocksAhead.end()) {
+                    std::swap(block, it->second);
+                } else if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus())) {
+                    // Leave the failure to ConnectTip
+                    mapRead.erase(pindex);
+                    break;
+                }
+                vBlocks.push_back(&block);
+            }
+            pindexPrefetched = pindex;
+        }
+        mapBlocksAhead.swap(mapRead);
+        int64_t nTime2 = GetTimeMicros();
+
+        CCoinsPrefetchStats stats;
+        PrefetchBlockInputs(*pcoinsTip, vBlocks, nScriptCheckThreads ? &prefetchqueue : NULL, stats);
+        int64_t nTime3 = GetTimeMicros(); nTimePrefetch += nTime3 - nTime1;
+        const size_t nExternal = stats.nInputs - stats.nInternal;
+        nPrefetchInputs += nExternal;
+        nPrefetchHits += stats.nCached + stats.nFound;
+        nTimePrefetchSaved += stats.nReadMicros - stats.nWallMicros;
+        LogPrint("bench", "  - Prefetch %u blocks: %.2fms (reading blocks %.2fms) [%.2fs]\n", vBlocks.size(), (nTime3 - nTime1) * 0.001, (nTime2 - nTime1) * 0.001, nTimePrefetch * 0.000001);
+        LogPrint("bench", "    - %u inputs (%u created in batch, %u cached, %u fetched, %u missing), hit rate %.1f%% [%.1f%%], saved %.2fms [%.2fs]\n",
+            stats.nInputs, stats.nInternal, stats.nCached, stats.nFound, stats.nRead - stats.nFound,
+            nExternal ? 100.0 * (stats.nCached + stats.nFound) / nExternal : 100.0, nPrefetchInputs ? 100.0 * nPrefetchHits / nPrefetchInputs : 100.0,
+            (stats.nReadMicros - stats.nWallMicros) * 0.001, nTimePrefetchSaved * 0.000001);
+    }
+
+    if (pindexNext == pindexMostWork && pblock)
+        return pblock;
+    std::map<CBlockIndex*, CBlock>::const_iterator it = mapBlocksAhead.find(pindexNext);
+    return it != mapBlocksAhead.end() ? &it->second : NULL;
+}
 
 /**
  * Connect a new block to chainActive. pblock is either NULL or a pointer to a CBlock
@@ -3028,8 +3356,14 @@ static bool ActivateBestChainStep(CValidationState& state, const CChainParams& c
         nHeight = nTargetHeight;
 
         // Connect new blocks.
-        BOOST_REVERSE_FOREACH(CBlockIndex *pindexConnect, vpindexToConnect) {
-            if (!ConnectTip(state, chainparams, pindexConnect, pindexConnect == pindexMostWork ? pblock : NULL)) {
+        for (int i = vpindexToConnect.size() - 1; i >= 0; i--) {
+            CBlockIndex *pindexConnect = vpindexToConnect[i];
+            const CBlock *pblockConnect = PrefetchBlocksAhead(chainparams, vpindexToConnect, i, pindexMostWork, pblock);
+            bool fConnected = ConnectTip(state, chainparams, pindexConnect, pblockConnect);
+            mapBlocksAhead.erase(pindexConnect);
+            if (!fConnected) {
+                mapBlocksAhead.clear();
+                pindexPrefetched = NULL;
                 if (state.IsInvalid()) {
                     // The block violates a consensus rule.
                     if (!state.CorruptionPossible())
@@ -3251,10 +3585,9 @@ bool ResetBlockFailureFlags(CBlockIndex *pindex) {
     return true;
 }
 
-CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
+CBlockIndex* AddToBlockIndex(const CBlockHeader& block, const uint256& hash)
 {
     // Check for duplicate
-    uint256 hash = block.GetHash();
     BlockMap::iterator it = mapBlockIndex.find(hash);
     if (it != mapBlockIndex.end())
         return it->second;
@@ -3672,11 +4005,12 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
     return true;
 }
 
-static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex=NULL)
+/** Accept a header whose hash is already known. With fCheckPOW false, its
+ *  proof of work must have been checked against that hash. */
+static bool AcceptBlockHeader(const CBlockHeader& block, const uint256& hash, bool fCheckPOW, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex=NULL)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
-    uint256 hash = block.GetHash();
     BlockMap::iterator miSelf = mapBlockIndex.find(hash);
     CBlockIndex *pindex = NULL;
     if (hash != chainparams.GetConsensus().hashGenesisBlock) {
@@ -3691,7 +4025,7 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
             return true;
         }
 
-        if (!CheckBlockHeader(block, state, chainparams.GetConsensus()))
+        if (!CheckBlockHeader(block, state, chainparams.GetConsensus(), fCheckPOW))
             return error("%s: Consensus::CheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
 
         // Get prev block index
@@ -3711,7 +4045,7 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
             return error("%s: Consensus::ContextualCheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
     }
     if (pindex == NULL)
-        pindex = AddToBlockIndex(block);
+        pindex = AddToBlockIndex(block, hash);
 
     if (ppindex)
         *ppindex = pindex;
@@ -3719,6 +4053,11 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
     return true;
 }
 
+static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex=NULL)
+{
+    return AcceptBlockHeader(block, block.GetHash(), true, state, chainparams, ppindex);
+}
+
 /** Store block on disk. If dbp is non-NULL, the file is known to already reside on disk */
 static bool AcceptBlock(const CBlock& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, bool* fNewBlock)
 {
@@ -4025,27 +4364,98 @@ CBlockIndex * InsertBlockIndex(uint256 hash)
     return pindexNew;
 }
 
+namespace {
+/** Worker threads used while loading the block index, stopped once it is done. */
+class CBlockIndexLoadWorkers
+{
+private:
+    CBlockIndexLoadQueue queue;
+    boost::thread_group threadGroup;
+
+public:
+    CBlockIndexLoadWorkers(int nThreads) : queue(1)
+    {
+        for (int i = 0; i < nThreads; i++)
+            threadGroup.create_thread(boost::bind(&CBlockIndexLoadQueue::Thread, &queue));
+    }
+
+    ~CBlockIndexLoadWorkers()
+    {
+        threadGroup.interrupt_all();
+        threadGroup.join_all();
+    }
+
+    CBlockIndexLoadQueue* Queue() { return threadGroup.size() ? &queue : NULL; }
+};
+
+/** Store each entry's own proof in nChainWork and, for entries on chain, set the skip pointer. */
+bool ComputeBlockProofsAndSkips(const std::vector<CBlockIndex*>* pvIndex, size_t nBegin, size_t nEnd, const CChain* pchain)
+{
+    for (size_t i = nBegin; i < nEnd; i++) {
+        CBlockIndex* pindex = (*pvIndex)[i];
+        pindex->nChainWork = GetBlockProof(*pindex);
+        if (pchain->Contains(pindex))
+            pchain->BuildSkip(pindex);
+    }
+    return true;
+}
+} // anon namespace
+
 bool static LoadBlockIndexDB()
 {
-    const CChainParams& chainparams = Params();
-    if (!pblocktree->LoadBlockIndexGuts(InsertBlockIndex))
+    CBlockIndexLoadWorkers workers(nScriptCheckThreads ? nScriptCheckThreads - 1 : 0);
+
+    int64_t nTimeStart = GetTimeMicros();
+    if (!pblocktree->LoadBlockIndexGuts(InsertBlockIndex, workers.Queue()))
         return false;
+    int64_t nTimeLoad = GetTimeMicros();
 
     boost::this_thread::interruption_point();
 
-    // Calculate nChainWork
-    vector<pair<int, CBlockIndex*> > vSortedByHeight;
-    vSortedByHeight.reserve(mapBlockIndex.size());
+    // Bucket the entries by height; parents always come before their children
+    int nMaxHeight = -1;
+    CBlockIndex* pindexHighest = NULL;
     BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
     {
-        CBlockIndex* pindex = item.second;
-        vSortedByHeight.push_back(make_pair(pindex->nHeight, pindex));
+        if (item.second->nHeight > nMaxHeight) {
+            nMaxHeight = item.second->nHeight;
+            pindexHighest = item.second;
+        }
     }
-    sort(vSortedByHeight.begin(), vSortedByHeight.end());
-    BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight)
+    vector<size_t> vBucketStart(nMaxHeight + 2, 0);
+    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+        vBucketStart[item.second->nHeight + 1]++;
+    for (int nHeight = 0; nHeight <= nMaxHeight; nHeight++)
+        vBucketStart[nHeight + 1] += vBucketStart[nHeight];
+    vector<CBlockIndex*> vSortedByHeight(mapBlockIndex.size());
+    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+        vSortedByHeight[vBucketStart[item.second->nHeight]++] = item.second;
+    int64_t nTimeSort = GetTimeMicros();
+
+    // Block proofs and the skip pointers of the longest chain don't depend on
+    // each other, so they are computed in parallel; the rest is linked below.
+    CChain chainLongest;
+    chainLongest.SetTip(pindexHighest);
     {
-        CBlockIndex* pindex = item.second;
-        pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
+        CCheckQueueControl<CBlockIndexLoadJob> control(workers.Queue());
+        for (size_t nBegin = 0; nBegin < vSortedByHeight.size(); nBegin += BLOCK_INDEX_VERIFY_BATCH) {
+            size_t nEnd = std::min(nBegin + BLOCK_INDEX_VERIFY_BATCH, vSortedByHeight.size());
+            if (workers.Queue()) {
+                std::vector<CBlockIndexLoadJob> vJobs(1, CBlockIndexLoadJob(boost::bind(ComputeBlockProofsAndSkips, &vSortedByHeight, nBegin, nEnd, &chainLongest)));
+                control.Add(vJobs);
+            } else {
+                ComputeBlockProofsAndSkips(&vSortedByHeight, nBegin, nEnd, &chainLongest);
+            }
+        }
+        control.Wait();
+    }
+    int64_t nTimeWork = GetTimeMicros();
+
+    // Calculate nChainWork
+    BOOST_FOREACH(CBlockIndex* pindex, vSortedByHeight)
+    {
+        // nChainWork holds this block's own proof at this point
+        pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + pindex->nChainWork;
         // We can link the chain of blocks for which we've received transactions at some point.
         // Pruned nodes may have deleted the block.
         if (pindex->nTx > 0) {
@@ -4064,11 +4474,14 @@ bool static LoadBlockIndexDB()
             setBlockIndexCandidates.insert(pindex);
         if (pindex->nStatus & BLOCK_FAILED_MASK && (!pindexBestInvalid || pindex->nChainWork > pindexBestInvalid->nChainWork))
             pindexBestInvalid = pindex;
-        if (pindex->pprev)
+        if (pindex->pprev && !pindex->pskip)
             pindex->BuildSkip();
         if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == NULL || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
             pindexBestHeader = pindex;
     }
+    int64_t nTimeLink = GetTimeMicros();
+    LogPrintf("%s: %u entries: load %.2fms, sort %.2fms, proofs and skip pointers %.2fms, link %.2fms\n", __func__, vSortedByHeight.size(),
+        (nTimeLoad - nTimeStart) * 0.001, (nTimeSort - nTimeLoad) * 0.001, (nTimeWork - nTimeSort) * 0.001, (nTimeLink - nTimeWork) * 0.001);
 
     // Load block file info
     pblocktree->ReadLastBlockFile(nLastBlockFile);
@@ -4119,6 +4532,15 @@ bool static LoadBlockIndexDB()
     pblocktree->ReadFlag("txindex", fTxIndex);
     LogPrintf("%s: transaction index %s\n", __func__, fTxIndex ? "enabled" : "disabled");
 
+    return true;
+}
+
+bool LoadChainTip(const CChainParams& chainparams)
+{
+    LOCK(cs_main);
+    if (chainActive.Tip() && chainActive.Tip()->GetBlockHash() == pcoinsTip->GetBestBlock())
+        return true;
+
     // Load pointer to end of best chain
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     if (it == mapBlockIndex.end())
@@ -4135,6 +4557,92 @@ bool static LoadBlockIndexDB()
     return true;
 }
 
+/** Apply the effects of a block on the utxo cache, ignoring that it may already have been applied. */
+static bool RollforwardBlock(const CBlockIndex* pindex, CCoinsViewCache& inputs, const CChainParams& params)
+{
+    CBlock block;
+    if (!ReadBlockFromDisk(block, pindex, params.GetConsensus()))
+        return error("ReplayBlock(): ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+
+    BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+        if (!tx.IsCoinBase()) {
+            BOOST_FOREACH(const CTxIn& txin, tx.vin)
+                inputs.SpendCoin(txin.prevout);
+        }
+        // Every output may already be there
+        AddCoins(inputs, tx, pindex->nHeight, true);
+    }
+    return true;
+}
+
+bool ReplayBlocks(const CChainParams& params, CCoinsView* view)
+{
+    LOCK(cs_main);
+
+    CCoinsViewCache cache(view);
+
+    std::vector<uint256> vhashHeads = view->GetHeadBlocks();
+    if (vhashHeads.empty())
+        return true; // The database is consistent
+    if (vhashHeads.size() != 2)
+        return error("ReplayBlocks(): unknown inconsistent state");
+
+    uiInterface.ShowProgress(_("Replaying blocks..."), 0);
+    LogPrintf("Replaying blocks\n");
+
+    CBlockIndex* pindexOld = NULL;  // Old tip during the interrupted write
+    CBlockIndex* pindexNew = NULL;  // New tip during the interrupted write
+    CBlockIndex* pindexFork = NULL; // Latest block common to both of them
+
+    BlockMap::iterator it = mapBlockIndex.find(vhashHeads[0]);
+    if (it == mapBlockIndex.end())
+        return error("ReplayBlocks(): reorganization to unknown block requested");
+    pindexNew = it->second;
+
+    if (!vhashHeads[1].IsNull()) { // The old tip is null for the first write
+        it = mapBlockIndex.find(vhashHeads[1]);
+        if (it == mapBlockIndex.end())
+            return error("ReplayBlocks(): reorganization from unknown block requested");
+        pindexOld = it->second;
+        pindexFork = LastCommonAncestor(pindexOld, pindexNew);
+        assert(pindexFork != NULL);
+    }
+
+    // Roll back along the old branch. Writing or deleting an output are both
+    // idempotent, so blocks whose changes were only partly written are
+    // undone all the same; the result is merely not "clean".
+    if (pindexOld)
+        cache.SetBestBlock(pindexOld->GetBlockHash());
+    while (pindexOld != pindexFork) {
+        if (pindexOld->nHeight > 0) { // Never disconnect the genesis block
+            CBlock block;
+            if (!ReadBlockFromDisk(block, pindexOld, params.GetConsensus()))
+                return error("ReplayBlocks(): ReadBlockFromDisk() failed at %d, hash=%s", pindexOld->nHeight, pindexOld->GetBlockHash().ToString());
+            LogPrintf("Rolling back %s (%i)\n", pindexOld->GetBlockHash().ToString(), pindexOld->nHeight);
+            CValidationState state;
+            bool fClean = true;
+            if (!DisconnectBlock(block, state, pindexOld, cache, &fClean))
+                return error("ReplayBlocks(): DisconnectBlock failed at %d, hash=%s", pindexOld->nHeight, pindexOld->GetBlockHash().ToString());
+        }
+        pindexOld = pindexOld->pprev;
+    }
+
+    // Roll forward from the fork to the new tip
+    int nForkHeight = pindexFork ? pindexFork->nHeight : 0;
+    for (int nHeight = nForkHeight + 1; nHeight <= pindexNew->nHeight; ++nHeight) {
+        const CBlockIndex* pindex = pindexNew->GetAncestor(nHeight);
+        LogPrintf("Rolling forward %s (%i)\n", pindex->GetBlockHash().ToString(), nHeight);
+        uiInterface.ShowProgress(_("Replaying blocks..."), (int)((nHeight - nForkHeight) * 100.0 / (pindexNew->nHeight - nForkHeight)));
+        if (!RollforwardBlock(pindex, cache, params))
+            return false;
+    }
+
+    cache.SetBestBlock(pindexNew->GetBlockHash());
+    cache.Flush();
+    uiInterface.ShowProgress("", 100);
+    return true;
+}
+
 CVerifyDB::CVerifyDB()
 {
     uiInterface.ShowProgress(_("Verifying blocks..."), 0);
@@ -4392,7 +4900,7 @@ bool InitBlockIndex(const CChainParams& chainparams)
                 return error("LoadBlockIndex(): FindBlockPos failed");
             if (!WriteBlockToDisk(block, blockPos, chainparams.MessageStart()))
                 return error("LoadBlockIndex(): writing genesis block to disk failed");
-            CBlockIndex *pindex = AddToBlockIndex(block);
+            CBlockIndex *pindex = AddToBlockIndex(block, block.GetHash());
             if (!ReceivedBlockTransactions(block, state, pindex, blockPos))
                 return error("LoadBlockIndex(): genesis block not accepted");
             // Force a chainstate write so that when we VerifyDB in a moment, it doesn't check stale data
@@ -4777,12 +5285,14 @@ bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
                 recentRejects->reset();
             }
 
-            // Use pcoinsTip->HaveCoinsInCache as a quick approximation to exclude
-            // requesting or processing some txs which have already been included in a block
+            // Use pcoinsTip->HaveCoinInCache as a quick approximation to exclude
+            // requesting or processing some txs which have already been included in a block.
+            // Only the first two outputs are checked, as most transactions have no more.
             return recentRejects->contains(inv.hash) ||
                    mempool.exists(inv.hash) ||
                    mapOrphanTransactions.count(inv.hash) ||
-                   pcoinsTip->HaveCoinsInCache(inv.hash);
+                   pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 0)) ||
+                   pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 1));
         }
     case MSG_BLOCK:
     case MSG_WITNESS_BLOCK:
@@ -4798,8 +5308,9 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
 
     vector<CInv> vNotFound;
 
-    LOCK(cs_main);
-
+    // cs_main is only held while looking requests up. Blocks are read from
+    // disk and serialized without it, so that serving them doesn't hold up
+    // the other peers.
     while (it != pfrom->vRecvGetData.end()) {
         // Don't bother if send buffer is too full to respond anyway
         if (pfrom->nSendSize >= SendBufferSize())
@@ -4813,44 +5324,85 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
             if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK || inv.type == MSG_WITNESS_BLOCK)
             {
                 bool send = false;
-                BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
-                if (mi != mapBlockIndex.end())
+                CDiskBlockPos blockPos;
+                bool fSendCmpct = false;
+                bool fPeerWantsWitness = false;
+                bool fWitnessEnabled = true;
+                bool fAddToCache = false;
+                uint256 hashTip;
                 {
-                    if (chainActive.Contains(mi->second)) {
-                        send = true;
-                    } else {
-                        static const int nOneMonth = 30 * 24 * 60 * 60;
-                        // To prevent fingerprinting attacks, only send blocks outside of the active
-                        // chain if they are valid, and no more than a month older (both in time, and in
-                        // best equivalent proof of work) than the best header chain we know about.
-                        send = mi->second->IsValid(BLOCK_VALID_SCRIPTS) && (pindexBestHeader != NULL) &&
-                            (pindexBestHeader->GetBlockTime() - mi->second->GetBlockTime() < nOneMonth) &&
-                            (GetBlockProofEquivalentTime(*pindexBestHeader, *mi->second, *pindexBestHeader, consensusParams) < nOneMonth);
-                        if (!send) {
-                            LogPrintf("%s: ignoring request from peer=%i for old block that isn't in the main chain\n", __func__, pfrom->GetId());
+                    LOCK(cs_main);
+                    BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
+                    if (mi != mapBlockIndex.end())
+                    {
+                        if (chainActive.Contains(mi->second)) {
+                            send = true;
+                        } else {
+                            static const int nOneMonth = 30 * 24 * 60 * 60;
+                            // To prevent fingerprinting attacks, only send blocks outside of the active
+                            // chain if they are valid, and no more than a month older (both in time, and in
+                            // best equivalent proof of work) than the best header chain we know about.
+                            send = mi->second->IsValid(BLOCK_VALID_SCRIPTS) && (pindexBestHeader != NULL) &&
+                                (pindexBestHeader->GetBlockTime() - mi->second->GetBlockTime() < nOneMonth) &&
+                                (GetBlockProofEquivalentTime(*pindexBestHeader, *mi->second, *pindexBestHeader, consensusParams) < nOneMonth);
+                            if (!send) {
+                                LogPrintf("%s: ignoring request from peer=%i for old block that isn't in the main chain\n", __func__, pfrom->GetId());
+                            }
                         }
                     }
-                }
-                // disconnect node in case we have reached the outbound limit for serving historical blocks
-                // never disconnect whitelisted nodes
-                static const int nOneWeek = 7 * 24 * 60 * 60; // assume > 1 week = historical
-                if (send && CNode::OutboundTargetReached(true) && ( ((pindexBestHeader != NULL) && (pindexBestHeader->GetBlockTime() - mi->second->GetBlockTime() > nOneWeek)) || inv.type == MSG_FILTERED_BLOCK) && !pfrom->fWhitelisted)
-                {
-                    LogPrint("net", "historical block serving limit reached, disconnect peer=%d\n", pfrom->GetId());
+                    // disconnect node in case we have reached the outbound limit for serving historical blocks
+                    // never disconnect whitelisted nodes
+                    static const int nOneWeek = 7 * 24 * 60 * 60; // assume > 1 week = historical
+                    if (send && CNode::OutboundTargetReached(true) && ( ((pindexBestHeader != NULL) && (pindexBestHeader->GetBlockTime() - mi->second->GetBlockTime() > nOneWeek)) || inv.type == MSG_FILTERED_BLOCK) && !pfrom->fWhitelisted)
+                    {
+                        LogPrint("net", "historical block serving limit reached, disconnect peer=%d\n", pfrom->GetId());
 
-                    //disconnect node
-                    pfrom->fDisconnect = true;
-                    send = false;
+                        //disconnect node
+                        pfrom->fDisconnect = true;
+                        send = false;
+                    }
+                    // Pruned nodes may have deleted the block, so check whether
+                    // it's available before trying to send.
+                    if (send && (mi->second->nStatus & BLOCK_HAVE_DATA)) {
+                        blockPos = mi->second->GetBlockPos();
+                        // If a peer is asking for old blocks, we're almost guaranteed
+                        // they wont have a useful mempool to match against a compact block,
+                        // and we don't feel like constructing the object for them, so
+                        // instead we respond with the full, non-compact block.
+                        fPeerWantsWitness = State(pfrom->GetId())->fWantsCmpctWitness;
+                        fSendCmpct = CanDirectFetch(consensusParams) && mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH;
+                        fWitnessEnabled = IsWitnessEnabled(mi->second->pprev, consensusParams);
+                        fAddToCache = mi->second->nHeight > chainActive.Height() - BLOCK_SERVE_CACHE_DEPTH;
+                        hashTip = chainActive.Tip()->GetBlockHash();
+                    } else {
+                        send = false;
+                    }
                 }
-                // Pruned nodes may have deleted the block, so check whether
-                // it's available before trying to send.
-                if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
+                // Blocks are stored with their witness data. When that is what
+                // the peer gets, send the stored bytes as they are instead of
+                // decoding and re-encoding the block. Blocks from before segwit
+                // activation have no witness data to strip.
+                const bool fSendWitness = inv.type == MSG_WITNESS_BLOCK || (inv.type == MSG_CMPCT_BLOCK && fPeerWantsWitness);
+                const bool fSendRaw = (inv.type == MSG_BLOCK || inv.type == MSG_WITNESS_BLOCK || (inv.type == MSG_CMPCT_BLOCK && !fSendCmpct)) &&
+                    (fSendWitness || !fWitnessEnabled);
+
+                // Send block from disk, or from the cache of recently served blocks
+                CBlock block;
+                std::shared_ptr<const std::vector<unsigned char> > pvchBlock;
+                if (send) {
+                    if (fSendRaw)
+                        send = ReadServedBlock(pvchBlock, blockPos, inv.hash, Params().MessageStart(), fAddToCache);
+                    else
+                        send = ReadServedBlock(block, blockPos, inv.hash, Params(), fAddToCache);
+                    // The block file may have been pruned since cs_main was released
+                    if (!send)
+                        LogPrint("net", "%s: could not load block %s requested by peer=%d\n", __func__, inv.hash.ToString(), pfrom->GetId());
+                }
+                if (send)
                 {
-                    // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second, consensusParams))
-                        assert(!"cannot load block from disk");
-                    if (inv.type == MSG_BLOCK)
+                    if (fSendRaw)
+                        pfrom->PushMessage(NetMsgType::BLOCK, CFlatData((void*)pvchBlock->data(), (void*)(pvchBlock->data() + pvchBlock->size())));
+                    else if (inv.type == MSG_BLOCK)
                         pfrom->PushMessageWithFlag(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, block);
                     else if (inv.type == MSG_WITNESS_BLOCK)
                         pfrom->PushMessage(NetMsgType::BLOCK, block);
@@ -4882,12 +5434,7 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                     }
                     else if (inv.type == MSG_CMPCT_BLOCK)
                     {
-                        // If a peer is asking for old blocks, we're almost guaranteed
-                        // they wont have a useful mempool to match against a compact block,
-                        // and we don't feel like constructing the object for them, so
-                        // instead we respond with the full, non-compact block.
-                        bool fPeerWantsWitness = State(pfrom->GetId())->fWantsCmpctWitness;
-                        if (CanDirectFetch(consensusParams) && mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH) {
+                        if (fSendCmpct) {
                             CBlockHeaderAndShortTxIDs cmpctblock(block, fPeerWantsWitness);
                             pfrom->PushMessageWithFlag(fPeerWantsWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::CMPCTBLOCK, cmpctblock);
                         } else
@@ -4901,7 +5448,7 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                         // and we want it right after the last block so they don't
                         // wait for other stuff first.
                         vector<CInv> vInv;
-                        vInv.push_back(CInv(MSG_BLOCK, chainActive.Tip()->GetBlockHash()));
+                        vInv.push_back(CInv(MSG_BLOCK, hashTip));
                         pfrom->PushMessage(NetMsgType::INV, vInv);
                         pfrom->hashContinue.SetNull();
                     }
@@ -4910,21 +5457,23 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
             else if (inv.type == MSG_TX || inv.type == MSG_WITNESS_TX)
             {
                 // Send stream from relay memory
-                bool push = false;
-                auto mi = mapRelay.find(inv.hash);
-                if (mi != mapRelay.end()) {
-                    pfrom->PushMessageWithFlag(inv.type == MSG_TX ? SERIALIZE_TRANSACTION_NO_WITNESS : 0, NetMsgType::TX, *mi->second);
-                    push = true;
-                } else if (pfrom->timeLastMempoolReq) {
+                std::shared_ptr<const CTransaction> ptx;
+                {
+                    LOCK(cs_main);
+                    auto mi = mapRelay.find(inv.hash);
+                    if (mi != mapRelay.end())
+                        ptx = mi->second;
+                }
+                if (!ptx && pfrom->timeLastMempoolReq) {
                     auto txinfo = mempool.info(inv.hash);
                     // To protect privacy, do not answer getdata using the mempool when
                     // that TX couldn't have been INVed in reply to a MEMPOOL request.
-                    if (txinfo.tx && txinfo.nTime <= pfrom->timeLastMempoolReq) {
-                        pfrom->PushMessageWithFlag(inv.type == MSG_TX ? SERIALIZE_TRANSACTION_NO_WITNESS : 0, NetMsgType::TX, *txinfo.tx);
-                        push = true;
-                    }
+                    if (txinfo.tx && txinfo.nTime <= pfrom->timeLastMempoolReq)
+                        ptx = txinfo.tx;
                 }
-                if (!push) {
+                if (ptx) {
+                    pfrom->PushMessageWithFlag(inv.type == MSG_TX ? SERIALIZE_TRANSACTION_NO_WITNESS : 0, NetMsgType::TX, *ptx);
+                } else {
                     vNotFound.push_back(inv);
                 }
             }
@@ -5425,44 +5974,60 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         BlockTransactionsRequest req;
         vRecv >> req;
 
-        LOCK(cs_main);
+        CDiskBlockPos blockPos;
+        bool fWantsCmpctWitness;
+        {
+            LOCK(cs_main);
 
-        BlockMap::iterator it = mapBlockIndex.find(req.blockhash);
-        if (it == mapBlockIndex.end() || !(it->second->nStatus & BLOCK_HAVE_DATA)) {
-            LogPrintf("Peer %d sent us a getblocktxn for a block we don't have", pfrom->id);
-            return true;
-        }
+            BlockMap::iterator it = mapBlockIndex.find(req.blockhash);
+            if (it == mapBlockIndex.end() || !(it->second->nStatus & BLOCK_HAVE_DATA)) {
+                LogPrintf("Peer %d sent us a getblocktxn for a block we don't have", pfrom->id);
+                return true;
+            }
 
-        if (it->second->nHeight < chainActive.Height() - MAX_BLOCKTXN_DEPTH) {
-            // If an older block is requested (should never happen in practice,
-            // but can happen in tests) send a block response instead of a
-            // blocktxn response. Sending a full block response instead of a
-            // small blocktxn response is preferable in the case where a peer
-            // might maliciously send lots of getblocktxn requests to trigger
-            // expensive disk reads, because it will require the peer to
-            // actually receive all the data read from disk over the network.
-            LogPrint("net", "Peer %d sent us a getblocktxn for a block > %i deep", pfrom->id, MAX_BLOCKTXN_DEPTH);
-            CInv inv;
-            inv.type = State(pfrom->GetId())->fWantsCmpctWitness ? MSG_WITNESS_BLOCK : MSG_BLOCK;
-            inv.hash = req.blockhash;
-            pfrom->vRecvGetData.push_back(inv);
+            fWantsCmpctWitness = State(pfrom->GetId())->fWantsCmpctWitness;
+            if (it->second->nHeight < chainActive.Height() - MAX_BLOCKTXN_DEPTH) {
+                // If an older block is requested (should never happen in practice,
+                // but can happen in tests) send a block response instead of a
+                // blocktxn response. Sending a full block response instead of a
+                // small blocktxn response is preferable in the case where a peer
+                // might maliciously send lots of getblocktxn requests to trigger
+                // expensive disk reads, because it will require the peer to
+                // actually receive all the data read from disk over the network.
+                LogPrint("net", "Peer %d sent us a getblocktxn for a block > %i deep", pfrom->id, MAX_BLOCKTXN_DEPTH);
+                CInv inv;
+                inv.type = fWantsCmpctWitness ? MSG_WITNESS_BLOCK : MSG_BLOCK;
+                inv.hash = req.blockhash;
+                pfrom->vRecvGetData.push_back(inv);
+                blockPos.SetNull();
+            } else {
+                blockPos = it->second->GetBlockPos();
+            }
+        }
+        if (blockPos.IsNull()) {
             ProcessGetData(pfrom, chainparams.GetConsensus());
             return true;
         }
 
+        // Read the block without holding cs_main; it may have been pruned since.
+        // It is within MAX_BLOCKTXN_DEPTH of the tip, so worth caching.
         CBlock block;
-        assert(ReadBlockFromDisk(block, it->second, chainparams.GetConsensus()));
+        if (!ReadServedBlock(block, blockPos, req.blockhash, chainparams, true)) {
+            LogPrint("net", "Peer %d sent us a getblocktxn for a block we could not load\n", pfrom->id);
+            return true;
+        }
 
         BlockTransactions resp(req);
         for (size_t i = 0; i < req.indexes.size(); i++) {
             if (req.indexes[i] >= block.vtx.size()) {
+                LOCK(cs_main);
                 Misbehaving(pfrom->GetId(), 100);
                 LogPrintf("Peer %d sent us a getblocktxn with out-of-bounds tx indices", pfrom->id);
                 return true;
             }
             resp.txn[i] = block.vtx[req.indexes[i]];
         }
-        pfrom->PushMessageWithFlag(State(pfrom->GetId())->fWantsCmpctWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCKTXN, resp);
+        pfrom->PushMessageWithFlag(fWantsCmpctWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCKTXN, resp);
     }
 
 
@@ -5947,6 +6512,12 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
         }
 
+        // Hashing the headers is most of the work of accepting them, and
+        // needs no locks.
+        std::vector<uint256> vHashes;
+        std::vector<char> vPowOk;
+        HashAndCheckHeaders(headers, vHashes, vPowOk, chainparams.GetConsensus());
+
         {
         LOCK(cs_main);
 
@@ -5969,14 +6540,14 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             nodestate->nUnconnectingHeaders++;
             pfrom->PushMessage(NetMsgType::GETHEADERS, chainActive.GetLocator(pindexBestHeader), uint256());
             LogPrint("net", "received header %s: missing prev block %s, sending getheaders (%d) to end (peer=%d, nUnconnectingHeaders=%d)\n",
-                    headers[0].GetHash().ToString(),
+                    vHashes[0].ToString(),
                     headers[0].hashPrevBlock.ToString(),
                     pindexBestHeader->nHeight,
                     pfrom->id, nodestate->nUnconnectingHeaders);
             // Set hashLastUnknownBlock for this peer, so that if we
             // eventually get the headers - even from a different peer -
             // we can use this peer to download.
-            UpdateBlockAvailability(pfrom->GetId(), headers.back().GetHash());
+            UpdateBlockAvailability(pfrom->GetId(), vHashes.back());
 
             if (nodestate->nUnconnectingHeaders % MAX_UNCONNECTING_HEADERS == 0) {
                 Misbehaving(pfrom->GetId(), 20);
@@ -5985,13 +6556,16 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         }
 
         CBlockIndex *pindexLast = NULL;
-        BOOST_FOREACH(const CBlockHeader& header, headers) {
+        for (unsigned int n = 0; n < nCount; n++) {
+            const CBlockHeader& header = headers[n];
             CValidationState state;
             if (pindexLast != NULL && header.hashPrevBlock != pindexLast->GetBlockHash()) {
                 Misbehaving(pfrom->GetId(), 20);
                 return error("non-continuous headers sequence");
             }
-            if (!AcceptBlockHeader(header, state, chainparams, &pindexLast)) {
+            // Headers failing their proof of work are checked again, so
+            // they are rejected the usual way.
+            if (!AcceptBlockHeader(header, vHashes[n], !vPowOk[n], state, chainparams, &pindexLast)) {
                 int nDoS;
                 if (state.IsInvalid(nDoS)) {
                     if (nDoS > 0)
@@ -6126,7 +6700,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         }
         pfrom->fSentAddr = true;
 
-        pfrom->vAddrToSend.clear();
+        {
+            LOCK(pfrom->cs_vAddrToSend);
+            pfrom->vAddrToSend.clear();
+        }
         vector<CAddress> vAddr = addrman.GetAddr();
         BOOST_FOREACH(const CAddress &addr, vAddr)
             pfrom->PushAddress(addr);
@@ -6537,27 +7114,25 @@ bool SendMessages(CNode* pto)
         if (pto->nNextAddrSend < nNow) {
             pto->nNextAddrSend = PoissonNextSend(nNow, AVG_ADDRESS_BROADCAST_INTERVAL);
             vector<CAddress> vAddr;
-            vAddr.reserve(pto->vAddrToSend.size());
-            BOOST_FOREACH(const CAddress& addr, pto->vAddrToSend)
             {
-                if (!pto->addrKnown.contains(addr.GetKey()))
+                LOCK(pto->cs_vAddrToSend);
+                vAddr.reserve(pto->vAddrToSend.size());
+                BOOST_FOREACH(const CAddress& addr, pto->vAddrToSend)
                 {
-                    pto->addrKnown.insert(addr.GetKey());
-                    vAddr.push_back(addr);
-                    // receiver rejects addr messages larger than 1000
-                    if (vAddr.size() >= 1000)
+                    if (!pto->addrKnown.contains(addr.GetKey()))
                     {
-                        pto->PushMessage(NetMsgType::ADDR, vAddr);
-                        vAddr.clear();
+                        pto->addrKnown.insert(addr.GetKey());
+                        vAddr.push_back(addr);
                     }
                 }
+                pto->vAddrToSend.clear();
+                // we only send the big addr message once
+                if (pto->vAddrToSend.capacity() > 40)
+                    pto->vAddrToSend.shrink_to_fit();
             }
-            pto->vAddrToSend.clear();
-            if (!vAddr.empty())
-                pto->PushMessage(NetMsgType::ADDR, vAddr);
-            // we only send the big addr message once
-            if (pto->vAddrToSend.capacity() > 40)
-                pto->vAddrToSend.shrink_to_fit();
+            // receiver rejects addr messages larger than 1000
+            for (size_t nStart = 0; nStart < vAddr.size(); nStart += 1000)
+                pto->PushMessage(NetMsgType::ADDR, vector<CAddress>(vAddr.begin() + nStart, vAddr.begin() + std::min(vAddr.size(), nStart + 1000)));
         }
 
         CNodeState &state = *State(pto->GetId());
@@ -6971,6 +7546,166 @@ bool SendMessages(CNode* pto)
      return strprintf("CBlockFileInfo(blocks=%u, size=%u, heights=%u...%u, time=%s...%s)", nBlocks, nSize, nHeightFirst, nHeightLast, DateTimeStrFormat("%Y-%m-%d", nTimeFirst), DateTimeStrFormat("%Y-%m-%d", nTimeLast));
  }
 
+static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+
+bool DumpMempool()
+{
+    int64_t nTimeStart = GetTimeMicros();
+
+    std::vector<TxMempoolInfo> vinfo;
+    std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+    {
+        LOCK(mempool.cs);
+        mapDeltas = mempool.mapDeltas;
+        vinfo = mempool.infoAll();
+    }
+
+    int64_t nTimeMid = GetTimeMicros();
+
+    try {
+        boost::filesystem::path pathNew = GetDataDir() / "mempool.dat.new";
+        CAutoFile file(fopen(pathNew.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        if (file.IsNull())
+            return error("%s: Failed to open %s", __func__, pathNew.string());
+
+        file << MEMPOOL_DUMP_VERSION;
+        file << mapDeltas;
+        file << (uint64_t)vinfo.size();
+        BOOST_FOREACH(const TxMempoolInfo& info, vinfo) {
+            file << *(info.tx);
+            file << (int64_t)info.nTime;
+        }
+        FileCommit(file.Get());
+        file.fclose();
+        if (!RenameOver(pathNew, GetDataDir() / "mempool.dat"))
+            return error("%s: Failed to rename %s", __func__, pathNew.string());
+    } catch (const std::exception& e) {
+        return error("%s: Failed to dump mempool: %s", __func__, e.what());
+    }
+
+    int64_t nTimeEnd = GetTimeMicros();
+    LogPrintf("Dumped %u mempool transactions to disk: %.2fms to copy, %.2fms to write\n", vinfo.size(), (nTimeMid - nTimeStart) * 0.001, (nTimeEnd - nTimeMid) * 0.001);
+    return true;
+}
+
+/**
+ * Run the script checks of a batch of transactions about to be loaded into
+ * the mempool on the script check threads. The checks store their results in
+ * the signature cache, so the (serial) AcceptToMemoryPool calls that follow
+ * find the signatures already verified. Failures are left for
+ * AcceptToMemoryPool to report.
+ */
+static void PreCheckMempoolBatch(const std::vector<CTransaction>& vtx, std::vector<int64_t>::const_iterator itTime, int64_t nExpiryTime)
+{
+    AssertLockHeld(cs_main);
+
+    unsigned int flags = STANDARD_SCRIPT_VERIFY_FLAGS;
+    if (!Params().RequireStandard())
+        flags = GetArg("-promiscuousmempoolflags", flags);
+
+    // Transactions in the batch may spend each other, so their outputs are
+    // added to the view as they are visited, in dependency order.
+    CCoinsViewMemPool viewMemPool(pcoinsTip, mempool);
+    CCoinsViewCache view(&viewMemPool);
+    std::vector<PrecomputedTransactionData> vtxdata;
+    vtxdata.reserve(vtx.size());
+    std::vector<CScriptCheck> vChecks;
+    for (size_t i = 0; i < vtx.size(); i++, itTime++) {
+        const CTransaction& tx = vtx[i];
+        if (*itTime < nExpiryTime || tx.IsCoinBase())
+            continue;
+        bool fHaveInputs = true;
+        BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+            if (!view.HaveCoin(txin.prevout)) {
+                fHaveInputs = false;
+                break;
+            }
+        }
+        if (!fHaveInputs)
+            continue;
+        CValidationState state;
+        vtxdata.push_back(PrecomputedTransactionData(tx));
+        if (!CheckInputs(tx, state, view, true, flags, true, false, vtxdata.back(), &vChecks))
+            continue;
+        AddCoins(view, tx, MEMPOOL_HEIGHT);
+    }
+
+    CCheckQueueControl<CScriptCheck> control(&scriptcheckqueue);
+    control.Add(vChecks);
+    control.Wait();
+}
+
+bool LoadMempool()
+{
+    int64_t nTimeStart = GetTimeMicros();
+    int64_t nExpiryTime = GetTime() - GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60;
+
+    boost::filesystem::path path = GetDataDir() / "mempool.dat";
+    FILE* filestr = fopen(path.string().c_str(), "rb");
+    CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        LogPrintf("Failed to open mempool file from disk. Continuing anyway.\n");
+        return false;
+    }
+
+    int64_t nCount = 0;
+    int64_t nFailed = 0;
+    int64_t nExpired = 0;
+
+    try {
+        uint64_t nVersion;
+        file >> nVersion;
+        if (nVersion != MEMPOOL_DUMP_VERSION)
+            return error("%s: Unknown mempool file version %u", __func__, nVersion);
+
+        // Fee deltas are restored first, so that prioritised transactions are
+        // judged by their modified fee when they are accepted again.
+        std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+        file >> mapDeltas;
+        for (std::map<uint256, std::pair<double, CAmount> >::const_iterator it = mapDeltas.begin(); it != mapDeltas.end(); ++it)
+            mempool.PrioritiseTransaction(it->first, it->first.ToString(), it->second.first, it->second.second);
+
+        uint64_t nNum;
+        file >> nNum;
+
+        std::vector<CTransaction> vtx;
+        std::vector<int64_t> vTime;
+        vtx.reserve(std::min(nNum, (uint64_t)MEMPOOL_LOAD_BATCH_SIZE));
+        while (nNum) {
+            size_t nBatch = std::min(nNum, (uint64_t)MEMPOOL_LOAD_BATCH_SIZE);
+            nNum -= nBatch;
+            vtx.resize(nBatch);
+            vTime.resize(nBatch);
+            for (size_t i = 0; i < nBatch; i++)
+                file >> vtx[i] >> vTime[i];
+
+            if (ShutdownRequested())
+                return false;
+
+            LOCK(cs_main);
+            if (nScriptCheckThreads)
+                PreCheckMempoolBatch(vtx, vTime.begin(), nExpiryTime);
+            for (size_t i = 0; i < nBatch; i++) {
+                if (vTime[i] < nExpiryTime) {
+                    nExpired++;
+                    continue;
+                }
+                CValidationState state;
+                if (AcceptToMemoryPoolWithTime(mempool, state, vtx[i], true, NULL, vTime[i]))
+                    nCount++;
+                else
+                    nFailed++;
+            }
+        }
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to deserialize mempool data on disk: %s. Continuing anyway.\n", e.what());
+        return false;
+    }
+
+    LogPrintf("Imported mempool transactions from disk: %i successes, %i failed, %i expired (%.2fms)\n", nCount, nFailed, nExpired, (GetTimeMicros() - nTimeStart) * 0.001);
+    return true;
+}
+
 ThresholdState VersionBitsTipState(const Consensus::Params& params, Consensus::DeploymentPos pos)
 {
     LOCK(cs_main);
@@ -21,6 +21,7 @@
 #include <algorithm>
 #include <exception>
 #include <map>
+#include <memory>
 #include <set>
 #include <stdint.h>
 #include <string>
@@ -29,10 +30,13 @@
 
 #include <boost/unordered_map.hpp>
 
+class CBlockCache;
 class CBlockIndex;
 class CBlockTreeDB;
 class CBloomFilter;
 class CChainParams;
+class CCoinsViewDB;
+class CCoinsViewWriteBehind;
 class CInv;
 class CScriptCheck;
 class CTxMemPool;
@@ -55,6 +59,10 @@ static const CAmount DEFAULT_TRANSACTION_MAXFEE = 0.1 * COIN;
 static const CAmount HIGH_TX_FEE_PER_KB = 0.01 * COIN;
 //! -maxtxfee will warn if called with a higher fee than this amount (in satoshis)
 static const CAmount HIGH_MAX_TX_FEE = 100 * HIGH_TX_FEE_PER_KB;
+/** Default for -maxscriptcachesize, in MiB */
+static const unsigned int DEFAULT_MAX_SCRIPT_CACHE_SIZE = 16;
+/** Maximum -maxscriptcachesize, in MiB */
+static const int64_t MAX_MAX_SCRIPT_CACHE_SIZE = 16384;
 /** Default for -maxorphantx, maximum number of orphan transactions kept in memory */
 static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
 /** Expiration time for orphan transactions in seconds */
@@ -71,6 +79,10 @@ static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
 static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = 101;
 /** Default for -mempoolexpiry, expiration time for mempool transactions in hours */
 static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 72;
+/** Default for -persistmempool */
+static const bool DEFAULT_PERSIST_MEMPOOL = true;
+/** Number of transactions LoadMempool() checks the scripts of in parallel at a time */
+static const unsigned int MEMPOOL_LOAD_BATCH_SIZE = 256;
 /** The maximum size of a blk?????.dat file (since 0.8) */
 static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 /** The pre-allocation chunk size for blk?????.dat files (since 0.8) */
@@ -82,6 +94,14 @@ static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** -prefetchblocks default (number of blocks whose inputs are read ahead, 0 = off) */
+static const int DEFAULT_PREFETCH_BLOCKS = 8;
+/** Maximum value of -prefetchblocks */
+static const int MAX_PREFETCH_BLOCKS = 64;
+/** Maximum number of threads hashing received headers, besides the message handler waiting for them */
+static const int MAX_HEADERCHECK_THREADS = 3;
+/** Number of received headers a header checking thread hashes at a time */
+static const size_t HEADER_CHECK_BATCH = 128;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 128;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
@@ -128,6 +148,9 @@ static const unsigned int DEFAULT_LIMITFREERELAY = 15;
 static const bool DEFAULT_RELAYPRIORITY = true;
 static const int64_t DEFAULT_MAX_TIP_AGE = 24 * 60 * 60;
 
+/** Only blocks this close to the tip are added to blockcache, so that serving
+ *  old blocks to syncing peers does not push out the recent ones */
+static const int BLOCK_SERVE_CACHE_DEPTH = 144;
 /** Default for -permitbaremultisig */
 static const bool DEFAULT_PERMIT_BAREMULTISIG = true;
 static const bool DEFAULT_CHECKPOINTS_ENABLED = true;
@@ -156,6 +179,8 @@ struct BlockHasher
 extern CScript COINBASE_FLAGS;
 extern CCriticalSection cs_main;
 extern CTxMemPool mempool;
+/** Recently served blocks, see ReadServedBlock() */
+extern CBlockCache blockcache;
 typedef boost::unordered_map<uint256, CBlockIndex*, BlockHasher> BlockMap;
 extern BlockMap mapBlockIndex;
 extern uint64_t nLastBlockTx;
@@ -167,6 +192,7 @@ extern CConditionVariable cvBlockChange;
 extern bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
+extern int nPrefetchBlocks;
 extern bool fTxIndex;
 extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
@@ -242,6 +268,10 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
 bool InitBlockIndex(const CChainParams& chainparams);
 /** Load the block tree and coins database from disk */
 bool LoadBlockIndex();
+/** Complete a coins database write that was interrupted, by replaying the blocks it covers */
+bool ReplayBlocks(const CChainParams& params, CCoinsView* view);
+/** Set the active chain to the best block of the coins database */
+bool LoadChainTip(const CChainParams& chainparams);
 /** Unload database information */
 void UnloadBlockIndex();
 /** Process protocol messages received from a given node */
@@ -254,6 +284,10 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the input prefetching thread */
+void ThreadCoinsPrefetch();
+/** Run an instance of the header checking thread */
+void ThreadHeaderCheck();
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Format a string that describes several potential problems detected by the core.
@@ -307,6 +341,16 @@ void PruneAndFlush();
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
                         bool* pfMissingInputs, bool fOverrideMempoolLimit=false, const CAmount nAbsurdFee=0);
 
+/** (try to) add transaction to memory pool with a specified acceptance time **/
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                                bool* pfMissingInputs, int64_t nAcceptTime, bool fOverrideMempoolLimit=false, const CAmount nAbsurdFee=0);
+
+/** Dump the mempool to disk, so LoadMempool() can restore it on the next start. */
+bool DumpMempool();
+
+/** Load the mempool written by DumpMempool(), checking the scripts of its transactions in parallel. */
+bool LoadMempool();
+
 /** Convert CValidationState to a human-readable message for logging */
 std::string FormatStateMessage(const CValidationState &state);
 
@@ -350,9 +394,20 @@ int64_t GetTransactionSigOpCost(const CTransaction& tx, const CCoinsViewCache& i
  * Check whether all inputs of this transaction are valid (no double spends, scripts & sigs, amounts)
  * This does not modify the UTXO set. If pvChecks is not NULL, script checks are pushed onto it
  * instead of being performed inline.
+ *
+ * Transactions whose scripts all passed with exactly these flags before are
+ * skipped using the script execution cache. cacheFullScriptStore stores a
+ * new success there (only when the checks ran inline) and keeps existing
+ * entries; otherwise a cached entry is consumed. Requires cs_main.
  */
 bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &view, bool fScriptChecks,
-                 unsigned int flags, bool cacheStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks = NULL);
+                 unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks = NULL);
+
+/** Allocate the script execution cache, sized by -maxscriptcachesize. */
+void InitScriptExecutionCache();
+
+/** Number of script execution cache lookups that found / didn't find a transaction. */
+void GetScriptExecutionCacheStats(uint64_t& nHits, uint64_t& nMisses);
 
 /** Apply the effects of this transaction on the UTXO set represented by view */
 void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight);
@@ -417,8 +472,8 @@ private:
 
 public:
     CScriptCheck(): amount(0), ptxTo(0), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
-    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, PrecomputedTransactionData* txdataIn) :
-        scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey), amount(txFromIn.vout[txToIn.vin[nInIn].prevout.n].nValue),
+    CScriptCheck(const CScript& scriptPubKeyIn, const CAmount amountIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, PrecomputedTransactionData* txdataIn) :
+        scriptPubKey(scriptPubKeyIn), amount(amountIn),
         ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(txdataIn) { }
 
     bool operator()();
@@ -442,11 +497,28 @@ public:
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+/** Read the serialized block at pos as it is stored, with witness data. Neither
+ *  the block nor its proof of work are checked; only the index header is. */
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vchBlock, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
+/** Read the block with the given hash, stored at pos, for sending it to a peer
+ *  or client. Recently served blocks are taken from blockcache; others are
+ *  read with ReadRawBlockFromDisk() and added to it if fAddToCache is set
+ *  (see BLOCK_SERVE_CACHE_DEPTH). Fails if the block header read does not
+ *  have the given hash; nothing is cached then. */
+bool ReadServedBlock(std::shared_ptr<const std::vector<unsigned char> >& pvchBlock, const CDiskBlockPos& pos, const uint256& hash, const CMessageHeader::MessageStartChars& messageStart, bool fAddToCache);
+/** Same, decoded. Only cached once it decodes. */
+bool ReadServedBlock(CBlock& block, const CDiskBlockPos& pos, const uint256& hash, const CChainParams& chainparams, bool fAddToCache);
+/** Same, as the hex form of the serialization. */
+bool ReadServedBlockHex(std::shared_ptr<const std::string>& pstrHex, const CDiskBlockPos& pos, const uint256& hash, const CMessageHeader::MessageStartChars& messageStart, bool fAddToCache);
 
 /** Functions for validating blocks and updating the block tree */
 
 /** Context-independent validity checks */
 bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true);
+/** Compute the hashes of a series of headers and whether each meets the target
+ *  it claims, on the header checking threads if no other caller is using them.
+ *  Needs no locks, so received headers are hashed before taking cs_main. */
+void HashAndCheckHeaders(const std::vector<CBlockHeader>& headers, std::vector<uint256>& vHashes, std::vector<char>& vPowOk, const Consensus::Params& consensusParams);
 bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
 
 /** Context-dependent validity checks.
@@ -505,6 +577,12 @@ extern CChain chainActive;
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 
+/** The coin database below pcoinsTip (protected by cs_main) */
+extern CCoinsViewDB *pcoinsdbview;
+
+/** Background writer below pcoinsTip, if enabled (protected by cs_main) */
+extern CCoinsViewWriteBehind *pcoinsWriteBehind;
+
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
@@ -6,6 +6,7 @@
 #define BITCOIN_MEMUSAGE_H
 
 #include "indirectmap.h"
+#include "support/allocators/pool.h"
 
 #include <stdlib.h>
 
@@ -167,6 +168,23 @@ static inline size_t DynamicUsage(const boost::unordered_map<X, Y, Z>& m)
     return MallocUsage(sizeof(boost_unordered_node<std::pair<const X, Y> >)) * m.size() + MallocUsage(sizeof(void*) * m.bucket_count());
 }
 
+// Pooled data structures
+
+template<size_t MAX_BLOCK_SIZE_BYTES, size_t ALIGN_BYTES>
+static inline size_t DynamicUsage(const CPoolResource<MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& r)
+{
+    // Large allocations are the bucket arrays of the containers using it
+    return MallocUsage(r.ChunkSizeBytes()) * r.NumAllocatedChunks() + MallocUsage(sizeof(char*) * r.ChunkListCapacity()) +
+           (r.NumLargeAllocations() ? MallocUsage(r.LargeAllocatedBytes() / r.NumLargeAllocations()) * r.NumLargeAllocations() : 0);
+}
+
+/** Everything the pool of the map holds, whether in use or free. */
+template<typename X, typename Y, typename Z, typename P, size_t MAX_BLOCK_SIZE_BYTES, size_t ALIGN_BYTES>
+static inline size_t DynamicUsage(const boost::unordered_map<X, Y, Z, P, CPoolAllocator<std::pair<const X, Y>, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> >& m)
+{
+    return DynamicUsage(m.get_allocator().GetResource()) + DynamicUsage(*m.get_allocator().GetResource());
+}
+
 }
 
 #endif // BITCOIN_MEMUSAGE_H
@@ -6,12 +6,15 @@
 #include "miner.h"
 
 #include "amount.h"
+#include "arith_uint256.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "coins.h"
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/validation.h"
+#include "crypto/common.h"
+#include "crypto/skein512.h"
 #include "hash.h"
 #include "main.h"
 #include "net.h"
@@ -23,9 +26,12 @@
 #include "txmempool.h"
 #include "util.h"
 #include "utilmoneystr.h"
+#include "utilstrencodings.h"
 #include "validationinterface.h"
 
 #include <algorithm>
+#include <atomic>
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
 #include <boost/tuple/tuple.hpp>
 #include <queue>
@@ -165,21 +171,8 @@ CBlockTemplate* BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn)
     addPriorityTxs();
     addPackageTxs();
 
-    nLastBlockTx = nBlockTx;
-    nLastBlockSize = nBlockSize;
-    nLastBlockWeight = nBlockWeight;
-
     // Create coinbase transaction.
-    CMutableTransaction coinbaseTx;
-    coinbaseTx.vin.resize(1);
-    coinbaseTx.vin[0].prevout.SetNull();
-    coinbaseTx.vout.resize(1);
-    coinbaseTx.vout[0].scriptPubKey = scriptPubKeyIn;
-    coinbaseTx.vout[0].nValue = nFees + GetBlockSubsidy(nHeight, chainparams.GetConsensus());
-    coinbaseTx.vin[0].scriptSig = CScript() << nHeight << OP_0;
-    pblock->vtx[0] = coinbaseTx;
-    pblocktemplate->vchCoinbaseCommitment = GenerateCoinbaseCommitment(*pblock, pindexPrev, chainparams.GetConsensus());
-    pblocktemplate->vTxFees[0] = -nFees;
+    UpdateCoinbase(*pblocktemplate, scriptPubKeyIn, pindexPrev);
 
     uint64_t nSerializeSize = GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION);
     LogPrintf("CreateNewBlock(): total size: %u block weight: %u txs: %u fees: %ld sigops %d\n", nSerializeSize, GetBlockWeight(*pblock), nBlockTx, nFees, nBlockSigOpsCost);
@@ -189,7 +182,6 @@ CBlockTemplate* BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn)
     UpdateTime(pblock, chainparams.GetConsensus(), pindexPrev);
     pblock->nBits          = GetNextWorkRequired(pindexPrev, pblock, chainparams.GetConsensus());
     pblock->nNonce         = 0;
-    pblocktemplate->vTxSigOpsCost[0] = WITNESS_SCALE_FACTOR * GetLegacySigOpCount(pblock->vtx[0]);
 
     CValidationState state;
     if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
@@ -199,6 +191,78 @@ CBlockTemplate* BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn)
     return pblocktemplate.release();
 }
 
+void BlockAssembler::UpdateCoinbase(CBlockTemplate& tmpl, const CScript& scriptPubKeyIn, const CBlockIndex* pindexPrev)
+{
+    nLastBlockTx = nBlockTx;
+    nLastBlockSize = nBlockSize;
+    nLastBlockWeight = nBlockWeight;
+
+    CMutableTransaction coinbaseTx;
+    coinbaseTx.vin.resize(1);
+    coinbaseTx.vin[0].prevout.SetNull();
+    coinbaseTx.vout.resize(1);
+    coinbaseTx.vout[0].scriptPubKey = scriptPubKeyIn;
+    coinbaseTx.vout[0].nValue = nFees + GetBlockSubsidy(nHeight, chainparams.GetConsensus());
+    coinbaseTx.vin[0].scriptSig = CScript() << nHeight << OP_0;
+    tmpl.block.vtx[0] = coinbaseTx;
+    tmpl.vchCoinbaseCommitment = GenerateCoinbaseCommitment(tmpl.block, pindexPrev, chainparams.GetConsensus());
+    tmpl.vTxFees[0] = -nFees;
+    tmpl.vTxSigOpsCost[0] = WITNESS_SCALE_FACTOR * GetLegacySigOpCount(tmpl.block.vtx[0]);
+}
+
+bool BlockAssembler::AppendToTemplate(CBlockTemplate& tmpl, CTxMemPool::txiter iter)
+{
+    CTxMemPool::setEntries package;
+    package.insert(iter);
+    if (!TestPackage(iter->GetTxSize(), iter->GetSigOpCost()) || !TestPackageTransactions(package))
+        return false;
+
+    tmpl.block.vtx.push_back(iter->GetTx());
+    tmpl.vTxFees.push_back(iter->GetFee());
+    tmpl.vTxSigOpsCost.push_back(iter->GetSigOpCost());
+    if (fNeedSizeAccounting) {
+        nBlockSize += ::GetSerializeSize(iter->GetTx(), SER_NETWORK, PROTOCOL_VERSION);
+    }
+    nBlockWeight += iter->GetTxWeight();
+    ++nBlockTx;
+    nBlockSigOpsCost += iter->GetSigOpCost();
+    nFees += iter->GetFee();
+    return true;
+}
+
+void BlockAssembler::RemoveFromTemplate(CBlockTemplate& tmpl, std::set<uint256>& setRemove)
+{
+    std::vector<CTransaction>& vtx = tmpl.block.vtx;
+    // Transactions come after their parents, so one pass finds all spenders
+    size_t nKept = 1;
+    for (size_t i = 1; i < vtx.size(); i++) {
+        const CTransaction& tx = vtx[i];
+        bool fRemove = setRemove.count(tx.GetHash());
+        for (size_t j = 0; !fRemove && j < tx.vin.size(); j++)
+            fRemove = setRemove.count(tx.vin[j].prevout.hash);
+        if (fRemove) {
+            setRemove.insert(tx.GetHash());
+            if (fNeedSizeAccounting) {
+                nBlockSize -= ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+            }
+            nBlockWeight -= GetTransactionWeight(tx);
+            --nBlockTx;
+            nBlockSigOpsCost -= tmpl.vTxSigOpsCost[i];
+            nFees -= tmpl.vTxFees[i];
+            continue;
+        }
+        if (nKept != i) {
+            vtx[nKept] = tx;
+            tmpl.vTxFees[nKept] = tmpl.vTxFees[i];
+            tmpl.vTxSigOpsCost[nKept] = tmpl.vTxSigOpsCost[i];
+        }
+        nKept++;
+    }
+    vtx.erase(vtx.begin() + nKept, vtx.end());
+    tmpl.vTxFees.resize(nKept);
+    tmpl.vTxSigOpsCost.resize(nKept);
+}
+
 bool BlockAssembler::isStillDependent(CTxMemPool::txiter iter)
 {
     BOOST_FOREACH(CTxMemPool::txiter parent, mempool.GetMemPoolParents(iter))
@@ -589,6 +653,175 @@ void BlockAssembler::addPriorityTxs()
     fNeedSizeAccounting = fSizeAccounting;
 }
 
+CBlockTemplateCache* pblocktemplatecache = NULL;
+
+CBlockTemplateCache::CBlockTemplateCache(const CChainParams& chainparamsIn, const CScript& scriptPubKeyIn)
+    : chainparams(chainparamsIn), scriptPubKey(scriptPubKeyIn),
+      nRefreshInterval(GetArg("-blocktemplaterefresh", DEFAULT_BLOCK_TEMPLATE_REFRESH)),
+      fActive(false), pindexPrev(NULL), nBehindSince(0)
+{
+    connAdded = mempool.NotifyEntryAdded.connect(boost::bind(&CBlockTemplateCache::QueueChange, this, _1, true));
+    connRemoved = mempool.NotifyEntryRemoved.connect(boost::bind(&CBlockTemplateCache::QueueChange, this, _1, false));
+}
+
+CBlockTemplateCache::~CBlockTemplateCache()
+{
+    connAdded.disconnect();
+    connRemoved.disconnect();
+}
+
+void CBlockTemplateCache::QueueChange(const CTransaction& tx, bool fAdded)
+{
+    if (!fActive)
+        return;
+    LOCK(cs);
+    if (!pblocktemplate)
+        return;
+    if (vPending.size() >= MAX_BLOCK_TEMPLATE_PENDING) {
+        // Nobody has asked for the template in a long while; start over
+        // when someone does.
+        pblocktemplate.reset();
+        vPending.clear();
+        return;
+    }
+    vPending.push_back(std::make_pair(tx.GetHash(), fAdded));
+}
+
+bool CBlockTemplateCache::Rebuild()
+{
+    AssertLockHeld(cs_main);
+    int64_t nTimeStart = GetTimeMicros();
+    std::unique_ptr<BlockAssembler> newassembler(new BlockAssembler(chainparams));
+    pblocktemplate.reset(newassembler->CreateNewBlock(scriptPubKey));
+    vPending.clear();
+    setTemplateTx.clear();
+    if (!pblocktemplate)
+        return false;
+    assembler = std::move(newassembler);
+    pindexPrev = chainActive.Tip();
+    for (size_t i = 1; i < pblocktemplate->block.vtx.size(); i++)
+        setTemplateTx.insert(pblocktemplate->block.vtx[i].GetHash());
+    nBehindSince = 0;
+
+    stats.nBuilds++;
+    stats.nBuildMicros = GetTimeMicros() - nTimeStart;
+    stats.nBuildTime = GetTime();
+    stats.nUpdates = 0;
+    LogPrint("bench", "    - Block template for height %d: %.2fms\n", pindexPrev->nHeight + 1, stats.nBuildMicros * 0.001);
+    return true;
+}
+
+CBlockTemplate& CBlockTemplateCache::Modify()
+{
+    // Requests served earlier keep the template they were given
+    if (!pblocktemplate.unique())
+        pblocktemplate = std::make_shared<CBlockTemplate>(*pblocktemplate);
+    return *pblocktemplate;
+}
+
+void CBlockTemplateCache::ApplyPending()
+{
+    AssertLockHeld(mempool.cs);
+    if (vPending.empty())
+        return;
+
+    std::set<uint256> setRemove;
+    size_t nAdded = 0;
+    bool fBehind = false;
+    for (size_t i = 0; i < vPending.size(); i++) {
+        const uint256& hash = vPending[i].first;
+        if (!vPending[i].second) {
+            if (setTemplateTx.erase(hash)) {
+                setRemove.insert(hash);
+                fBehind = true;
+            }
+            continue;
+        }
+        CTxMemPool::txiter it = mempool.mapTx.find(hash);
+        if (it == mempool.mapTx.end())
+            continue; // Removed again since
+        if (setRemove.count(hash)) {
+            // Re-added after being dropped; it has to wait for a rebuild
+            // rather than appear twice until the drop is applied.
+            fBehind = true;
+            continue;
+        }
+        bool fParentsIn = true;
+        BOOST_FOREACH(CTxMemPool::txiter parent, mempool.GetMemPoolParents(it)) {
+            if (!setTemplateTx.count(parent->GetTx().GetHash())) {
+                fParentsIn = false;
+                break;
+            }
+        }
+        if (!fParentsIn || !assembler->AppendToTemplate(Modify(), it)) {
+            fBehind = true;
+            continue;
+        }
+        setTemplateTx.insert(hash);
+        nAdded++;
+    }
+    vPending.clear();
+
+    if (!setRemove.empty()) {
+        assembler->RemoveFromTemplate(Modify(), setRemove);
+        BOOST_FOREACH(const uint256& hash, setRemove)
+            setTemplateTx.erase(hash);
+    }
+    if (nAdded || !setRemove.empty()) {
+        assembler->UpdateCoinbase(Modify(), scriptPubKey, pindexPrev);
+        stats.nUpdates += nAdded + setRemove.size();
+    }
+    if (fBehind && !nBehindSince)
+        nBehindSince = GetTime();
+}
+
+void CBlockTemplateCache::UpdatedBlockTip(const CBlockIndex *pindex)
+{
+    if (!fActive)
+        return;
+    LOCK2(cs_main, mempool.cs);
+    LOCK(cs);
+    if (pindexPrev == chainActive.Tip())
+        return;
+    try {
+        Rebuild();
+    } catch (const std::exception& e) {
+        // The next request tries again
+        LogPrintf("%s: %s\n", __func__, e.what());
+    }
+}
+
+bool CBlockTemplateCache::GetTemplate(std::shared_ptr<const CBlockTemplate>& ptmpl, const CBlockIndex*& pindexPrevOut)
+{
+    LOCK2(cs_main, mempool.cs);
+    LOCK(cs);
+    fActive = true;
+    if (pblocktemplate && pindexPrev == chainActive.Tip())
+        ApplyPending();
+    if (!pblocktemplate || pindexPrev != chainActive.Tip() ||
+        (nBehindSince && GetTime() - nBehindSince >= nRefreshInterval)) {
+        if (!Rebuild())
+            return false;
+    }
+    ptmpl = pblocktemplate;
+    pindexPrevOut = pindexPrev;
+    return true;
+}
+
+CBlockTemplateStats CBlockTemplateCache::GetStats()
+{
+    LOCK2(cs_main, mempool.cs);
+    LOCK(cs);
+    if (pblocktemplate && pindexPrev == chainActive.Tip())
+        ApplyPending();
+    CBlockTemplateStats ret = stats;
+    if (pblocktemplate && pindexPrev != chainActive.Tip())
+        ret.nStaleSeconds = GetTime() - stats.nBuildTime;
+    else if (nBehindSince)
+        ret.nStaleSeconds = GetTime() - nBehindSince;
+    return ret;
+}
+
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
 {
     // Update nExtraNonce
@@ -607,3 +840,106 @@ void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned
     pblock->vtx[0] = txCoinbase;
     pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
 }
+
+namespace {
+/** Nonces tried on the calling thread before fanning out; easy targets are nearly always met here */
+static const uint32_t NONCE_SCAN_INLINE = 256;
+/** Nonces hashed per SkeinSHA256_80_Midstate call; a multiple of the widest SIMD kernel */
+static const uint32_t NONCE_SCAN_BATCH = 64;
+/** Bytes of the header that follow the Skein midstate */
+static const size_t HEADER_TAIL_SIZE = 16;
+
+struct NonceScanState
+{
+    std::atomic<bool> fFound;
+    std::atomic<uint64_t> nTried;
+    uint32_t nNonce; //! written only by the thread that flipped fFound
+
+    NonceScanState() : fFound(false), nTried(0), nNonce(0) {}
+};
+
+void ScanNonceSlice(const Skein512Midstate& mid, const unsigned char* tail, uint32_t nBegin, uint32_t nEnd, const arith_uint256& bnTarget, NonceScanState& state)
+{
+    unsigned char tails[NONCE_SCAN_BATCH * HEADER_TAIL_SIZE];
+    unsigned char hashes[NONCE_SCAN_BATCH * 32];
+    for (uint32_t i = 0; i < NONCE_SCAN_BATCH; i++)
+        memcpy(tails + i * HEADER_TAIL_SIZE, tail, HEADER_TAIL_SIZE);
+
+    uint64_t nTried = 0;
+    uint32_t nNonce = nBegin;
+    while (nNonce < nEnd && !state.fFound.load(std::memory_order_relaxed)) {
+        uint32_t n = std::min(NONCE_SCAN_BATCH, nEnd - nNonce);
+        for (uint32_t i = 0; i < n; i++)
+            WriteLE32(tails + i * HEADER_TAIL_SIZE + 12, nNonce + i);
+        SkeinSHA256_80_Midstate(hashes, mid, tails, n);
+        for (uint32_t i = 0; i < n; i++) {
+            uint256 hash;
+            memcpy(hash.begin(), hashes + i * 32, 32);
+            if (UintToArith256(hash) <= bnTarget) {
+                bool fExpected = false;
+                if (state.fFound.compare_exchange_strong(fExpected, true))
+                    state.nNonce = nNonce + i;
+                state.nTried += nTried + i;
+                return;
+            }
+        }
+        nTried += n;
+        nNonce += n;
+    }
+    state.nTried += nTried;
+}
+}
+
+bool ScanNonces(CBlockHeader& header, uint32_t nNonceEnd, uint64_t& nMaxTries, int nThreads, const Consensus::Params& params)
+{
+    const uint32_t nBegin = header.nNonce;
+    if (nBegin >= nNonceEnd || nMaxTries == 0)
+        return false;
+    uint32_t nEnd = nNonceEnd;
+    if (nMaxTries < nEnd - nBegin)
+        nEnd = nBegin + (uint32_t)nMaxTries;
+
+    bool fNegative;
+    bool fOverflow;
+    arith_uint256 bnTarget;
+    bnTarget.SetCompact(header.nBits, &fNegative, &fOverflow);
+    if (fNegative || bnTarget == 0 || fOverflow || bnTarget > UintToArith256(params.powLimit)) {
+        // No nonce can satisfy CheckProofOfWork; use up the range like a plain scan would.
+        nMaxTries -= nEnd - nBegin;
+        header.nNonce = nEnd;
+        return false;
+    }
+
+    unsigned char data[80];
+    memcpy(data, BEGIN(header.nVersion), sizeof(data));
+    Skein512Midstate mid;
+    Skein512Midstate80(mid, data);
+    const unsigned char* tail = data + sizeof(data) - HEADER_TAIL_SIZE;
+
+    NonceScanState state;
+    uint32_t nInlineEnd = nBegin + std::min(NONCE_SCAN_INLINE, nEnd - nBegin);
+    ScanNonceSlice(mid, tail, nBegin, nInlineEnd, bnTarget, state);
+
+    if (!state.fFound && nInlineEnd < nEnd) {
+        // Split the rest of the range into one slice per thread; the calling thread takes the last one.
+        nThreads = std::max(nThreads, 1);
+        uint64_t nSlice = ((uint64_t)(nEnd - nInlineEnd) + nThreads - 1) / nThreads;
+        boost::thread_group threadGroup;
+        uint32_t nSliceBegin = nInlineEnd;
+        while (nEnd - nSliceBegin > nSlice) {
+            uint32_t nSliceEnd = nSliceBegin + (uint32_t)nSlice;
+            threadGroup.create_thread(boost::bind(&ScanNonceSlice, boost::cref(mid), tail, nSliceBegin, nSliceEnd, boost::cref(bnTarget), boost::ref(state)));
+            nSliceBegin = nSliceEnd;
+        }
+        ScanNonceSlice(mid, tail, nSliceBegin, nEnd, bnTarget, state);
+        threadGroup.join_all();
+    }
+
+    nMaxTries -= state.nTried;
+    if (state.fFound) {
+        header.nNonce = state.nNonce;
+        return true;
+    }
+    header.nNonce = nEnd;
+    return false;
+}
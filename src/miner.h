@@ -7,22 +7,30 @@
 #define BITCOIN_MINER_H
 
 #include "primitives/block.h"
+#include "script/script.h"
+#include "sync.h"
 #include "txmempool.h"
+#include "validationinterface.h"
 
+#include <atomic>
 #include <stdint.h>
 #include <memory>
+#include <set>
 #include "boost/multi_index_container.hpp"
 #include "boost/multi_index/ordered_index.hpp"
 
 class CBlockIndex;
 class CChainParams;
 class CReserveKey;
-class CScript;
 class CWallet;
 
 namespace Consensus { struct Params; };
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+/** Default for -blocktemplaterefresh, seconds getblocktemplate serves a template behind the mempool before rebuilding it */
+static const int64_t DEFAULT_BLOCK_TEMPLATE_REFRESH = 5;
+/** Mempool changes queued for the maintained block template before it is dropped and rebuilt instead */
+static const size_t MAX_BLOCK_TEMPLATE_PENDING = 100000;
 
 struct CBlockTemplate
 {
@@ -166,6 +174,17 @@ public:
     /** Construct a new block template with coinbase to scriptPubKeyIn */
     CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn);
 
+    // Incremental changes to the template returned by the last CreateNewBlock
+    // call, which the assembler keeps accounting for.
+    /** Append a transaction that entered the mempool since, if it still fits.
+      * Its in-mempool parents must be in the template already. */
+    bool AppendToTemplate(CBlockTemplate& tmpl, CTxMemPool::txiter iter);
+    /** Take the transactions in setRemove out of the template, along with
+      * those spending them, which are added to setRemove. */
+    void RemoveFromTemplate(CBlockTemplate& tmpl, std::set<uint256>& setRemove);
+    /** (Re)create the coinbase, paying the fees of the transactions in the template */
+    void UpdateCoinbase(CBlockTemplate& tmpl, const CScript& scriptPubKeyIn, const CBlockIndex* pindexPrev);
+
 private:
     // utility functions
     /** Clear the block's state and prepare for assembling a new block */
@@ -205,10 +224,98 @@ private:
     void UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set &mapModifiedTx);
 };
 
+/** What CBlockTemplateCache::GetStats() reports */
+struct CBlockTemplateStats
+{
+    uint64_t nBuilds;      //!< Templates assembled from scratch
+    int64_t nBuildMicros;  //!< Time the last of them took
+    int64_t nBuildTime;    //!< ... and when it was assembled
+    uint64_t nUpdates;     //!< Mempool changes applied to it since
+    int64_t nStaleSeconds; //!< Time it has been missing a change it could not apply (0 if none)
+
+    CBlockTemplateStats() : nBuilds(0), nBuildMicros(0), nBuildTime(0), nUpdates(0), nStaleSeconds(0) {}
+};
+
+/**
+ * The candidate block served by getblocktemplate, maintained as the chain and
+ * the mempool change instead of being assembled from scratch for each request.
+ *
+ * A BlockAssembler rebuilds it whenever the tip changes. Mempool changes in
+ * between are queued and applied when the template is next requested: a new
+ * transaction is appended if its in-mempool parents are in the template and
+ * it fits, and a removed one is dropped along with anything in the template
+ * spending it. Changes that cannot be followed like this (a transaction that
+ * does not fit or waits for a parent, space freed by a removal) leave the
+ * template behind the mempool, and it is rebuilt once it has been behind for
+ * -blocktemplaterefresh seconds. Fee deltas from prioritisetransaction take
+ * effect at the next rebuild.
+ *
+ * Nothing is tracked until the first request.
+ */
+class CBlockTemplateCache : public CValidationInterface
+{
+private:
+    mutable CCriticalSection cs;
+    const CChainParams& chainparams;
+    const CScript scriptPubKey;
+    const int64_t nRefreshInterval;
+    std::atomic<bool> fActive;
+
+    //! The assembler that built the template, which tracks the room left in it
+    std::unique_ptr<BlockAssembler> assembler;
+    //! Shared with the requests served from it, so it is copied before it
+    //! is changed while one of them still holds it
+    std::shared_ptr<CBlockTemplate> pblocktemplate;
+    const CBlockIndex* pindexPrev;
+    std::set<uint256> setTemplateTx;
+    //! Mempool additions (true) and removals (false) not applied yet
+    std::vector<std::pair<uint256, bool> > vPending;
+    //! When the template first missed a change it could not apply (0 if none)
+    int64_t nBehindSince;
+    CBlockTemplateStats stats;
+
+    boost::signals2::connection connAdded;
+    boost::signals2::connection connRemoved;
+
+    void QueueChange(const CTransaction& tx, bool fAdded);
+    bool Rebuild();
+    void ApplyPending();
+    CBlockTemplate& Modify();
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex *pindex);
+
+public:
+    CBlockTemplateCache(const CChainParams& chainparamsIn, const CScript& scriptPubKeyIn);
+    ~CBlockTemplateCache();
+
+    /** Share the template for the current tip, bringing it up to date first.
+     *  It does not change while ptmpl holds it. */
+    bool GetTemplate(std::shared_ptr<const CBlockTemplate>& ptmpl, const CBlockIndex*& pindexPrevOut);
+    CBlockTemplateStats GetStats();
+};
+
+/** The template getblocktemplate serves */
+extern CBlockTemplateCache* pblocktemplatecache;
+
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
 
+/** Default for -genproclimit, the number of nonce search threads used by generate (<= 0: all cores) */
+static const int DEFAULT_GENERATE_THREADS = 0;
+
+/**
+ * Search the nonces [header.nNonce, nNonceEnd) for one that satisfies the
+ * header's proof of work, using up to nThreads threads on disjoint slices of
+ * the range. The Skein-512 midstate over the first 64 header bytes (which do not
+ * depend on the nonce) is computed once and nonces are hashed in SIMD batches.
+ * At most nMaxTries nonces are tried; nMaxTries is decreased by the number of
+ * failed attempts. On success returns true with header.nNonce set to the
+ * solution, otherwise leaves header.nNonce at the end of the scanned range.
+ */
+bool ScanNonces(CBlockHeader& header, uint32_t nNonceEnd, uint64_t& nMaxTries, int nThreads, const Consensus::Params& params);
+
 extern double dHashesPerSec;
 extern int64_t nHPSTimerStart;
 
@@ -93,6 +93,10 @@ uint64_t nLocalHostNonce = 0;
 static std::vector<ListenSocket> vhListenSocket;
 CAddrMan addrman;
 int nMaxConnections = DEFAULT_MAX_PEER_CONNECTIONS;
+CSocketEvents::Backend socketEventsBackend = CSocketEvents::BACKEND_SELECT;
+int nMessageHandlerThreads = DEFAULT_MSGHAND_THREADS;
+// Sockets of nodes (with the node as data) and listening sockets (with NULL)
+static CSocketEvents socketEvents;
 bool fAddressesInitialized = false;
 std::string strSubVersion;
 
@@ -111,6 +115,8 @@ CCriticalSection cs_nLastNodeId;
 
 static CSemaphore *semOutbound = NULL;
 boost::condition_variable messageHandlerCondition;
+static boost::mutex messageHandlerMutex;
+static bool fMessageHandlerWake = false;
 
 // Signals for message handling
 static CNodeSignals g_signals;
@@ -408,7 +414,7 @@ CNode* ConnectNode(CAddress addrConnect, const char *pszDest, bool fCountFailure
     if (pszDest ? ConnectSocketByName(addrConnect, hSocket, pszDest, Params().GetDefaultPort(), nConnectTimeout, &proxyConnectionFailed) :
                   ConnectSocket(addrConnect, hSocket, nConnectTimeout, &proxyConnectionFailed))
     {
-        if (!IsSelectableSocket(hSocket)) {
+        if (!socketEvents.IsUsableSocket(hSocket)) {
             LogPrintf("Cannot create connection: non-selectable socket created (fd >= FD_SETSIZE ?)\n");
             CloseSocket(hSocket);
             return NULL;
@@ -484,6 +490,7 @@ void CNode::CloseSocketDisconnect()
     if (hSocket != INVALID_SOCKET)
     {
         LogPrint("net", "disconnecting peer=%d\n", id);
+        socketEvents.Remove(hSocket);
         CloseSocket(hSocket);
     }
 
@@ -762,7 +769,7 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
             i->second += msg.hdr.nMessageSize + CMessageHeader::HEADER_SIZE;
 
             msg.nTime = GetTimeMicros();
-            messageHandlerCondition.notify_one();
+            WakeMessageHandler();
         }
     }
 
@@ -1043,7 +1050,7 @@ static void AcceptConnection(const ListenSocket& hListenSocket) {
         return;
     }
 
-    if (!IsSelectableSocket(hSocket))
+    if (!socketEvents.IsUsableSocket(hSocket))
     {
         LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
         CloseSocket(hSocket);
@@ -1088,9 +1095,117 @@ static void AcceptConnection(const ListenSocket& hListenSocket) {
     }
 }
 
+/**
+ * What to wait for on pnode's socket:
+ * * If there is data to send, wait for sending data. As this only
+ *   happens when optimistic write failed, we choose to first drain the
+ *   write buffer in this case before receiving more. This avoids
+ *   needlessly queueing received data, if the remote peer is not themselves
+ *   receiving data. This means properly utilizing TCP flow control signalling.
+ * * Otherwise, if there is no (complete) message in the receive buffer,
+ *   or there is space left in the buffer, wait for receiving data.
+ * * (if neither of the above applies, there is certainly one message
+ *   in the receiver buffer ready to be processed).
+ * Together, that means that at least one of the following is always possible,
+ * so we don't deadlock:
+ * * We send some data.
+ * * We wait for data to be received (and disconnect after timeout).
+ * * We process a message in the buffer (message handler thread).
+ */
+static int GetSocketInterest(CNode* pnode)
+{
+    {
+        TRY_LOCK(pnode->cs_vSend, lockSend);
+        if (lockSend && !pnode->vSendMsg.empty())
+            return CSocketEvents::EVENT_SEND;
+    }
+    {
+        TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+        if (lockRecv && (
+            pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
+            pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
+            return CSocketEvents::EVENT_RECV;
+    }
+    return 0;
+}
+
+/**
+ * Receive what is waiting on pnode's socket, up to one buffer full.
+ * Returns whether more may be waiting. Requires cs_vRecvMsg.
+ */
+static bool SocketRecvData(CNode* pnode)
+{
+    // typical socket buffer is 8K-64K
+    char pchBuf[0x10000];
+    int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+    if (nBytes > 0)
+    {
+        if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
+            pnode->CloseSocketDisconnect();
+        pnode->nLastRecv = GetTime();
+        pnode->nRecvBytes += nBytes;
+        pnode->RecordBytesRecv(nBytes);
+        return nBytes == sizeof(pchBuf);
+    }
+    else if (nBytes == 0)
+    {
+        // socket closed gracefully
+        if (!pnode->fDisconnect)
+            LogPrint("net", "socket closed\n");
+        pnode->CloseSocketDisconnect();
+    }
+    else if (nBytes < 0)
+    {
+        // error
+        int nErr = WSAGetLastError();
+        if (nErr == WSAEINTR)
+            return true;
+        if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINPROGRESS)
+        {
+            if (!pnode->fDisconnect)
+                LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
+            pnode->CloseSocketDisconnect();
+        }
+    }
+    return false;
+}
+
+static void InactivityCheck(CNode* pnode, int64_t nTime)
+{
+    if (nTime - pnode->nTimeConnected > 60)
+    {
+        if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
+        {
+            LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
+            pnode->fDisconnect = true;
+        }
+        else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
+        {
+            LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
+            pnode->fDisconnect = true;
+        }
+        else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90*60))
+        {
+            LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
+            pnode->fDisconnect = true;
+        }
+        else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
+        {
+            LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
+            pnode->fDisconnect = true;
+        }
+    }
+}
+
 void ThreadSocketHandler()
 {
     unsigned int nPrevNodeCount = 0;
+    // Nodes with fRecvReady or fSendReady set. Only nodes in here are
+    // serviced, so with epoll idle peers cost nothing.
+    std::set<CNode*> setReady;
+    std::vector<CSocketEvents::Event> vEvents;
+    bool fMoreWork = false;
+    int64_t nLastInactivityCheck = 0;
     while (true)
     {
         //
@@ -1107,6 +1222,7 @@ void ThreadSocketHandler()
                 {
                     // remove from vNodes
                     vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+                    setReady.erase(pnode);
 
                     // release outbound grant (if any)
                     pnode->grantOutbound.Release();
@@ -1159,198 +1275,128 @@ void ThreadSocketHandler()
         //
         // Find which sockets have data to receive
         //
-        struct timeval timeout;
-        timeout.tv_sec  = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
-
-        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = std::max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
-        }
-
+        if (socketEvents.GetBackend() == CSocketEvents::BACKEND_SELECT)
         {
             LOCK(cs_vNodes);
             BOOST_FOREACH(CNode* pnode, vNodes)
             {
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = std::max(hSocketMax, pnode->hSocket);
-                have_fds = true;
-
-                // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
-                //   happens when optimistic write failed, we choose to first drain the
-                //   write buffer in this case before receiving more. This avoids
-                //   needlessly queueing received data, if the remote peer is not themselves
-                //   receiving data. This means properly utilizing TCP flow control signalling.
-                // * Otherwise, if there is no (complete) message in the receive buffer,
-                //   or there is space left in the buffer, select() for receiving data.
-                // * (if neither of the above applies, there is certainly one message
-                //   in the receiver buffer ready to be processed).
-                // Together, that means that at least one of the following is always possible,
-                // so we don't deadlock:
-                // * We send some data.
-                // * We wait for data to be received (and disconnect after timeout).
-                // * We process a message in the buffer (message handler thread).
-                {
-                    TRY_LOCK(pnode->cs_vSend, lockSend);
-                    if (lockSend && !pnode->vSendMsg.empty()) {
-                        FD_SET(pnode->hSocket, &fdsetSend);
-                        continue;
-                    }
-                }
-                {
-                    TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                    if (lockRecv && (
-                        pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
-                        pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
-                        FD_SET(pnode->hSocket, &fdsetRecv);
-                }
+                if (pnode->hSocket != INVALID_SOCKET)
+                    socketEvents.SetInterest(pnode->hSocket, GetSocketInterest(pnode));
             }
         }
 
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+        // Don't wait while a socket may still have data. Otherwise wake up
+        // regularly, to poll pnode->vSend and buffers that were full.
+        vEvents.clear();
+        socketEvents.Wait(fMoreWork ? 0 : 50, vEvents);
         boost::this_thread::interruption_point();
 
-        if (nSelect == SOCKET_ERROR)
+        BOOST_FOREACH(const CSocketEvents::Event& event, vEvents)
         {
-            if (have_fds)
+            if (event.pdata == NULL)
             {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
-            }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            MilliSleep(timeout.tv_usec/1000);
-        }
-
-        //
-        // Accept new connections
-        //
-        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
-        {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
-            {
-                AcceptConnection(hListenSocket);
+                //
+                // Accept new connections
+                //
+                BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
+                {
+                    if (hListenSocket.socket == event.hSocket)
+                        AcceptConnection(hListenSocket);
+                }
+                continue;
             }
+            // The node can't be gone yet: only this thread deletes nodes, and
+            // their sockets are removed from socketEvents before that.
+            CNode* pnode = static_cast<CNode*>(event.pdata);
+            if (event.nEvents & (CSocketEvents::EVENT_RECV | CSocketEvents::EVENT_ERROR))
+                pnode->fRecvReady = true;
+            if (event.nEvents & CSocketEvents::EVENT_SEND)
+                pnode->fSendReady = true;
+            setReady.insert(pnode);
         }
 
         //
         // Service each socket
         //
-        std::vector<CNode*> vNodesCopy;
-        {
-            LOCK(cs_vNodes);
-            vNodesCopy = vNodes;
-            BOOST_FOREACH(CNode* pnode, vNodesCopy)
-                pnode->AddRef();
-        }
-        BOOST_FOREACH(CNode* pnode, vNodesCopy)
+        fMoreWork = false;
+        for (std::set<CNode*>::iterator it = setReady.begin(); it != setReady.end(); )
         {
             boost::this_thread::interruption_point();
+            CNode* pnode = *it;
 
             //
-            // Receive
+            // Send
             //
             if (pnode->hSocket == INVALID_SOCKET)
+            {
+                setReady.erase(it++);
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError))
+            }
+            if (pnode->fSendReady)
             {
-                TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                if (lockRecv)
+                TRY_LOCK(pnode->cs_vSend, lockSend);
+                if (lockSend)
                 {
-                    {
-                        // typical socket buffer is 8K-64K
-                        char pchBuf[0x10000];
-                        int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
-                        if (nBytes > 0)
-                        {
-                            if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
-                                pnode->CloseSocketDisconnect();
-                            pnode->nLastRecv = GetTime();
-                            pnode->nRecvBytes += nBytes;
-                            pnode->RecordBytesRecv(nBytes);
-                        }
-                        else if (nBytes == 0)
-                        {
-                            // socket closed gracefully
-                            if (!pnode->fDisconnect)
-                                LogPrint("net", "socket closed\n");
-                            pnode->CloseSocketDisconnect();
-                        }
-                        else if (nBytes < 0)
-                        {
-                            // error
-                            int nErr = WSAGetLastError();
-                            if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
-                            {
-                                if (!pnode->fDisconnect)
-                                    LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
-                                pnode->CloseSocketDisconnect();
-                            }
-                        }
-                    }
+                    if (!pnode->vSendMsg.empty())
+                        SocketSendData(pnode);
+                    // Either everything was sent, or the socket is full and
+                    // will be reported again once it has room.
+                    pnode->fSendReady = false;
                 }
             }
 
             //
-            // Send
+            // Receive
             //
             if (pnode->hSocket == INVALID_SOCKET)
-                continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetSend))
             {
-                TRY_LOCK(pnode->cs_vSend, lockSend);
-                if (lockSend)
-                    SocketSendData(pnode);
+                setReady.erase(it++);
+                continue;
             }
-
-            //
-            // Inactivity checking
-            //
-            int64_t nTime = GetTime();
-            if (nTime - pnode->nTimeConnected > 60)
+            if (pnode->fRecvReady && GetSocketInterest(pnode) == CSocketEvents::EVENT_RECV)
             {
-                if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
-                {
-                    LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
-                {
-                    LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90*60))
-                {
-                    LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
-                    pnode->fDisconnect = true;
-                }
-                else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
+                TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+                if (lockRecv)
                 {
-                    LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
-                    pnode->fDisconnect = true;
+                    if (SocketRecvData(pnode))
+                        fMoreWork = true;
+                    else
+                        pnode->fRecvReady = false;
                 }
             }
+
+            if (pnode->fRecvReady || pnode->fSendReady)
+                ++it;
+            else
+                setReady.erase(it++);
         }
+
+        //
+        // Inactivity checking
+        //
+        int64_t nTime = GetTime();
+        if (nTime != nLastInactivityCheck)
         {
+            nLastInactivityCheck = nTime;
             LOCK(cs_vNodes);
-            BOOST_FOREACH(CNode* pnode, vNodesCopy)
-                pnode->Release();
+            BOOST_FOREACH(CNode* pnode, vNodes)
+            {
+                if (pnode->hSocket == INVALID_SOCKET)
+                    continue;
+                InactivityCheck(pnode, nTime);
+
+                // Retry queued data now and then, in case a send was cut
+                // short without the socket becoming full.
+                if (!pnode->fSendReady)
+                {
+                    TRY_LOCK(pnode->cs_vSend, lockSend);
+                    if (lockSend && !pnode->vSendMsg.empty())
+                    {
+                        pnode->fSendReady = true;
+                        setReady.insert(pnode);
+                    }
+                }
+            }
         }
     }
 }
@@ -1849,11 +1895,18 @@ bool OpenNetworkConnection(const CAddress& addrConnect, bool fCountFailure, CSem
 }
 
 
-void ThreadMessageHandler()
+void WakeMessageHandler()
 {
-    boost::mutex condition_mutex;
-    boost::unique_lock<boost::mutex> lock(condition_mutex);
+    {
+        boost::unique_lock<boost::mutex> lock(messageHandlerMutex);
+        fMessageHandlerWake = true;
+    }
+    // Any idle handler thread may pick the node up, so wake them all
+    messageHandlerCondition.notify_all();
+}
 
+void ThreadMessageHandler(int nThread)
+{
     while (true)
     {
         std::vector<CNode*> vNodesCopy;
@@ -1867,11 +1920,21 @@ void ThreadMessageHandler()
 
         bool fSleep = true;
 
-        BOOST_FOREACH(CNode* pnode, vNodesCopy)
+        // Every thread starts its pass at a different node, so they spread
+        // over the peers instead of queueing up behind the same busy one.
+        const size_t nNodes = vNodesCopy.size();
+        const size_t nStart = nNodes * nThread / nMessageHandlerThreads;
+        for (size_t i = 0; i < nNodes; i++)
         {
+            CNode* pnode = vNodesCopy[(nStart + i) % nNodes];
             if (pnode->fDisconnect)
                 continue;
 
+            // Skip nodes another thread is working on
+            TRY_LOCK(pnode->cs_processing, lockProcessing);
+            if (!lockProcessing)
+                continue;
+
             // Receive messages
             {
                 TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
@@ -1906,8 +1969,12 @@ void ThreadMessageHandler()
                 pnode->Release();
         }
 
-        if (fSleep)
-            messageHandlerCondition.timed_wait(lock, boost::posix_time::microsec_clock::universal_time() + boost::posix_time::milliseconds(100));
+        if (fSleep) {
+            boost::unique_lock<boost::mutex> lock(messageHandlerMutex);
+            if (!fMessageHandlerWake)
+                messageHandlerCondition.timed_wait(lock, boost::posix_time::microsec_clock::universal_time() + boost::posix_time::milliseconds(100));
+            fMessageHandlerWake = false;
+        }
     }
 }
 
@@ -2103,6 +2170,14 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     fAddressesInitialized = true;
 
+    if (!socketEvents.Start(socketEventsBackend)) {
+        LogPrintf("Waiting for sockets with %s is not available, falling back to select\n", CSocketEvents::GetBackendName(socketEventsBackend));
+        socketEvents.Start(CSocketEvents::BACKEND_SELECT);
+    }
+    LogPrintf("Using %s to wait for sockets\n", CSocketEvents::GetBackendName(socketEvents.GetBackend()));
+    BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
+        socketEvents.Add(hListenSocket.socket, NULL, true);
+
     if (semOutbound == NULL) {
         // initialize semaphore
         int nMaxOutbound = std::min((MAX_OUTBOUND_CONNECTIONS + MAX_FEELER_CONNECTIONS), nMaxConnections);
@@ -2136,7 +2211,9 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "opencon", &ThreadOpenConnections));
 
     // Process messages
-    threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "msghand", &ThreadMessageHandler));
+    LogPrintf("Using %d threads for processing peer messages\n", nMessageHandlerThreads);
+    for (int i = 0; i < nMessageHandlerThreads; i++)
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "msghand", boost::function<void()>(boost::bind(&ThreadMessageHandler, i))));
 
     // Dump network addresses
     scheduler.scheduleEvery(&DumpData, DUMP_ADDRESSES_INTERVAL);
@@ -2471,6 +2548,8 @@ CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNa
     nServices = NODE_NONE;
     nServicesExpected = NODE_NONE;
     hSocket = hSocketIn;
+    fRecvReady = false;
+    fSendReady = false;
     nRecvVersion = INIT_PROTO_VERSION;
     nLastSend = 0;
     nLastRecv = 0;
@@ -2534,10 +2613,15 @@ CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNa
         PushVersion();
 
     GetNodeSignals().InitializeNode(GetId(), this);
+
+    // Last, as the socket handler may use this node as soon as its socket is watched
+    if (hSocket != INVALID_SOCKET && socketEvents.IsStarted() && !socketEvents.Add(hSocket, this))
+        fDisconnect = true;
 }
 
 CNode::~CNode()
 {
+    socketEvents.Remove(hSocket);
     CloseSocket(hSocket);
 
     if (pfilter)
@@ -13,6 +13,7 @@
 #include "netbase.h"
 #include "protocol.h"
 #include "random.h"
+#include "socketevents.h"
 #include "streams.h"
 #include "sync.h"
 #include "uint256.h"
@@ -65,6 +66,16 @@ static const size_t MAPASKFOR_MAX_SZ = MAX_INV_SZ;
 static const size_t SETASKFOR_MAX_SZ = 2 * MAX_INV_SZ;
 /** The maximum number of peer connections to maintain. */
 static const unsigned int DEFAULT_MAX_PEER_CONNECTIONS = 125;
+/** Default for -socketevents */
+#ifdef USE_EPOLL
+static const char* const DEFAULT_SOCKETEVENTS = "epoll";
+#else
+static const char* const DEFAULT_SOCKETEVENTS = "select";
+#endif
+/** Default for -msghandthreads, the number of threads processing peer messages */
+static const int DEFAULT_MSGHAND_THREADS = 4;
+/** Maximum number of message handler threads */
+static const int MAX_MSGHAND_THREADS = 16;
 /** The default for -maxuploadtarget. 0 = Unlimited */
 static const uint64_t DEFAULT_MAX_UPLOAD_TARGET = 0;
 /** Default for blocks only*/
@@ -98,6 +109,10 @@ bool BindListenPort(const CService &bindAddr, std::string& strError, bool fWhite
 void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler);
 bool StopNode();
 void SocketSendData(CNode *pnode);
+/** Process the messages of the nodes in vNodes; handler nThread of nMessageHandlerThreads */
+void ThreadMessageHandler(int nThread);
+/** Wake the message handler threads because a complete message arrived */
+void WakeMessageHandler();
 
 struct CombinerAll
 {
@@ -165,6 +180,10 @@ extern CAddrMan addrman;
 
 /** Maximum number of connections to simultaneously allow (aka connection slots) */
 extern int nMaxConnections;
+/** How the socket handler waits for sockets (-socketevents) */
+extern CSocketEvents::Backend socketEventsBackend;
+/** Number of threads processing peer messages (-msghandthreads) */
+extern int nMessageHandlerThreads;
 
 extern std::vector<CNode*> vNodes;
 extern CCriticalSection cs_vNodes;
@@ -325,6 +344,10 @@ public:
     ServiceFlags nServices;
     ServiceFlags nServicesExpected;
     SOCKET hSocket;
+    // Whether hSocket was reported ready to receive / send, and may still be.
+    // Only used by the socket handler thread.
+    bool fRecvReady;
+    bool fSendReady;
     CDataStream ssSend;
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
@@ -335,6 +358,9 @@ public:
     std::deque<CInv> vRecvGetData;
     std::deque<CNetMessage> vRecvMsg;
     CCriticalSection cs_vRecvMsg;
+    // Held by the message handler thread processing this node, so that only
+    // one at a time runs ProcessMessages/SendMessages for it.
+    CCriticalSection cs_processing;
     uint64_t nRecvBytes;
     int nRecvVersion;
 
@@ -396,8 +422,11 @@ public:
     int nStartingHeight;
 
     // flood relay
+    // Addresses are pushed by the message handler threads of other peers too,
+    // so vAddrToSend and addrKnown are protected by cs_vAddrToSend.
     std::vector<CAddress> vAddrToSend;
     CRollingBloomFilter addrKnown;
+    CCriticalSection cs_vAddrToSend;
     bool fGetAddr;
     std::set<uint256> setKnown;
     int64_t nNextAddrSend;
@@ -514,6 +543,7 @@ public:
 
     void AddAddressKnown(const CAddress& addr)
     {
+        LOCK(cs_vAddrToSend);
         addrKnown.insert(addr.GetKey());
     }
 
@@ -522,6 +552,7 @@ public:
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
+        LOCK(cs_vAddrToSend);
         if (addr.IsValid() && !addrKnown.contains(addr.GetKey())) {
             if (vAddrToSend.size() >= MAX_ADDR_TO_SEND) {
                 vAddrToSend[insecure_rand() % vAddrToSend.size()] = addr;
@@ -9,12 +9,39 @@
 #include "tinyformat.h"
 #include "utilstrencodings.h"
 #include "crypto/common.h"
+#include "crypto/sha256.h"
+#include "crypto/skein512.h"
+
+#include <algorithm>
+#include <string.h>
 
 uint256 CBlockHeader::GetHash() const
 {
     return HashSkein(BEGIN(nVersion), END(nNonce));
 }
 
+void HashSkeinBatch(const CBlockHeader* headers, size_t count, uint256* hashes)
+{
+    // Headers are processed in chunks so the staging buffer stays on the stack.
+    static const size_t CHUNK = 64;
+    unsigned char in[CHUNK * SKEIN512_80_INPUT_SIZE];
+
+    while (count) {
+        size_t n = std::min(count, CHUNK);
+        for (size_t i = 0; i < n; i++) {
+            memcpy(in + i * SKEIN512_80_INPUT_SIZE, BEGIN(headers[i].nVersion), SKEIN512_80_INPUT_SIZE);
+        }
+        unsigned char out[CHUNK * CSHA256::OUTPUT_SIZE];
+        SkeinSHA256_80(out, in, n);
+        for (size_t i = 0; i < n; i++) {
+            memcpy(hashes[i].begin(), out + i * CSHA256::OUTPUT_SIZE, CSHA256::OUTPUT_SIZE);
+        }
+        headers += n;
+        hashes += n;
+        count -= n;
+    }
+}
+
 std::string CBlock::ToString() const
 {
     std::stringstream s;
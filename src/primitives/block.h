@@ -157,4 +157,9 @@ struct CBlockLocator
 /** Compute the consensus-critical block weight (see BIP 141). */
 int64_t GetBlockWeight(const CBlock& tx);
 
+/** Compute the hashes of `count` consecutive headers at once; equivalent to calling
+ *  GetHash() on each of them, but runs Skein-512 over several headers in parallel
+ *  SIMD lanes when the CPU supports it (see Skein512AutoDetect). */
+void HashSkeinBatch(const CBlockHeader* headers, size_t count, uint256* hashes);
+
 #endif // BITCOIN_PRIMITIVES_BLOCK_H
@@ -4,6 +4,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "amount.h"
+#include "blockcache.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "checkpoints.h"
@@ -12,18 +13,23 @@
 #include "main.h"
 #include "policy/policy.h"
 #include "primitives/transaction.h"
+#include "rpc/jsonwriter.h"
 #include "rpc/server.h"
 #include "streams.h"
 #include "sync.h"
+#include "txdb.h"
 #include "txmempool.h"
 #include "util.h"
 #include "utilstrencodings.h"
 #include "hash.h"
 
+#include <atomic>
 #include <stdint.h>
 
 #include <univalue.h>
 
+#include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/thread/thread.hpp> // boost::thread::interrupt
 
 using namespace std;
@@ -90,48 +96,49 @@ UniValue blockheaderToJSON(const CBlockIndex* blockindex)
     return result;
 }
 
-UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false)
+void blockToJSON(CJSONWriter& writer, const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false)
 {
-    UniValue result(UniValue::VOBJ);
-    result.push_back(Pair("hash", blockindex->GetBlockHash().GetHex()));
+    writer.BeginObject();
+    writer.Pair("hash", blockindex->GetBlockHash().GetHex());
     int confirmations = -1;
     // Only report confirmations if the block is on the main chain
     if (chainActive.Contains(blockindex))
         confirmations = chainActive.Height() - blockindex->nHeight + 1;
-    result.push_back(Pair("confirmations", confirmations));
-    result.push_back(Pair("strippedsize", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS)));
-    result.push_back(Pair("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION)));
-    result.push_back(Pair("weight", (int)::GetBlockWeight(block)));
-    result.push_back(Pair("height", blockindex->nHeight));
-    result.push_back(Pair("version", block.nVersion));
-    result.push_back(Pair("versionHex", strprintf("%08x", block.nVersion)));
-    result.push_back(Pair("merkleroot", block.hashMerkleRoot.GetHex()));
-    UniValue txs(UniValue::VARR);
+    writer.Pair("confirmations", confirmations);
+    writer.Pair("strippedsize", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS));
+    writer.Pair("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION));
+    writer.Pair("weight", (int)::GetBlockWeight(block));
+    writer.Pair("height", blockindex->nHeight);
+    writer.Pair("version", block.nVersion);
+    writer.Pair("versionHex", strprintf("%08x", block.nVersion));
+    writer.Pair("merkleroot", block.hashMerkleRoot.GetHex());
+    writer.Key("tx");
+    writer.BeginArray();
     BOOST_FOREACH(const CTransaction&tx, block.vtx)
     {
         if(txDetails)
         {
             UniValue objTx(UniValue::VOBJ);
             TxToJSON(tx, uint256(), objTx);
-            txs.push_back(objTx);
+            writer.Value(objTx);
         }
         else
-            txs.push_back(tx.GetHash().GetHex());
+            writer.Value(tx.GetHash().GetHex());
     }
-    result.push_back(Pair("tx", txs));
-    result.push_back(Pair("time", block.GetBlockTime()));
-    result.push_back(Pair("mediantime", (int64_t)blockindex->GetMedianTimePast()));
-    result.push_back(Pair("nonce", (uint64_t)block.nNonce));
-    result.push_back(Pair("bits", strprintf("%08x", block.nBits)));
-    result.push_back(Pair("difficulty", GetDifficulty(blockindex)));
-    result.push_back(Pair("chainwork", blockindex->nChainWork.GetHex()));
+    writer.EndArray();
+    writer.Pair("time", block.GetBlockTime());
+    writer.Pair("mediantime", (int64_t)blockindex->GetMedianTimePast());
+    writer.Pair("nonce", (uint64_t)block.nNonce);
+    writer.Pair("bits", strprintf("%08x", block.nBits));
+    writer.Pair("difficulty", GetDifficulty(blockindex));
+    writer.Pair("chainwork", blockindex->nChainWork.GetHex());
 
     if (blockindex->pprev)
-        result.push_back(Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
+        writer.Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex());
     CBlockIndex *pnext = chainActive.Next(blockindex);
     if (pnext)
-        result.push_back(Pair("nextblockhash", pnext->GetBlockHash().GetHex()));
-    return result;
+        writer.Pair("nextblockhash", pnext->GetBlockHash().GetHex());
+    writer.EndObject();
 }
 
 UniValue getblockcount(const UniValue& params, bool fHelp)
@@ -239,34 +246,35 @@ void entryToJSON(UniValue &info, const CTxMemPoolEntry &e)
     info.push_back(Pair("depends", depends));
 }
 
-UniValue mempoolToJSON(bool fVerbose = false)
+void mempoolToJSON(CJSONWriter& writer, bool fVerbose = false)
 {
     if (fVerbose)
     {
         LOCK(mempool.cs);
-        UniValue o(UniValue::VOBJ);
+        writer.BeginObject();
         BOOST_FOREACH(const CTxMemPoolEntry& e, mempool.mapTx)
         {
             const uint256& hash = e.GetTx().GetHash();
             UniValue info(UniValue::VOBJ);
             entryToJSON(info, e);
-            o.push_back(Pair(hash.ToString(), info));
+            writer.Pair(hash.ToString(), info);
         }
-        return o;
+        writer.EndObject();
     }
     else
     {
         vector<uint256> vtxid;
         mempool.queryHashes(vtxid);
 
-        UniValue a(UniValue::VARR);
+        writer.BeginArray();
         BOOST_FOREACH(const uint256& hash, vtxid)
-            a.push_back(hash.ToString());
-
-        return a;
+            writer.Value(hash.ToString());
+        writer.EndArray();
     }
 }
 
+void getrawmempool_stream(const UniValue& params, CJSONWriter& writer);
+
 UniValue getrawmempool(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() > 1)
@@ -291,11 +299,21 @@ UniValue getrawmempool(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getrawmempool", "true")
         );
 
+    CJSONWriter writer(CJSONWriter::OUTPUT_VALUE);
+    getrawmempool_stream(params, writer);
+    return writer.GetValue();
+}
+
+void getrawmempool_stream(const UniValue& params, CJSONWriter& writer)
+{
+    if (params.size() > 1)
+        getrawmempool(params, true); // throws the usage message
+
     bool fVerbose = false;
     if (params.size() > 0)
         fVerbose = params[0].get_bool();
 
-    return mempoolToJSON(fVerbose);
+    mempoolToJSON(writer, fVerbose);
 }
 
 UniValue getmempoolancestors(const UniValue& params, bool fHelp)
@@ -543,6 +561,8 @@ UniValue getblockheader(const UniValue& params, bool fHelp)
     return blockheaderToJSON(pblockindex);
 }
 
+void getblock_stream(const UniValue& params, CJSONWriter& writer);
+
 UniValue getblock(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 1 || params.size() > 2)
@@ -584,6 +604,16 @@ UniValue getblock(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getblock", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\"")
         );
 
+    CJSONWriter writer(CJSONWriter::OUTPUT_VALUE);
+    getblock_stream(params, writer);
+    return writer.GetValue();
+}
+
+void getblock_stream(const UniValue& params, CJSONWriter& writer)
+{
+    if (params.size() < 1 || params.size() > 2)
+        getblock(params, true); // throws the usage message
+
     LOCK(cs_main);
 
     std::string strHash = params[0].get_str();
@@ -602,7 +632,20 @@ UniValue getblock(const UniValue& params, bool fHelp)
     if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
 
-    if(!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
+    const bool fAddToCache = pblockindex->nHeight > chainActive.Height() - BLOCK_SERVE_CACHE_DEPTH;
+
+    // Blocks are cached serialized with witness data, so use that unless
+    // -rpcserialversion asks for something else
+    if (!fVerbose && RPCSerializationFlags() == 0)
+    {
+        std::shared_ptr<const std::string> pstrHex;
+        if (!ReadServedBlockHex(pstrHex, pblockindex->GetBlockPos(), hash, Params().MessageStart(), fAddToCache))
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+        writer.Value(*pstrHex);
+        return;
+    }
+
+    if (!ReadServedBlock(block, pblockindex->GetBlockPos(), hash, Params(), fAddToCache))
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
 
     if (!fVerbose)
@@ -610,10 +653,11 @@ UniValue getblock(const UniValue& params, bool fHelp)
         CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
         ssBlock << block;
         std::string strHex = HexStr(ssBlock.begin(), ssBlock.end());
-        return strHex;
+        writer.Value(strHex);
+        return;
     }
 
-    return blockToJSON(block, pblockindex);
+    blockToJSON(writer, block, pblockindex);
 }
 
 struct CCoinsStats
@@ -629,44 +673,192 @@ struct CCoinsStats
     CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), nTotalAmount(0) {}
 };
 
-//! Calculate statistics about the unspent transaction output set
-static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
+//! Add the unspent outputs of one transaction to the statistics
+template <typename Stream>
+static void ApplyStats(CCoinsStats &stats, Stream& ss, const uint256& hash, const std::map<uint32_t, Coin>& outputs, unsigned int nSerializedSize)
 {
-    boost::scoped_ptr<CCoinsViewCursor> pcursor(view->Cursor());
+    assert(!outputs.empty());
+    stats.nTransactions++;
+    ss << hash;
+    for (std::map<uint32_t, Coin>::const_iterator it = outputs.begin(); it != outputs.end(); ++it) {
+        stats.nTransactionOutputs++;
+        ss << VARINT(it->first + 1);
+        ss << it->second.out;
+        stats.nTotalAmount += it->second.out.nValue;
+    }
+    stats.nSerializedSize += 32 + nSerializedSize;
+    ss << VARINT(0);
+}
 
-    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    stats.hashBlock = pcursor->GetBestBlock();
+namespace {
+
+//! Number of parts the UTXO set is split into for GetUTXOStats, by the first byte of the txid
+static const int UTXO_STATS_SHARDS = 256;
+
+/** Statistics of one part of the UTXO set, and the data it adds to the hash */
+struct CCoinsStatsShard
+{
+    CCoinsStats stats;
+    CDataStream ss;
+    bool fDone;
+    bool fOk;
+
+    CCoinsStatsShard() : ss(SER_GETHASH, PROTOCOL_VERSION), fDone(false), fOk(false) {}
+};
+
+/**
+ * Computes the statistics of a snapshot of the UTXO set on several threads.
+ *
+ * Workers each take the next shard and serialize it as the hash expects. The
+ * calling thread hashes the shards in key order as they complete, so the
+ * result is the same as iterating over the whole set in one go. Workers stay
+ * at most a few shards ahead of the hashing to bound the memory used.
+ */
+class CCoinsStatsCollector
+{
+private:
+    const CCoinsViewDB& view;
+    const CDBSnapshot& snapshot;
+    const int nMaxAhead;
+
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    std::vector<CCoinsStatsShard> vShards;
+    int nNextShard;
+    int nHashed;
+    std::atomic<bool> fAbort;
+
+    bool ReadShard(int nShard, CCoinsStatsShard& shard)
     {
-        LOCK(cs_main);
-        stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
+        uint256 hashBegin, hashEnd;
+        *hashBegin.begin() = nShard;
+        if (nShard + 1 < UTXO_STATS_SHARDS)
+            *hashEnd.begin() = nShard + 1;
+        boost::scoped_ptr<CCoinsViewCursor> pcursor(view.Cursor(snapshot, hashBegin, hashEnd));
+        // Outputs are stored one by one, but hashed and counted per transaction,
+        // in order of their index.
+        uint256 prevkey;
+        std::map<uint32_t, Coin> outputs;
+        unsigned int nOutputsSize = 0;
+        while (pcursor->Valid()) {
+            if (fAbort)
+                return false;
+            COutPoint key;
+            Coin coin;
+            if (!pcursor->GetKey(key) || !pcursor->GetValue(coin))
+                return error("%s: unable to read value", __func__);
+            if (!outputs.empty() && key.hash != prevkey) {
+                ApplyStats(shard.stats, shard.ss, prevkey, outputs, nOutputsSize);
+                outputs.clear();
+                nOutputsSize = 0;
+            }
+            prevkey = key.hash;
+            outputs[key.n] = coin;
+            nOutputsSize += pcursor->GetValueSize();
+            pcursor->Next();
+        }
+        if (!outputs.empty())
+            ApplyStats(shard.stats, shard.ss, prevkey, outputs, nOutputsSize);
+        return true;
     }
-    ss << stats.hashBlock;
-    CAmount nTotalAmount = 0;
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        uint256 key;
-        CCoins coins;
-        if (pcursor->GetKey(key) && pcursor->GetValue(coins)) {
-            stats.nTransactions++;
-            ss << key;
-            for (unsigned int i=0; i<coins.vout.size(); i++) {
-                const CTxOut &out = coins.vout[i];
-                if (!out.IsNull()) {
-                    stats.nTransactionOutputs++;
-                    ss << VARINT(i+1);
-                    ss << out;
-                    nTotalAmount += out.nValue;
-                }
+
+    void ThreadWork()
+    {
+        while (true) {
+            int nShard;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (!fAbort && nNextShard < UTXO_STATS_SHARDS && nNextShard >= nHashed + nMaxAhead)
+                    cond.wait(lock);
+                if (fAbort || nNextShard == UTXO_STATS_SHARDS)
+                    return;
+                nShard = nNextShard++;
             }
-            stats.nSerializedSize += 32 + pcursor->GetValueSize();
-            ss << VARINT(0);
-        } else {
-            return error("%s: unable to read value", __func__);
+            CCoinsStatsShard& shard = vShards[nShard];
+            bool fOk = ReadShard(nShard, shard);
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                shard.fDone = true;
+                shard.fOk = fOk;
+            }
+            cond.notify_all();
         }
-        pcursor->Next();
     }
+
+    bool HashShards(CCoinsStats& stats, CHashWriter& ss)
+    {
+        for (int nShard = 0; nShard < UTXO_STATS_SHARDS; nShard++) {
+            boost::this_thread::interruption_point();
+            CCoinsStatsShard& shard = vShards[nShard];
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (!shard.fDone)
+                    cond.wait(lock);
+            }
+            if (!shard.fOk)
+                return false;
+            if (!shard.ss.empty())
+                ss.write(&shard.ss[0], shard.ss.size());
+            stats.nTransactions += shard.stats.nTransactions;
+            stats.nTransactionOutputs += shard.stats.nTransactionOutputs;
+            stats.nSerializedSize += shard.stats.nSerializedSize;
+            stats.nTotalAmount += shard.stats.nTotalAmount;
+            shard.ss = CDataStream(SER_GETHASH, PROTOCOL_VERSION); // free it
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                nHashed++;
+            }
+            cond.notify_all();
+        }
+        return true;
+    }
+
+public:
+    CCoinsStatsCollector(const CCoinsViewDB& viewIn, const CDBSnapshot& snapshotIn, int nThreads) :
+        view(viewIn), snapshot(snapshotIn), nMaxAhead(2 * nThreads), vShards(UTXO_STATS_SHARDS), nNextShard(0), nHashed(0), fAbort(false) {}
+
+    //! Add the statistics and hash data of all shards, using nThreads workers
+    bool Collect(CCoinsStats& stats, CHashWriter& ss, int nThreads)
+    {
+        boost::thread_group threadGroup;
+        bool fOk = false;
+        try {
+            for (int i = 0; i < nThreads; i++)
+                threadGroup.create_thread(boost::bind(&CCoinsStatsCollector::ThreadWork, this));
+            fOk = HashShards(stats, ss);
+        } catch (...) {
+            fAbort = true;
+            cond.notify_all();
+            threadGroup.join_all();
+            throw;
+        }
+        fAbort = true;
+        cond.notify_all();
+        threadGroup.join_all();
+        return fOk;
+    }
+};
+
+} // anon namespace
+
+//! Calculate statistics about the unspent transaction output set as of snapshot
+static bool GetUTXOStats(const CCoinsViewDB& view, const CDBSnapshot& snapshot, CCoinsStats& stats)
+{
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    stats.hashBlock = view.GetBestBlock(snapshot);
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(stats.hashBlock);
+        if (it == mapBlockIndex.end())
+            return error("%s: unknown best block %s", __func__, stats.hashBlock.ToString());
+        stats.nHeight = it->second->nHeight;
+    }
+    ss << stats.hashBlock;
+    int nThreads = std::max(1, std::min(GetNumCores(), MAX_SCRIPTCHECK_THREADS));
+    CCoinsStatsCollector collector(view, snapshot, nThreads);
+    if (!collector.Collect(stats, ss, nThreads))
+        return false;
     stats.hashSerialized = ss.GetHash();
-    stats.nTotalAmount = nTotalAmount;
     return true;
 }
 
@@ -694,9 +886,20 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
 
     UniValue ret(UniValue::VOBJ);
 
+    // Write everything out, and take a snapshot of the database before
+    // validation can change it again. The statistics are computed from the
+    // snapshot without holding up validation.
+    boost::scoped_ptr<CDBSnapshot> psnapshot;
+    {
+        LOCK(cs_main);
+        FlushStateToDisk();
+        if (!pcoinsdbview)
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Chain state database is not open");
+        psnapshot.reset(new CDBSnapshot(pcoinsdbview->GetDB()));
+    }
+
     CCoinsStats stats;
-    FlushStateToDisk();
-    if (GetUTXOStats(pcoinsTip, stats)) {
+    if (GetUTXOStats(*pcoinsdbview, *psnapshot, stats)) {
         ret.push_back(Pair("height", (int64_t)stats.nHeight));
         ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
         ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
@@ -710,6 +913,98 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
     return ret;
 }
 
+static UniValue DBStatsToJSON(const CDBWrapper& db)
+{
+    UniValue ret(UniValue::VOBJ);
+    const CDBOptions& dboptions = db.GetDBOptions();
+    ret.push_back(Pair("compression", dboptions.fCompression));
+    ret.push_back(Pair("maxopenfiles", dboptions.nMaxOpenFiles));
+    ret.push_back(Pair("bloombits", dboptions.nBloomBits));
+    ret.push_back(Pair("blocksize", (uint64_t)dboptions.nBlockSize));
+    ret.push_back(Pair("writebuffer", (uint64_t)db.GetWriteBufferSize()));
+
+    // Keys start with a one-byte record type, so break the size down by that
+    UniValue sizes(UniValue::VOBJ);
+    uint64_t nTotal = 0;
+    // No key has a one-byte prefix after 0xff, so the last range ends at a
+    // key of 0xff bytes longer than any key in use instead
+    const std::pair<char, uint256> keyEnd((char)0xff, uint256S(std::string(64, 'f')));
+    for (int i = 0; i <= 255; i++) {
+        uint64_t nSize = i < 255 ? db.EstimateSize((char)i, (char)(i + 1)) : db.EstimateSize((char)i, keyEnd);
+        if (nSize == 0)
+            continue;
+        bool fLetter = (i >= 'A' && i <= 'Z') || (i >= 'a' && i <= 'z');
+        std::string strPrefix = fLetter ? std::string(1, (char)i) : strprintf("0x%02x", i);
+        sizes.push_back(Pair(strPrefix, nSize));
+        nTotal += nSize;
+    }
+    ret.push_back(Pair("approximate_size", nTotal));
+    ret.push_back(Pair("approximate_sizes", sizes));
+    ret.push_back(Pair("stats", db.GetProperty("leveldb.stats")));
+    return ret;
+}
+
+UniValue getdbstats(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getdbstats\n"
+            "\nReturns the settings and LevelDB statistics of the block chain databases,\n"
+            "and statistics of the cache of recently served blocks.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"chainstate\": {          (object) The chain state database (chainstate/)\n"
+            "    \"compression\": true|false, (boolean) Whether table blocks are compressed, if LevelDB supports it\n"
+            "    \"maxopenfiles\": n,     (numeric) Number of table files that may be kept open\n"
+            "    \"bloombits\": n,        (numeric) Bloom filter bits per key, 0 for none\n"
+            "    \"blocksize\": n,        (numeric) Approximate table block size in bytes\n"
+            "    \"writebuffer\": n,      (numeric) Memtable size in bytes\n"
+            "    \"approximate_size\": n, (numeric) Estimated disk space used, in bytes\n"
+            "    \"approximate_sizes\": { (object) Estimated disk space by key type\n"
+            "      \"type\": n,           (numeric) For keys starting with this character (or hex byte)\n"
+            "      ...\n"
+            "    },\n"
+            "    \"stats\": \"...\"         (string) LevelDB's statistics: files, sizes and compaction work per level\n"
+            "  },\n"
+            "  \"blockindex\": {          (object) The block index database (blocks/index/), which includes the transaction index\n"
+            "    ...                      Same fields as for chainstate\n"
+            "  },\n"
+            "  \"blockcache\": {          (object) The cache of recently served blocks (see -blockservecache)\n"
+            "    \"blocks\": n,           (numeric) Number of blocks in the cache\n"
+            "    \"bytes\": n,            (numeric) Memory used by their serializations and hex forms\n"
+            "    \"maxbytes\": n,         (numeric) Memory limit of the cache\n"
+            "    \"hits\": n,             (numeric) Blocks requests served from the cache\n"
+            "    \"misses\": n,           (numeric) Block requests that read the block from disk\n"
+            "    \"hexhits\": n,          (numeric) Hex form requests served from the cache\n"
+            "    \"hexmisses\": n         (numeric) Hex form requests that encoded the block\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getdbstats", "")
+            + HelpExampleRpc("getdbstats", "")
+        );
+
+    LOCK(cs_main);
+    if (!pcoinsdbview || !pblocktree)
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Databases are not open");
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("chainstate", DBStatsToJSON(pcoinsdbview->GetDB())));
+    ret.push_back(Pair("blockindex", DBStatsToJSON(*pblocktree)));
+
+    CBlockCacheStats stats = blockcache.GetStats();
+    UniValue cache(UniValue::VOBJ);
+    cache.push_back(Pair("blocks", (uint64_t)stats.nBlocks));
+    cache.push_back(Pair("bytes", (uint64_t)stats.nBytes));
+    cache.push_back(Pair("maxbytes", (uint64_t)stats.nMaxBytes));
+    cache.push_back(Pair("hits", stats.nHits));
+    cache.push_back(Pair("misses", stats.nMisses));
+    cache.push_back(Pair("hexhits", stats.nHexHits));
+    cache.push_back(Pair("hexmisses", stats.nHexMisses));
+    ret.push_back(Pair("blockcache", cache));
+    return ret;
+}
+
 UniValue gettxout(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 2 || params.size() > 3)
@@ -735,7 +1030,6 @@ UniValue gettxout(const UniValue& params, bool fHelp)
             "        ,...\n"
             "     ]\n"
             "  },\n"
-            "  \"version\" : n,            (numeric) The version\n"
             "  \"coinbase\" : true|false   (boolean) Coinbase or not\n"
             "}\n"
 
@@ -759,33 +1053,33 @@ UniValue gettxout(const UniValue& params, bool fHelp)
     if (params.size() > 2)
         fMempool = params[2].get_bool();
 
-    CCoins coins;
+    if (n < 0)
+        return NullUniValue;
+    COutPoint out(hash, n);
+
+    Coin coin;
     if (fMempool) {
         LOCK(mempool.cs);
         CCoinsViewMemPool view(pcoinsTip, mempool);
-        if (!view.GetCoins(hash, coins))
+        if (!view.GetCoin(out, coin) || mempool.isSpent(out)) // TODO: filtering spent coins should be done by the CCoinsViewMemPool
             return NullUniValue;
-        mempool.pruneSpent(hash, coins); // TODO: this should be done by the CCoinsViewMemPool
     } else {
-        if (!pcoinsTip->GetCoins(hash, coins))
+        if (!pcoinsTip->GetCoin(out, coin))
             return NullUniValue;
     }
-    if (n<0 || (unsigned int)n>=coins.vout.size() || coins.vout[n].IsNull())
-        return NullUniValue;
 
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     CBlockIndex *pindex = it->second;
     ret.push_back(Pair("bestblock", pindex->GetBlockHash().GetHex()));
-    if ((unsigned int)coins.nHeight == MEMPOOL_HEIGHT)
+    if (coin.nHeight == MEMPOOL_HEIGHT)
         ret.push_back(Pair("confirmations", 0));
     else
-        ret.push_back(Pair("confirmations", pindex->nHeight - coins.nHeight + 1));
-    ret.push_back(Pair("value", ValueFromAmount(coins.vout[n].nValue)));
+        ret.push_back(Pair("confirmations", (int64_t)(pindex->nHeight - coin.nHeight + 1)));
+    ret.push_back(Pair("value", ValueFromAmount(coin.out.nValue)));
     UniValue o(UniValue::VOBJ);
-    ScriptPubKeyToJSON(coins.vout[n].scriptPubKey, o, true);
+    ScriptPubKeyToJSON(coin.out.scriptPubKey, o, true);
     ret.push_back(Pair("scriptPubKey", o));
-    ret.push_back(Pair("version", coins.nVersion));
-    ret.push_back(Pair("coinbase", coins.fCoinBase));
+    ret.push_back(Pair("coinbase", (bool)coin.fCoinBase));
 
     return ret;
 }
@@ -1085,6 +1379,10 @@ UniValue mempoolInfoToJSON()
     size_t maxmempool = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
     ret.push_back(Pair("maxmempool", (int64_t) maxmempool));
     ret.push_back(Pair("mempoolminfee", ValueFromAmount(mempool.GetMinFee(maxmempool).GetFeePerK())));
+    uint64_t nScriptCacheHits, nScriptCacheMisses;
+    GetScriptExecutionCacheStats(nScriptCacheHits, nScriptCacheMisses);
+    ret.push_back(Pair("scriptcachehits", nScriptCacheHits));
+    ret.push_back(Pair("scriptcachemisses", nScriptCacheMisses));
 
     return ret;
 }
@@ -1101,7 +1399,9 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp)
             "  \"bytes\": xxxxx,              (numeric) Sum of all tx sizes\n"
             "  \"usage\": xxxxx,              (numeric) Total memory usage for the mempool\n"
             "  \"maxmempool\": xxxxx,         (numeric) Maximum memory usage for the mempool\n"
-            "  \"mempoolminfee\": xxxxx       (numeric) Minimum fee for tx to be accepted\n"
+            "  \"mempoolminfee\": xxxxx,      (numeric) Minimum fee for tx to be accepted\n"
+            "  \"scriptcachehits\": xxxxx,    (numeric) Transactions whose scripts were skipped thanks to the script execution cache\n"
+            "  \"scriptcachemisses\": xxxxx   (numeric) Transactions whose scripts had to be run\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getmempoolinfo", "")
@@ -1196,6 +1496,7 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getblockhash",           &getblockhash,           true  },
     { "blockchain",         "getblockheader",         &getblockheader,         true  },
     { "blockchain",         "getchaintips",           &getchaintips,           true  },
+    { "blockchain",         "getdbstats",             &getdbstats,             true  },
     { "blockchain",         "getdifficulty",          &getdifficulty,          true  },
     { "blockchain",         "getmempoolancestors",    &getmempoolancestors,    true  },
     { "blockchain",         "getmempooldescendants",  &getmempooldescendants,  true  },
@@ -1215,4 +1516,7 @@ void RegisterBlockchainRPCCommands(CRPCTable &tableRPC)
 {
     for (unsigned int vcidx = 0; vcidx < ARRAYLEN(commands); vcidx++)
         tableRPC.appendCommand(commands[vcidx].name, &commands[vcidx]);
+
+    tableRPC.appendStreamCommand("getblock", &getblock_stream);
+    tableRPC.appendStreamCommand("getrawmempool", &getrawmempool_stream);
 }
@@ -0,0 +1,158 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "rpc/jsonwriter.h"
+
+#include <assert.h>
+
+CJSONWriter::CJSONWriter(Output outputIn) : output(outputIn), nChunkSize(0), nFlushed(0), fAfterKey(false)
+{
+}
+
+CJSONWriter::CJSONWriter(const Sink& sinkIn, size_t nChunkSizeIn) : output(OUTPUT_TEXT), sink(sinkIn), nChunkSize(nChunkSizeIn), nFlushed(0), fAfterKey(false)
+{
+}
+
+UniValue* CJSONWriter::AddValue(const UniValue& val)
+{
+    fAfterKey = false;
+    if (vContainers.empty()) {
+        valRoot = val;
+        return &valRoot;
+    }
+    UniValue& parent = *vContainers.back();
+    if (parent.isObject())
+        parent.pushKV(strKey, val);
+    else
+        parent.push_back(val);
+    // Only the innermost container is added to, so this stays valid until
+    // the value is complete
+    return const_cast<UniValue*>(&parent[parent.size() - 1]);
+}
+
+void CJSONWriter::BeginContainer(UniValue::VType type)
+{
+    // Added empty and filled in place, so that it is not copied
+    vContainers.push_back(AddValue(UniValue(type)));
+}
+
+void CJSONWriter::EndContainer(UniValue::VType type)
+{
+    assert(!vContainers.empty() && vContainers.back()->getType() == type && !fAfterKey);
+    vContainers.pop_back();
+}
+
+void CJSONWriter::BeginValue()
+{
+    if (fAfterKey) {
+        fAfterKey = false;
+    } else if (!vEmpty.empty()) {
+        if (!vEmpty.back())
+            buffer += ',';
+        vEmpty.back() = false;
+    }
+}
+
+void CJSONWriter::Written()
+{
+    if (sink && buffer.size() >= nChunkSize)
+        Flush();
+}
+
+void CJSONWriter::BeginObject()
+{
+    if (output == OUTPUT_VALUE) {
+        BeginContainer(UniValue::VOBJ);
+        return;
+    }
+    BeginValue();
+    buffer += '{';
+    vEmpty.push_back(true);
+}
+
+void CJSONWriter::EndObject()
+{
+    if (output == OUTPUT_VALUE) {
+        EndContainer(UniValue::VOBJ);
+        return;
+    }
+    assert(!vEmpty.empty() && !fAfterKey);
+    vEmpty.pop_back();
+    buffer += '}';
+    Written();
+}
+
+void CJSONWriter::BeginArray()
+{
+    if (output == OUTPUT_VALUE) {
+        BeginContainer(UniValue::VARR);
+        return;
+    }
+    BeginValue();
+    buffer += '[';
+    vEmpty.push_back(true);
+}
+
+void CJSONWriter::EndArray()
+{
+    if (output == OUTPUT_VALUE) {
+        EndContainer(UniValue::VARR);
+        return;
+    }
+    assert(!vEmpty.empty());
+    vEmpty.pop_back();
+    buffer += ']';
+    Written();
+}
+
+void CJSONWriter::Key(const std::string& key)
+{
+    if (output == OUTPUT_VALUE) {
+        assert(!vContainers.empty() && vContainers.back()->isObject() && !fAfterKey);
+        strKey = key;
+        fAfterKey = true;
+        return;
+    }
+    assert(!vEmpty.empty() && !fAfterKey);
+    if (!vEmpty.back())
+        buffer += ',';
+    vEmpty.back() = false;
+    buffer += UniValue(key).write();
+    buffer += ':';
+    fAfterKey = true;
+}
+
+void CJSONWriter::Value(const UniValue& val)
+{
+    if (output == OUTPUT_VALUE) {
+        assert(vContainers.empty() || vContainers.back()->isArray() || fAfterKey);
+        AddValue(val);
+        return;
+    }
+    BeginValue();
+    buffer += val.write();
+    Written();
+}
+
+void CJSONWriter::Raw(const std::string& str)
+{
+    assert(output == OUTPUT_TEXT);
+    buffer += str;
+    Written();
+}
+
+void CJSONWriter::Flush()
+{
+    if (!sink || buffer.empty())
+        return;
+    sink(buffer);
+    nFlushed += buffer.size();
+    buffer.clear();
+}
+
+const UniValue& CJSONWriter::GetValue() const
+{
+    assert(output == OUTPUT_VALUE && vContainers.empty());
+    return valRoot;
+}
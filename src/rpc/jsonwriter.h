@@ -0,0 +1,94 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_RPC_JSONWRITER_H
+#define BITCOIN_RPC_JSONWRITER_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <boost/function.hpp>
+
+#include <univalue.h>
+
+/** Number of bytes a CJSONWriter collects before handing them to its sink */
+static const size_t JSON_WRITER_CHUNK_SIZE = 64 * 1024;
+
+/**
+ * Serializes a JSON document piece by piece, so that large results do not
+ * have to be built as a UniValue tree and written to a single string first.
+ *
+ * Containers are opened and closed explicitly; everything else is written
+ * with UniValue::write(), so the output is the same as that of write() on
+ * the equivalent tree. Output is collected in a buffer, which is passed to
+ * the sink (if any) whenever it holds nChunkSize bytes or more.
+ *
+ * A writer can also build the document as a UniValue tree instead, for
+ * callers that need a value, so that code producing large results can be
+ * written once for both.
+ */
+class CJSONWriter
+{
+public:
+    typedef boost::function<void (const std::string&)> Sink;
+
+    /** What a writer without a sink produces */
+    enum Output {
+        OUTPUT_TEXT,    //!< JSON text, see GetBuffer()
+        OUTPUT_VALUE,   //!< A UniValue tree, see GetValue()
+    };
+
+private:
+    Output output;
+    Sink sink;
+    size_t nChunkSize;
+    std::string buffer;
+    uint64_t nFlushed;
+    //! One entry per open container, set until something is written into it
+    std::vector<bool> vEmpty;
+    bool fAfterKey;
+
+    //! With OUTPUT_VALUE: the document, the open containers in it and the
+    //! key of the next value
+    UniValue valRoot;
+    std::vector<UniValue*> vContainers;
+    std::string strKey;
+
+    void BeginValue();
+    void Written();
+    UniValue* AddValue(const UniValue& val);
+    void BeginContainer(UniValue::VType type);
+    void EndContainer(UniValue::VType type);
+
+public:
+    /** Collect all output in the buffer, or in a UniValue */
+    explicit CJSONWriter(Output outputIn = OUTPUT_TEXT);
+    CJSONWriter(const Sink& sinkIn, size_t nChunkSizeIn = JSON_WRITER_CHUNK_SIZE);
+
+    void BeginObject();
+    void EndObject();
+    void BeginArray();
+    void EndArray();
+
+    /** Write an object key, the next value written belongs to it */
+    void Key(const std::string& key);
+    void Value(const UniValue& val);
+    void Pair(const std::string& key, const UniValue& val) { Key(key); Value(val); }
+    /** Write str as is, e.g. the line break that ends a document. Not for OUTPUT_VALUE. */
+    void Raw(const std::string& str);
+
+    /** Pass the buffer to the sink, if there is one */
+    void Flush();
+
+    /** Output not passed to the sink yet (all of it without a sink) */
+    const std::string& GetBuffer() const { return buffer; }
+    /** Bytes passed to the sink so far */
+    uint64_t GetFlushed() const { return nFlushed; }
+
+    /** The document built by an OUTPUT_VALUE writer */
+    const UniValue& GetValue() const;
+};
+
+#endif // BITCOIN_RPC_JSONWRITER_H
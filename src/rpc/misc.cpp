@@ -5,6 +5,7 @@
 
 #include "base58.h"
 #include "clientversion.h"
+#include "httpserver.h"
 #include "init.h"
 #include "main.h"
 #include "net.h"
@@ -447,10 +448,55 @@ UniValue setmocktime(const UniValue& params, bool fHelp)
     return NullUniValue;
 }
 
+UniValue gethttpqueueinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "gethttpqueueinfo\n"
+            "Returns the state of the work queues (lanes) that HTTP requests wait in for a worker thread.\n"
+            "JSON-RPC calls in the mining category, except long-poll getblocktemplate, and REST requests\n"
+            "have their own lanes, unless -rpcminingthreads or -restthreads is 0. The REST lane has no\n"
+            "threads unless -rest is set.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"lane\": {              (json object) one of rpc, mining and rest\n"
+            "    \"threads\": n,        (numeric) worker threads, 0 if the lane's requests go to the rpc lane\n"
+            "    \"busy\": n,           (numeric) worker threads handling a request\n"
+            "    \"depth\": n,          (numeric) requests waiting for a worker thread\n"
+            "    \"maxdepth\": n,       (numeric) depth beyond which requests are rejected\n"
+            "    \"requests\": n,       (numeric) requests taken by a worker thread\n"
+            "    \"rejected\": n,       (numeric) requests rejected because the queue was full\n"
+            "    \"waittime\": n,       (numeric) total time requests waited for a worker thread, in microseconds\n"
+            "    \"maxwaittime\": n     (numeric) longest time a request waited, in microseconds\n"
+            "  },\n"
+            "  ...\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("gethttpqueueinfo", "")
+            + HelpExampleRpc("gethttpqueueinfo", "")
+        );
+
+    UniValue ret(UniValue::VOBJ);
+    BOOST_FOREACH(const HTTPLaneStats& stats, GetHTTPLaneStats()) {
+        UniValue lane(UniValue::VOBJ);
+        lane.push_back(Pair("threads", stats.nThreads));
+        lane.push_back(Pair("busy", stats.nBusy));
+        lane.push_back(Pair("depth", (uint64_t)stats.nDepth));
+        lane.push_back(Pair("maxdepth", (uint64_t)stats.nMaxDepth));
+        lane.push_back(Pair("requests", stats.nRequests));
+        lane.push_back(Pair("rejected", stats.nRejected));
+        lane.push_back(Pair("waittime", stats.nWaitTime));
+        lane.push_back(Pair("maxwaittime", stats.nMaxWaitTime));
+        ret.push_back(Pair(stats.name, lane));
+    }
+    return ret;
+}
+
 static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         okSafeMode
   //  --------------------- ------------------------  -----------------------  ----------
     { "control",            "getinfo",                &getinfo,                true  }, /* uses wallet if enabled */
+    { "control",            "gethttpqueueinfo",       &gethttpqueueinfo,       true  },
     { "util",               "validateaddress",        &validateaddress,        true  }, /* uses wallet if enabled */
     { "util",               "createmultisig",         &createmultisig,         true  },
     { "util",               "verifymessage",          &verifymessage,          true  },
@@ -61,6 +61,31 @@ UniValue JSONRPCError(int code, const string& message)
     return error;
 }
 
+string JSONRPCPeekMethod(const string& strRequest)
+{
+    static const char* WHITESPACE = " \t\r\n";
+    size_t pos = strRequest.find_first_not_of(WHITESPACE);
+    if (pos == string::npos || strRequest[pos] != '{')
+        return "";
+    pos = strRequest.find("\"method\"", pos);
+    if (pos == string::npos)
+        return "";
+    pos = strRequest.find_first_not_of(WHITESPACE, pos + 8);
+    if (pos == string::npos || strRequest[pos] != ':')
+        return "";
+    pos = strRequest.find_first_not_of(WHITESPACE, pos + 1);
+    if (pos == string::npos || strRequest[pos] != '"')
+        return "";
+    size_t end = strRequest.find('"', pos + 1);
+    if (end == string::npos)
+        return "";
+    string strMethod = strRequest.substr(pos + 1, end - pos - 1);
+    // No method names need escapes
+    if (strMethod.find('\\') != string::npos)
+        return "";
+    return strMethod;
+}
+
 /** Username used when cookie authentication is in use (arbitrary, only for
  * recognizability in debugging/logging purposes)
  */
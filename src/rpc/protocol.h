@@ -80,6 +80,12 @@ std::string JSONRPCRequest(const std::string& strMethod, const UniValue& params,
 UniValue JSONRPCReplyObj(const UniValue& result, const UniValue& error, const UniValue& id);
 std::string JSONRPCReply(const UniValue& result, const UniValue& error, const UniValue& id);
 UniValue JSONRPCError(int code, const std::string& message);
+/**
+ * Find the method of a JSON-RPC request by looking for its "method" key,
+ * without parsing the request, to route it early. Returns an empty string
+ * for batches, or if it is not found in strRequest, which may be cut short.
+ */
+std::string JSONRPCPeekMethod(const std::string& strRequest);
 
 /** Get name of RPC authentication cookie file */
 boost::filesystem::path GetAuthCookieFile();
@@ -25,6 +25,8 @@
 #include <boost/thread.hpp>
 #include <boost/algorithm/string/case_conv.hpp> // for to_upper()
 
+#include <set>
+
 using namespace RPCServer;
 using namespace std;
 
@@ -307,6 +309,14 @@ bool CRPCTable::appendCommand(const std::string& name, const CRPCCommand* pcmd)
     return true;
 }
 
+bool CRPCTable::appendStreamCommand(const std::string& name, rpcstreamfn_type actor)
+{
+    if (IsRPCRunning() || !mapCommands.count(name))
+        return false;
+
+    return mapStreamCommands.insert(std::make_pair(name, actor)).second;
+}
+
 bool StartRPC()
 {
     LogPrint("rpc", "Starting RPC\n");
@@ -409,12 +419,128 @@ static UniValue JSONRPCExecOne(const UniValue& req)
     return rpc_result;
 }
 
-std::string JSONRPCExecBatch(const UniValue& vReq)
+/**
+ * Methods that only read node state, so that the order in which they run
+ * does not matter. okSafeMode is no such marker: submitblock, setban,
+ * walletpassphrase and many other calls that change state are allowed in
+ * safe mode.
+ */
+static const char* const vReadOnlyMethods[] = {
+    "decoderawtransaction",
+    "decodescript",
+    "estimatefee",
+    "estimatepriority",
+    "estimatesmartfee",
+    "estimatesmartpriority",
+    "getbestblockhash",
+    "getblock",
+    "getblockchaininfo",
+    "getblockcount",
+    "getblockhash",
+    "getblockheader",
+    "getchaintips",
+    "getconnectioncount",
+    "getdifficulty",
+    "getmempoolancestors",
+    "getmempooldescendants",
+    "getmempoolentry",
+    "getmempoolinfo",
+    "getnetworkinfo",
+    "getpeerinfo",
+    "getrawmempool",
+    "getrawtransaction",
+    "gettxout",
+    "gettxoutproof",
+    "verifytxoutproof",
+};
+
+/** Whether a batch element may run concurrently with its neighbours */
+static bool IsConcurrentRequest(const UniValue& req)
 {
-    UniValue ret(UniValue::VARR);
-    for (unsigned int reqIdx = 0; reqIdx < vReq.size(); reqIdx++)
-        ret.push_back(JSONRPCExecOne(vReq[reqIdx]));
+    static const std::set<std::string> setReadOnly(vReadOnlyMethods, vReadOnlyMethods + ARRAYLEN(vReadOnlyMethods));
+    if (!req.isObject())
+        return false;
+    const UniValue& valMethod = find_value(req, "method");
+    if (!valMethod.isStr())
+        return false;
+    return setReadOnly.count(valMethod.get_str()) && tableRPC[valMethod.get_str()];
+}
+
+/**
+ * A run of batch elements that several threads take requests from until
+ * none are left. Threads that only start once the run is finished find
+ * nothing to do, so the batch does not have to wait for them.
+ */
+class CRPCBatchRun
+{
+private:
+    boost::mutex cs;
+    boost::condition_variable cond;
+    const UniValue* pvReq;
+    std::vector<UniValue>* pvReply;
+    size_t nNext;
+    size_t nEnd;
+    size_t nRunning;
+
+public:
+    CRPCBatchRun(const UniValue* pvReqIn, std::vector<UniValue>* pvReplyIn, size_t nBegin, size_t nEndIn) :
+        pvReq(pvReqIn), pvReply(pvReplyIn), nNext(nBegin), nEnd(nEndIn), nRunning(0) {}
+
+    void Work()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (nNext < nEnd) {
+            size_t n = nNext++;
+            nRunning++;
+            lock.unlock();
+            (*pvReply)[n] = JSONRPCExecOne((*pvReq)[n]);
+            lock.lock();
+            nRunning--;
+        }
+        if (nRunning == 0)
+            cond.notify_all();
+    }
+
+    /** Wait until every element of the run has been executed */
+    void Wait()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (nNext < nEnd || nRunning > 0)
+            cond.wait(lock);
+    }
+};
+
+std::string JSONRPCExecBatch(const UniValue& vReq, const RPCBatchDispatcher& dispatch)
+{
+    size_t nThreads = 1;
+    if (dispatch)
+        nThreads = std::max(GetArg("-rpcbatchthreads", DEFAULT_RPC_BATCH_THREADS), (int64_t)1);
+
+    std::vector<UniValue> vReply(vReq.size());
+    size_t reqIdx = 0;
+    while (reqIdx < vReq.size()) {
+        size_t nEnd = reqIdx;
+        while (nThreads > 1 && nEnd < vReq.size() && IsConcurrentRequest(vReq[nEnd]))
+            nEnd++;
+        if (nEnd - reqIdx < 2) {
+            vReply[reqIdx] = JSONRPCExecOne(vReq[reqIdx]);
+            reqIdx++;
+            continue;
+        }
+
+        boost::shared_ptr<CRPCBatchRun> run(new CRPCBatchRun(&vReq, &vReply, reqIdx, nEnd));
+        size_t nHelpers = std::min(nThreads, nEnd - reqIdx) - 1;
+        for (size_t i = 0; i < nHelpers; i++) {
+            if (!dispatch(boost::bind(&CRPCBatchRun::Work, run)))
+                break;
+        }
+        run->Work();
+        run->Wait();
+        reqIdx = nEnd;
+    }
 
+    UniValue ret(UniValue::VARR);
+    ret.push_backV(vReply);
     return ret.write() + "\n";
 }
 
@@ -447,6 +573,37 @@ UniValue CRPCTable::execute(const std::string &strMethod, const UniValue &params
     g_rpcSignals.PostCommand(*pcmd);
 }
 
+bool CRPCTable::executeStream(const std::string &strMethod, const UniValue &params, CJSONWriter& writer) const
+{
+    std::map<std::string, rpcstreamfn_type>::const_iterator it = mapStreamCommands.find(strMethod);
+    if (it == mapStreamCommands.end())
+        return false;
+
+    // Return immediately if in warmup
+    {
+        LOCK(cs_rpcWarmup);
+        if (fRPCInWarmup)
+            throw JSONRPCError(RPC_IN_WARMUP, rpcWarmupStatus);
+    }
+
+    const CRPCCommand *pcmd = tableRPC[strMethod];
+    assert(pcmd);
+    g_rpcSignals.PreCommand(*pcmd);
+
+    try
+    {
+        // Execute
+        it->second(params, writer);
+    }
+    catch (const std::exception& e)
+    {
+        throw JSONRPCError(RPC_MISC_ERROR, e.what());
+    }
+
+    g_rpcSignals.PostCommand(*pcmd);
+    return true;
+}
+
 std::vector<std::string> CRPCTable::listCommands() const
 {
     std::vector<std::string> commandList;
@@ -20,6 +20,8 @@
 #include <univalue.h>
 
 static const unsigned int DEFAULT_RPC_SERIALIZE_VERSION = 1;
+/** Default for -rpcbatchthreads, the most threads a single JSON-RPC batch runs on */
+static const int DEFAULT_RPC_BATCH_THREADS = 4;
 
 class CRPCCommand;
 
@@ -32,6 +34,7 @@ namespace RPCServer
 }
 
 class CBlockIndex;
+class CJSONWriter;
 class CNetAddr;
 
 /** Wrapper for UniValue::VType, which includes typeAny:
@@ -125,6 +128,7 @@ void RPCUnsetTimerInterface(RPCTimerInterface *iface);
 void RPCRunLater(const std::string& name, boost::function<void(void)> func, int64_t nSeconds);
 
 typedef UniValue(*rpcfn_type)(const UniValue& params, bool fHelp);
+typedef void(*rpcstreamfn_type)(const UniValue& params, CJSONWriter& writer);
 
 class CRPCCommand
 {
@@ -142,6 +146,7 @@ class CRPCTable
 {
 private:
     std::map<std::string, const CRPCCommand*> mapCommands;
+    std::map<std::string, rpcstreamfn_type> mapStreamCommands;
 public:
     CRPCTable();
     const CRPCCommand* operator[](const std::string& name) const;
@@ -156,6 +161,15 @@ public:
      */
     UniValue execute(const std::string &method, const UniValue &params) const;
 
+    /**
+     * Execute a method that can write its result as it goes, see
+     * appendStreamCommand().
+     * @returns false if the method has no such form; nothing is written then.
+     * @throws an exception (UniValue) when an error happens, before anything
+     * is written unless it is an internal error.
+     */
+    bool executeStream(const std::string &method, const UniValue &params, CJSONWriter& writer) const;
+
     /**
     * Returns a list of registered commands
     * @returns List of registered commands.
@@ -169,6 +183,14 @@ public:
      * Commands cannot be overwritten (returns false).
      */
     bool appendCommand(const std::string& name, const CRPCCommand* pcmd);
+
+    /**
+     * Add a second form to a command that writes its result to a CJSONWriter
+     * instead of returning it, for results too large to build in memory.
+     * It must produce the same JSON as the actor and do all checks that can
+     * fail before writing anything. Not used for help.
+     */
+    bool appendStreamCommand(const std::string& name, rpcstreamfn_type actor);
 };
 
 extern CRPCTable tableRPC;
@@ -195,7 +217,18 @@ extern void EnsureWalletIsUnlocked();
 bool StartRPC();
 void InterruptRPC();
 void StopRPC();
-std::string JSONRPCExecBatch(const UniValue& vReq);
+
+/** Starts a function on another thread, or returns false if it cannot */
+typedef boost::function<bool (const boost::function<void ()>&)> RPCBatchDispatcher;
+
+/**
+ * Execute a batch of requests and return the replies in the same order.
+ * Consecutive requests for methods that only read node state are run
+ * concurrently, on the calling thread and on up to -rpcbatchthreads - 1
+ * threads started with dispatch. Any other request waits for the ones before
+ * it and runs alone.
+ */
+std::string JSONRPCExecBatch(const UniValue& vReq, const RPCBatchDispatcher& dispatch = RPCBatchDispatcher());
 
 // Retrieves any serialization flags requested in command line argument
 int RPCSerializationFlags();
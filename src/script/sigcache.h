@@ -8,14 +8,35 @@
 
 #include "script/interpreter.h"
 
+#include <cstring>
 #include <vector>
 
-// DoS prevention: limit cache size to less than 40MB (over 500000
-// entries on 64-bit systems).
+// DoS prevention: limit cache size to 40MB (about 1.3 million entries, all
+// allocated up front).
 static const unsigned int DEFAULT_MAX_SIG_CACHE_SIZE = 40;
+// Maximum sig cache size allowed
+static const int64_t MAX_MAX_SIG_CACHE_SIZE = 16384;
 
 class CPubKey;
 
+/**
+ * Hasher for the cuckoo caches of salted 256-bit entries (signature and
+ * script execution caches). The entries already include a secret nonce, so
+ * the eight cuckoo hash functions are simply their eight 32-bit words.
+ */
+class CSignatureCacheHasher
+{
+public:
+    template <uint8_t hash_select>
+    uint32_t operator()(const uint256& key) const
+    {
+        static_assert(hash_select < 8, "CSignatureCacheHasher only has 8 hashes available.");
+        uint32_t u;
+        std::memcpy(&u, key.begin() + 4 * hash_select, 4);
+        return u;
+    }
+};
+
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker
 {
 private:
@@ -27,4 +48,7 @@ public:
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 };
 
+/** Allocate the signature cache, sized by -maxsigcachesize. */
+void InitSignatureCache();
+
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
@@ -0,0 +1,263 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "socketevents.h"
+
+#include "netbase.h"
+#include "util.h"
+#include "utiltime.h"
+
+#include <algorithm>
+
+#ifdef USE_EPOLL
+//! Maximum number of events taken from the kernel in one epoll_wait() call
+static const int MAX_EPOLL_EVENTS = 1024;
+#endif
+
+bool CSocketEvents::ParseBackend(const std::string& strName, Backend& backend)
+{
+    if (strName == "select") {
+        backend = BACKEND_SELECT;
+        return true;
+    }
+    if (strName == "epoll") {
+        backend = BACKEND_EPOLL;
+        return true;
+    }
+    return false;
+}
+
+std::string CSocketEvents::GetBackendName(Backend backend)
+{
+    switch (backend) {
+    case BACKEND_SELECT: return "select";
+    case BACKEND_EPOLL: return "epoll";
+    }
+    return "unknown";
+}
+
+bool CSocketEvents::IsBackendSupported(Backend backend)
+{
+#ifdef USE_EPOLL
+    if (backend == BACKEND_EPOLL)
+        return true;
+#endif
+    return backend == BACKEND_SELECT;
+}
+
+CSocketEvents::CSocketEvents() : backend(BACKEND_SELECT), fStarted(false)
+{
+#ifdef USE_EPOLL
+    hEpoll = -1;
+#endif
+}
+
+CSocketEvents::~CSocketEvents()
+{
+    // No locking; this may run during static destruction
+#ifdef USE_EPOLL
+    if (hEpoll != -1)
+        close(hEpoll);
+#endif
+}
+
+bool CSocketEvents::Start(Backend backendIn)
+{
+    Stop();
+    if (!IsBackendSupported(backendIn))
+        return false;
+#ifdef USE_EPOLL
+    if (backendIn == BACKEND_EPOLL) {
+        hEpoll = epoll_create1(EPOLL_CLOEXEC);
+        if (hEpoll == -1) {
+            LogPrintf("%s: epoll_create1 failed: %s\n", __func__, NetworkErrorString(WSAGetLastError()));
+            return false;
+        }
+        vEpollEvents.resize(MAX_EPOLL_EVENTS);
+    }
+#endif
+    backend = backendIn;
+    fStarted = true;
+    return true;
+}
+
+void CSocketEvents::Stop()
+{
+    LOCK(cs);
+#ifdef USE_EPOLL
+    if (hEpoll != -1) {
+        close(hEpoll);
+        hEpoll = -1;
+    }
+#endif
+    mapSockets.clear();
+    fStarted = false;
+}
+
+bool CSocketEvents::IsUsableSocket(SOCKET s) const
+{
+    if (backend == BACKEND_EPOLL)
+        return true;
+    return IsSelectableSocket(s);
+}
+
+bool CSocketEvents::Add(SOCKET s, void* pdata, bool fListen)
+{
+    if (!fStarted || s == INVALID_SOCKET || !IsUsableSocket(s))
+        return false;
+
+    LOCK(cs);
+    Entry& entry = mapSockets[s];
+    entry.pdata = pdata;
+    entry.nInterest = fListen ? EVENT_RECV : 0;
+    entry.fListen = fListen;
+#ifdef USE_EPOLL
+    if (backend == BACKEND_EPOLL) {
+        struct epoll_event event;
+        event.events = fListen ? EPOLLIN : (EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET);
+        event.data.fd = s;
+        // A descriptor that was closed without Remove() may still be registered
+        if (epoll_ctl(hEpoll, EPOLL_CTL_ADD, s, &event) == -1 &&
+            (errno != EEXIST || epoll_ctl(hEpoll, EPOLL_CTL_MOD, s, &event) == -1)) {
+            LogPrintf("%s: epoll_ctl failed: %s\n", __func__, NetworkErrorString(WSAGetLastError()));
+            mapSockets.erase(s);
+            return false;
+        }
+    }
+#endif
+    return true;
+}
+
+void CSocketEvents::Remove(SOCKET s)
+{
+    if (!fStarted || s == INVALID_SOCKET)
+        return;
+
+    LOCK(cs);
+    if (mapSockets.erase(s) == 0)
+        return;
+#ifdef USE_EPOLL
+    // Closing the socket would unregister it too, but not while a copy of the
+    // descriptor (say, in a forked child) keeps it open.
+    if (backend == BACKEND_EPOLL)
+        epoll_ctl(hEpoll, EPOLL_CTL_DEL, s, NULL);
+#endif
+}
+
+void CSocketEvents::SetInterest(SOCKET s, int nEvents)
+{
+    if (backend != BACKEND_SELECT)
+        return;
+
+    LOCK(cs);
+    std::map<SOCKET, Entry>::iterator it = mapSockets.find(s);
+    if (it != mapSockets.end() && !it->second.fListen)
+        it->second.nInterest = nEvents;
+}
+
+bool CSocketEvents::Wait(int64_t nTimeoutMillis, std::vector<Event>& vEvents)
+{
+#ifdef USE_EPOLL
+    if (fStarted && backend == BACKEND_EPOLL)
+        return WaitEpoll(nTimeoutMillis, vEvents);
+#endif
+    return WaitSelect(nTimeoutMillis, vEvents);
+}
+
+bool CSocketEvents::WaitSelect(int64_t nTimeoutMillis, std::vector<Event>& vEvents)
+{
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+    bool have_fds = false;
+
+    {
+        LOCK(cs);
+        for (std::map<SOCKET, Entry>::const_iterator it = mapSockets.begin(); it != mapSockets.end(); ++it) {
+            const SOCKET s = it->first;
+            if (!it->second.fListen)
+                FD_SET(s, &fdsetError);
+            if (it->second.nInterest & EVENT_RECV)
+                FD_SET(s, &fdsetRecv);
+            if (it->second.nInterest & EVENT_SEND)
+                FD_SET(s, &fdsetSend);
+            hSocketMax = std::max(hSocketMax, s);
+            have_fds = true;
+        }
+    }
+
+    struct timeval timeout = MillisToTimeval(nTimeoutMillis);
+    int nSelect = select(have_fds ? hSocketMax + 1 : 0,
+                         &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+
+    LOCK(cs);
+    if (nSelect == SOCKET_ERROR) {
+        if (have_fds) {
+            int nErr = WSAGetLastError();
+            LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
+            for (std::map<SOCKET, Entry>::const_iterator it = mapSockets.begin(); it != mapSockets.end(); ++it) {
+                Event event = {it->first, it->second.pdata, EVENT_RECV};
+                vEvents.push_back(event);
+            }
+        }
+        MilliSleep(nTimeoutMillis);
+        return false;
+    }
+
+    if (nSelect > 0) {
+        for (std::map<SOCKET, Entry>::const_iterator it = mapSockets.begin(); it != mapSockets.end(); ++it) {
+            const SOCKET s = it->first;
+            int nEvents = 0;
+            if (FD_ISSET(s, &fdsetRecv))
+                nEvents |= EVENT_RECV;
+            if (FD_ISSET(s, &fdsetSend))
+                nEvents |= EVENT_SEND;
+            if (FD_ISSET(s, &fdsetError))
+                nEvents |= EVENT_ERROR;
+            if (nEvents) {
+                Event event = {s, it->second.pdata, nEvents};
+                vEvents.push_back(event);
+            }
+        }
+    }
+    return true;
+}
+
+#ifdef USE_EPOLL
+bool CSocketEvents::WaitEpoll(int64_t nTimeoutMillis, std::vector<Event>& vEvents)
+{
+    int nReady = epoll_wait(hEpoll, &vEpollEvents[0], vEpollEvents.size(), nTimeoutMillis);
+    if (nReady == -1) {
+        int nErr = WSAGetLastError();
+        if (nErr == WSAEINTR)
+            return true;
+        LogPrintf("socket epoll_wait error %s\n", NetworkErrorString(nErr));
+        MilliSleep(nTimeoutMillis);
+        return false;
+    }
+
+    LOCK(cs);
+    for (int i = 0; i < nReady; i++) {
+        const struct epoll_event& ev = vEpollEvents[i];
+        // Skip sockets removed after the kernel reported them
+        std::map<SOCKET, Entry>::const_iterator it = mapSockets.find(ev.data.fd);
+        if (it == mapSockets.end())
+            continue;
+        int nEvents = 0;
+        if (ev.events & (EPOLLIN | EPOLLRDHUP))
+            nEvents |= EVENT_RECV;
+        if (ev.events & EPOLLOUT)
+            nEvents |= EVENT_SEND;
+        if (ev.events & (EPOLLERR | EPOLLHUP))
+            nEvents |= EVENT_ERROR;
+        Event event = {it->first, it->second.pdata, nEvents};
+        vEvents.push_back(event);
+    }
+    return true;
+}
+#endif
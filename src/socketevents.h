@@ -0,0 +1,124 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SOCKETEVENTS_H
+#define BITCOIN_SOCKETEVENTS_H
+
+#include "compat.h"
+#include "sync.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#endif
+
+/**
+ * Waits for many sockets at once to become ready for receiving or sending.
+ *
+ * With the epoll backend, sockets are registered with the kernel once, and
+ * waiting costs the same no matter how many of them are idle. Their readiness
+ * is edge-triggered: an event is only reported when a socket becomes ready
+ * again, so after one the caller has to keep receiving (or sending) until the
+ * call would block, or remember that the socket is still ready. Listening
+ * sockets are level-triggered instead, so one connection can be accepted per
+ * event.
+ *
+ * The select() backend is the portable fallback. It is level-triggered,
+ * rebuilds its descriptor sets on every Wait() and can't watch descriptors
+ * at or above FD_SETSIZE.
+ *
+ * Add() and Remove() may be called from any thread; Wait() from one thread
+ * at a time.
+ */
+class CSocketEvents
+{
+public:
+    enum Backend {
+        BACKEND_SELECT,
+        BACKEND_EPOLL,
+    };
+
+    //! Event flags
+    static const int EVENT_RECV = 1;
+    static const int EVENT_SEND = 2;
+    static const int EVENT_ERROR = 4;
+
+    struct Event {
+        SOCKET hSocket;
+        //! Whatever was passed to Add()
+        void* pdata;
+        int nEvents;
+    };
+
+    //! Parse a backend name ("epoll" or "select"). Returns false for unknown names.
+    static bool ParseBackend(const std::string& strName, Backend& backend);
+    static std::string GetBackendName(Backend backend);
+    //! Whether this build supports the backend
+    static bool IsBackendSupported(Backend backend);
+
+    CSocketEvents();
+    ~CSocketEvents();
+
+    /** Start watching with the given backend. Returns false, and stays stopped,
+     *  when it isn't available. Not thread safe. */
+    bool Start(Backend backendIn);
+    /** Stop watching; all sockets are forgotten. Not thread safe. */
+    void Stop();
+
+    bool IsStarted() const { return fStarted; }
+    Backend GetBackend() const { return backend; }
+
+    //! Whether the current backend can watch s
+    bool IsUsableSocket(SOCKET s) const;
+
+    /** Watch s, until Remove(s). Its events are reported along with pdata.
+     *  Listening sockets are only watched for incoming connections. Does
+     *  nothing when stopped. */
+    bool Add(SOCKET s, void* pdata, bool fListen = false);
+    /** Stop watching s. Call this before closing the socket. */
+    void Remove(SOCKET s);
+    /** Which of EVENT_RECV/EVENT_SEND Wait() should look for on s. Only used
+     *  by the select() backend, which starts without either; epoll reports
+     *  every change. Errors are always reported. */
+    void SetInterest(SOCKET s, int nEvents);
+
+    /** Wait up to nTimeoutMillis for events and append them to vEvents.
+     *  Returns false if waiting failed, after sleeping for the timeout; the
+     *  select() backend then reports every socket as readable, so that the
+     *  caller notices the broken ones. */
+    bool Wait(int64_t nTimeoutMillis, std::vector<Event>& vEvents);
+
+private:
+    struct Entry {
+        void* pdata;
+        int nInterest;
+        bool fListen;
+    };
+
+    Backend backend;
+    bool fStarted;
+
+    CCriticalSection cs;
+    //! Watched sockets (protected by cs)
+    std::map<SOCKET, Entry> mapSockets;
+
+#ifdef USE_EPOLL
+    int hEpoll;
+    //! Buffer for epoll_wait(); only used by Wait()
+    std::vector<struct epoll_event> vEpollEvents;
+#endif
+
+    CSocketEvents(const CSocketEvents&);
+    CSocketEvents& operator=(const CSocketEvents&);
+
+    bool WaitSelect(int64_t nTimeoutMillis, std::vector<Event>& vEvents);
+#ifdef USE_EPOLL
+    bool WaitEpoll(int64_t nTimeoutMillis, std::vector<Event>& vEvents);
+#endif
+};
+
+#endif // BITCOIN_SOCKETEVENTS_H
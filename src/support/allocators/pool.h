@@ -0,0 +1,215 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+#define BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+
+#include <stddef.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+/**
+ * A memory resource for many allocations of a few small sizes, like the nodes
+ * of a node-based container.
+ *
+ * Memory is taken from the system in chunks, which are carved into blocks
+ * rounded up to a multiple of ALIGN_BYTES, without any per-block overhead.
+ * Freed blocks go onto a free list for their size and are handed out again
+ * by later allocations of that size. Nothing is returned to the system before
+ * the resource is destroyed, which releases all chunks at once.
+ *
+ * Allocations larger than MAX_BLOCK_SIZE_BYTES, or that need a stricter
+ * alignment than ALIGN_BYTES, go to operator new directly.
+ *
+ * Not thread safe.
+ */
+template <size_t MAX_BLOCK_SIZE_BYTES, size_t ALIGN_BYTES>
+class CPoolResource
+{
+    static_assert(ALIGN_BYTES > 0 && (ALIGN_BYTES & (ALIGN_BYTES - 1)) == 0, "ALIGN_BYTES must be a power of two");
+    static_assert(ALIGN_BYTES >= sizeof(void*), "blocks must fit a free list pointer");
+    static_assert(ALIGN_BYTES <= alignof(std::max_align_t), "chunks are only aligned to std::max_align_t");
+
+private:
+    //! A freed block, linking to the next free block of the same size
+    struct ListNode {
+        ListNode* next;
+    };
+
+    //! Free lists by block size in units of ALIGN_BYTES
+    ListNode* vFreeLists[(MAX_BLOCK_SIZE_BYTES + ALIGN_BYTES - 1) / ALIGN_BYTES + 1];
+
+    const size_t nChunkSizeBytes;
+    std::vector<char*> vChunks;
+    //! Not yet used part of the last chunk
+    char* pAvailableBegin;
+    char* pAvailableEnd;
+
+    //! Outstanding allocations that did not fit the pool
+    size_t nLargeAllocations;
+    size_t nLargeBytes;
+
+    CPoolResource(const CPoolResource&);
+    CPoolResource& operator=(const CPoolResource&);
+
+    static size_t NumAlignUnits(size_t nBytes)
+    {
+        return (nBytes + ALIGN_BYTES - 1) / ALIGN_BYTES + (nBytes == 0);
+    }
+
+    static bool IsPoolable(size_t nBytes, size_t nAlignment)
+    {
+        return nAlignment <= ALIGN_BYTES && nBytes <= MAX_BLOCK_SIZE_BYTES;
+    }
+
+    void PushFree(void* p, size_t nUnits)
+    {
+        ListNode* node = new (p) ListNode;
+        node->next = vFreeLists[nUnits];
+        vFreeLists[nUnits] = node;
+    }
+
+    void AllocateChunk()
+    {
+        // The rest of the current chunk is too small for the request, but
+        // still good for a smaller one
+        const size_t nRemaining = pAvailableEnd - pAvailableBegin;
+        if (nRemaining > 0)
+            PushFree(pAvailableBegin, nRemaining / ALIGN_BYTES);
+
+        vChunks.reserve(vChunks.size() + 1);
+        pAvailableBegin = static_cast<char*>(::operator new(nChunkSizeBytes));
+        pAvailableEnd = pAvailableBegin + nChunkSizeBytes;
+        vChunks.push_back(pAvailableBegin);
+    }
+
+public:
+    static const size_t DEFAULT_CHUNK_SIZE_BYTES = 256 * 1024;
+
+    explicit CPoolResource(size_t nChunkSizeBytesIn = DEFAULT_CHUNK_SIZE_BYTES)
+        : nChunkSizeBytes(NumAlignUnits(std::max(nChunkSizeBytesIn, MAX_BLOCK_SIZE_BYTES)) * ALIGN_BYTES),
+          pAvailableBegin(NULL), pAvailableEnd(NULL), nLargeAllocations(0), nLargeBytes(0)
+    {
+        for (size_t i = 0; i < sizeof(vFreeLists) / sizeof(vFreeLists[0]); i++)
+            vFreeLists[i] = NULL;
+    }
+
+    ~CPoolResource()
+    {
+        for (size_t i = 0; i < vChunks.size(); i++)
+            ::operator delete(vChunks[i]);
+    }
+
+    void* Allocate(size_t nBytes, size_t nAlignment)
+    {
+        if (!IsPoolable(nBytes, nAlignment)) {
+            nLargeAllocations++;
+            nLargeBytes += nBytes;
+            return ::operator new(nBytes);
+        }
+        const size_t nUnits = NumAlignUnits(nBytes);
+        if (vFreeLists[nUnits] != NULL) {
+            ListNode* node = vFreeLists[nUnits];
+            vFreeLists[nUnits] = node->next;
+            return node;
+        }
+        if ((size_t)(pAvailableEnd - pAvailableBegin) < nUnits * ALIGN_BYTES)
+            AllocateChunk();
+        void* p = pAvailableBegin;
+        pAvailableBegin += nUnits * ALIGN_BYTES;
+        return p;
+    }
+
+    void Deallocate(void* p, size_t nBytes, size_t nAlignment)
+    {
+        if (!IsPoolable(nBytes, nAlignment)) {
+            nLargeAllocations--;
+            nLargeBytes -= nBytes;
+            ::operator delete(p);
+            return;
+        }
+        PushFree(p, NumAlignUnits(nBytes));
+    }
+
+    size_t ChunkSizeBytes() const { return nChunkSizeBytes; }
+    size_t NumAllocatedChunks() const { return vChunks.size(); }
+    size_t ChunkListCapacity() const { return vChunks.capacity(); }
+    size_t NumLargeAllocations() const { return nLargeAllocations; }
+    size_t LargeAllocatedBytes() const { return nLargeBytes; }
+};
+
+/**
+ * Allocator taking its memory from a shared CPoolResource, for containers
+ * whose memory should be pooled. Copies (and rebound copies) of an allocator
+ * share its resource, which lives until the last of them is gone. A default
+ * constructed allocator starts a new resource.
+ *
+ * The allocator moves along with the contents of a container when it is
+ * swapped or assigned, so two containers never share a resource by accident.
+ */
+template <typename T, size_t MAX_BLOCK_SIZE_BYTES, size_t ALIGN_BYTES = alignof(void*)>
+class CPoolAllocator
+{
+public:
+    typedef CPoolResource<MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> Resource;
+
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    template <typename U>
+    struct rebind {
+        typedef CPoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> other;
+    };
+
+    CPoolAllocator() : resource(std::make_shared<Resource>()) {}
+    explicit CPoolAllocator(const std::shared_ptr<Resource>& resourceIn) : resource(resourceIn) {}
+
+    template <typename U>
+    CPoolAllocator(const CPoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& other) : resource(other.GetResource())
+    {
+    }
+
+    T* allocate(size_t n)
+    {
+        return static_cast<T*>(resource->Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        resource->Deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    const std::shared_ptr<Resource>& GetResource() const { return resource; }
+
+private:
+    std::shared_ptr<Resource> resource;
+};
+
+template <typename T, typename U, size_t MAX_BLOCK_SIZE_BYTES, size_t ALIGN_BYTES>
+bool operator==(const CPoolAllocator<T, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a, const CPoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b)
+{
+    return a.GetResource() == b.GetResource();
+}
+
+template <typename T, typename U, size_t MAX_BLOCK_SIZE_BYTES, size_t ALIGN_BYTES>
+bool operator!=(const CPoolAllocator<T, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a, const CPoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b)
+{
+    return !(a == b);
+}
+
+#endif // BITCOIN_SUPPORT_ALLOCATORS_POOL_H
@@ -0,0 +1,125 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockcache.h"
+#include "chainparams.h"
+#include "consensus/validation.h"
+#include "main.h"
+#include "streams.h"
+#include "utilstrencodings.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockcache_tests, BasicTestingSetup)
+
+static std::shared_ptr<const std::vector<unsigned char> > MakeBlock(unsigned char c, size_t nSize)
+{
+    return std::make_shared<const std::vector<unsigned char> >(nSize, c);
+}
+
+BOOST_AUTO_TEST_CASE(blockcache_lru)
+{
+    CBlockCache cache(1000);
+    uint256 hashA = uint256S("0a"), hashB = uint256S("0b"), hashC = uint256S("0c");
+
+    BOOST_CHECK(!cache.Get(hashA));
+    cache.Put(hashA, MakeBlock(0xa, 400));
+    cache.Put(hashB, MakeBlock(0xb, 400));
+    BOOST_CHECK_EQUAL(cache.Get(hashA)->size(), 400U);
+
+    // B is the least recently used, so it makes room for C
+    cache.Put(hashC, MakeBlock(0xc, 400));
+    BOOST_CHECK(cache.Get(hashA));
+    BOOST_CHECK(!cache.Get(hashB));
+    BOOST_CHECK(cache.Get(hashC));
+
+    // Blocks larger than the whole cache are not added
+    cache.Put(hashB, MakeBlock(0xb, 1001));
+    BOOST_CHECK(!cache.Get(hashB));
+
+    // Hex forms count towards the limit and are dropped with their block
+    BOOST_CHECK(!cache.GetHex(hashA));
+    cache.PutHex(hashB, std::make_shared<const std::string>("bb"));
+    BOOST_CHECK(!cache.GetHex(hashB));
+    cache.PutHex(hashC, std::make_shared<const std::string>(100, 'c'));
+    BOOST_CHECK_EQUAL(*cache.GetHex(hashC), std::string(100, 'c'));
+    CBlockCacheStats stats = cache.GetStats();
+    BOOST_CHECK_EQUAL(stats.nBlocks, 2U);
+    BOOST_CHECK_EQUAL(stats.nBytes, 900U);
+    BOOST_CHECK_EQUAL(stats.nHits, 3U);
+    BOOST_CHECK_EQUAL(stats.nMisses, 3U);
+    BOOST_CHECK_EQUAL(stats.nHexHits, 1U);
+    BOOST_CHECK_EQUAL(stats.nHexMisses, 2U);
+
+    // C was used last, so shrinking the cache evicts A
+    cache.SetMaxBytes(500);
+    BOOST_CHECK(!cache.Get(hashA));
+    BOOST_CHECK(cache.GetHex(hashC));
+
+    cache.Erase(hashC);
+    BOOST_CHECK(!cache.Get(hashC));
+    BOOST_CHECK_EQUAL(cache.GetStats().nBytes, 0U);
+
+    // Nothing is kept with a limit of 0
+    cache.SetMaxBytes(0);
+    cache.Put(hashA, MakeBlock(0xa, 1));
+    BOOST_CHECK(!cache.Get(hashA));
+}
+
+BOOST_FIXTURE_TEST_CASE(blockcache_readservedblock, TestChain100Setup)
+{
+    const CChainParams& chainparams = Params();
+    CBlockIndex* pindex = chainActive.Tip();
+    const uint256 hash = pindex->GetBlockHash();
+    CBlock blockDisk;
+    BOOST_CHECK(ReadBlockFromDisk(blockDisk, pindex, chainparams.GetConsensus()));
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << blockDisk;
+
+    blockcache.Clear();
+    CBlockCacheStats statsBefore = blockcache.GetStats();
+    std::shared_ptr<const std::vector<unsigned char> > pvchBlock;
+    BOOST_CHECK(ReadServedBlock(pvchBlock, pindex->GetBlockPos(), hash, chainparams.MessageStart(), true));
+    BOOST_CHECK(*pvchBlock == std::vector<unsigned char>(ss.begin(), ss.end()));
+
+    CBlock block;
+    BOOST_CHECK(ReadServedBlock(block, pindex->GetBlockPos(), hash, chainparams, true));
+    BOOST_CHECK(block.GetHash() == hash);
+    std::shared_ptr<const std::string> pstrHex;
+    BOOST_CHECK(ReadServedBlockHex(pstrHex, pindex->GetBlockPos(), hash, chainparams.MessageStart(), true));
+    BOOST_CHECK_EQUAL(*pstrHex, HexStr(ss.begin(), ss.end()));
+    BOOST_CHECK(ReadServedBlockHex(pstrHex, pindex->GetBlockPos(), hash, chainparams.MessageStart(), true));
+
+    CBlockCacheStats stats = blockcache.GetStats();
+    BOOST_CHECK_EQUAL(stats.nBlocks, 1U);
+    BOOST_CHECK_EQUAL(stats.nMisses - statsBefore.nMisses, 1U);
+    BOOST_CHECK_EQUAL(stats.nHits - statsBefore.nHits, 2U);
+    BOOST_CHECK_EQUAL(stats.nHexHits - statsBefore.nHexHits, 1U);
+
+    // Blocks are only added to the cache when asked to
+    CBlockIndex* pindexOld = chainActive[1];
+    BOOST_CHECK(ReadServedBlock(pvchBlock, pindexOld->GetBlockPos(), pindexOld->GetBlockHash(), chainparams.MessageStart(), false));
+    BOOST_CHECK(!blockcache.Get(pindexOld->GetBlockHash()));
+
+    // A block read under the wrong hash is rejected and not kept
+    CBlock blockWrong;
+    uint256 hashPrev = pindex->pprev->GetBlockHash();
+    BOOST_CHECK(!ReadServedBlock(blockWrong, pindex->GetBlockPos(), hashPrev, chainparams, true));
+    BOOST_CHECK(!blockcache.Get(hashPrev));
+    BOOST_CHECK(!ReadServedBlock(pvchBlock, pindex->GetBlockPos(), hashPrev, chainparams.MessageStart(), true));
+    BOOST_CHECK(!ReadServedBlockHex(pstrHex, pindex->GetBlockPos(), hashPrev, chainparams.MessageStart(), true));
+    BOOST_CHECK(!blockcache.Get(hashPrev));
+
+    // Disconnecting the tip drops it from the cache
+    CValidationState state;
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(InvalidateBlock(state, chainparams, pindex));
+    }
+    BOOST_CHECK(!blockcache.Get(hash));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,89 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "checkqueue.h"
+#include "main.h"
+#include "random.h"
+
+#include "test/test_bitcoin.h"
+
+#include <atomic>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(checkqueue_tests, BasicTestingSetup)
+
+static std::atomic<int> nChecksRun(0);
+
+/** Counts how often it runs; fails if fOk is false. */
+class CCountingCheck
+{
+private:
+    bool fOk;
+
+public:
+    CCountingCheck() : fOk(true) {}
+    explicit CCountingCheck(bool fOkIn) : fOk(fOkIn) {}
+
+    bool operator()()
+    {
+        nChecksRun++;
+        return fOk;
+    }
+
+    void swap(CCountingCheck& check) { std::swap(fOk, check.fOk); }
+};
+
+static void RunCheckQueue(int nThreads)
+{
+    CCheckQueue<CCountingCheck> queue(16);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < nThreads - 1; i++)
+        threadGroup.create_thread(boost::bind(&CCheckQueue<CCountingCheck>::Thread, &queue));
+
+    for (int nRound = 0; nRound < 50; nRound++) {
+        // Batches of varying size, spilling over the rings' initial capacity
+        nChecksRun = 0;
+        int nTotal = 0;
+        {
+            CCheckQueueControl<CCountingCheck> control(&queue);
+            for (int i = 0; i < 20; i++) {
+                std::vector<CCountingCheck> vChecks(insecure_rand() % 600);
+                nTotal += vChecks.size();
+                control.Add(vChecks);
+                BOOST_CHECK(vChecks.empty());
+            }
+            BOOST_CHECK(control.Wait());
+        }
+        BOOST_CHECK_EQUAL(nChecksRun.load(), nTotal);
+
+        // A single failure fails the whole round, and doesn't leak into the next one
+        {
+            CCheckQueueControl<CCountingCheck> control(&queue);
+            std::vector<CCountingCheck> vChecks(100);
+            vChecks[insecure_rand() % 100] = CCountingCheck(false);
+            control.Add(vChecks);
+            BOOST_CHECK(!control.Wait());
+        }
+    }
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_master_only)
+{
+    RunCheckQueue(1);
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_workers)
+{
+    RunCheckQueue(4);
+    RunCheckQueue(MAX_SCRIPTCHECK_THREADS);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
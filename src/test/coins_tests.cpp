@@ -3,61 +3,70 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "coins.h"
+#include "coinsprefetch.h"
 #include "random.h"
 #include "script/standard.h"
 #include "uint256.h"
 #include "utilstrencodings.h"
 #include "test/test_bitcoin.h"
 #include "main.h"
+#include "txdb.h"
 #include "consensus/validation.h"
+#include "undo.h"
 
 #include <vector>
 #include <map>
 
+#include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
 
 namespace
 {
+//! equality test
+bool operator==(const Coin &a, const Coin &b) {
+    // Empty Coin objects are always equal.
+    if (a.IsSpent() && b.IsSpent()) return true;
+    return a.fCoinBase == b.fCoinBase &&
+           a.nHeight == b.nHeight &&
+           a.out == b.out;
+}
+
 class CCoinsViewTest : public CCoinsView
 {
     uint256 hashBestBlock_;
-    std::map<uint256, CCoins> map_;
+    std::map<COutPoint, Coin> map_;
 
 public:
-    bool GetCoins(const uint256& txid, CCoins& coins) const
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const
     {
-        std::map<uint256, CCoins>::const_iterator it = map_.find(txid);
+        std::map<COutPoint, Coin>::const_iterator it = map_.find(outpoint);
         if (it == map_.end()) {
             return false;
         }
-        coins = it->second;
-        if (coins.IsPruned() && insecure_rand() % 2 == 0) {
+        coin = it->second;
+        if (coin.IsSpent() && insecure_rand() % 2 == 0) {
             // Randomly return false in case of an empty entry.
             return false;
         }
         return true;
     }
 
-    bool HaveCoins(const uint256& txid) const
-    {
-        CCoins coins;
-        return GetCoins(txid, coins);
-    }
-
     uint256 GetBestBlock() const { return hashBestBlock_; }
 
     bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
     {
-        for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ) {
+        // Like CCoinsViewDB, leave the entries for the caller to clear
+        for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); ++it) {
             if (it->second.flags & CCoinsCacheEntry::DIRTY) {
                 // Same optimization used in CCoinsViewDB is to only write dirty entries.
-                map_[it->first] = it->second.coins;
-                if (it->second.coins.IsPruned() && insecure_rand() % 3 == 0) {
+                map_[it->first] = it->second.coin;
+                if (it->second.coin.IsSpent() && insecure_rand() % 3 == 0) {
                     // Randomly delete empty entries on write.
                     map_.erase(it->first);
                 }
             }
-            mapCoins.erase(it++);
         }
         if (!hashBlock.IsNull())
             hashBestBlock_ = hashBlock;
@@ -74,9 +83,12 @@ public:
     {
         // Manually recompute the dynamic usage of the whole data, and compare it.
         size_t ret = memusage::DynamicUsage(cacheCoins);
+        size_t count = 0;
         for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++) {
-            ret += it->second.coins.DynamicMemoryUsage();
+            ret += it->second.coin.DynamicMemoryUsage();
+            ++count;
         }
+        BOOST_CHECK_EQUAL(GetCacheSize(), count);
         BOOST_CHECK_EQUAL(DynamicMemoryUsage(), ret);
     }
 
@@ -91,7 +103,7 @@ static const unsigned int NUM_SIMULATION_ITERATIONS = 40000;
 // This is a large randomized insert/remove simulation test on a variable-size
 // stack of caches on top of CCoinsViewTest.
 //
-// It will randomly create/update/delete CCoins entries to a tip of caches, with
+// It will randomly create/update/delete Coin entries to a tip of caches, with
 // txids picked from a limited list of random 256-bit hashes. Occasionally, a
 // new tip is added to the stack of caches, or the tip is flushed and removed.
 //
@@ -103,13 +115,15 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     bool removed_all_caches = false;
     bool reached_4_caches = false;
     bool added_an_entry = false;
+    bool added_an_unspendable_entry = false;
     bool removed_an_entry = false;
     bool updated_an_entry = false;
     bool found_an_entry = false;
     bool missed_an_entry = false;
+    bool uncached_an_entry = false;
 
     // A simple map to track what we expect the cache stack to represent.
-    std::map<uint256, CCoins> result;
+    std::map<COutPoint, Coin> result;
 
     // The cache stack.
     CCoinsViewTest base; // A CCoinsViewTest at the bottom.
@@ -127,36 +141,52 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
         // Do a random modification.
         {
             uint256 txid = txids[insecure_rand() % txids.size()]; // txid we're going to modify in this iteration.
-            CCoins& coins = result[txid];
-            CCoinsModifier entry = stack.back()->ModifyCoins(txid);
-            BOOST_CHECK(coins == *entry);
-            if (insecure_rand() % 5 == 0 || coins.IsPruned()) {
-                if (coins.IsPruned()) {
-                    added_an_entry = true;
+            Coin& coin = result[COutPoint(txid, 0)];
+            const Coin& entry = (insecure_rand() % 500 == 0) ?
+                AccessByTxid(*stack.back(), txid) : stack.back()->AccessCoin(COutPoint(txid, 0));
+            BOOST_CHECK(coin == entry);
+
+            if (insecure_rand() % 5 == 0 || coin.IsSpent()) {
+                Coin newcoin;
+                newcoin.out.nValue = insecure_rand();
+                newcoin.nHeight = 1;
+                if (insecure_rand() % 16 == 0 && coin.IsSpent()) {
+                    newcoin.out.scriptPubKey.assign(1 + (insecure_rand() & 0x3F), OP_RETURN);
+                    BOOST_CHECK(newcoin.out.scriptPubKey.IsUnspendable());
+                    added_an_unspendable_entry = true;
                 } else {
-                    updated_an_entry = true;
+                    newcoin.out.scriptPubKey.assign(insecure_rand() & 0x3F, 0); // Random sizes so we can test memory usage accounting
+                    (coin.IsSpent() ? added_an_entry : updated_an_entry) = true;
+                    coin = newcoin;
                 }
-                coins.nVersion = insecure_rand();
-                coins.vout.resize(1);
-                coins.vout[0].nValue = insecure_rand();
-                *entry = coins;
+                stack.back()->AddCoin(COutPoint(txid, 0), newcoin, !coin.IsSpent() || insecure_rand() & 1);
             } else {
-                coins.Clear();
-                entry->Clear();
                 removed_an_entry = true;
+                coin.Clear();
+                stack.back()->SpendCoin(COutPoint(txid, 0));
             }
         }
 
+        // Once every 10 iterations, remove a random entry from the cache
+        if (insecure_rand() % 10 == 0) {
+            COutPoint out(txids[insecure_rand() % txids.size()], 0);
+            int cacheid = insecure_rand() % stack.size();
+            stack[cacheid]->Uncache(out);
+            uncached_an_entry |= !stack[cacheid]->HaveCoinInCache(out);
+        }
+
         // Once every 1000 iterations and at the end, verify the full cache.
         if (insecure_rand() % 1000 == 1 || i == NUM_SIMULATION_ITERATIONS - 1) {
-            for (std::map<uint256, CCoins>::iterator it = result.begin(); it != result.end(); it++) {
-                const CCoins* coins = stack.back()->AccessCoins(it->first);
-                if (coins) {
-                    BOOST_CHECK(*coins == it->second);
-                    found_an_entry = true;
-                } else {
-                    BOOST_CHECK(it->second.IsPruned());
+            for (std::map<COutPoint, Coin>::iterator it = result.begin(); it != result.end(); it++) {
+                bool have = stack.back()->HaveCoin(it->first);
+                const Coin& coin = stack.back()->AccessCoin(it->first);
+                BOOST_CHECK(have == !coin.IsSpent());
+                BOOST_CHECK(coin == it->second);
+                if (coin.IsSpent()) {
                     missed_an_entry = true;
+                } else {
+                    BOOST_CHECK(stack.back()->HaveCoinInCache(it->first));
+                    found_an_entry = true;
                 }
             }
             BOOST_FOREACH(const CCoinsViewCacheTest *test, stack) {
@@ -205,10 +235,12 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     BOOST_CHECK(removed_all_caches);
     BOOST_CHECK(reached_4_caches);
     BOOST_CHECK(added_an_entry);
+    BOOST_CHECK(added_an_unspendable_entry);
     BOOST_CHECK(removed_an_entry);
     BOOST_CHECK(updated_an_entry);
     BOOST_CHECK(found_an_entry);
     BOOST_CHECK(missed_an_entry);
+    BOOST_CHECK(uncached_an_entry);
 }
 
 // This test is similar to the previous test
@@ -220,7 +252,7 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
 {
     bool spent_a_duplicate_coinbase = false;
     // A simple map to track what we expect the cache stack to represent.
-    std::map<uint256, CCoins> result;
+    std::map<COutPoint, Coin> result;
 
     // The cache stack.
     CCoinsViewTest base; // A CCoinsViewTest at the bottom.
@@ -273,8 +305,7 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
                 tx.vin[0].prevout.n = 0;
 
                 // Update the expected result of prevouthash to know these coins are spent
-                CCoins& oldcoins = result[prevouthash];
-                oldcoins.Clear();
+                result[tx.vin[0].prevout].Clear();
 
                 // It is of particular importance here that once we spend a coinbase tx hash
                 // it is no longer available to be duplicated (or spent again)
@@ -294,21 +325,18 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
             alltxids.insert(tx.GetHash());
 
             // Update the expected result to know about the new output coins
-            CCoins &coins = result[tx.GetHash()];
-            coins.FromTx(tx, height);
+            result[COutPoint(tx.GetHash(), 0)] = Coin(tx.vout[0], height, CTransaction(tx).IsCoinBase());
 
             UpdateCoins(tx, *(stack.back()), height);
         }
 
         // Once every 1000 iterations and at the end, verify the full cache.
         if (insecure_rand() % 1000 == 1 || i == NUM_SIMULATION_ITERATIONS - 1) {
-            for (std::map<uint256, CCoins>::iterator it = result.begin(); it != result.end(); it++) {
-                const CCoins* coins = stack.back()->AccessCoins(it->first);
-                if (coins) {
-                    BOOST_CHECK(*coins == it->second);
-                 } else {
-                    BOOST_CHECK(it->second.IsPruned());
-                 }
+            for (std::map<COutPoint, Coin>::iterator it = result.begin(); it != result.end(); it++) {
+                bool have = stack.back()->HaveCoin(it->first);
+                const Coin& coin = stack.back()->AccessCoin(it->first);
+                BOOST_CHECK(have == !coin.IsSpent());
+                BOOST_CHECK(coin == it->second);
             }
         }
 
@@ -346,56 +374,44 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
     BOOST_CHECK(spent_a_duplicate_coinbase);
 }
 
-BOOST_AUTO_TEST_CASE(ccoins_serialization)
+BOOST_AUTO_TEST_CASE(coin_serialization)
 {
     // Good example
-    CDataStream ss1(ParseHex("0104835800816115944e077fe7c803cfa57f29b36bf87c1d358bb85e"), SER_DISK, CLIENT_VERSION);
-    CCoins cc1;
+    CDataStream ss1(ParseHex("97f23c835800816115944e077fe7c803cfa57f29b36bf87c1d35"), SER_DISK, CLIENT_VERSION);
+    Coin cc1;
     ss1 >> cc1;
-    BOOST_CHECK_EQUAL(cc1.nVersion, 1);
     BOOST_CHECK_EQUAL(cc1.fCoinBase, false);
     BOOST_CHECK_EQUAL(cc1.nHeight, 203998);
-    BOOST_CHECK_EQUAL(cc1.vout.size(), 2);
-    BOOST_CHECK_EQUAL(cc1.IsAvailable(0), false);
-    BOOST_CHECK_EQUAL(cc1.IsAvailable(1), true);
-    BOOST_CHECK_EQUAL(cc1.vout[1].nValue, 60000000000ULL);
-    BOOST_CHECK_EQUAL(HexStr(cc1.vout[1].scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("816115944e077fe7c803cfa57f29b36bf87c1d35"))))));
+    BOOST_CHECK_EQUAL(cc1.out.nValue, 60000000000ULL);
+    BOOST_CHECK_EQUAL(HexStr(cc1.out.scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("816115944e077fe7c803cfa57f29b36bf87c1d35"))))));
 
     // Good example
-    CDataStream ss2(ParseHex("0109044086ef97d5790061b01caab50f1b8e9c50a5057eb43c2d9563a4eebbd123008c988f1a4a4de2161e0f50aac7f17e7f9555caa486af3b"), SER_DISK, CLIENT_VERSION);
-    CCoins cc2;
+    CDataStream ss2(ParseHex("8ddf77bbd123008c988f1a4a4de2161e0f50aac7f17e7f9555caa4"), SER_DISK, CLIENT_VERSION);
+    Coin cc2;
     ss2 >> cc2;
-    BOOST_CHECK_EQUAL(cc2.nVersion, 1);
     BOOST_CHECK_EQUAL(cc2.fCoinBase, true);
     BOOST_CHECK_EQUAL(cc2.nHeight, 120891);
-    BOOST_CHECK_EQUAL(cc2.vout.size(), 17);
-    for (int i = 0; i < 17; i++) {
-        BOOST_CHECK_EQUAL(cc2.IsAvailable(i), i == 4 || i == 16);
-    }
-    BOOST_CHECK_EQUAL(cc2.vout[4].nValue, 234925952);
-    BOOST_CHECK_EQUAL(HexStr(cc2.vout[4].scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("61b01caab50f1b8e9c50a5057eb43c2d9563a4ee"))))));
-    BOOST_CHECK_EQUAL(cc2.vout[16].nValue, 110397);
-    BOOST_CHECK_EQUAL(HexStr(cc2.vout[16].scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("8c988f1a4a4de2161e0f50aac7f17e7f9555caa4"))))));
+    BOOST_CHECK_EQUAL(cc2.out.nValue, 110397);
+    BOOST_CHECK_EQUAL(HexStr(cc2.out.scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("8c988f1a4a4de2161e0f50aac7f17e7f9555caa4"))))));
 
-    // Smallest possible example
-    CDataStream ssx(SER_DISK, CLIENT_VERSION);
-    BOOST_CHECK_EQUAL(HexStr(ssx.begin(), ssx.end()), "");
+    // Round trip
+    CDataStream ss2b(SER_DISK, CLIENT_VERSION);
+    ss2b << cc2;
+    BOOST_CHECK_EQUAL(HexStr(ss2b.begin(), ss2b.end()), "8ddf77bbd123008c988f1a4a4de2161e0f50aac7f17e7f9555caa4");
 
-    CDataStream ss3(ParseHex("0002000600"), SER_DISK, CLIENT_VERSION);
-    CCoins cc3;
+    // Smallest possible example
+    CDataStream ss3(ParseHex("000006"), SER_DISK, CLIENT_VERSION);
+    Coin cc3;
     ss3 >> cc3;
-    BOOST_CHECK_EQUAL(cc3.nVersion, 0);
     BOOST_CHECK_EQUAL(cc3.fCoinBase, false);
     BOOST_CHECK_EQUAL(cc3.nHeight, 0);
-    BOOST_CHECK_EQUAL(cc3.vout.size(), 1);
-    BOOST_CHECK_EQUAL(cc3.IsAvailable(0), true);
-    BOOST_CHECK_EQUAL(cc3.vout[0].nValue, 0);
-    BOOST_CHECK_EQUAL(cc3.vout[0].scriptPubKey.size(), 0);
+    BOOST_CHECK_EQUAL(cc3.out.nValue, 0);
+    BOOST_CHECK_EQUAL(cc3.out.scriptPubKey.size(), 0);
 
     // scriptPubKey that ends beyond the end of the stream
-    CDataStream ss4(ParseHex("0002000800"), SER_DISK, CLIENT_VERSION);
+    CDataStream ss4(ParseHex("000007"), SER_DISK, CLIENT_VERSION);
     try {
-        CCoins cc4;
+        Coin cc4;
         ss4 >> cc4;
         BOOST_CHECK_MESSAGE(false, "We should have thrown");
     } catch (const std::ios_base::failure& e) {
@@ -406,13 +422,252 @@ BOOST_AUTO_TEST_CASE(ccoins_serialization)
     uint64_t x = 3000000000ULL;
     tmp << VARINT(x);
     BOOST_CHECK_EQUAL(HexStr(tmp.begin(), tmp.end()), "8a95c0bb00");
-    CDataStream ss5(ParseHex("0002008a95c0bb0000"), SER_DISK, CLIENT_VERSION);
+    CDataStream ss5(ParseHex("00008a95c0bb00"), SER_DISK, CLIENT_VERSION);
     try {
-        CCoins cc5;
+        Coin cc5;
         ss5 >> cc5;
         BOOST_CHECK_MESSAGE(false, "We should have thrown");
     } catch (const std::ios_base::failure& e) {
     }
 }
 
+BOOST_AUTO_TEST_CASE(txundo_legacy_format)
+{
+    // Undo records of older versions only carry the height and coinbase
+    // flag for the last spent output of a transaction (height 0 otherwise),
+    // followed by a version number.
+    Coin coin(CTxOut(50, CScript() << OP_TRUE), 120891, true);
+    CTxUndo undo;
+    undo.vprevout.push_back(coin);
+    undo.vprevout.push_back(Coin(coin.out, 0, false));
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << undo;
+    // count, (code, dummy version, compressed txout), (code, compressed txout)
+    BOOST_CHECK_EQUAL(HexStr(ss.begin(), ss.end()), "02" "8ddf77" "00" "2a0751" "00" "2a0751");
+
+    CTxUndo undo2;
+    ss >> undo2;
+    BOOST_REQUIRE_EQUAL(undo2.vprevout.size(), 2U);
+    BOOST_CHECK(undo2.vprevout[0] == coin);
+    BOOST_CHECK_EQUAL(undo2.vprevout[1].nHeight, 0);
+    BOOST_CHECK(undo2.vprevout[1].out == coin.out);
+}
+
+BOOST_AUTO_TEST_CASE(coins_write_behind)
+{
+    CCoinsViewTest base;
+    COutPoint outA(GetRandHash(), 0);
+    COutPoint outB(GetRandHash(), 1);
+    Coin coin(CTxOut(1000, CScript() << OP_TRUE), 100, false);
+    uint256 hashFirst = GetRandHash();
+    uint256 hashSecond = GetRandHash();
+    {
+        CCoinsViewWriteBehind writer(&base);
+        CCoinsViewCacheTest cache(&writer);
+        cache.AddCoin(outA, coin, false);
+        cache.AddCoin(outB, coin, false);
+        cache.SetBestBlock(hashFirst);
+        BOOST_CHECK(cache.Flush());
+        BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0U);
+
+        // Flushed outputs are visible whether or not they have been written yet
+        BOOST_CHECK(cache.AccessCoin(outA) == coin);
+        BOOST_CHECK(cache.GetBestBlock() == hashFirst);
+        BOOST_CHECK(cache.SpendCoin(outB));
+        cache.SetBestBlock(hashSecond);
+        BOOST_CHECK(cache.Flush());
+        BOOST_CHECK(cache.AccessCoin(outB).IsSpent());
+        BOOST_CHECK(writer.Sync());
+        BOOST_CHECK(!writer.HasFailed());
+        BOOST_CHECK(cache.AccessCoin(outA) == coin);
+    }
+    Coin coinRead;
+    BOOST_CHECK(base.GetCoin(outA, coinRead) && coinRead == coin);
+    BOOST_CHECK(!base.GetCoin(outB, coinRead) || coinRead.IsSpent());
+    BOOST_CHECK(base.GetBestBlock() == hashSecond);
+
+    // A failed write is reported by Sync() and fails the next flush
+    CCoinsView viewFailing;
+    CCoinsViewWriteBehind writer(&viewFailing);
+    CCoinsViewCacheTest cache(&writer);
+    cache.AddCoin(outA, coin, false);
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(!writer.Sync());
+    BOOST_CHECK(writer.HasFailed());
+    cache.AddCoin(outB, coin, false);
+    BOOST_CHECK(!cache.Flush());
+}
+
+// Holds each BatchWrite until Release() is called.
+class CCoinsViewHeld : public CCoinsViewTest
+{
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    bool fReleased;
+
+public:
+    CCoinsViewHeld() : fReleased(false) {}
+
+    void Release()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fReleased = true;
+        cond.notify_all();
+    }
+
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!fReleased)
+            cond.wait(lock);
+        return CCoinsViewTest::BatchWrite(mapCoins, hashBlock);
+    }
+};
+
+BOOST_AUTO_TEST_CASE(coins_write_behind_usage)
+{
+    CCoinsViewHeld base;
+    CCoinsViewWriteBehind writer(&base);
+    CCoinsViewCacheTest cache(&writer);
+    BOOST_CHECK_EQUAL(writer.DynamicMemoryUsage(), 0U);
+    for (int i = 0; i < 100; i++)
+        cache.AddCoin(COutPoint(GetRandHash(), 0), Coin(CTxOut(1000, CScript() << OP_TRUE), 100, false), false);
+    cache.SetBestBlock(GetRandHash());
+    const size_t nCacheUsage = cache.DynamicMemoryUsage();
+    BOOST_CHECK(cache.Flush());
+
+    // The flushed entries still take memory until they are written
+    BOOST_CHECK(writer.DynamicMemoryUsage() > 0);
+    BOOST_CHECK(writer.DynamicMemoryUsage() <= nCacheUsage);
+    base.Release();
+    BOOST_CHECK(writer.Sync());
+    BOOST_CHECK_EQUAL(writer.DynamicMemoryUsage(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(coins_prefetch)
+{
+    CCoinsViewDB db(1 << 20, true);
+    std::vector<COutPoint> vOutPoints;
+    {
+        CCoinsViewCache cache(&db);
+        for (int i = 0; i < 300; i++) {
+            vOutPoints.push_back(COutPoint(GetRandHash(), i % 3));
+            cache.AddCoin(vOutPoints.back(), Coin(CTxOut(i + 1, CScript() << OP_TRUE), 100, false), false);
+        }
+        cache.SetBestBlock(GetRandHash());
+        BOOST_CHECK(cache.Flush());
+    }
+
+    // Two blocks spending all of those outputs (one of them twice), an
+    // output that does not exist, and one created by the first block
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vout.resize(1);
+    CMutableTransaction spend;
+    for (size_t i = 0; i < 200; i++)
+        spend.vin.push_back(CTxIn(vOutPoints[i]));
+    spend.vin.push_back(CTxIn(vOutPoints[1]));
+    spend.vout.resize(1);
+    CMutableTransaction child;
+    for (size_t i = 200; i < vOutPoints.size(); i++)
+        child.vin.push_back(CTxIn(vOutPoints[i]));
+    child.vin.push_back(CTxIn(COutPoint(spend.GetHash(), 0)));
+    child.vin.push_back(CTxIn(COutPoint(GetRandHash(), 0)));
+    child.vout.resize(1);
+    CBlock blockA, blockB;
+    blockA.vtx.push_back(coinbase);
+    blockA.vtx.push_back(spend);
+    blockB.vtx.push_back(coinbase);
+    blockB.vtx.push_back(child);
+    std::vector<const CBlock*> vBlocks;
+    vBlocks.push_back(&blockA);
+    vBlocks.push_back(&blockB);
+
+    CCoinsPrefetchQueue queue(1);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < 3; i++)
+        threadGroup.create_thread(boost::bind(&CCoinsPrefetchQueue::Thread, &queue));
+
+    for (int nPass = 0; nPass < 2; nPass++) {
+        CCoinsViewCacheTest cache(&db);
+        BOOST_CHECK(cache.HaveCoin(vOutPoints[0]));
+
+        CCoinsPrefetchStats stats;
+        PrefetchBlockInputs(cache, vBlocks, nPass ? &queue : NULL, stats);
+        BOOST_CHECK_EQUAL(stats.nInputs, 303U);
+        BOOST_CHECK_EQUAL(stats.nInternal, 1U);
+        BOOST_CHECK_EQUAL(stats.nCached, 1U);
+        BOOST_CHECK_EQUAL(stats.nRead, 300U);
+        BOOST_CHECK_EQUAL(stats.nFound, 299U);
+        BOOST_CHECK_EQUAL(cache.GetCacheSize(), 300U);
+        cache.SelfTest();
+
+        // The prefetched coins are the database's, and not modified
+        for (size_t i = 0; i < vOutPoints.size(); i++) {
+            Coin coin;
+            BOOST_CHECK(db.GetCoin(vOutPoints[i], coin));
+            BOOST_CHECK(cache.HaveCoinInCache(vOutPoints[i]));
+            BOOST_CHECK(cache.AccessCoin(vOutPoints[i]) == coin);
+            cache.Uncache(vOutPoints[i]);
+        }
+        BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0U);
+        cache.SelfTest();
+    }
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+BOOST_AUTO_TEST_CASE(coins_db_snapshot_cursor)
+{
+    CCoinsViewDB db(1 << 20, true);
+    std::map<COutPoint, Coin> mapExpected;
+    uint256 hashSnapshotBlock = GetRandHash();
+    {
+        CCoinsViewCache cache(&db);
+        for (int i = 0; i < 500; i++) {
+            COutPoint outpoint(GetRandHash(), i % 4);
+            Coin coin(CTxOut(i + 1, CScript() << OP_TRUE), i, false);
+            cache.AddCoin(outpoint, coin, false);
+            mapExpected[outpoint] = coin;
+        }
+        cache.SetBestBlock(hashSnapshotBlock);
+        BOOST_CHECK(cache.Flush());
+    }
+    CDBSnapshot snapshot(db.GetDB());
+
+    // Changes after the snapshot are not seen through it
+    {
+        CCoinsViewCache cache(&db);
+        BOOST_CHECK(cache.SpendCoin(mapExpected.begin()->first));
+        cache.AddCoin(COutPoint(GetRandHash(), 0), Coin(CTxOut(1, CScript() << OP_TRUE), 1, false), false);
+        cache.SetBestBlock(GetRandHash());
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(db.GetBestBlock(snapshot) == hashSnapshotBlock);
+
+    // Cursors over consecutive ranges of txids return all outputs in order
+    std::vector<uint256> vBounds(1);
+    for (int i = 1; i < 8; i++) {
+        vBounds.push_back(uint256());
+        *vBounds.back().begin() = i * 32;
+    }
+    vBounds.push_back(uint256());
+    std::map<COutPoint, Coin>::const_iterator itExpected = mapExpected.begin();
+    for (size_t i = 0; i + 1 < vBounds.size(); i++) {
+        boost::scoped_ptr<CCoinsViewCursor> pcursor(db.Cursor(snapshot, vBounds[i], vBounds[i + 1]));
+        BOOST_CHECK(pcursor->GetBestBlock() == hashSnapshotBlock);
+        for (; pcursor->Valid(); pcursor->Next()) {
+            COutPoint key;
+            Coin coin;
+            BOOST_CHECK(pcursor->GetKey(key) && pcursor->GetValue(coin));
+            BOOST_CHECK(*key.hash.begin() >= i * 32);
+            BOOST_CHECK(itExpected != mapExpected.end() && key == itExpected->first && coin == itExpected->second);
+            if (itExpected != mapExpected.end())
+                ++itExpected;
+        }
+    }
+    BOOST_CHECK(itExpected == mapExpected.end());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
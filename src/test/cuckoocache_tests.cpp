@@ -0,0 +1,110 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "cuckoocache.h"
+#include "random.h"
+#include "uint256.h"
+
+#include "test/test_bitcoin.h"
+
+#include <cstring>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(cuckoocache_tests, BasicTestingSetup)
+
+namespace {
+class CTestHasher
+{
+public:
+    template <uint8_t hash_select>
+    uint32_t operator()(const uint256& key) const
+    {
+        uint32_t u;
+        std::memcpy(&u, key.begin() + 4 * hash_select, 4);
+        return u;
+    }
+};
+
+typedef CCuckooCache<uint256, CTestHasher> CTestCache;
+
+std::vector<uint256> RandomEntries(size_t n)
+{
+    std::vector<uint256> v(n);
+    for (size_t i = 0; i < n; i++)
+        v[i] = GetRandHash();
+    return v;
+}
+
+double HitRate(const CTestCache& cache, const std::vector<uint256>& v, size_t nBegin, size_t nEnd)
+{
+    size_t nHits = 0;
+    for (size_t i = nBegin; i < nEnd; i++)
+        nHits += cache.Contains(v[i], false);
+    return (double)nHits / (nEnd - nBegin);
+}
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_memory_bound)
+{
+    CTestCache cache;
+    const size_t nBytes = 1 << 20;
+    uint32_t nSlots = cache.SetupBytes(nBytes);
+    // Entries plus two flag bits per slot fit, one more slot wouldn't
+    BOOST_CHECK(nSlots * sizeof(uint256) + (2 * nSlots + 7) / 8 <= nBytes);
+    BOOST_CHECK((nSlots + 1) * sizeof(uint256) + (2 * (nSlots + 1) + 7) / 8 > nBytes - 1);
+    BOOST_CHECK_EQUAL(cache.SetupBytes(0), 2U);
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_insert_contains)
+{
+    CTestCache cache;
+    uint32_t nSlots = cache.Setup(1 << 14);
+
+    // Filled to 90%, nearly everything is found
+    std::vector<uint256> v = RandomEntries(nSlots * 9 / 10);
+    for (size_t i = 0; i < v.size(); i++)
+        cache.Insert(v[i]);
+    BOOST_CHECK(HitRate(cache, v, 0, v.size()) > 0.99);
+
+    std::vector<uint256> vOther = RandomEntries(1000);
+    BOOST_CHECK_EQUAL(HitRate(cache, vOther, 0, vOther.size()), 0.0);
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_erase)
+{
+    CTestCache cache;
+    uint32_t nSlots = cache.Setup(1 << 14);
+    std::vector<uint256> v = RandomEntries(nSlots);
+    const size_t nFifth = nSlots / 5;
+
+    // Erase the first half of what was inserted lazily: still visible until overwritten...
+    for (size_t i = 0; i < 2 * nFifth; i++)
+        cache.Insert(v[i]);
+    for (size_t i = 0; i < nFifth; i++)
+        BOOST_CHECK(cache.Contains(v[i], true));
+    BOOST_CHECK(HitRate(cache, v, 0, nFifth) == 1.0);
+
+    // ...but their slots can be reused, while the entries that were not erased stay.
+    for (size_t i = 2 * nFifth; i < 3 * nFifth; i++)
+        cache.Insert(v[i]);
+    BOOST_CHECK(HitRate(cache, v, nFifth, 3 * nFifth) > 0.99);
+    BOOST_CHECK(HitRate(cache, v, 0, nFifth) < 0.95);
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_generations)
+{
+    CTestCache cache;
+    uint32_t nSlots = cache.Setup(1 << 14);
+
+    // Keep inserting well past the capacity: recent entries are kept, old ones evicted
+    std::vector<uint256> v = RandomEntries(4 * nSlots);
+    for (size_t i = 0; i < v.size(); i++)
+        cache.Insert(v[i]);
+    BOOST_CHECK(HitRate(cache, v, v.size() - nSlots / 4, v.size()) > 0.95);
+    BOOST_CHECK(HitRate(cache, v, 0, nSlots) < 0.05);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
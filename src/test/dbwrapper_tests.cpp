@@ -324,4 +324,55 @@ BOOST_AUTO_TEST_CASE(iterator_string_ordering)
 
 
 
+BOOST_AUTO_TEST_CASE(dbwrapper_options)
+{
+    std::map<std::string, CDBOptions> mapOptions;
+    mapOptions["a"] = CDBOptions();
+    mapOptions["b"] = CDBOptions();
+    std::vector<std::string> vSettings;
+    vSettings.push_back("a.compression=1");
+    vSettings.push_back("a.bloombits=0");
+    vSettings.push_back("a.blocksize=16384");
+    vSettings.push_back("b.maxopenfiles=1000");
+    vSettings.push_back("b.writebuffer=1048576");
+    std::string strError;
+    BOOST_CHECK(ParseDBOptions(vSettings, mapOptions, strError));
+    BOOST_CHECK(mapOptions["a"].fCompression);
+    BOOST_CHECK_EQUAL(mapOptions["a"].nBloomBits, 0);
+    BOOST_CHECK_EQUAL(mapOptions["a"].nBlockSize, 16384U);
+    BOOST_CHECK_EQUAL(mapOptions["a"].nMaxOpenFiles, CDBOptions().nMaxOpenFiles);
+    BOOST_CHECK_EQUAL(mapOptions["b"].nMaxOpenFiles, 1000);
+    BOOST_CHECK_EQUAL(mapOptions["b"].nWriteBufferSize, 1048576U);
+    BOOST_CHECK(!mapOptions["b"].fCompression);
+
+    const char* vBad[] = {"a.compression", "a=1", "c.bloombits=1", "a.unknown=1", "a.bloombits=x", "a.compression=2", "a.maxopenfiles=0", "a.blocksize=1"};
+    for (size_t i = 0; i < sizeof(vBad) / sizeof(vBad[0]); i++) {
+        std::vector<std::string> vBadSettings(1, vBad[i]);
+        strError.clear();
+        BOOST_CHECK(!ParseDBOptions(vBadSettings, mapOptions, strError));
+        BOOST_CHECK(!strError.empty());
+    }
+
+    // A database opened with them works and reports its statistics
+    path ph = temp_directory_path() / unique_path();
+    CDBWrapper dbw(ph, (1 << 20), true, false, false, mapOptions["a"]);
+    BOOST_CHECK(dbw.GetDBOptions().fCompression);
+    BOOST_CHECK_EQUAL(dbw.GetWriteBufferSize(), (size_t)(1 << 18));
+    for (int i = 0; i < 1000; i++)
+        BOOST_CHECK(dbw.Write(std::make_pair('k', i), GetRandHash()));
+    uint256 res;
+    BOOST_CHECK(dbw.Read(std::make_pair('k', 500), res));
+    dbw.CompactRange('k', 'l');
+    BOOST_CHECK(dbw.EstimateSize('k', 'l') > 0);
+    BOOST_CHECK_EQUAL(dbw.EstimateSize('a', 'b'), 0U);
+    // The keys with the last prefix are counted up to a longer end key
+    for (int i = 0; i < 1000; i++)
+        BOOST_CHECK(dbw.Write(std::make_pair((char)0xff, i), GetRandHash()));
+    const std::pair<char, uint256> keyEnd((char)0xff, uint256S(std::string(64, 'f')));
+    dbw.CompactRange(std::make_pair((char)0xff, 0), std::make_pair((char)0xff, 1000));
+    BOOST_CHECK(dbw.EstimateSize((char)0xff, keyEnd) > 0);
+    BOOST_CHECK(!dbw.GetProperty("leveldb.stats").empty());
+    BOOST_CHECK(dbw.GetProperty("leveldb.nosuchproperty").empty());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -3,11 +3,16 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "hash.h"
+#include "crypto/common.h"
+#include "crypto/skein512.h"
+#include "primitives/block.h"
+#include "random.h"
 #include "utilstrencodings.h"
 #include "test/test_bitcoin.h"
 
 #include <vector>
 
+#include <boost/foreach.hpp>
 #include <boost/test/unit_test.hpp>
 
 using namespace std;
@@ -126,6 +131,93 @@ BOOST_AUTO_TEST_CASE(siphash)
     CHashWriter ss(SER_DISK, CLIENT_VERSION);
     ss << CTransaction();
     BOOST_CHECK_EQUAL(SipHashUint256(1, 2, ss.GetHash()), 0x79751e980c2a0a35ULL);
+
+    // Check the extra 32 bits against the generic implementation
+    for (int i = 0; i < 16; ++i) {
+        uint256 x = GetRandHash();
+        uint32_t n = insecure_rand();
+        unsigned char nb[4];
+        WriteLE32(nb, n);
+        CSipHasher sip288(1, 2);
+        sip288.Write(x.begin(), 32);
+        sip288.Write(nb, 4);
+        BOOST_CHECK_EQUAL(SipHashUint256Extra(1, 2, x, n), sip288.Finalize());
+    }
+}
+
+static void CheckSkeinBatch()
+{
+    // Every batch size up to 20 mixes the 8-way and single-lane paths.
+    for (size_t count = 0; count <= 20; count++) {
+        std::vector<CBlockHeader> headers(count);
+        for (size_t i = 0; i < count; i++) {
+            headers[i].nVersion = insecure_rand();
+            headers[i].hashPrevBlock = GetRandHash();
+            headers[i].hashMerkleRoot = GetRandHash();
+            headers[i].nTime = insecure_rand();
+            headers[i].nBits = insecure_rand();
+            headers[i].nNonce = insecure_rand();
+        }
+        std::vector<uint256> hashes(count);
+        HashSkeinBatch(begin_ptr(headers), count, begin_ptr(hashes));
+        for (size_t i = 0; i < count; i++) {
+            BOOST_CHECK(hashes[i] == headers[i].GetHash());
+        }
+    }
+}
+
+static void CheckSkeinMidstate()
+{
+    CBlockHeader header;
+    header.nVersion = 2;
+    header.hashPrevBlock = GetRandHash();
+    header.hashMerkleRoot = GetRandHash();
+    header.nTime = insecure_rand();
+    header.nBits = insecure_rand();
+
+    Skein512Midstate mid;
+    Skein512Midstate80(mid, (const unsigned char*)BEGIN(header.nVersion));
+
+    // Vary the nonce in the 16-byte tail, as a nonce search does.
+    for (size_t count = 1; count <= 20; count++) {
+        std::vector<unsigned char> tails(count * 16);
+        for (size_t i = 0; i < count; i++) {
+            memcpy(&tails[i * 16], BEGIN(header.nVersion) + 64, 16);
+            WriteLE32(&tails[i * 16 + 12], i * 7919);
+        }
+        std::vector<unsigned char> out(count * 32);
+        SkeinSHA256_80_Midstate(&out[0], mid, &tails[0], count);
+        for (size_t i = 0; i < count; i++) {
+            header.nNonce = i * 7919;
+            BOOST_CHECK(uint256(std::vector<unsigned char>(&out[i * 32], &out[i * 32] + 32)) == header.GetHash());
+        }
+    }
+}
+
+// Run the checks against every kernel this build and CPU provide, not only
+// the one autodetection prefers. Kernels the CPU lacks fall back to generic.
+static const skein512_implementation::UseImplementation skein_implementations[] = {
+    skein512_implementation::USE_GENERIC,
+    skein512_implementation::USE_AVX2,
+    skein512_implementation::USE_AVX512,
+};
+
+BOOST_AUTO_TEST_CASE(skein_batch)
+{
+    BOOST_FOREACH(skein512_implementation::UseImplementation use, skein_implementations) {
+        BOOST_TEST_MESSAGE("skein_batch: " + Skein512AutoDetect(use));
+        CheckSkeinBatch();
+    }
+    Skein512AutoDetect();
+}
+
+BOOST_AUTO_TEST_CASE(skein_midstate)
+{
+    BOOST_FOREACH(skein512_implementation::UseImplementation use, skein_implementations) {
+        BOOST_TEST_MESSAGE("skein_midstate: " + Skein512AutoDetect(use));
+        CheckSkeinMidstate();
+    }
+    Skein512AutoDetect();
 }
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,202 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "httpserver.h"
+#include "httprpc.h"
+#include "netbase.h"
+#include "rpc/server.h"
+#include "utilstrencodings.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+
+#include <univalue.h>
+
+BOOST_FIXTURE_TEST_SUITE(httpserver_tests, TestingSetup)
+
+namespace {
+
+/** A loopback port nothing listens on right now */
+int FreeLoopbackPort()
+{
+    SOCKET hSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    BOOST_REQUIRE(hSocket != INVALID_SOCKET);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    socklen_t len = sizeof(addr);
+    BOOST_REQUIRE(bind(hSocket, (struct sockaddr*)&addr, sizeof(addr)) != SOCKET_ERROR);
+    BOOST_REQUIRE(getsockname(hSocket, (struct sockaddr*)&addr, &len) != SOCKET_ERROR);
+    CloseSocket(hSocket);
+    return ntohs(addr.sin_port);
+}
+
+/** Runs the HTTP server with the JSON-RPC handler for the lifetime of the object */
+class HTTPRPCServer
+{
+public:
+    int nPort;
+
+    HTTPRPCServer(int nMiningThreads)
+    {
+        nPort = FreeLoopbackPort();
+        mapArgs["-rpcport"] = itostr(nPort);
+        mapArgs["-rpcuser"] = "lanes";
+        mapArgs["-rpcpassword"] = "lanes";
+        mapArgs["-rpcminingthreads"] = itostr(nMiningThreads);
+        // As init does without -rest
+        mapArgs["-restthreads"] = "0";
+        BOOST_REQUIRE(InitHTTPServer());
+        BOOST_REQUIRE(StartHTTPRPC());
+        BOOST_REQUIRE(StartHTTPServer());
+    }
+
+    ~HTTPRPCServer()
+    {
+        InterruptHTTPServer();
+        InterruptHTTPRPC();
+        StopHTTPRPC();
+        StopHTTPServer();
+        mapArgs.erase("-rpcport");
+        mapArgs.erase("-rpcuser");
+        mapArgs.erase("-rpcpassword");
+        mapArgs.erase("-rpcminingthreads");
+        mapArgs.erase("-restthreads");
+    }
+
+    /** POST strBody to the JSON-RPC handler and return the status line */
+    std::string Post(const std::string& strBody)
+    {
+        std::string strReply = Request("/", strBody);
+        return strReply.substr(0, strReply.find("\r\n"));
+    }
+
+    /** POST strBody to strURI and return everything the server sent back */
+    std::string Request(const std::string& strURI, const std::string& strBody)
+    {
+        SOCKET hSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        BOOST_REQUIRE(hSocket != INVALID_SOCKET);
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(nPort);
+        BOOST_REQUIRE(connect(hSocket, (const struct sockaddr*)&addr, sizeof(addr)) != SOCKET_ERROR);
+
+        std::string strRequest = strprintf("POST %s HTTP/1.1\r\n"
+                                           "Host: 127.0.0.1\r\n"
+                                           "Authorization: Basic %s\r\n"
+                                           "Content-Type: application/json\r\n"
+                                           "Content-Length: %u\r\n"
+                                           "Connection: close\r\n"
+                                           "\r\n",
+                                           strURI, EncodeBase64("lanes:lanes"), strBody.size()) + strBody;
+        BOOST_REQUIRE(send(hSocket, strRequest.data(), strRequest.size(), MSG_NOSIGNAL) == (int)strRequest.size());
+
+        // The server closes the connection once the reply is out
+        std::string strReply;
+        char buf[4096];
+        int nBytes;
+        while ((nBytes = recv(hSocket, buf, sizeof(buf), 0)) > 0)
+            strReply.append(buf, nBytes);
+        CloseSocket(hSocket);
+        return strReply;
+    }
+};
+
+bool HTTPReq_Chunks(HTTPRequest* req, const std::string&, bool fComplete)
+{
+    req->WriteHeader("Content-Type", "application/json");
+    req->WriteReplyChunk(HTTP_OK, "{\"result\": [");
+    req->WriteReplyChunk(HTTP_OK, "1, 2, 3");
+    if (fComplete)
+        req->EndReply(HTTP_OK, "]}");
+    else
+        req->AbortReply();
+    return true;
+}
+
+UniValue CallGetHTTPQueueInfo()
+{
+    return tableRPC["gethttpqueueinfo"]->actor(NullUniValue, false);
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(httpserver_lanes)
+{
+    HTTPRPCServer server(2);
+
+    BOOST_CHECK(!server.Post(JSONRPCRequest("getblockcount", NullUniValue, 1)).empty());
+    UniValue blockparams(UniValue::VARR);
+    blockparams.push_back("00");
+    BOOST_CHECK(!server.Post(JSONRPCRequest("submitblock", blockparams, 2)).empty());
+
+    UniValue params(UniValue::VARR);
+    params.push_back(UniValue(UniValue::VOBJ));
+    BOOST_CHECK(!server.Post(JSONRPCRequest("getblocktemplate", params, 3)).empty());
+
+    // A long poll would hold a mining worker until the next block
+    UniValue longpoll(UniValue::VOBJ);
+    longpoll.push_back(Pair("longpollid", "0"));
+    UniValue lpparams(UniValue::VARR);
+    lpparams.push_back(longpoll);
+    BOOST_CHECK(!server.Post(JSONRPCRequest("getblocktemplate", lpparams, 4)).empty());
+
+    // Batches are not looked into
+    BOOST_CHECK(!server.Post("[" + JSONRPCRequest("submitblock", NullUniValue, 5) + "]").empty());
+
+    UniValue info = CallGetHTTPQueueInfo();
+    const UniValue& rpc = find_value(info, "rpc");
+    const UniValue& mining = find_value(info, "mining");
+    const UniValue& rest = find_value(info, "rest");
+    BOOST_CHECK_EQUAL(find_value(rpc, "requests").get_int64(), 3);
+    BOOST_CHECK_EQUAL(find_value(mining, "threads").get_int(), 2);
+    BOOST_CHECK_EQUAL(find_value(mining, "requests").get_int64(), 2);
+    BOOST_CHECK_EQUAL(find_value(rest, "threads").get_int(), 0);
+    BOOST_CHECK_EQUAL(find_value(rest, "requests").get_int64(), 0);
+    BOOST_CHECK_EQUAL(find_value(rpc, "rejected").get_int64(), 0);
+    BOOST_CHECK_EQUAL(find_value(mining, "rejected").get_int64(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(httpserver_lane_fallback)
+{
+    // A lane without threads hands its requests to the RPC lane
+    HTTPRPCServer server(0);
+
+    BOOST_CHECK(!server.Post(JSONRPCRequest("submitblock", NullUniValue, 1)).empty());
+    BOOST_CHECK(!server.Post(JSONRPCRequest("getblockcount", NullUniValue, 2)).empty());
+
+    UniValue info = CallGetHTTPQueueInfo();
+    BOOST_CHECK_EQUAL(find_value(find_value(info, "rpc"), "requests").get_int64(), 2);
+    BOOST_CHECK_EQUAL(find_value(find_value(info, "mining"), "threads").get_int(), 0);
+    BOOST_CHECK_EQUAL(find_value(find_value(info, "mining"), "requests").get_int64(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(httpserver_abort_reply)
+{
+    HTTPRPCServer server(0);
+    RegisterHTTPHandler("/complete", true, boost::bind(HTTPReq_Chunks, _1, _2, true));
+    RegisterHTTPHandler("/aborted", true, boost::bind(HTTPReq_Chunks, _1, _2, false));
+
+    // A finished chunked reply ends with an empty chunk
+    std::string strComplete = server.Request("/complete", "");
+    BOOST_CHECK(strComplete.find("HTTP/1.1 200") == 0);
+    BOOST_CHECK(strComplete.find("Transfer-Encoding: chunked") != std::string::npos);
+    BOOST_CHECK(strComplete.find("1, 2, 3") != std::string::npos);
+    BOOST_CHECK(strComplete.size() >= 5 && strComplete.compare(strComplete.size() - 5, 5, "0\r\n\r\n") == 0);
+
+    // An aborted one just stops, so the client cannot take it for complete
+    std::string strAborted = server.Request("/aborted", "");
+    BOOST_CHECK(strAborted.find("]}") == std::string::npos);
+    BOOST_CHECK(strAborted.size() < 5 || strAborted.compare(strAborted.size() - 5, 5, "0\r\n\r\n") != 0);
+
+    UnregisterHTTPHandler("/complete", true);
+    UnregisterHTTPHandler("/aborted", true);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
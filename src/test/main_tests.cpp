@@ -3,10 +3,16 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "chainparams.h"
+#include "coins.h"
 #include "main.h"
+#include "pow.h"
+#include "script/interpreter.h"
+#include "streams.h"
+#include "txdb.h"
 
 #include "test/test_bitcoin.h"
 
+#include <boost/scoped_ptr.hpp>
 #include <boost/signals2/signal.hpp>
 #include <boost/test/unit_test.hpp>
 
@@ -74,4 +80,166 @@ BOOST_AUTO_TEST_CASE(test_combiner_all)
     Test.disconnect(&ReturnTrue);
     BOOST_CHECK(Test());
 }
+
+BOOST_FIXTURE_TEST_CASE(read_raw_block, TestChain100Setup)
+{
+    const CChainParams& chainparams = Params();
+    for (int nHeight = 1; nHeight <= chainActive.Height(); nHeight += 33) {
+        const CBlockIndex* pindex = chainActive[nHeight];
+        CBlock block;
+        BOOST_REQUIRE(ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()));
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << block;
+
+        // The raw bytes are the block as it is sent to peers
+        std::vector<unsigned char> vchBlock;
+        BOOST_REQUIRE(ReadRawBlockFromDisk(vchBlock, pindex->GetBlockPos(), chainparams.MessageStart()));
+        BOOST_CHECK(std::vector<unsigned char>(ss.begin(), ss.end()) == vchBlock);
+
+        // Positions that don't follow an index header are rejected
+        CDiskBlockPos pos = pindex->GetBlockPos();
+        pos.nPos += 1;
+        BOOST_CHECK(!ReadRawBlockFromDisk(vchBlock, pos, chainparams.MessageStart()));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(hash_and_check_headers)
+{
+    const Consensus::Params& params = Params(CBaseChainParams::REGTEST).GetConsensus();
+    std::vector<CBlockHeader> headers(HEADER_CHECK_BATCH * 2 + 5);
+    for (size_t i = 0; i < headers.size(); i++) {
+        headers[i].nVersion = 4;
+        headers[i].hashPrevBlock = i ? headers[i - 1].GetHash() : uint256();
+        headers[i].nTime = 1470000000 + i;
+        headers[i].nBits = 0x207fffff; // about every other nonce
+        headers[i].nNonce = i;
+    }
+
+    // On the calling thread, and through the queue (which the calling
+    // thread works through alone here, as no header checking threads run)
+    int nScriptCheckThreadsBefore = nScriptCheckThreads;
+    for (nScriptCheckThreads = 0; nScriptCheckThreads <= 2; nScriptCheckThreads += 2) {
+        std::vector<uint256> vHashes;
+        std::vector<char> vPowOk;
+        HashAndCheckHeaders(headers, vHashes, vPowOk, params);
+        BOOST_CHECK_EQUAL(vHashes.size(), headers.size());
+        BOOST_CHECK_EQUAL(vPowOk.size(), headers.size());
+        size_t nOk = 0;
+        for (size_t i = 0; i < headers.size(); i++) {
+            BOOST_CHECK(vHashes[i] == headers[i].GetHash());
+            BOOST_CHECK_EQUAL((bool)vPowOk[i], CheckProofOfWork(headers[i].GetHash(), headers[i].nBits, params));
+            nOk += vPowOk[i];
+        }
+        BOOST_CHECK(nOk > 0 && nOk < headers.size());
+    }
+    nScriptCheckThreads = nScriptCheckThreadsBefore;
+}
+
+// Chainstate database that can be left the way an interrupted BatchWrite leaves it
+class CCoinsViewDBInterrupted : public CCoinsViewDB
+{
+public:
+    CCoinsViewDBInterrupted() : CCoinsViewDB(1 << 20, true) {}
+
+    //! Mark the database as being between hashOld and hashNew
+    void Interrupt(const uint256& hashNew, const uint256& hashOld)
+    {
+        std::vector<uint256> vhashHeads;
+        vhashHeads.push_back(hashNew);
+        vhashHeads.push_back(hashOld);
+        CDBBatch batch(db);
+        batch.Erase('B'); // DB_BEST_BLOCK
+        batch.Write('H', vhashHeads); // DB_HEAD_BLOCKS
+        BOOST_REQUIRE(db.WriteBatch(batch));
+    }
+};
+
+static std::map<COutPoint, Coin> ReadCoins(const CCoinsView& view)
+{
+    std::map<COutPoint, Coin> mapCoins;
+    boost::scoped_ptr<CCoinsViewCursor> pcursor(view.Cursor());
+    for (; pcursor->Valid(); pcursor->Next()) {
+        COutPoint key;
+        Coin coin;
+        BOOST_REQUIRE(pcursor->GetKey(key) && pcursor->GetValue(coin));
+        mapCoins[key] = coin;
+    }
+    return mapCoins;
+}
+
+static bool SameCoins(const std::map<COutPoint, Coin>& mapA, const std::map<COutPoint, Coin>& mapB)
+{
+    if (mapA.size() != mapB.size())
+        return false;
+    for (std::map<COutPoint, Coin>::const_iterator itA = mapA.begin(), itB = mapB.begin(); itA != mapA.end(); ++itA, ++itB) {
+        if (itA->first != itB->first || itA->second.out != itB->second.out ||
+            itA->second.nHeight != itB->second.nHeight || itA->second.fCoinBase != itB->second.fCoinBase)
+            return false;
+    }
+    return true;
+}
+
+BOOST_FIXTURE_TEST_CASE(replay_interrupted_flush, TestChain100Setup)
+{
+    const CChainParams& chainparams = Params();
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+
+    // Our own copy of the chainstate at the current tip
+    BOOST_REQUIRE(pcoinsTip->Flush());
+    uint256 hashOld = chainActive.Tip()->GetBlockHash();
+    std::map<COutPoint, Coin> mapOld = ReadCoins(*pcoinsdbview);
+    CCoinsViewDBInterrupted db;
+    {
+        CCoinsViewCache cache(&db);
+        for (std::map<COutPoint, Coin>::const_iterator it = mapOld.begin(); it != mapOld.end(); ++it)
+            cache.AddCoin(it->first, it->second, false);
+        cache.SetBestBlock(hashOld);
+        BOOST_REQUIRE(cache.Flush());
+    }
+
+    // Two more blocks, the first spending the oldest coinbase
+    CMutableTransaction spend;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(coinbaseTxns[0].GetHash(), 0);
+    spend.vout.resize(1);
+    spend.vout[0].nValue = 11*CENT;
+    spend.vout[0].scriptPubKey = scriptPubKey;
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, spend, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+    BOOST_REQUIRE(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << vchSig;
+
+    int nOldHeight = chainActive.Height();
+    CreateAndProcessBlock(std::vector<CMutableTransaction>(1, spend), scriptPubKey);
+    CreateAndProcessBlock(std::vector<CMutableTransaction>(), scriptPubKey);
+    BOOST_REQUIRE_EQUAL(chainActive.Height(), nOldHeight + 2);
+    BOOST_REQUIRE(pcoinsTip->Flush());
+    uint256 hashNew = chainActive.Tip()->GetBlockHash();
+    std::map<COutPoint, Coin> mapNew = ReadCoins(*pcoinsdbview);
+    BOOST_CHECK(!mapNew.count(spend.vin[0].prevout));
+    BOOST_CHECK(mapNew.count(COutPoint(spend.GetHash(), 0)));
+
+    // Stop after a partial batch: some of the new outputs are written, no
+    // spend is, and the heads marker replaces the best block
+    {
+        CCoinsViewCache cache(&db);
+        int nAdded = 0;
+        for (std::map<COutPoint, Coin>::const_iterator it = mapNew.begin(); it != mapNew.end(); ++it)
+            if (!mapOld.count(it->first) && nAdded++ % 2 == 0)
+                cache.AddCoin(it->first, it->second, false);
+        BOOST_CHECK_EQUAL(nAdded, 3);
+        cache.SetBestBlock(hashNew);
+        BOOST_REQUIRE(cache.Flush());
+    }
+    db.Interrupt(hashNew, hashOld);
+    BOOST_CHECK(db.GetBestBlock().IsNull());
+    BOOST_CHECK(!SameCoins(ReadCoins(db), mapNew));
+
+    BOOST_CHECK(ReplayBlocks(chainparams, &db));
+    BOOST_CHECK(db.GetBestBlock() == hashNew);
+    BOOST_CHECK(db.GetHeadBlocks().empty());
+    BOOST_CHECK(SameCoins(ReadCoins(db), mapNew));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -422,6 +422,128 @@ BOOST_AUTO_TEST_CASE(MempoolAncestorIndexingTest)
     CheckSort<ancestor_score>(pool, sortedOrder);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolPackageStateTest)
+{
+    TestMemPoolEntryHelper entry;
+
+    // txA0 -> txA1 -> txA -> txB, txC -> txD, so that txD reaches txA
+    // through both txB and txC
+    CMutableTransaction txA0, txA1, txA, txB, txC, txD;
+    txA0.vin.resize(1);
+    txA0.vin[0].scriptSig = CScript() << OP_11;
+    txA0.vout.resize(1);
+    txA0.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txA0.vout[0].nValue = 10 * COIN;
+    txA1.vin.resize(1);
+    txA1.vin[0].prevout = COutPoint(txA0.GetHash(), 0);
+    txA1.vin[0].scriptSig = CScript() << OP_11;
+    txA1.vout.resize(1);
+    txA1.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txA1.vout[0].nValue = 9 * COIN;
+    txA.vin.resize(1);
+    txA.vin[0].prevout = COutPoint(txA1.GetHash(), 0);
+    txA.vin[0].scriptSig = CScript() << OP_11;
+    txA.vout.resize(2);
+    for (int i = 0; i < 2; i++) {
+        txA.vout[i].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txA.vout[i].nValue = 4 * COIN;
+    }
+    CMutableTransaction* txMiddle[2] = {&txB, &txC};
+    for (int i = 0; i < 2; i++) {
+        txMiddle[i]->vin.resize(1);
+        txMiddle[i]->vin[0].prevout = COutPoint(txA.GetHash(), i);
+        txMiddle[i]->vin[0].scriptSig = CScript() << OP_11;
+        txMiddle[i]->vout.resize(1);
+        txMiddle[i]->vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txMiddle[i]->vout[0].nValue = 3 * COIN;
+    }
+    txD.vin.resize(2);
+    txD.vin[0].prevout = COutPoint(txB.GetHash(), 0);
+    txD.vin[0].scriptSig = CScript() << OP_11;
+    txD.vin[1].prevout = COutPoint(txC.GetHash(), 0);
+    txD.vin[1].scriptSig = CScript() << OP_11;
+    txD.vout.resize(1);
+    txD.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txD.vout[0].nValue = 5 * COIN;
+
+    CTxMemPool pool(CFeeRate(0));
+    pool.addUnchecked(txA0.GetHash(), entry.Fee(1000LL).FromTx(txA0));
+    pool.addUnchecked(txA1.GetHash(), entry.Fee(1000LL).FromTx(txA1));
+    pool.addUnchecked(txA.GetHash(), entry.Fee(1000LL).FromTx(txA));
+    pool.addUnchecked(txB.GetHash(), entry.Fee(1000LL).FromTx(txB));
+    pool.addUnchecked(txC.GetHash(), entry.Fee(1000LL).FromTx(txC));
+    pool.addUnchecked(txD.GetHash(), entry.Fee(1000LL).FromTx(txD));
+
+    // Every ancestor is counted once, however many paths lead to it
+    CTxMemPool::txiter itA0 = pool.mapTx.find(txA0.GetHash());
+    CTxMemPool::txiter itA = pool.mapTx.find(txA.GetHash());
+    CTxMemPool::txiter itD = pool.mapTx.find(txD.GetHash());
+    BOOST_CHECK_EQUAL(itD->GetCountWithAncestors(), 6U);
+    BOOST_CHECK_EQUAL(itD->GetModFeesWithAncestors(), 6000);
+    BOOST_CHECK_EQUAL(itA0->GetCountWithDescendants(), 6U);
+    BOOST_CHECK_EQUAL(itA->GetCountWithDescendants(), 4U);
+    CTxMemPool::setEntries setAncestors, setDescendants;
+    std::string errString;
+    const uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    BOOST_CHECK(pool.CalculateMemPoolAncestors(*itD, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, errString, false));
+    BOOST_CHECK_EQUAL(setAncestors.size(), 5U);
+    pool.CalculateDescendants(itA, setDescendants);
+    BOOST_CHECK_EQUAL(setDescendants.size(), 4U);
+
+    // A child of txD has six ancestors
+    CMutableTransaction txE;
+    txE.vin.resize(1);
+    txE.vin[0].prevout = COutPoint(txD.GetHash(), 0);
+    txE.vin[0].scriptSig = CScript() << OP_11;
+    txE.vout.resize(1);
+    txE.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txE.vout[0].nValue = 4 * COIN;
+    CTxMemPoolEntry entryE = entry.Fee(1000LL).FromTx(txE);
+    setAncestors.clear();
+    BOOST_CHECK(pool.CalculateMemPoolAncestors(entryE, setAncestors, 7, nNoLimit, nNoLimit, nNoLimit, errString));
+    BOOST_CHECK_EQUAL(setAncestors.size(), 6U);
+    setAncestors.clear();
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(entryE, setAncestors, 6, nNoLimit, nNoLimit, nNoLimit, errString));
+    BOOST_CHECK_EQUAL(errString, "too many unconfirmed ancestors [limit: 6]");
+    setAncestors.clear();
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(entryE, setAncestors, nNoLimit, itD->GetSizeWithAncestors() + entryE.GetTxSize() - 1, nNoLimit, nNoLimit, errString));
+    BOOST_CHECK_EQUAL(errString, strprintf("exceeds ancestor size limit [limit: %u]", itD->GetSizeWithAncestors() + entryE.GetTxSize() - 1));
+
+    // Return txA0, txA1 and txA from a disconnected block to a mempool that
+    // holds their descendants already. txA is updated first, and txA0 picks
+    // up its descendants from the cache without counting any of them twice.
+    CTxMemPool poolReorg(CFeeRate(0));
+    poolReorg.addUnchecked(txB.GetHash(), entry.Fee(1000LL).FromTx(txB));
+    poolReorg.addUnchecked(txC.GetHash(), entry.Fee(1000LL).FromTx(txC));
+    poolReorg.addUnchecked(txD.GetHash(), entry.Fee(1000LL).FromTx(txD));
+    poolReorg.addUnchecked(txA0.GetHash(), entry.Fee(1000LL).FromTx(txA0));
+    poolReorg.addUnchecked(txA1.GetHash(), entry.Fee(1000LL).FromTx(txA1));
+    poolReorg.addUnchecked(txA.GetHash(), entry.Fee(1000LL).FromTx(txA));
+    std::vector<uint256> vHashesFromBlock;
+    vHashesFromBlock.push_back(txA0.GetHash());
+    vHashesFromBlock.push_back(txA1.GetHash());
+    vHashesFromBlock.push_back(txA.GetHash());
+    poolReorg.UpdateTransactionsFromBlock(vHashesFromBlock);
+    BOOST_CHECK_EQUAL(poolReorg.mapTx.find(txA0.GetHash())->GetCountWithDescendants(), 6U);
+    BOOST_CHECK_EQUAL(poolReorg.mapTx.find(txA0.GetHash())->GetModFeesWithDescendants(), 6000);
+    BOOST_CHECK_EQUAL(poolReorg.mapTx.find(txA1.GetHash())->GetCountWithDescendants(), 5U);
+    BOOST_CHECK_EQUAL(poolReorg.mapTx.find(txA.GetHash())->GetCountWithDescendants(), 4U);
+    BOOST_CHECK_EQUAL(poolReorg.mapTx.find(txB.GetHash())->GetCountWithAncestors(), 4U);
+    BOOST_CHECK_EQUAL(poolReorg.mapTx.find(txD.GetHash())->GetCountWithAncestors(), 6U);
+    BOOST_CHECK_EQUAL(poolReorg.mapTx.find(txD.GetHash())->GetSizeWithAncestors(), itD->GetSizeWithAncestors());
+
+    // Removing entries moves the links of others around, which must stay intact
+    std::list<CTransaction> removed;
+    poolReorg.removeRecursive(CTransaction(txB), removed);
+    BOOST_CHECK_EQUAL(removed.size(), 2U);
+    CTxMemPool::txiter itReorgA = poolReorg.mapTx.find(txA.GetHash());
+    CTxMemPool::txiter itReorgC = poolReorg.mapTx.find(txC.GetHash());
+    BOOST_CHECK(poolReorg.GetMemPoolChildren(itReorgA) == CTxMemPool::vecEntries(1, itReorgC));
+    BOOST_CHECK(poolReorg.GetMemPoolParents(itReorgC) == CTxMemPool::vecEntries(1, itReorgA));
+    BOOST_CHECK(poolReorg.GetMemPoolChildren(itReorgC).empty());
+    BOOST_CHECK_EQUAL(poolReorg.mapTx.find(txA0.GetHash())->GetCountWithDescendants(), 4U);
+}
+
 
 BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
 {
@@ -539,7 +661,7 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
         pool.addUnchecked(tx5.GetHash(), entry.Fee(1000LL).FromTx(tx5, &pool));
     pool.addUnchecked(tx7.GetHash(), entry.Fee(9000LL).FromTx(tx7, &pool));
 
-    pool.TrimToSize(pool.DynamicMemoryUsage() / 2); // should maximize mempool size by only removing 5/7
+    pool.TrimToSize(pool.DynamicMemoryUsage() * 3 / 5); // should maximize mempool size by only removing 5/7
     BOOST_CHECK(pool.exists(tx4.GetHash()));
     BOOST_CHECK(!pool.exists(tx5.GetHash()));
     BOOST_CHECK(pool.exists(tx6.GetHash()));
@@ -9,6 +9,7 @@
 #include "consensus/validation.h"
 #include "main.h"
 #include "miner.h"
+#include "pow.h"
 #include "pubkey.h"
 #include "script/standard.h"
 #include "txmempool.h"
@@ -502,4 +503,129 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     fCheckpointsEnabled = true;
 }
 
+BOOST_FIXTURE_TEST_CASE(BlockTemplateCache_incremental, TestChain100Setup)
+{
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CBlockTemplateCache cache(Params(), scriptPubKey);
+    std::shared_ptr<const CBlockTemplate> ptmpl;
+    const CBlockIndex* pindexPrev = NULL;
+    int64_t nTime = GetTime();
+    SetMockTime(nTime);
+
+    BOOST_CHECK(cache.GetTemplate(ptmpl, pindexPrev));
+    BOOST_CHECK(pindexPrev == chainActive.Tip());
+    BOOST_CHECK_EQUAL(ptmpl->block.vtx.size(), 1U);
+    BOOST_CHECK_EQUAL(cache.GetStats().nBuilds, 1U);
+    std::shared_ptr<const CBlockTemplate> ptmplHeld = ptmpl;
+
+    // A coinbase spend and its child are appended to it as they arrive
+    std::vector<CMutableTransaction> txs(2);
+    COutPoint prevout(coinbaseTxns[0].GetHash(), 0);
+    CAmount nValue = coinbaseTxns[0].vout[0].nValue;
+    for (int i = 0; i < 2; i++) {
+        nValue -= CENT;
+        txs[i].vin.resize(1);
+        txs[i].vin[0].prevout = prevout;
+        txs[i].vout.resize(1);
+        txs[i].vout[0].nValue = nValue;
+        txs[i].vout[0].scriptPubKey = scriptPubKey;
+
+        std::vector<unsigned char> vchSig;
+        uint256 hash = SignatureHash(scriptPubKey, txs[i], 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+        BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        txs[i].vin[0].scriptSig << vchSig;
+        prevout = COutPoint(txs[i].GetHash(), 0);
+
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_CHECK(AcceptToMemoryPool(mempool, state, txs[i], false, NULL));
+    }
+    BOOST_CHECK(cache.GetTemplate(ptmpl, pindexPrev));
+    BOOST_CHECK_EQUAL(ptmpl->block.vtx.size(), 3U);
+    BOOST_CHECK(ptmpl->block.vtx[1].GetHash() == txs[0].GetHash());
+    BOOST_CHECK(ptmpl->block.vtx[2].GetHash() == txs[1].GetHash());
+    // ... while a template handed out before stays as it was
+    BOOST_CHECK(ptmplHeld != ptmpl);
+    BOOST_CHECK_EQUAL(ptmplHeld->block.vtx.size(), 1U);
+    ptmplHeld.reset();
+    BOOST_CHECK_EQUAL(ptmpl->vTxFees[0], -2 * CENT);
+    BOOST_CHECK_EQUAL(ptmpl->block.vtx[0].vout[0].nValue, GetBlockSubsidy(pindexPrev->nHeight + 1, Params().GetConsensus()) + 2 * CENT);
+    CBlockTemplateStats stats = cache.GetStats();
+    BOOST_CHECK_EQUAL(stats.nBuilds, 1U);
+    BOOST_CHECK_EQUAL(stats.nUpdates, 2U);
+    BOOST_CHECK_EQUAL(stats.nStaleSeconds, 0);
+
+    // Removing the parent takes the child out as well, and the freed space
+    // leaves the template behind until it is rebuilt
+    std::list<CTransaction> removed;
+    mempool.removeRecursive(txs[0], removed);
+    BOOST_CHECK(cache.GetTemplate(ptmpl, pindexPrev));
+    BOOST_CHECK_EQUAL(ptmpl->block.vtx.size(), 1U);
+    BOOST_CHECK_EQUAL(ptmpl->vTxFees[0], 0);
+    SetMockTime(nTime + 3);
+    stats = cache.GetStats();
+    BOOST_CHECK_EQUAL(stats.nBuilds, 1U);
+    BOOST_CHECK_EQUAL(stats.nUpdates, 4U);
+    BOOST_CHECK_EQUAL(stats.nStaleSeconds, 3);
+    SetMockTime(nTime + DEFAULT_BLOCK_TEMPLATE_REFRESH);
+    BOOST_CHECK(cache.GetTemplate(ptmpl, pindexPrev));
+    stats = cache.GetStats();
+    BOOST_CHECK_EQUAL(stats.nBuilds, 2U);
+    BOOST_CHECK_EQUAL(stats.nUpdates, 0U);
+    BOOST_CHECK_EQUAL(stats.nStaleSeconds, 0);
+
+    // A new tip rebuilds it on top of the parent confirmed there
+    CreateAndProcessBlock(std::vector<CMutableTransaction>(1, txs[0]), scriptPubKey);
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_CHECK(AcceptToMemoryPool(mempool, state, txs[1], false, NULL));
+    }
+    BOOST_CHECK(cache.GetTemplate(ptmpl, pindexPrev));
+    BOOST_CHECK(pindexPrev == chainActive.Tip());
+    BOOST_CHECK(ptmpl->block.hashPrevBlock == chainActive.Tip()->GetBlockHash());
+    BOOST_CHECK_EQUAL(ptmpl->block.vtx.size(), 2U);
+    BOOST_CHECK(ptmpl->block.vtx[1].GetHash() == txs[1].GetHash());
+    BOOST_CHECK_EQUAL(cache.GetStats().nBuilds, 3U);
+
+    mempool.clear();
+    SetMockTime(0);
+}
+
+BOOST_AUTO_TEST_CASE(ScanNonces_midstate)
+{
+    const Consensus::Params& params = Params(CBaseChainParams::REGTEST).GetConsensus();
+    CBlockHeader header;
+    header.nVersion = 4;
+    header.hashPrevBlock = GetRandHash();
+    header.hashMerkleRoot = GetRandHash();
+    header.nTime = 1470000000;
+    header.nBits = 0x1f7fffff; // about one in 512 nonces
+
+    // Solutions found by any of the threads must pass the regular check.
+    for (int nThreads = 1; nThreads <= 4; nThreads++) {
+        header.nNonce = 0;
+        uint64_t nMaxTries = 1000000;
+        BOOST_CHECK(ScanNonces(header, 0x100000, nMaxTries, nThreads, params));
+        BOOST_CHECK(CheckProofOfWork(header.GetHash(), header.nBits, params));
+        BOOST_CHECK(nMaxTries <= 1000000);
+        header.hashMerkleRoot = GetRandHash();
+    }
+
+    // An unreachable target exhausts exactly the allowed number of tries.
+    header.nBits = 0x03000001;
+    header.nNonce = 0;
+    uint64_t nMaxTries = 5000;
+    BOOST_CHECK(!ScanNonces(header, 1000, nMaxTries, 3, params));
+    BOOST_CHECK_EQUAL(nMaxTries, 4000U);
+    BOOST_CHECK_EQUAL(header.nNonce, 1000U);
+
+    header.nNonce = 0;
+    nMaxTries = 700;
+    BOOST_CHECK(!ScanNonces(header, 1000, nMaxTries, 3, params));
+    BOOST_CHECK_EQUAL(nMaxTries, 0U);
+    BOOST_CHECK_EQUAL(header.nNonce, 700U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
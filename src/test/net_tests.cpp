@@ -10,6 +10,9 @@
 #include "streams.h"
 #include "net.h"
 #include "chainparams.h"
+#include "utiltime.h"
+
+#include <boost/thread.hpp>
 
 using namespace std;
 
@@ -164,4 +167,98 @@ BOOST_AUTO_TEST_CASE(cnode_simple_test)
     BOOST_CHECK(pnode2->fFeeler == false);
 }
 
+// State shared between msghand_ordering and the handler it installs
+static CCriticalSection cs_msghandTest;
+static std::map<NodeId, std::vector<uint32_t> > mapMsghandSeen;
+static std::set<NodeId> setMsghandBusy;
+static bool fMsghandOverlap = false;
+
+static bool MsghandTestProcess(CNode* pnode)
+{
+    // Called with cs_vRecvMsg held; take one message per call like main does
+    if (pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete())
+        return true;
+    uint32_t nSeq;
+    pnode->vRecvMsg.front().vRecv >> nSeq;
+    pnode->vRecvMsg.pop_front();
+    {
+        LOCK(cs_msghandTest);
+        if (!setMsghandBusy.insert(pnode->id).second)
+            fMsghandOverlap = true;
+    }
+    MilliSleep(1);
+    {
+        LOCK(cs_msghandTest);
+        setMsghandBusy.erase(pnode->id);
+        mapMsghandSeen[pnode->id].push_back(nSeq);
+    }
+    return true;
+}
+
+BOOST_AUTO_TEST_CASE(msghand_ordering)
+{
+    const int nMessages = 50;
+    in_addr ipv4Addr;
+    ipv4Addr.s_addr = 0xa0b0c001;
+    CAddress addr = CAddress(CService(ipv4Addr, 7777), NODE_NETWORK);
+
+    std::vector<CNode*> vTestNodes;
+    for (int i = 0; i < 2; i++)
+        vTestNodes.push_back(new CNode(INVALID_SOCKET, addr, "", true));
+    {
+        LOCK(cs_vNodes);
+        vNodes = vTestNodes;
+    }
+
+    boost::signals2::connection conn = GetNodeSignals().ProcessMessages.connect(&MsghandTestProcess);
+    int nThreadsSaved = nMessageHandlerThreads;
+    nMessageHandlerThreads = 2;
+    boost::thread_group handlers;
+    for (int i = 0; i < nMessageHandlerThreads; i++)
+        handlers.create_thread(boost::bind(&ThreadMessageHandler, i));
+
+    // Feed both nodes in small bursts while the handlers are running
+    for (int n = 0; n < nMessages; n++) {
+        BOOST_FOREACH(CNode* pnode, vTestNodes) {
+            CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+            ss << CMessageHeader(Params().MessageStart(), "ping", sizeof(uint32_t)) << (uint32_t)n;
+            LOCK(pnode->cs_vRecvMsg);
+            BOOST_CHECK(pnode->ReceiveMsgBytes(&ss[0], ss.size()));
+        }
+        if (n % 10 == 9)
+            MilliSleep(5);
+    }
+
+    // A handler sleeps up to 100ms when idle; give them plenty of time
+    for (int i = 0; i < 500; i++) {
+        {
+            LOCK(cs_msghandTest);
+            if (mapMsghandSeen[vTestNodes[0]->id].size() == nMessages &&
+                mapMsghandSeen[vTestNodes[1]->id].size() == nMessages)
+                break;
+        }
+        MilliSleep(10);
+    }
+
+    handlers.interrupt_all();
+    handlers.join_all();
+    nMessageHandlerThreads = nThreadsSaved;
+    conn.disconnect();
+    {
+        LOCK(cs_vNodes);
+        vNodes.clear();
+    }
+
+    std::vector<uint32_t> vExpected;
+    for (int n = 0; n < nMessages; n++)
+        vExpected.push_back(n);
+    BOOST_FOREACH(CNode* pnode, vTestNodes) {
+        const std::vector<uint32_t>& vSeen = mapMsghandSeen[pnode->id];
+        BOOST_CHECK_EQUAL_COLLECTIONS(vSeen.begin(), vSeen.end(), vExpected.begin(), vExpected.end());
+        delete pnode;
+    }
+    // No node was ever processed by both threads at once
+    BOOST_CHECK(!fMsghandOverlap);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
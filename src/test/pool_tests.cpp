@@ -0,0 +1,89 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "support/allocators/pool.h"
+
+#include "coins.h"
+#include "memusage.h"
+#include "random.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(pool_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(pool_resource_reuse)
+{
+    CPoolResource<64, 8> resource(1024);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 0U);
+
+    // Blocks are carved from one chunk, rounded up to the alignment
+    void* a = resource.Allocate(20, 8);
+    void* b = resource.Allocate(24, 8);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1U);
+    BOOST_CHECK_EQUAL((char*)b - (char*)a, 24);
+
+    // A freed block is reused by the next allocation of its size only
+    resource.Deallocate(a, 20, 8);
+    void* c = resource.Allocate(32, 8);
+    BOOST_CHECK(c != a);
+    void* d = resource.Allocate(17, 8);
+    BOOST_CHECK(d == a);
+
+    // Too large or too strictly aligned allocations bypass the pool
+    void* e = resource.Allocate(65, 8);
+    void* f = resource.Allocate(16, 16);
+    BOOST_CHECK_EQUAL(resource.NumLargeAllocations(), 2U);
+    BOOST_CHECK_EQUAL(resource.LargeAllocatedBytes(), 81U);
+    resource.Deallocate(e, 65, 8);
+    resource.Deallocate(f, 16, 16);
+    BOOST_CHECK_EQUAL(resource.NumLargeAllocations(), 0U);
+    BOOST_CHECK_EQUAL(resource.LargeAllocatedBytes(), 0U);
+
+    // The unused rest of a chunk serves smaller requests later
+    for (int i = 0; i < 20; i++)
+        resource.Allocate(64, 8);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 2U);
+    void* g = resource.Allocate(48, 8);
+    BOOST_CHECK((char*)g > (char*)a && (char*)g < (char*)a + 1024);
+    resource.Deallocate(b, 24, 8);
+    resource.Deallocate(c, 32, 8);
+    resource.Deallocate(d, 17, 8);
+    resource.Deallocate(g, 48, 8);
+}
+
+BOOST_AUTO_TEST_CASE(pool_allocator_map)
+{
+    CCoinsMap map;
+    BOOST_CHECK(map.get_allocator() != CCoinsMap().get_allocator());
+
+    Coin coin(CTxOut(1, CScript()), 1, false);
+    for (uint32_t i = 0; i < 10000; i++)
+        map[COutPoint(GetRandHash(), i)] = CCoinsCacheEntry(coin);
+    const CCoinsMapAllocator::Resource& resource = *map.get_allocator().GetResource();
+    BOOST_CHECK(resource.NumAllocatedChunks() > 0);
+    // Nodes are packed more densely than malloc would
+    BOOST_CHECK(memusage::DynamicUsage(map) < memusage::MallocUsage(sizeof(CCoinsMap::value_type) + 2 * sizeof(void*)) * map.size() + memusage::MallocUsage(sizeof(void*) * map.bucket_count()) + resource.ChunkSizeBytes());
+
+    // Erasing keeps the memory in the pool for reuse
+    size_t nChunks = resource.NumAllocatedChunks();
+    size_t nUsage = memusage::DynamicUsage(map);
+    map.clear();
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), nChunks);
+    for (uint32_t i = 0; i < 10000; i++)
+        map[COutPoint(GetRandHash(), i)] = CCoinsCacheEntry(coin);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), nChunks);
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(map), nUsage);
+
+    // Swapping moves the pool along with the entries
+    CCoinsMap mapOther;
+    const CCoinsMapAllocator allocator = map.get_allocator();
+    map.swap(mapOther);
+    BOOST_CHECK(mapOther.get_allocator() == allocator);
+    BOOST_CHECK(map.get_allocator() != allocator);
+    BOOST_CHECK_EQUAL(mapOther.size(), 10000U);
+    BOOST_CHECK_EQUAL(map.get_allocator().GetResource()->NumAllocatedChunks(), 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -4,14 +4,17 @@
 
 #include "rpc/server.h"
 #include "rpc/client.h"
+#include "rpc/jsonwriter.h"
 
 #include "base58.h"
+#include "dbwrapper.h"
 #include "netbase.h"
 
 #include "test/test_bitcoin.h"
 
 #include <boost/algorithm/string.hpp>
 #include <boost/assign/list_of.hpp>
+#include <boost/bind.hpp>
 #include <boost/test/unit_test.hpp>
 
 #include <univalue.h>
@@ -332,4 +335,171 @@ BOOST_AUTO_TEST_CASE(rpc_convert_values_generatetoaddress)
     BOOST_CHECK_EQUAL(result[2].get_int(), 9);
 }
 
+BOOST_AUTO_TEST_CASE(rpc_getdbstats)
+{
+    UniValue r;
+    BOOST_CHECK_NO_THROW(r = CallRPC("getdbstats"));
+    BOOST_CHECK_EQUAL(find_value(r.get_obj(), "chainstate")["maxopenfiles"].get_int(), CDBOptions().nMaxOpenFiles);
+    BOOST_CHECK(find_value(r.get_obj(), "blockindex")["approximate_sizes"].isObject());
+    BOOST_CHECK(find_value(r.get_obj(), "blockindex")["stats"].isStr());
+    BOOST_CHECK_THROW(CallRPC("getdbstats 1"), runtime_error);
+}
+
+static void AppendChunk(std::vector<std::string>& vChunks, const std::string& strChunk)
+{
+    vChunks.push_back(strChunk);
+}
+
+BOOST_AUTO_TEST_CASE(rpc_jsonwriter)
+{
+    UniValue inner(UniValue::VOBJ);
+    inner.push_back(Pair("a\"b", 1.5));
+    inner.push_back(Pair("empty", UniValue(UniValue::VARR)));
+    UniValue arr(UniValue::VARR);
+    arr.push_back(inner);
+    arr.push_back("x\ny");
+    arr.push_back(NullUniValue);
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("arr", arr));
+    obj.push_back(Pair("n", (int64_t)-3));
+    obj.push_back(Pair("obj", UniValue(UniValue::VOBJ)));
+
+    // The same document written piece by piece, into a string, in small
+    // chunks and into a UniValue
+    CJSONWriter writer;
+    std::vector<std::string> vChunks;
+    CJSONWriter chunkWriter(boost::bind(AppendChunk, boost::ref(vChunks), _1), 8);
+    CJSONWriter valueWriter(CJSONWriter::OUTPUT_VALUE);
+    CJSONWriter* writers[] = {&writer, &chunkWriter, &valueWriter};
+    BOOST_FOREACH(CJSONWriter* w, writers) {
+        w->BeginObject();
+        w->Key("arr");
+        w->BeginArray();
+        w->BeginObject();
+        w->Pair("a\"b", 1.5);
+        w->Key("empty");
+        w->BeginArray();
+        w->EndArray();
+        w->EndObject();
+        w->Value("x\ny");
+        w->Value(NullUniValue);
+        w->EndArray();
+        w->Pair("n", (int64_t)-3);
+        w->Pair("obj", UniValue(UniValue::VOBJ));
+        w->EndObject();
+    }
+    BOOST_CHECK_EQUAL(writer.GetBuffer(), obj.write());
+    BOOST_CHECK_EQUAL(valueWriter.GetValue().write(), obj.write());
+
+    BOOST_CHECK(vChunks.size() > 1);
+    BOOST_FOREACH(const std::string& strChunk, vChunks)
+        BOOST_CHECK(strChunk.size() >= 8);
+    chunkWriter.Flush();
+    BOOST_CHECK(chunkWriter.GetBuffer().empty());
+    BOOST_CHECK_EQUAL(boost::algorithm::join(vChunks, ""), obj.write());
+    BOOST_CHECK_EQUAL(chunkWriter.GetFlushed(), obj.write().size());
+
+    // Streaming forms of commands give the same result as their actors
+    if (RPCIsInWarmup(NULL))
+        SetRPCWarmupFinished();
+    std::string strHash = CallRPC("getbestblockhash").get_str();
+    const char* calls[] = {"getblock", "getrawmempool"};
+    UniValue params[] = {UniValue(UniValue::VARR), UniValue(UniValue::VARR)};
+    params[0].push_back(strHash);
+    params[1].push_back(true);
+    for (int i = 0; i < 2; i++) {
+        CJSONWriter w;
+        BOOST_CHECK(tableRPC.executeStream(calls[i], params[i], w));
+        BOOST_CHECK_EQUAL(w.GetBuffer(), tableRPC.execute(calls[i], params[i]).write());
+    }
+    CJSONWriter w;
+    BOOST_CHECK(!tableRPC.executeStream("getblockcount", UniValue(UniValue::VARR), w));
+    BOOST_CHECK_THROW(tableRPC.executeStream("getblock", UniValue(UniValue::VARR), w), UniValue);
+    BOOST_CHECK(w.GetBuffer().empty());
+}
+
+static bool StartBatchThread(boost::thread_group* threads, int* pnStarted, const boost::function<void ()>& func)
+{
+    threads->create_thread(func);
+    (*pnStarted)++;
+    return true;
+}
+
+static bool NoBatchThread(const boost::function<void ()>& func)
+{
+    return false;
+}
+
+BOOST_AUTO_TEST_CASE(rpc_batch)
+{
+    if (RPCIsInWarmup(NULL))
+        SetRPCWarmupFinished();
+
+    // Read-only calls run concurrently, the others split the batch into runs
+    UniValue vReq;
+    BOOST_CHECK(vReq.read("["
+        "{\"method\":\"getblockcount\",\"id\":1},"
+        "{\"method\":\"getbestblockhash\",\"id\":2},"
+        "{\"method\":\"getdifficulty\",\"id\":3},"
+        "{\"method\":\"nosuchmethod\",\"id\":4},"
+        "{\"method\":\"getblockcount\",\"id\":5},"
+        "{\"method\":\"getblockhash\",\"params\":[0],\"id\":6},"
+        "{\"method\":\"getblockhash\",\"params\":[-1],\"id\":7},"
+        "{\"method\":\"getmempoolinfo\",\"id\":8},"
+        "\"notanobject\","
+        "{\"method\":\"getblockcount\",\"id\":10}]"));
+    std::string strSerial = JSONRPCExecBatch(vReq);
+
+    UniValue vReply;
+    BOOST_CHECK(vReply.read(strSerial));
+    BOOST_CHECK_EQUAL(vReply.size(), vReq.size());
+    for (size_t i = 0; i < 8; i++)
+        BOOST_CHECK_EQUAL(find_value(vReply[i], "id").get_int(), (int)i + 1);
+    BOOST_CHECK(find_value(vReply[3], "error").isObject());
+    BOOST_CHECK(find_value(vReply[6], "error").isObject());
+
+    boost::thread_group threads;
+    int nStarted = 0;
+    BOOST_CHECK_EQUAL(JSONRPCExecBatch(vReq, boost::bind(StartBatchThread, &threads, &nStarted, _1)), strSerial);
+    threads.join_all();
+    // Helpers for the runs of three and of four calls, none for single calls
+    BOOST_CHECK_EQUAL(nStarted, 2 + 3);
+    BOOST_CHECK_EQUAL(JSONRPCExecBatch(vReq, NoBatchThread), strSerial);
+
+    // Calls that change state split runs even if they are allowed in safe mode
+    UniValue vReqMixed;
+    BOOST_CHECK(vReqMixed.read("["
+        "{\"method\":\"getblockcount\",\"id\":1},"
+        "{\"method\":\"getbestblockhash\",\"id\":2},"
+        "{\"method\":\"setmocktime\",\"params\":[0],\"id\":3},"
+        "{\"method\":\"getblockcount\",\"id\":4},"
+        "{\"method\":\"getdifficulty\",\"id\":5}]"));
+    BOOST_CHECK(tableRPC["setmocktime"]->okSafeMode);
+    nStarted = 0;
+    std::string strMixed = JSONRPCExecBatch(vReqMixed, boost::bind(StartBatchThread, &threads, &nStarted, _1));
+    threads.join_all();
+    BOOST_CHECK_EQUAL(nStarted, 1 + 1);
+    BOOST_CHECK_EQUAL(strMixed, JSONRPCExecBatch(vReqMixed, NoBatchThread));
+
+    mapArgs["-rpcbatchthreads"] = "1";
+    nStarted = 0;
+    BOOST_CHECK_EQUAL(JSONRPCExecBatch(vReq, boost::bind(StartBatchThread, &threads, &nStarted, _1)), strSerial);
+    threads.join_all();
+    BOOST_CHECK_EQUAL(nStarted, 0);
+    mapArgs.erase("-rpcbatchthreads");
+}
+
+BOOST_AUTO_TEST_CASE(rpc_peekmethod)
+{
+    BOOST_CHECK_EQUAL(JSONRPCPeekMethod(JSONRPCRequest("getblocktemplate", NullUniValue, 1)), "getblocktemplate");
+    BOOST_CHECK_EQUAL(JSONRPCPeekMethod(" {\"id\": 1, \"method\" : \"submitblock\", \"params\": [\"00\"]}"), "submitblock");
+    // Batches, requests cut short before the method, and escaped names are not routed
+    BOOST_CHECK_EQUAL(JSONRPCPeekMethod("[{\"method\":\"submitblock\"}]"), "");
+    BOOST_CHECK_EQUAL(JSONRPCPeekMethod("{\"params\":[\"00\"], \"meth"), "");
+    BOOST_CHECK_EQUAL(JSONRPCPeekMethod("{\"method\":\"submit"), "");
+    BOOST_CHECK_EQUAL(JSONRPCPeekMethod("{\"method\":\"submit\\u0062lock\"}"), "");
+    BOOST_CHECK_EQUAL(JSONRPCPeekMethod("{\"method\":1}"), "");
+    BOOST_CHECK_EQUAL(JSONRPCPeekMethod(""), "");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
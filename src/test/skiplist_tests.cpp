@@ -44,6 +44,34 @@ BOOST_AUTO_TEST_CASE(skiplist_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(chain_buildskip_test)
+{
+    std::vector<CBlockIndex> vIndex(SKIPLIST_LENGTH);
+    std::vector<CBlockIndex> vChainIndex(SKIPLIST_LENGTH);
+
+    for (int i=0; i<SKIPLIST_LENGTH; i++) {
+        vIndex[i].nHeight = vChainIndex[i].nHeight = i;
+        vIndex[i].pprev = (i == 0) ? NULL : &vIndex[i - 1];
+        vChainIndex[i].pprev = (i == 0) ? NULL : &vChainIndex[i - 1];
+        vIndex[i].BuildSkip();
+    }
+
+    // Skip pointers built from the chain, in any order, match the incremental ones.
+    CChain chain;
+    chain.SetTip(&vChainIndex.back());
+    for (int i=SKIPLIST_LENGTH - 1; i>=0; i--)
+        chain.BuildSkip(&vChainIndex[i]);
+
+    for (int i=0; i<SKIPLIST_LENGTH; i++) {
+        if (i > 0) {
+            BOOST_CHECK_EQUAL(vChainIndex[i].pskip->nHeight, vIndex[i].pskip->nHeight);
+            BOOST_CHECK(vChainIndex[i].pskip == &vChainIndex[vChainIndex[i].pskip->nHeight]);
+        } else {
+            BOOST_CHECK(vChainIndex[i].pskip == NULL);
+        }
+    }
+}
+
 BOOST_AUTO_TEST_CASE(getlocator_test)
 {
     // Build a main chain 100000 blocks long.
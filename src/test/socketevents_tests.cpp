@@ -0,0 +1,176 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "socketevents.h"
+#include "netbase.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(socketevents_tests, BasicTestingSetup)
+
+namespace {
+
+/** A non-blocking listening socket on an ephemeral loopback port. */
+SOCKET ListenLoopback(struct sockaddr_in& addr)
+{
+    SOCKET hListen = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    BOOST_REQUIRE(hListen != INVALID_SOCKET);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    socklen_t len = sizeof(addr);
+    BOOST_REQUIRE(bind(hListen, (struct sockaddr*)&addr, sizeof(addr)) != SOCKET_ERROR);
+    BOOST_REQUIRE(getsockname(hListen, (struct sockaddr*)&addr, &len) != SOCKET_ERROR);
+    BOOST_REQUIRE(listen(hListen, SOMAXCONN) != SOCKET_ERROR);
+    BOOST_REQUIRE(SetSocketNonBlocking(hListen, true));
+    return hListen;
+}
+
+SOCKET ConnectLoopback(const struct sockaddr_in& addr)
+{
+    SOCKET hSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    BOOST_REQUIRE(hSocket != INVALID_SOCKET);
+    BOOST_REQUIRE(connect(hSocket, (const struct sockaddr*)&addr, sizeof(addr)) != SOCKET_ERROR);
+    return hSocket;
+}
+
+SOCKET AcceptLoopback(SOCKET hListen)
+{
+    SOCKET hSocket = INVALID_SOCKET;
+    for (int i = 0; i < 1000 && hSocket == INVALID_SOCKET; i++) {
+        hSocket = accept(hListen, NULL, NULL);
+        if (hSocket == INVALID_SOCKET)
+            MilliSleep(1);
+    }
+    BOOST_REQUIRE(hSocket != INVALID_SOCKET);
+    return hSocket;
+}
+
+int EventsFor(const std::vector<CSocketEvents::Event>& vEvents, SOCKET hSocket)
+{
+    int nEvents = 0;
+    for (size_t i = 0; i < vEvents.size(); i++)
+        if (vEvents[i].hSocket == hSocket)
+            nEvents |= vEvents[i].nEvents;
+    return nEvents;
+}
+
+void TestBackend(CSocketEvents::Backend backend)
+{
+    CSocketEvents events;
+    BOOST_REQUIRE(events.Start(backend));
+    BOOST_CHECK(events.GetBackend() == backend);
+    const bool fEdgeTriggered = backend == CSocketEvents::BACKEND_EPOLL;
+
+    struct sockaddr_in addr;
+    SOCKET hListen = ListenLoopback(addr);
+    BOOST_CHECK(events.Add(hListen, NULL, true));
+
+    std::vector<CSocketEvents::Event> vEvents;
+    BOOST_CHECK(events.Wait(0, vEvents));
+    BOOST_CHECK(vEvents.empty());
+
+    // A pending connection is reported until it is accepted
+    SOCKET hClient = ConnectLoopback(addr);
+    for (int i = 0; i < 2; i++) {
+        vEvents.clear();
+        BOOST_CHECK(events.Wait(1000, vEvents));
+        BOOST_CHECK_EQUAL(vEvents.size(), 1U);
+        BOOST_CHECK(EventsFor(vEvents, hListen) & CSocketEvents::EVENT_RECV);
+        BOOST_CHECK(vEvents.size() == 1 && vEvents[0].pdata == NULL);
+    }
+    SOCKET hServer = AcceptLoopback(hListen);
+    vEvents.clear();
+    BOOST_CHECK(events.Wait(0, vEvents));
+    BOOST_CHECK_EQUAL(EventsFor(vEvents, hListen), 0);
+
+    int nTag = 0;
+    BOOST_CHECK(events.Add(hServer, &nTag));
+    events.SetInterest(hServer, CSocketEvents::EVENT_RECV);
+    vEvents.clear();
+    BOOST_CHECK(events.Wait(0, vEvents));
+    BOOST_CHECK_EQUAL(EventsFor(vEvents, hServer) & CSocketEvents::EVENT_RECV, 0);
+
+    // Incoming data is reported with the socket's data
+    char ch = 'x';
+    BOOST_CHECK_EQUAL(send(hClient, &ch, 1, MSG_NOSIGNAL), 1);
+    vEvents.clear();
+    BOOST_CHECK(events.Wait(1000, vEvents));
+    BOOST_CHECK(EventsFor(vEvents, hServer) & CSocketEvents::EVENT_RECV);
+    for (size_t i = 0; i < vEvents.size(); i++)
+        if (vEvents[i].hSocket == hServer)
+            BOOST_CHECK(vEvents[i].pdata == &nTag);
+
+    // Until it is read, it is reported again by select(), but not by epoll
+    vEvents.clear();
+    BOOST_CHECK(events.Wait(0, vEvents));
+    BOOST_CHECK_EQUAL((EventsFor(vEvents, hServer) & CSocketEvents::EVENT_RECV) != 0, !fEdgeTriggered);
+
+    // More data is reported again by both
+    BOOST_CHECK_EQUAL(send(hClient, &ch, 1, MSG_NOSIGNAL), 1);
+    vEvents.clear();
+    BOOST_CHECK(events.Wait(1000, vEvents));
+    BOOST_CHECK(EventsFor(vEvents, hServer) & CSocketEvents::EVENT_RECV);
+
+    char buf[2];
+    BOOST_CHECK_EQUAL(recv(hServer, buf, sizeof(buf), MSG_DONTWAIT), 2);
+    vEvents.clear();
+    BOOST_CHECK(events.Wait(0, vEvents));
+    BOOST_CHECK_EQUAL(EventsFor(vEvents, hServer) & CSocketEvents::EVENT_RECV, 0);
+
+    // Removed sockets are not reported
+    events.Remove(hServer);
+    BOOST_CHECK_EQUAL(send(hClient, &ch, 1, MSG_NOSIGNAL), 1);
+    vEvents.clear();
+    BOOST_CHECK(events.Wait(50, vEvents));
+    BOOST_CHECK_EQUAL(EventsFor(vEvents, hServer), 0);
+
+    // A closed connection is reported as readable
+    BOOST_CHECK(events.Add(hServer, &nTag));
+    events.SetInterest(hServer, CSocketEvents::EVENT_RECV);
+    BOOST_CHECK(CloseSocket(hClient));
+    vEvents.clear();
+    BOOST_CHECK(events.Wait(1000, vEvents));
+    BOOST_CHECK(EventsFor(vEvents, hServer) & (CSocketEvents::EVENT_RECV | CSocketEvents::EVENT_ERROR));
+
+    events.Remove(hServer);
+    events.Remove(hListen);
+    CloseSocket(hServer);
+    CloseSocket(hListen);
+    events.Stop();
+    BOOST_CHECK(!events.IsStarted());
+}
+
+} // anon namespace
+
+BOOST_AUTO_TEST_CASE(socketevents_backends)
+{
+    CSocketEvents::Backend backend;
+    BOOST_CHECK(CSocketEvents::ParseBackend("select", backend) && backend == CSocketEvents::BACKEND_SELECT);
+    BOOST_CHECK(CSocketEvents::ParseBackend("epoll", backend) && backend == CSocketEvents::BACKEND_EPOLL);
+    BOOST_CHECK(!CSocketEvents::ParseBackend("kqueue", backend));
+    BOOST_CHECK_EQUAL(CSocketEvents::GetBackendName(CSocketEvents::BACKEND_EPOLL), "epoll");
+    BOOST_CHECK(CSocketEvents::IsBackendSupported(CSocketEvents::BACKEND_SELECT));
+
+    // Nothing is watched before Start()
+    CSocketEvents events;
+    BOOST_CHECK(!events.IsStarted());
+    BOOST_CHECK(!events.Add(0, NULL));
+}
+
+BOOST_AUTO_TEST_CASE(socketevents_select)
+{
+    TestBackend(CSocketEvents::BACKEND_SELECT);
+}
+
+#ifdef USE_EPOLL
+BOOST_AUTO_TEST_CASE(socketevents_epoll)
+{
+    TestBackend(CSocketEvents::BACKEND_EPOLL);
+}
+#endif
+
+BOOST_AUTO_TEST_SUITE_END()
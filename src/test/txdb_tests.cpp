@@ -0,0 +1,302 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "arith_uint256.h"
+#include "chain.h"
+#include "chainparams.h"
+#include "coins.h"
+#include "compressor.h"
+#include "pow.h"
+#include "random.h"
+#include "script/script.h"
+#include "txdb.h"
+#include "uint256.h"
+#include "util.h"
+
+#include "test/test_bitcoin.h"
+
+#include <map>
+
+#include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(txdb_tests, BasicTestingSetup)
+
+typedef std::map<uint256, CBlockIndex*> TestBlockMap;
+
+static CBlockIndex* InsertTestBlockIndex(TestBlockMap& map, const uint256& hash)
+{
+    if (hash.IsNull())
+        return NULL;
+    TestBlockMap::iterator it = map.find(hash);
+    if (it != map.end())
+        return it->second;
+    CBlockIndex* pindex = new CBlockIndex();
+    it = map.insert(std::make_pair(hash, pindex)).first;
+    pindex->phashBlock = &it->first;
+    return pindex;
+}
+
+static bool LoadTestBlockIndex(CBlockTreeDB& db, TestBlockMap& map, CBlockIndexLoadQueue* pqueue = NULL)
+{
+    return db.LoadBlockIndexGuts(boost::bind(InsertTestBlockIndex, boost::ref(map), _1), pqueue);
+}
+
+static void FreeTestBlockIndex(TestBlockMap& map)
+{
+    for (TestBlockMap::iterator it = map.begin(); it != map.end(); ++it)
+        delete it->second;
+    map.clear();
+}
+
+BOOST_AUTO_TEST_CASE(load_block_index_hashes)
+{
+    SelectParams(CBaseChainParams::REGTEST);
+    const Consensus::Params& params = Params().GetConsensus();
+
+    CBlockHeader header;
+    header.nVersion = 4;
+    header.nTime = 1296688602;
+    header.nBits = UintToArith256(params.powLimit).GetCompact();
+    while (!CheckProofOfWork(header.GetHash(), header.nBits, params))
+        header.nNonce++;
+    uint256 hash = header.GetHash();
+    CBlockIndex index(header);
+    index.phashBlock = &hash;
+
+    // A second entry stored under a key that meets its target but is not its hash.
+    CBlockHeader header2 = header;
+    header2.nTime++;
+    uint256 hash2 = uint256S("0000000000000000000000000000000000000000000000000000000000000001");
+    CBlockIndex index2(header2);
+    index2.phashBlock = &hash2;
+
+    std::vector<std::pair<int, const CBlockFileInfo*> > vFiles;
+    std::vector<const CBlockIndex*> vBlocks;
+    vBlocks.push_back(&index);
+    CBlockTreeDB db(1 << 20, true);
+    BOOST_CHECK(db.WriteBatchSync(vFiles, 0, vBlocks));
+
+    TestBlockMap map;
+    BOOST_CHECK(LoadTestBlockIndex(db, map));
+    BOOST_CHECK(map.size() == 1 && map.count(hash));
+    BOOST_CHECK(map[hash]->GetBlockHeader().GetHash() == hash);
+    FreeTestBlockIndex(map);
+
+    // By default the stored hash is trusted, so the bad entry loads too.
+    vBlocks.push_back(&index2);
+    BOOST_CHECK(db.WriteBatchSync(vFiles, 0, vBlocks));
+    BOOST_CHECK(LoadTestBlockIndex(db, map));
+    BOOST_CHECK_EQUAL(map.size(), 2U);
+    FreeTestBlockIndex(map);
+
+    // -checkblockindexpow recomputes it and rejects the mismatch.
+    mapArgs["-checkblockindexpow"] = "1";
+    BOOST_CHECK(!LoadTestBlockIndex(db, map));
+    FreeTestBlockIndex(map);
+    mapArgs.erase("-checkblockindexpow");
+
+    SelectParams(CBaseChainParams::MAIN);
+}
+
+BOOST_AUTO_TEST_CASE(load_block_index_parallel)
+{
+    SelectParams(CBaseChainParams::REGTEST);
+    const Consensus::Params& params = Params().GetConsensus();
+
+    // A chain spanning several loader batches.
+    const int nBlocks = 3 * BLOCK_INDEX_VERIFY_BATCH + 17;
+    std::vector<uint256> vHashes(nBlocks);
+    std::vector<CBlockIndex> vIndex(nBlocks);
+    std::vector<const CBlockIndex*> vBlocks;
+    CBlockHeader header;
+    header.nVersion = 4;
+    header.nTime = 1296688602;
+    header.nBits = UintToArith256(params.powLimit).GetCompact();
+    for (int i = 0; i < nBlocks; i++) {
+        header.hashPrevBlock = i ? vHashes[i - 1] : uint256();
+        while (!CheckProofOfWork(header.GetHash(), header.nBits, params))
+            header.nNonce++;
+        vHashes[i] = header.GetHash();
+        vIndex[i] = CBlockIndex(header);
+        vIndex[i].phashBlock = &vHashes[i];
+        vIndex[i].pprev = i ? &vIndex[i - 1] : NULL;
+        vIndex[i].nHeight = i;
+        vBlocks.push_back(&vIndex[i]);
+    }
+    std::vector<std::pair<int, const CBlockFileInfo*> > vFiles;
+    CBlockTreeDB db(1 << 24, true);
+    BOOST_CHECK(db.WriteBatchSync(vFiles, 0, vBlocks));
+
+    CBlockIndexLoadQueue queue(1);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < 3; i++)
+        threadGroup.create_thread(boost::bind(&CBlockIndexLoadQueue::Thread, &queue));
+
+    mapArgs["-checkblockindexpow"] = "1";
+    TestBlockMap map;
+    BOOST_CHECK(LoadTestBlockIndex(db, map, &queue));
+    BOOST_CHECK_EQUAL(map.size(), (size_t)nBlocks);
+    for (int i = 1; i < nBlocks; i++) {
+        const CBlockIndex* pindex = map[vHashes[i]];
+        BOOST_CHECK(pindex->pprev == map[vHashes[i - 1]]);
+        BOOST_CHECK_EQUAL(pindex->nHeight, i);
+    }
+    FreeTestBlockIndex(map);
+
+    // A corrupted entry in the middle is caught by a worker.
+    uint256 hashBad = uint256S("0000000000000000000000000000000000000000000000000000000000000001");
+    CBlockIndex indexBad(vIndex[nBlocks / 2].GetBlockHeader());
+    indexBad.nHeight = nBlocks / 2;
+    indexBad.phashBlock = &hashBad;
+    std::vector<const CBlockIndex*> vBad(1, &indexBad);
+    BOOST_CHECK(db.WriteBatchSync(vFiles, 0, vBad));
+    BOOST_CHECK(!LoadTestBlockIndex(db, map, &queue));
+    FreeTestBlockIndex(map);
+    mapArgs.erase("-checkblockindexpow");
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+    SelectParams(CBaseChainParams::MAIN);
+}
+
+/** Per-transaction UTXO record as older versions wrote it, spent outputs null */
+class CLegacyCoinsRecord
+{
+public:
+    bool fCoinBase;
+    std::vector<CTxOut> vout;
+    int nHeight;
+
+    CLegacyCoinsRecord(bool fCoinBaseIn, int nHeightIn) : fCoinBase(fCoinBaseIn), nHeight(nHeightIn) {}
+
+    template<typename Stream>
+    void Serialize(Stream &s, int nType, int nVersion) const {
+        // Bitmask bytes for the outputs after the first two, up to the last
+        // byte that is not zero; only the nonzero ones are counted in nCode
+        unsigned int nMaskSize = 0, nMaskCode = 0;
+        for (unsigned int b = 0; 2 + b * 8 < vout.size(); b++) {
+            bool fZero = true;
+            for (unsigned int i = 0; i < 8 && 2 + b * 8 + i < vout.size(); i++)
+                if (!vout[2 + b * 8 + i].IsNull())
+                    fZero = false;
+            if (!fZero) {
+                nMaskSize = b + 1;
+                nMaskCode++;
+            }
+        }
+        bool fFirst = vout.size() > 0 && !vout[0].IsNull();
+        bool fSecond = vout.size() > 1 && !vout[1].IsNull();
+        unsigned int nCode = 8 * (nMaskCode - (fFirst || fSecond ? 0 : 1)) + (fCoinBase ? 1 : 0) + (fFirst ? 2 : 0) + (fSecond ? 4 : 0);
+        int nTxVersion = 1;
+        ::Serialize(s, VARINT(nTxVersion), nType, nVersion);
+        ::Serialize(s, VARINT(nCode), nType, nVersion);
+        for (unsigned int b = 0; b < nMaskSize; b++) {
+            unsigned char chAvail = 0;
+            for (unsigned int i = 0; i < 8 && 2 + b * 8 + i < vout.size(); i++)
+                if (!vout[2 + b * 8 + i].IsNull())
+                    chAvail |= (1 << i);
+            ::Serialize(s, chAvail, nType, nVersion);
+        }
+        for (unsigned int i = 0; i < vout.size(); i++)
+            if (!vout[i].IsNull())
+                ::Serialize(s, CTxOutCompressor(REF(vout[i])), nType, nVersion);
+        ::Serialize(s, VARINT(nHeight), nType, nVersion);
+    }
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const {
+        CDataStream ss(nType, nVersion);
+        Serialize(ss, nType, nVersion);
+        return ss.size();
+    }
+};
+
+/** Coin database that per-transaction records can be written to */
+class CCoinsViewDBLegacy : public CCoinsViewDB
+{
+public:
+    CCoinsViewDBLegacy() : CCoinsViewDB(1 << 20, true) {}
+
+    void WriteLegacy(const uint256& txid, const CLegacyCoinsRecord& coins)
+    {
+        BOOST_REQUIRE(db.Write(std::make_pair('c', txid), coins)); // DB_COINS
+    }
+
+    bool HaveLegacy()
+    {
+        boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+        pcursor->Seek(std::make_pair('c', uint256()));
+        std::pair<char, uint256> key;
+        return pcursor->Valid() && pcursor->GetKey(key) && key.first == 'c';
+    }
+};
+
+BOOST_AUTO_TEST_CASE(upgrade_legacy_coins)
+{
+    CCoinsViewDBLegacy db;
+    CScript script = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 0x42) << OP_EQUALVERIFY << OP_CHECKSIG;
+    CScript scriptUnspendable = CScript() << OP_RETURN << std::vector<unsigned char>(4, 0x01);
+
+    // A coinbase with both outputs unspent
+    uint256 txidCoinBase = GetRandHash();
+    CLegacyCoinsRecord coinbase(true, 10);
+    coinbase.vout.push_back(CTxOut(50 * COIN, script));
+    coinbase.vout.push_back(CTxOut(1, script));
+    db.WriteLegacy(txidCoinBase, coinbase);
+
+    // First output spent, second unspendable, a whole bitmask byte of
+    // spent outputs, and the last two left
+    uint256 txidMixed = GetRandHash();
+    CLegacyCoinsRecord mixed(false, 20);
+    mixed.vout.resize(14);
+    mixed.vout[1] = CTxOut(0, scriptUnspendable);
+    mixed.vout[11] = CTxOut(3 * COIN, script);
+    mixed.vout[13] = CTxOut(4 * COIN, script);
+    db.WriteLegacy(txidMixed, mixed);
+
+    // Neither of the first two outputs left
+    uint256 txidLate = GetRandHash();
+    CLegacyCoinsRecord late(false, 30);
+    late.vout.resize(3);
+    late.vout[2] = CTxOut(5 * COIN, script);
+    db.WriteLegacy(txidLate, late);
+
+    BOOST_CHECK(db.HaveLegacy());
+    BOOST_CHECK(db.Upgrade());
+    BOOST_CHECK(!db.HaveLegacy());
+
+    std::map<COutPoint, Coin> mapExpected;
+    mapExpected[COutPoint(txidCoinBase, 0)] = Coin(coinbase.vout[0], 10, true);
+    mapExpected[COutPoint(txidCoinBase, 1)] = Coin(coinbase.vout[1], 10, true);
+    mapExpected[COutPoint(txidMixed, 11)] = Coin(mixed.vout[11], 20, false);
+    mapExpected[COutPoint(txidMixed, 13)] = Coin(mixed.vout[13], 20, false);
+    mapExpected[COutPoint(txidLate, 2)] = Coin(late.vout[2], 30, false);
+
+    // Exactly these outputs are left; spent and unspendable ones are dropped
+    size_t nCoins = 0;
+    boost::scoped_ptr<CCoinsViewCursor> pcursor(db.Cursor());
+    for (; pcursor->Valid(); pcursor->Next()) {
+        COutPoint key;
+        Coin coin;
+        BOOST_CHECK(pcursor->GetKey(key) && pcursor->GetValue(coin));
+        std::map<COutPoint, Coin>::const_iterator it = mapExpected.find(key);
+        BOOST_REQUIRE(it != mapExpected.end());
+        BOOST_CHECK(coin.out == it->second.out);
+        BOOST_CHECK(coin.nHeight == it->second.nHeight);
+        BOOST_CHECK(coin.fCoinBase == it->second.fCoinBase);
+        nCoins++;
+    }
+    BOOST_CHECK_EQUAL(nCoins, mapExpected.size());
+    BOOST_CHECK(!db.HaveCoin(COutPoint(txidMixed, 0)));
+    BOOST_CHECK(!db.HaveCoin(COutPoint(txidMixed, 1)));
+    BOOST_CHECK(db.HaveCoin(COutPoint(txidMixed, 13)));
+
+    // Nothing is left to upgrade the next time
+    BOOST_CHECK(db.Upgrade());
+    BOOST_CHECK(!db.HaveLegacy());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -2,6 +2,7 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "coins.h"
 #include "consensus/validation.h"
 #include "key.h"
 #include "main.h"
@@ -83,4 +84,122 @@ BOOST_FIXTURE_TEST_CASE(tx_mempool_block_doublespend, TestChain100Setup)
     BOOST_CHECK_EQUAL(mempool.size(), 0);
 }
 
+BOOST_FIXTURE_TEST_CASE(script_execution_cache, TestingSetup)
+{
+    LOCK(cs_main);
+
+    CKey key;
+    key.MakeNewKey(true);
+    CScript scriptPubKey = CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG;
+
+    CMutableTransaction funding;
+    funding.vout.resize(1);
+    funding.vout[0].nValue = 11*CENT;
+    funding.vout[0].scriptPubKey = scriptPubKey;
+
+    CCoinsView viewDummy;
+    CCoinsViewCache view(&viewDummy);
+    view.SetBestBlock(chainActive.Tip()->GetBlockHash());
+    UpdateCoins(funding, view, chainActive.Height());
+
+    CMutableTransaction spend;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(funding.GetHash(), 0);
+    spend.vout.resize(1);
+    spend.vout[0].nValue = 10*CENT;
+    spend.vout[0].scriptPubKey = scriptPubKey;
+    CMutableTransaction badSpend = spend;
+
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, spend, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+    BOOST_CHECK(key.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << vchSig;
+    vchSig[10] ^= 1;
+    badSpend.vin[0].scriptSig << vchSig;
+
+    const unsigned int flags = SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_DERSIG;
+    CTransaction tx(spend), badTx(badSpend);
+    PrecomputedTransactionData txdata(tx), badTxdata(badTx);
+    CValidationState state;
+    uint64_t nHits, nMisses, nHitsBefore, nMissesBefore;
+    GetScriptExecutionCacheStats(nHitsBefore, nMissesBefore);
+
+    // Checks that don't store, run deferred or fail leave nothing behind
+    BOOST_CHECK(CheckInputs(tx, state, view, true, flags, true, false, txdata));
+    std::vector<CScriptCheck> vChecks;
+    BOOST_CHECK(CheckInputs(tx, state, view, true, flags, true, true, txdata, &vChecks));
+    BOOST_CHECK_EQUAL(vChecks.size(), 1U);
+    BOOST_CHECK(!CheckInputs(badTx, state, view, true, flags, true, true, badTxdata));
+    BOOST_CHECK(!CheckInputs(badTx, state, view, true, flags, true, true, badTxdata));
+    GetScriptExecutionCacheStats(nHits, nMisses);
+    BOOST_CHECK_EQUAL(nHits - nHitsBefore, 0U);
+    BOOST_CHECK_EQUAL(nMisses - nMissesBefore, 4U);
+
+    // A successful inline check is remembered for exactly the same flags
+    BOOST_CHECK(CheckInputs(tx, state, view, true, flags, true, true, txdata));
+    BOOST_CHECK(CheckInputs(tx, state, view, true, flags, true, true, txdata));
+    BOOST_CHECK(CheckInputs(tx, state, view, true, flags | SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY, true, false, txdata));
+    vChecks.clear();
+    BOOST_CHECK(CheckInputs(tx, state, view, true, flags, true, true, txdata, &vChecks));
+    BOOST_CHECK(vChecks.empty());
+    GetScriptExecutionCacheStats(nHits, nMisses);
+    BOOST_CHECK_EQUAL(nHits - nHitsBefore, 2U);
+    BOOST_CHECK_EQUAL(nMisses - nMissesBefore, 6U);
+}
+
+BOOST_FIXTURE_TEST_CASE(mempool_persist, TestChain100Setup)
+{
+    CScript scriptPubKey = CScript() <<  ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+
+    // A coinbase spend and a child of it, which has to be loaded after it
+    std::vector<CMutableTransaction> txs(2);
+    COutPoint prevout(coinbaseTxns[0].GetHash(), 0);
+    CAmount nValue = coinbaseTxns[0].vout[0].nValue;
+    for (int i = 0; i < 2; i++) {
+        nValue -= CENT;
+        txs[i].vin.resize(1);
+        txs[i].vin[0].prevout = prevout;
+        txs[i].vout.resize(1);
+        txs[i].vout[0].nValue = nValue;
+        txs[i].vout[0].scriptPubKey = scriptPubKey;
+
+        std::vector<unsigned char> vchSig;
+        uint256 hash = SignatureHash(scriptPubKey, txs[i], 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+        BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        txs[i].vin[0].scriptSig << vchSig;
+        BOOST_CHECK(ToMemPool(txs[i]));
+        prevout = COutPoint(txs[i].GetHash(), 0);
+    }
+    const uint256 hashParent = txs[0].GetHash(), hashChild = txs[1].GetHash(), hashOther = GetRandHash();
+    mempool.PrioritiseTransaction(hashChild, hashChild.ToString(), 0, 5*CENT);
+    mempool.PrioritiseTransaction(hashOther, hashOther.ToString(), 1e6, 0);
+    const int64_t nTimeChild = mempool.info(hashChild).nTime;
+
+    BOOST_CHECK(DumpMempool());
+    mempool.clear();
+    {
+        LOCK(mempool.cs);
+        mempool.mapDeltas.clear();
+    }
+
+    // Load with a script check thread, so the batch goes through the check queue
+    int nScriptCheckThreadsBefore = nScriptCheckThreads;
+    nScriptCheckThreads = 1;
+    BOOST_CHECK(LoadMempool());
+    nScriptCheckThreads = nScriptCheckThreadsBefore;
+
+    LOCK(mempool.cs);
+    BOOST_CHECK_EQUAL(mempool.size(), 2U);
+    BOOST_CHECK(mempool.exists(hashParent));
+    BOOST_CHECK(mempool.exists(hashChild));
+    BOOST_CHECK_EQUAL(mempool.info(hashChild).nTime, nTimeChild);
+    BOOST_CHECK_EQUAL(mempool.mapTx.find(hashChild)->GetModifiedFee(), 6*CENT);
+    BOOST_CHECK_EQUAL(mempool.mapDeltas.size(), 2U);
+    BOOST_CHECK(mempool.mapDeltas[hashOther] == std::make_pair(1e6, (CAmount)0));
+    mempool.clear();
+    mempool.mapDeltas.clear();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -6,37 +6,66 @@
 #include "txdb.h"
 
 #include "chainparams.h"
+#include "compressor.h"
 #include "hash.h"
+#include "init.h"
+#include "memusage.h"
 #include "pow.h"
+#include "ui_interface.h"
 #include "uint256.h"
+#include "util.h"
 
 #include <stdint.h>
 
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/thread.hpp>
 
 using namespace std;
 
+static const char DB_COIN = 'C';
 static const char DB_COINS = 'c';
 static const char DB_BLOCK_FILES = 'f';
 static const char DB_TXINDEX = 't';
 static const char DB_BLOCK_INDEX = 'b';
 
 static const char DB_BEST_BLOCK = 'B';
+static const char DB_HEAD_BLOCKS = 'H';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
 
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true) 
+namespace {
+
+/** Database key of an unspent output: DB_COIN, txid and output index. */
+struct CoinEntry {
+    COutPoint* outpoint;
+    char key;
+    CoinEntry(const COutPoint* ptr) : outpoint(const_cast<COutPoint*>(ptr)), key(DB_COIN) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(key);
+        READWRITE(outpoint->hash);
+        READWRITE(VARINT(outpoint->n));
+    }
+};
+
+} // anon namespace
+
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe, const CDBOptions& dboptions) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true, dboptions)
 {
 }
 
-bool CCoinsViewDB::GetCoins(const uint256 &txid, CCoins &coins) const {
-    return db.Read(make_pair(DB_COINS, txid), coins);
+bool CCoinsViewDB::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    return db.Read(CoinEntry(&outpoint), coin);
 }
 
-bool CCoinsViewDB::HaveCoins(const uint256 &txid) const {
-    return db.Exists(make_pair(DB_COINS, txid));
+bool CCoinsViewDB::HaveCoin(const COutPoint &outpoint) const {
+    return db.Exists(CoinEntry(&outpoint));
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const {
@@ -46,30 +75,219 @@ uint256 CCoinsViewDB::GetBestBlock() const {
     return hashBestChain;
 }
 
+std::vector<uint256> CCoinsViewDB::GetHeadBlocks() const {
+    std::vector<uint256> vhashHeadBlocks;
+    if (!db.Read(DB_HEAD_BLOCKS, vhashHeadBlocks))
+        return std::vector<uint256>();
+    return vhashHeadBlocks;
+}
+
 bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     CDBBatch batch(db);
     size_t count = 0;
     size_t changed = 0;
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+    int nBatches = 1;
+    const size_t nBatchSize = (size_t)std::max(GetArg("-dbbatchsize", nDefaultDbBatchSize), (int64_t)1);
+
+    // The changes may not fit in one batch. While they are being written,
+    // the database is marked as being between the old and the new best block,
+    // so that an interrupted write can be completed by replaying the blocks
+    // in between (see ReplayBlocks).
+    if (!hashBlock.IsNull()) {
+        uint256 hashOldBlock = GetBestBlock();
+        if (hashOldBlock.IsNull()) {
+            // Finishing an interrupted write
+            std::vector<uint256> vhashOldHeads = GetHeadBlocks();
+            if (vhashOldHeads.size() == 2) {
+                assert(vhashOldHeads[0] == hashBlock);
+                hashOldBlock = vhashOldHeads[1];
+            }
+        }
+        std::vector<uint256> vhashHeads;
+        vhashHeads.push_back(hashBlock);
+        vhashHeads.push_back(hashOldBlock);
+        batch.Erase(DB_BEST_BLOCK);
+        batch.Write(DB_HEAD_BLOCKS, vhashHeads);
+    }
+
+    // Entries are left in mapCoins; the caller clears it.
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); ++it) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            if (it->second.coins.IsPruned())
-                batch.Erase(make_pair(DB_COINS, it->first));
+            CoinEntry entry(&it->first);
+            if (it->second.coin.IsSpent())
+                batch.Erase(entry);
             else
-                batch.Write(make_pair(DB_COINS, it->first), it->second.coins);
+                batch.Write(entry, it->second.coin);
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
+        if (batch.SizeEstimate() > nBatchSize) {
+            LogPrint("coindb", "Writing partial batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
+            if (!db.WriteBatch(batch))
+                return false;
+            batch.Clear();
+            nBatches++;
+        }
     }
-    if (!hashBlock.IsNull())
+    if (!hashBlock.IsNull()) {
+        batch.Erase(DB_HEAD_BLOCKS);
         batch.Write(DB_BEST_BLOCK, hashBlock);
+    }
 
-    LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
+    LogPrint("coindb", "Committing %u changed outputs (out of %u) to coin database in %d batches...\n", (unsigned int)changed, (unsigned int)count, nBatches);
     return db.WriteBatch(batch);
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
+CCoinsViewWriteBehind::CCoinsViewWriteBehind(CCoinsView *viewIn) : CCoinsViewBacked(viewIn), fPending(false), nPendingUsage(0), fFailed(false), fStop(false)
+{
+    writerThread = boost::thread(boost::bind(&CCoinsViewWriteBehind::ThreadWrite, this));
+}
+
+CCoinsViewWriteBehind::~CCoinsViewWriteBehind()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fStop = true;
+    }
+    cond.notify_all();
+    writerThread.join();
+}
+
+void CCoinsViewWriteBehind::ThreadWrite()
+{
+    RenameThread("skeincoin-coinswr");
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (true) {
+        // A pending write is finished before stopping
+        while (!fPending && !fStop)
+            cond.wait(lock);
+        if (!fPending)
+            return;
+
+        lock.unlock();
+        // Counting the coins is left to this thread to keep it out of BatchWrite()
+        size_t nCoinsUsage = 0;
+        for (CCoinsMap::const_iterator it = mapPending.begin(); it != mapPending.end(); it++)
+            nCoinsUsage += it->second.coin.DynamicMemoryUsage();
+        lock.lock();
+        nPendingUsage += nCoinsUsage;
+        lock.unlock();
+
+        int64_t nStart = GetTimeMicros();
+        const size_t nCount = mapPending.size();
+        bool fOk = false;
+        try {
+            fOk = base->BatchWrite(mapPending, hashPendingBlock);
+        } catch (const std::exception& e) {
+            LogPrintf("%s: %s\n", __func__, e.what());
+        }
+        if (fOk)
+            LogPrint("coindb", "Wrote %u cached outputs in the background in %.2fms\n", (unsigned int)nCount, 0.001 * (GetTimeMicros() - nStart));
+        else
+            LogPrintf("%s: failed to write to coin database\n", __func__);
+        CCoinsMap mapDone;
+        lock.lock();
+
+        mapDone.swap(mapPending);
+        fPending = false;
+        nPendingUsage = 0;
+        fFailed |= !fOk;
+        cond.notify_all();
+        // Free the entries without holding the lock
+        lock.unlock();
+        mapDone.clear();
+        lock.lock();
+    }
+}
+
+bool CCoinsViewWriteBehind::GetCoin(const COutPoint &outpoint, Coin &coin) const
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (fPending) {
+            CCoinsMap::const_iterator it = mapPending.find(outpoint);
+            if (it != mapPending.end()) {
+                coin = it->second.coin;
+                return !coin.IsSpent();
+            }
+        }
+    }
+    return base->GetCoin(outpoint, coin);
+}
+
+bool CCoinsViewWriteBehind::HaveCoin(const COutPoint &outpoint) const
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (fPending) {
+            CCoinsMap::const_iterator it = mapPending.find(outpoint);
+            if (it != mapPending.end())
+                return !it->second.coin.IsSpent();
+        }
+    }
+    return base->HaveCoin(outpoint);
+}
+
+uint256 CCoinsViewWriteBehind::GetBestBlock() const
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (fPending && !hashPendingBlock.IsNull())
+            return hashPendingBlock;
+    }
+    return base->GetBestBlock();
+}
+
+std::vector<uint256> CCoinsViewWriteBehind::GetHeadBlocks() const
+{
+    Sync();
+    return base->GetHeadBlocks();
+}
+
+bool CCoinsViewWriteBehind::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (fPending)
+        cond.wait(lock);
+    if (fFailed)
+        return false;
+    // The caller gets back the empty map of the previous write
+    mapPending.swap(mapCoins);
+    hashPendingBlock = hashBlock;
+    fPending = true;
+    nPendingUsage = memusage::DynamicUsage(mapPending);
+    cond.notify_all();
+    return true;
+}
+
+CCoinsViewCursor *CCoinsViewWriteBehind::Cursor() const
+{
+    if (!Sync())
+        return NULL;
+    return base->Cursor();
+}
+
+bool CCoinsViewWriteBehind::Sync() const
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (fPending)
+        cond.wait(lock);
+    return !fFailed;
+}
+
+bool CCoinsViewWriteBehind::HasFailed() const
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return fFailed;
+}
+
+size_t CCoinsViewWriteBehind::DynamicMemoryUsage() const
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return nPendingUsage;
+}
+
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe, const CDBOptions& dboptions) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe, false, dboptions) {
 }
 
 bool CBlockTreeDB::ReadBlockFileInfo(int nFile, CBlockFileInfo &info) {
@@ -98,25 +316,41 @@ CCoinsViewCursor *CCoinsViewDB::Cursor() const
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
        that restriction.  */
-    i->pcursor->Seek(DB_COINS);
+    i->pcursor->Seek(DB_COIN);
     // Cache key of first record
-    i->pcursor->GetKey(i->keyTmp);
+    i->CacheKey();
     return i;
 }
 
-bool CCoinsViewDBCursor::GetKey(uint256 &key) const
+uint256 CCoinsViewDB::GetBestBlock(const CDBSnapshot &snapshot) const {
+    uint256 hashBestChain;
+    if (!db.Read(DB_BEST_BLOCK, hashBestChain, snapshot))
+        return uint256();
+    return hashBestChain;
+}
+
+CCoinsViewCursor *CCoinsViewDB::Cursor(const CDBSnapshot &snapshot, const uint256 &hashBegin, const uint256 &hashEnd) const
+{
+    CCoinsViewDBCursor *i = new CCoinsViewDBCursor(db.NewIterator(snapshot), GetBestBlock(snapshot), hashEnd);
+    COutPoint outpointBegin(hashBegin, 0);
+    i->pcursor->Seek(CoinEntry(&outpointBegin));
+    i->CacheKey();
+    return i;
+}
+
+bool CCoinsViewDBCursor::GetKey(COutPoint &key) const
 {
     // Return cached key
-    if (keyTmp.first == DB_COINS) {
+    if (keyTmp.first == DB_COIN) {
         key = keyTmp.second;
         return true;
     }
     return false;
 }
 
-bool CCoinsViewDBCursor::GetValue(CCoins &coins) const
+bool CCoinsViewDBCursor::GetValue(Coin &coin) const
 {
-    return pcursor->GetValue(coins);
+    return pcursor->GetValue(coin);
 }
 
 unsigned int CCoinsViewDBCursor::GetValueSize() const
@@ -126,14 +360,131 @@ unsigned int CCoinsViewDBCursor::GetValueSize() const
 
 bool CCoinsViewDBCursor::Valid() const
 {
-    return keyTmp.first == DB_COINS;
+    return keyTmp.first == DB_COIN;
 }
 
 void CCoinsViewDBCursor::Next()
 {
     pcursor->Next();
-    if (!pcursor->Valid() || !pcursor->GetKey(keyTmp))
+    CacheKey();
+}
+
+void CCoinsViewDBCursor::CacheKey()
+{
+    CoinEntry entry(&keyTmp.second);
+    if (!pcursor->Valid() || !pcursor->GetKey(entry) || (!hashEnd.IsNull() && !(keyTmp.second.hash < hashEnd)))
         keyTmp.first = 0; // Invalidate cached key after last record so that Valid() and GetKey() return false
+    else
+        keyTmp.first = entry.key;
+}
+
+namespace {
+
+/** Per-transaction UTXO record of older versions, only read to upgrade them. */
+class CLegacyCoins
+{
+public:
+    bool fCoinBase;
+    std::vector<CTxOut> vout;
+    int nHeight;
+
+    CLegacyCoins() : fCoinBase(false), nHeight(0) {}
+
+    template<typename Stream>
+    void Unserialize(Stream &s, int nType, int nVersion) {
+        unsigned int nCode = 0;
+        // version
+        int nVersionDummy;
+        ::Unserialize(s, VARINT(nVersionDummy), nType, nVersion);
+        // header code
+        ::Unserialize(s, VARINT(nCode), nType, nVersion);
+        fCoinBase = nCode & 1;
+        std::vector<bool> vAvail(2, false);
+        vAvail[0] = (nCode & 2) != 0;
+        vAvail[1] = (nCode & 4) != 0;
+        unsigned int nMaskCode = (nCode / 8) + ((nCode & 6) != 0 ? 0 : 1);
+        // spentness bitmask
+        while (nMaskCode > 0) {
+            unsigned char chAvail = 0;
+            ::Unserialize(s, chAvail, nType, nVersion);
+            for (unsigned int p = 0; p < 8; p++) {
+                bool f = (chAvail & (1 << p)) != 0;
+                vAvail.push_back(f);
+            }
+            if (chAvail != 0)
+                nMaskCode--;
+        }
+        // txouts themself
+        vout.assign(vAvail.size(), CTxOut());
+        for (unsigned int i = 0; i < vAvail.size(); i++) {
+            if (vAvail[i])
+                ::Unserialize(s, REF(CTxOutCompressor(vout[i])), nType, nVersion);
+        }
+        // coinbase height
+        ::Unserialize(s, VARINT(nHeight), nType, nVersion);
+    }
+};
+
+} // anon namespace
+
+bool CCoinsViewDB::Upgrade()
+{
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+    pcursor->Seek(make_pair(DB_COINS, uint256()));
+    if (!pcursor->Valid())
+        return true;
+
+    int64_t count = 0;
+    LogPrintf("Upgrading UTXO database to per-output records...\n");
+    uiInterface.ShowProgress(_("Upgrading UTXO database"), 0);
+    // Write out and compact what was converted every 16 MiB
+    const size_t nBatchSize = 1 << 24;
+    CDBBatch batch(db);
+    int nReportDone = 0;
+    std::pair<char, uint256> key;
+    std::pair<char, uint256> prevKey(DB_COINS, uint256());
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        if (ShutdownRequested())
+            break;
+        if (!pcursor->GetKey(key) || key.first != DB_COINS)
+            break;
+        if (count++ % 256 == 0) {
+            uint32_t nHigh = 0x100 * *key.second.begin() + *(key.second.begin() + 1);
+            int nPercentageDone = (int)(nHigh * 100.0 / 65536.0 + 0.5);
+            uiInterface.ShowProgress(_("Upgrading UTXO database"), nPercentageDone);
+            if (nReportDone < nPercentageDone / 10) {
+                // report max. every 10% step
+                LogPrintf("[%d%%]...", nPercentageDone);
+                nReportDone = nPercentageDone / 10;
+            }
+        }
+        CLegacyCoins oldCoins;
+        if (!pcursor->GetValue(oldCoins))
+            return error("%s: cannot parse CCoins record", __func__);
+        COutPoint outpoint(key.second, 0);
+        for (size_t i = 0; i < oldCoins.vout.size(); ++i) {
+            if (!oldCoins.vout[i].IsNull() && !oldCoins.vout[i].scriptPubKey.IsUnspendable()) {
+                outpoint.n = i;
+                batch.Write(CoinEntry(&outpoint), Coin(oldCoins.vout[i], oldCoins.nHeight, oldCoins.fCoinBase));
+            }
+        }
+        batch.Erase(key);
+        if (batch.SizeEstimate() > nBatchSize) {
+            if (!db.WriteBatch(batch))
+                return error("%s: failed to write UTXO database", __func__);
+            batch.Clear();
+            db.CompactRange(prevKey, key);
+            prevKey = key;
+        }
+        pcursor->Next();
+    }
+    if (!db.WriteBatch(batch))
+        return error("%s: failed to write UTXO database", __func__);
+    db.CompactRange(make_pair(DB_COINS, uint256()), key);
+    uiInterface.ShowProgress("", 100);
+    LogPrintf("[%s].\n", ShutdownRequested() ? "CANCELLED" : "DONE");
+    return !ShutdownRequested();
 }
 
 bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo) {
@@ -171,45 +522,95 @@ bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
     return true;
 }
 
-bool CBlockTreeDB::LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256&)> insertBlockIndex)
+namespace {
+/** Headers of consecutively loaded block index entries, with the hashes they are stored under. */
+struct CBlockIndexBatch
+{
+    std::vector<CBlockHeader> vHeaders;
+    std::vector<uint256> vHashes;
+};
+
+/** Check that each stored hash meets its header's target and, if fRehash, that it is that header's hash. */
+bool CheckBlockIndexBatch(boost::shared_ptr<CBlockIndexBatch> batch, bool fRehash)
+{
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    for (size_t i = 0; i < batch->vHashes.size(); i++) {
+        if (!CheckProofOfWork(batch->vHashes[i], batch->vHeaders[i].nBits, consensusParams))
+            return error("LoadBlockIndex(): CheckProofOfWork failed: %s", batch->vHashes[i].ToString());
+    }
+    if (fRehash) {
+        std::vector<uint256> vComputed(batch->vHeaders.size());
+        HashSkeinBatch(begin_ptr(batch->vHeaders), batch->vHeaders.size(), begin_ptr(vComputed));
+        for (size_t i = 0; i < vComputed.size(); i++) {
+            if (vComputed[i] != batch->vHashes[i])
+                return error("LoadBlockIndex(): block hash mismatch: stored %s, computed %s", batch->vHashes[i].ToString(), vComputed[i].ToString());
+        }
+    }
+    return true;
+}
+} // anon namespace
+
+bool CBlockTreeDB::LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256&)> insertBlockIndex, CBlockIndexLoadQueue* pqueue)
 {
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
 
     pcursor->Seek(make_pair(DB_BLOCK_INDEX, uint256()));
 
+    // Entries are keyed by the block hash, which was computed and checked
+    // against nBits when the header was first accepted. Unless asked to,
+    // don't recompute it for every block on every start.
+    const bool fRehash = GetBoolArg("-checkblockindexpow", DEFAULT_CHECKBLOCKINDEXPOW);
+    CCheckQueueControl<CBlockIndexLoadJob> control(pqueue);
+    boost::shared_ptr<CBlockIndexBatch> batch(new CBlockIndexBatch());
+
     // Load mapBlockIndex
-    while (pcursor->Valid()) {
+    while (true) {
         boost::this_thread::interruption_point();
-        std::pair<char, uint256> key;
-        if (pcursor->GetKey(key) && key.first == DB_BLOCK_INDEX) {
-            CDiskBlockIndex diskindex;
-            if (pcursor->GetValue(diskindex)) {
-                // Construct block index object
-                CBlockIndex* pindexNew = insertBlockIndex(diskindex.GetBlockHash());
-                pindexNew->pprev          = insertBlockIndex(diskindex.hashPrev);
-                pindexNew->nHeight        = diskindex.nHeight;
-                pindexNew->nFile          = diskindex.nFile;
-                pindexNew->nDataPos       = diskindex.nDataPos;
-                pindexNew->nUndoPos       = diskindex.nUndoPos;
-                pindexNew->nVersion       = diskindex.nVersion;
-                pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
-                pindexNew->nTime          = diskindex.nTime;
-                pindexNew->nBits          = diskindex.nBits;
-                pindexNew->nNonce         = diskindex.nNonce;
-                pindexNew->nStatus        = diskindex.nStatus;
-                pindexNew->nTx            = diskindex.nTx;
-
-                if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits, Params().GetConsensus()))
-                    return error("LoadBlockIndex(): CheckProofOfWork failed: %s", pindexNew->ToString());
-
-                pcursor->Next();
+        bool fEnd = !pcursor->Valid();
+        if (!fEnd) {
+            std::pair<char, uint256> key;
+            if (pcursor->GetKey(key) && key.first == DB_BLOCK_INDEX) {
+                CDiskBlockIndex diskindex;
+                if (pcursor->GetValue(diskindex)) {
+                    // Construct block index object
+                    CBlockIndex* pindexNew = insertBlockIndex(key.second);
+                    pindexNew->pprev          = insertBlockIndex(diskindex.hashPrev);
+                    pindexNew->nHeight        = diskindex.nHeight;
+                    pindexNew->nFile          = diskindex.nFile;
+                    pindexNew->nDataPos       = diskindex.nDataPos;
+                    pindexNew->nUndoPos       = diskindex.nUndoPos;
+                    pindexNew->nVersion       = diskindex.nVersion;
+                    pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
+                    pindexNew->nTime          = diskindex.nTime;
+                    pindexNew->nBits          = diskindex.nBits;
+                    pindexNew->nNonce         = diskindex.nNonce;
+                    pindexNew->nStatus        = diskindex.nStatus;
+                    pindexNew->nTx            = diskindex.nTx;
+
+                    batch->vHeaders.push_back(pindexNew->GetBlockHeader());
+                    batch->vHashes.push_back(key.second);
+                    pcursor->Next();
+                } else {
+                    return error("LoadBlockIndex() : failed to read value");
+                }
             } else {
-                return error("LoadBlockIndex() : failed to read value");
+                fEnd = true;
             }
-        } else {
-            break;
         }
+
+        // Hand the checks off in batches, so decoding continues while they run
+        if (batch->vHashes.size() >= BLOCK_INDEX_VERIFY_BATCH || (fEnd && !batch->vHashes.empty())) {
+            if (pqueue) {
+                std::vector<CBlockIndexLoadJob> vJobs(1, CBlockIndexLoadJob(boost::bind(CheckBlockIndexBatch, batch, fRehash)));
+                control.Add(vJobs);
+            } else if (!CheckBlockIndexBatch(batch, fRehash)) {
+                return false;
+            }
+            batch.reset(new CBlockIndexBatch());
+        }
+        if (fEnd)
+            break;
     }
 
-    return true;
+    return control.Wait();
 }
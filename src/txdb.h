@@ -6,6 +6,7 @@
 #ifndef BITCOIN_TXDB_H
 #define BITCOIN_TXDB_H
 
+#include "checkqueue.h"
 #include "coins.h"
 #include "dbwrapper.h"
 #include "chain.h"
@@ -16,6 +17,9 @@
 #include <vector>
 
 #include <boost/function.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 
 class CBlockIndex;
 class CCoinsViewDBCursor;
@@ -35,6 +39,14 @@ static const int64_t nMaxBlockDBCache = 2;
 static const int64_t nMaxBlockDBAndTxIndexCache = 1024;
 //! Max memory allocated to coin DB specific cache (MiB)
 static const int64_t nMaxCoinsDBCache = 8;
+//! -dbbatchsize default (bytes)
+static const int64_t nDefaultDbBatchSize = 16 << 20;
+//! -dbwritebehind default
+static const bool DEFAULT_DB_WRITE_BEHIND = true;
+//! -checkblockindexpow default
+static const bool DEFAULT_CHECKBLOCKINDEXPOW = false;
+//! Block index entries handed to a loader worker at a time
+static const size_t BLOCK_INDEX_VERIFY_BATCH = 4096;
 
 struct CDiskTxPos : public CDiskBlockPos
 {
@@ -67,13 +79,29 @@ class CCoinsViewDB : public CCoinsView
 protected:
     CDBWrapper db;
 public:
-    CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false, const CDBOptions& dboptions = CDBOptions());
 
-    bool GetCoins(const uint256 &txid, CCoins &coins) const;
-    bool HaveCoins(const uint256 &txid) const;
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
+    bool HaveCoin(const COutPoint &outpoint) const;
     uint256 GetBestBlock() const;
+    std::vector<uint256> GetHeadBlocks() const;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
     CCoinsViewCursor *Cursor() const;
+
+    //! Best block as of snapshot
+    uint256 GetBestBlock(const CDBSnapshot &snapshot) const;
+    /**
+     * Cursor over the outputs as of snapshot whose txids lie in [hashBegin,
+     * hashEnd), comparing txids by their bytes (the database key order). A
+     * null hashEnd means no upper bound. The cursor must not outlive snapshot.
+     */
+    CCoinsViewCursor *Cursor(const CDBSnapshot &snapshot, const uint256 &hashBegin, const uint256 &hashEnd) const;
+
+    //! Convert per-transaction records of older versions to per-output ones
+    bool Upgrade();
+
+    //! The underlying database, for statistics
+    const CDBWrapper& GetDB() const { return db; }
 };
 
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
@@ -82,27 +110,108 @@ class CCoinsViewDBCursor: public CCoinsViewCursor
 public:
     ~CCoinsViewDBCursor() {}
 
-    bool GetKey(uint256 &key) const;
-    bool GetValue(CCoins &coins) const;
+    bool GetKey(COutPoint &key) const;
+    bool GetValue(Coin &coin) const;
     unsigned int GetValueSize() const;
 
     bool Valid() const;
     void Next();
 
 private:
-    CCoinsViewDBCursor(CDBIterator* pcursorIn, const uint256 &hashBlockIn):
-        CCoinsViewCursor(hashBlockIn), pcursor(pcursorIn) {}
+    CCoinsViewDBCursor(CDBIterator* pcursorIn, const uint256 &hashBlockIn, const uint256 &hashEndIn = uint256()):
+        CCoinsViewCursor(hashBlockIn), pcursor(pcursorIn), hashEnd(hashEndIn) {}
     boost::scoped_ptr<CDBIterator> pcursor;
-    std::pair<char, uint256> keyTmp;
+    std::pair<char, COutPoint> keyTmp;
+    //! Txid to stop at, if not null
+    uint256 hashEnd;
+
+    //! Cache the key of the current record, or mark the cursor invalid past the last one
+    void CacheKey();
 
     friend class CCoinsViewDB;
 };
 
+/**
+ * Writes flushed coins to the view below it on a background thread.
+ *
+ * BatchWrite() takes over the caller's entries and returns without waiting
+ * for the database, so that validation can carry on with an empty cache.
+ * Until they are written, reads of those outputs are answered from them.
+ * Only one write is in flight at a time: BatchWrite() first waits for the
+ * previous one to finish.
+ *
+ * While a write is in flight its entries are held in addition to the cache
+ * above, so callers that bound memory count DynamicMemoryUsage() as well.
+ *
+ * Apart from the writer thread, the view must be used by one thread at a
+ * time (in practice, under cs_main).
+ */
+class CCoinsViewWriteBehind : public CCoinsViewBacked
+{
+private:
+    mutable boost::mutex mutex;
+    mutable boost::condition_variable cond;
+
+    //! Entries being written, and the block they bring the base view to.
+    //! Only changed with mutex held; the writer reads them without it.
+    CCoinsMap mapPending;
+    uint256 hashPendingBlock;
+    bool fPending;
+    //! Memory used by mapPending: the map itself at first, plus the coins
+    //! once the writer has counted them
+    size_t nPendingUsage;
+    //! Set once a write failed; the base view is then in an unknown state
+    bool fFailed;
+    bool fStop;
+
+    boost::thread writerThread;
+
+    void ThreadWrite();
+
+    CCoinsViewWriteBehind(const CCoinsViewWriteBehind&);
+    CCoinsViewWriteBehind& operator=(const CCoinsViewWriteBehind&);
+
+public:
+    CCoinsViewWriteBehind(CCoinsView *viewIn);
+    ~CCoinsViewWriteBehind();
+
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
+    bool HaveCoin(const COutPoint &outpoint) const;
+    uint256 GetBestBlock() const;
+    std::vector<uint256> GetHeadBlocks() const;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    CCoinsViewCursor *Cursor() const;
+
+    //! Wait until the pending write, if any, is done. Returns false if a write failed.
+    bool Sync() const;
+    //! Whether a write failed
+    bool HasFailed() const;
+    //! Memory held by the pending write, 0 when there is none
+    size_t DynamicMemoryUsage() const;
+};
+
+/** A unit of block index loading work, run on a CBlockIndexLoadQueue worker. */
+class CBlockIndexLoadJob
+{
+private:
+    boost::function<bool()> func;
+
+public:
+    CBlockIndexLoadJob() {}
+    explicit CBlockIndexLoadJob(const boost::function<bool()>& funcIn) : func(funcIn) {}
+
+    bool operator()() { return func(); }
+
+    void swap(CBlockIndexLoadJob& job) { func.swap(job.func); }
+};
+
+typedef CCheckQueue<CBlockIndexLoadJob> CBlockIndexLoadQueue;
+
 /** Access to the block database (blocks/index/) */
 class CBlockTreeDB : public CDBWrapper
 {
 public:
-    CBlockTreeDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CBlockTreeDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false, const CDBOptions& dboptions = CDBOptions());
 private:
     CBlockTreeDB(const CBlockTreeDB&);
     void operator=(const CBlockTreeDB&);
@@ -116,7 +225,10 @@ public:
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
-    bool LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256&)> insertBlockIndex);
+    /** Load all block index entries through insertBlockIndex. Entries are decoded and
+     *  inserted on the calling thread, while their proof of work is checked on pqueue's
+     *  workers when given. */
+    bool LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256&)> insertBlockIndex, CBlockIndexLoadQueue* pqueue = NULL);
 };
 
 #endif // BITCOIN_TXDB_H